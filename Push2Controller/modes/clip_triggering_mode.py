@@ -1,7 +1,7 @@
 import definitions
 import push2_python
 
-from utils import show_text, draw_clip
+from utils import show_text, draw_clip_overview
 
 
 class ClipTriggeringMode(definitions.ShepherdControllerMode):
@@ -111,7 +111,7 @@ class ClipTriggeringMode(definitions.ShepherdControllerMode):
                     # Draw clip notes
                     if clip_length > 0.0:
                         display_w = push2_python.constants.DISPLAY_LINE_PIXELS
-                        draw_clip(ctx, clip, frame=(1.0/8 * track_num, 0.0, 1.0/8, 0.87), event_color=track_color + '_darker1', highlight_color=definitions.WHITE)
+                        draw_clip_overview(ctx, clip, frame=(1.0/8 * track_num, 0.0, 1.0/8, 0.87), event_color=track_color + '_darker1', highlight_color=definitions.WHITE)
 
     def activate(self):
         self.update_buttons()
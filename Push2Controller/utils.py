@@ -193,6 +193,44 @@ def draw_clip(ctx,
             show_rectangle(ctx, x0, y0 - h, w, h, background_color=definitions.WHITE, alpha=0.25)
 
 
+def draw_clip_overview(ctx,
+                       clip,
+                       frame=(0.0, 0.0, 1.0, 1.0),  # (upper-left corner x, upper-left corner y, width, height)
+                       event_color=definitions.WHITE,
+                       highlight_color=definitions.GREEN,
+                       background_color=None
+                       ):
+    # Cheaper alternative to draw_clip which uses the summary precomputed by the backend (see pyshepherd ClipOverview)
+    # instead of going through all the sequence events of the clip. Falls back to draw_clip if there is no summary
+    overview = clip.overview
+    if overview is None:
+        draw_clip(ctx, clip, frame=frame, event_color=event_color, highlight_color=highlight_color,
+                  background_color=background_color)
+        return
+
+    xoffset_percentage, yoffset_percentage, width_percentage, height_percentage = frame
+    if background_color is not None:
+        show_rectangle(ctx, xoffset_percentage, yoffset_percentage, width_percentage, height_percentage, background_color=background_color)
+    if overview.num_notes == 0:
+        return
+
+    # Small pitch ranges use one row per note, so only these rows are drawn
+    num_rows = min(overview.num_rows, overview.max_midi_note - overview.min_midi_note + 1)
+    row_height = height_percentage / num_rows
+    column_width = width_percentage / overview.num_columns
+    playhead_column = -1
+    if clip.clip_length_in_beats > 0.0 and clip.playhead_position_in_beats != 0.0:
+        playhead_column = int(clip.playhead_position_in_beats / clip.clip_length_in_beats * overview.num_columns)
+    for row in range(num_rows):
+        y0 = yoffset_percentage + height_percentage - (row + 1) * row_height
+        for first_column, last_column in overview.occupied_column_runs(row):
+            show_rectangle(ctx, xoffset_percentage + first_column * column_width, y0,
+                           (last_column - first_column + 1) * column_width, row_height, background_color=event_color)
+            if first_column <= playhead_column <= last_column:
+                show_rectangle(ctx, xoffset_percentage + playhead_column * column_width, y0, column_width, row_height,
+                               background_color=highlight_color)
+
+
 def draw_knob(ctx, x_part, parameter_name, value, vmin, vmax, value_display, color, margin_top=0):
 
     def get_rad_for_value(value):
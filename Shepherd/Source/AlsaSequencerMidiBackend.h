@@ -0,0 +1,356 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "helpers_shepherd.h"
+
+#if USE_ALSA_SEQ_MIDI_BACKEND
+
+#include <alsa/asoundlib.h>
+#include <poll.h>
+
+
+/** MIDI backend which talks directly to the ALSA sequencer instead of using JUCE's MidiInput/MidiOutput.
+
+    The backend opens a single sequencer client with a queue which is started when the client is opened. The queue
+    real-time clock is mapped to juce::Time::getMillisecondCounterHiRes so that the same millisecond timestamps
+    used by the rest of the sequencer (see MidiOutputTimeBase) can be used to schedule output events and to
+    timestamp input events.
+
+    Output: for each output device, a local port is created and connected to the destination port. Events of a
+    slice are put in the ALSA queue with real-time stamps ahead of time, and the kernel delivers them at the right
+    time. Events with a negative start time are sent directly (not scheduled).
+
+    Input: for each input device, a local port is created with timestamping enabled and connected to the source
+    port. The kernel stamps incoming events with the queue time, which is converted back to the millisecond counter
+    and added to the MidiInputDeviceData's collector from the backend thread.
+
+    alsa-lib does not guarantee that a sequencer handle can be used from several threads at once, so all uses of the
+    handle (from the input thread, the MidiOutputDispatcher and the message thread) are serialized with seqLock. The
+    input thread only holds it while reading already received events (it waits for them in poll without it).
+
+    Ports are matched by name (either the port name, or "client name:port name"), so the names configured in
+    the hardware devices can be used, and it can be tested with virtual ports (e.g. "modprobe snd-virmidi" and
+    "aconnect -l", or "aseqdump").
+*/
+class AlsaSequencerMidiBackend: public MidiOutputBackend,
+                                private juce::Thread
+{
+public:
+    AlsaSequencerMidiBackend(): juce::Thread ("AlsaSequencerMidiBackend")
+    {
+    }
+
+    ~AlsaSequencerMidiBackend()
+    {
+        close();
+    }
+
+    bool open(const juce::String& clientName)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        if (seq != nullptr) { return true; }
+
+        if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0){
+            DBG("ERROR opening ALSA sequencer");
+            seq = nullptr;
+            return false;
+        }
+        snd_seq_set_client_name(seq, clientName.toRawUTF8());
+        snd_seq_set_output_buffer_size(seq, ALSA_SEQ_OUTPUT_BUFFER_SIZE);
+        clientId = snd_seq_client_id(seq);
+
+        queueId = snd_seq_alloc_named_queue(seq, clientName.toRawUTF8());
+        if (queueId < 0){
+            DBG("ERROR allocating ALSA sequencer queue");
+            close();
+            return false;
+        }
+        snd_seq_start_queue(seq, queueId, nullptr);
+        snd_seq_drain_output(seq);
+        queueStartTimeMs = juce::Time::getMillisecondCounterHiRes();
+
+        startThread(9);
+        return true;
+    }
+
+    void close()
+    {
+        stopThread(1000);
+        const juce::ScopedLock sl (seqLock);
+        if (seq != nullptr){
+            for (int i=0; i<numInputPorts.load(); i++){
+                inputPorts[i].deviceData.store(nullptr);
+            }
+            if (queueId >= 0){
+                snd_seq_stop_queue(seq, queueId, nullptr);
+                snd_seq_drain_output(seq);
+                snd_seq_free_queue(seq, queueId);
+            }
+            for (auto& encoder: encoders){
+                if (auto e = encoder.exchange(nullptr)){
+                    snd_midi_event_free(e);
+                }
+            }
+            snd_seq_close(seq);
+        }
+        seq = nullptr;
+        queueId = -1;
+        numInputPorts.store(0);
+    }
+
+    bool isOpen() const { return seq != nullptr; }
+
+    //==============================================================================
+
+    /** Creates a local output port connected to the device named as deviceData->name. On success, sets the
+        backend and port of deviceData so that the MidiOutputDispatcher sends messages through this backend. */
+    bool openOutputPort(MidiOutputDeviceData* deviceData)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        const juce::ScopedLock sl (seqLock);
+        if (seq == nullptr) { return false; }
+
+        int destClient, destPort;
+        if (!findPort(deviceData->name, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE, destClient, destPort)){
+            return false;
+        }
+        int port = snd_seq_create_simple_port(seq, deviceData->name.toRawUTF8(),
+                                              SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                              SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        if (port < 0) { return false; }
+        if (port >= (int)encoders.size()){
+            snd_seq_delete_simple_port(seq, port);
+            return false;
+        }
+        if (snd_seq_connect_to(seq, port, destClient, destPort) < 0){
+            snd_seq_delete_simple_port(seq, port);
+            return false;
+        }
+
+        // Encoders are only used from the dispatcher thread, but are created here so there is no allocation later
+        snd_midi_event_t* encoder = nullptr;
+        if (snd_midi_event_new(ALSA_SEQ_MIDI_EVENT_ENCODER_SIZE, &encoder) < 0){
+            snd_seq_delete_simple_port(seq, port);
+            return false;
+        }
+        encoders[port].store(encoder);
+
+        deviceData->identifier = juce::String(destClient) + ":" + juce::String(destPort);
+        deviceData->backendPortId = port;
+        deviceData->backend = this;
+        return true;
+    }
+
+    /** Creates a local (timestamped) input port connected from the device named as deviceData->name.
+        Received messages are added to deviceData's collector. */
+    bool openInputPort(MidiInputDeviceData* deviceData)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        const juce::ScopedLock sl (seqLock);
+        if (seq == nullptr) { return false; }
+        if (numInputPorts.load() >= (int)inputPorts.size()) { return false; }
+
+        int srcClient, srcPort;
+        if (!findPort(deviceData->name, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, srcClient, srcPort)){
+            return false;
+        }
+
+        snd_seq_port_info_t* portInfo;
+        snd_seq_port_info_alloca(&portInfo);
+        snd_seq_port_info_set_name(portInfo, deviceData->name.toRawUTF8());
+        snd_seq_port_info_set_capability(portInfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+        snd_seq_port_info_set_type(portInfo, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        snd_seq_port_info_set_timestamping(portInfo, 1);
+        snd_seq_port_info_set_timestamp_real(portInfo, 1);
+        snd_seq_port_info_set_timestamp_queue(portInfo, queueId);
+        if (snd_seq_create_port(seq, portInfo) < 0) { return false; }
+        int port = snd_seq_port_info_get_port(portInfo);
+        if (snd_seq_connect_from(seq, port, srcClient, srcPort) < 0){
+            snd_seq_delete_simple_port(seq, port);
+            return false;
+        }
+
+        deviceData->identifier = juce::String(srcClient) + ":" + juce::String(srcPort);
+        deviceData->backendPortId = port;
+        int n = numInputPorts.load();
+        inputPorts[n].port = port;
+        inputPorts[n].deviceData.store(deviceData);
+        numInputPorts.store(n + 1);  // Publish new port only after it has been fully stored
+        return true;
+    }
+
+    /** Stops delivering messages to deviceData. Must be called before deleting a MidiInputDeviceData object
+        which was opened with this backend. */
+    void closeInputPort(MidiInputDeviceData* deviceData)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        for (int i=0; i<numInputPorts.load(); i++){
+            if (inputPorts[i].deviceData.load() == deviceData){
+                inputPorts[i].deviceData.store(nullptr);
+                // Wait for the input thread to finish processing the current event (if any) so deviceData can be safely deleted
+                const juce::ScopedLock sl (seqLock);
+                if (seq != nullptr){
+                    snd_seq_delete_simple_port(seq, inputPorts[i].port);
+                }
+            }
+        }
+    }
+
+    //==============================================================================
+
+    /** Called from the MidiOutputDispatcher thread. */
+    void sendBlockOfMessages(MidiOutputDeviceData& deviceData, const juce::MidiBuffer& buffer, double startTimeMs, double sampleRate) override
+    {
+        const juce::ScopedLock sl (seqLock);
+        if (seq == nullptr) { return; }
+        if (deviceData.backendPortId < 0 || deviceData.backendPortId >= (int)encoders.size()) { return; }
+        snd_midi_event_t* encoder = encoders[deviceData.backendPortId].load();
+        if (encoder == nullptr) { return; }
+
+        for (const auto metadata: buffer){
+            snd_seq_event_t event;
+            snd_seq_ev_clear(&event);
+            snd_seq_ev_set_source(&event, deviceData.backendPortId);
+            snd_seq_ev_set_subs(&event);
+            if (startTimeMs < 0.0 || sampleRate <= 0.0){
+                snd_seq_ev_set_direct(&event);
+            } else {
+                snd_seq_real_time_t time = msCounterToQueueTime(startTimeMs + metadata.samplePosition * 1000.0 / sampleRate);
+                snd_seq_ev_schedule_real(&event, queueId, 0, &time);  // Absolute time. If time is in the past, event is delivered immediately
+            }
+
+            auto* data = metadata.data;
+            long numBytes = metadata.numBytes;
+            while (numBytes > 0){
+                long numEncoded = snd_midi_event_encode(encoder, data, numBytes, &event);
+                if (numEncoded <= 0) { break; }
+                numBytes -= numEncoded;
+                data += numEncoded;
+                if (event.type != SND_SEQ_EVENT_NONE){
+                    if (snd_seq_event_output(seq, &event) < 0){
+                        numDroppedOutputEvents += 1;
+                    }
+                    event.type = SND_SEQ_EVENT_NONE;
+                }
+            }
+            snd_midi_event_reset_encode(encoder);
+        }
+        snd_seq_drain_output(seq);
+    }
+
+    std::atomic<int> numDroppedOutputEvents = {0};
+
+private:
+    //==============================================================================
+
+    void run() override
+    {
+        std::vector<pollfd> descriptors;
+        {
+            const juce::ScopedLock sl (seqLock);
+            descriptors.resize((size_t)snd_seq_poll_descriptors_count(seq, POLLIN));
+            snd_seq_poll_descriptors(seq, descriptors.data(), (unsigned int)descriptors.size(), POLLIN);
+        }
+
+        snd_midi_event_t* decoder = nullptr;
+        if (snd_midi_event_new(ALSA_SEQ_MIDI_EVENT_ENCODER_SIZE, &decoder) < 0) { return; }
+        snd_midi_event_no_status(decoder, 1);  // Always include the status byte in decoded messages
+        juce::HeapBlock<juce::uint8> bytes (ALSA_SEQ_MIDI_EVENT_ENCODER_SIZE);
+
+        while (!threadShouldExit()){
+            if (poll(descriptors.data(), (nfds_t)descriptors.size(), 100) <= 0) { continue; }
+
+            const juce::ScopedLock sl (seqLock);
+            snd_seq_event_t* event = nullptr;
+            while (snd_seq_event_input(seq, &event) >= 0 && event != nullptr){
+                auto deviceData = getInputDeviceDataForPort(event->dest.port);
+                if (deviceData != nullptr){
+                    long numBytes = snd_midi_event_decode(decoder, bytes, ALSA_SEQ_MIDI_EVENT_ENCODER_SIZE, event);
+                    snd_midi_event_reset_decode(decoder);
+                    if (numBytes > 0){
+                        double timeMs = juce::Time::getMillisecondCounterHiRes();
+                        if ((event->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL){
+                            timeMs = queueTimeToMsCounter(event->time.time);
+                        }
+                        // NOTE: MidiMessageCollector expects timestamps in seconds relative to getMillisecondCounterHiRes
+                        deviceData->collector.addMessageToQueue(juce::MidiMessage(bytes, (int)numBytes, timeMs * 0.001));
+                    }
+                }
+                snd_seq_free_event(event);
+            }
+        }
+
+        snd_midi_event_free(decoder);
+    }
+
+    bool findPort(const juce::String& name, unsigned int requiredCapabilities, int& client, int& port)
+    {
+        snd_seq_client_info_t* clientInfo;
+        snd_seq_port_info_t* portInfo;
+        snd_seq_client_info_alloca(&clientInfo);
+        snd_seq_port_info_alloca(&portInfo);
+
+        snd_seq_client_info_set_client(clientInfo, -1);
+        while (snd_seq_query_next_client(seq, clientInfo) >= 0){
+            int candidateClient = snd_seq_client_info_get_client(clientInfo);
+            if (candidateClient == clientId) { continue; }  // Never connect to our own ports
+            juce::String clientName = snd_seq_client_info_get_name(clientInfo);
+            snd_seq_port_info_set_client(portInfo, candidateClient);
+            snd_seq_port_info_set_port(portInfo, -1);
+            while (snd_seq_query_next_port(seq, portInfo) >= 0){
+                if ((snd_seq_port_info_get_capability(portInfo) & requiredCapabilities) != requiredCapabilities) { continue; }
+                juce::String portName = snd_seq_port_info_get_name(portInfo);
+                if (portName == name || clientName + ":" + portName == name){
+                    client = candidateClient;
+                    port = snd_seq_port_info_get_port(portInfo);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    MidiInputDeviceData* getInputDeviceDataForPort(int port)
+    {
+        for (int i=0; i<numInputPorts.load(); i++){
+            if (inputPorts[i].port == port){
+                return inputPorts[i].deviceData.load();
+            }
+        }
+        return nullptr;
+    }
+
+    snd_seq_real_time_t msCounterToQueueTime(double timeMs) const
+    {
+        double queueTimeMs = juce::jmax(0.0, timeMs - queueStartTimeMs);
+        snd_seq_real_time_t time;
+        time.tv_sec = (unsigned int)(queueTimeMs / 1000.0);
+        time.tv_nsec = (unsigned int)((queueTimeMs - time.tv_sec * 1000.0) * 1000000.0);
+        return time;
+    }
+
+    double queueTimeToMsCounter(const snd_seq_real_time_t& time) const
+    {
+        return queueStartTimeMs + time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+    }
+
+    //==============================================================================
+
+    struct InputPort {
+        int port = -1;
+        std::atomic<MidiInputDeviceData*> deviceData = {nullptr};
+    };
+
+    snd_seq_t* seq = nullptr;
+    int clientId = -1;
+    int queueId = -1;
+    double queueStartTimeMs = 0.0;
+    std::array<std::atomic<snd_midi_event_t*>, ALSA_SEQ_MAX_OUTPUT_PORTS> encoders {};  // Indexed by local port id
+    std::array<InputPort, ALSA_SEQ_MAX_INPUT_PORTS> inputPorts;
+    std::atomic<int> numInputPorts = {0};
+    juce::CriticalSection seqLock;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AlsaSequencerMidiBackend)
+};
+
+#endif
@@ -26,6 +26,9 @@ Clip::Clip(const juce::ValueTree& _state,
     
     playhead = std::make_unique<Playhead>(state, playheadParentSliceGetter, [this]{ return getLocalSliceLength(); });
     
+    // Seed from the shared generator here (message thread) so that clips created at the same time get different sequences
+    chanceRandom.setSeed(juce::Random::getSystemRandom().nextInt64());
+    
     startTimer(50); // Check if sequence should be updated and do it!
 }
 
@@ -50,6 +53,7 @@ void Clip::bindState()
 {
     uuid.referTo(state, ShepherdIDs::uuid, nullptr, ShepherdDefaults::emptyString);
     name.referTo(state, ShepherdIDs::name, nullptr, ShepherdDefaults::emptyString);
+    handle.referTo(state, ShepherdIDs::handle, nullptr, -1);
     clipLengthInBeats.referTo(state, ShepherdIDs::clipLengthInBeats, nullptr, ShepherdDefaults::clipLengthInBeats);
     bpmMultiplier.referTo(state, ShepherdIDs::bpmMultiplier, nullptr, ShepherdDefaults::bpmMultiplier);
     wrapEventsAcrossClipLoop.referTo(state, ShepherdIDs::wrapEventsAcrossClipLoop, nullptr, ShepherdDefaults::wrapEventsAcrossClipLoop);
@@ -64,6 +68,7 @@ void Clip::bindState()
     stateRecording.referTo(state, ShepherdIDs::recording, nullptr, ShepherdDefaults::recording);
     recording = stateRecording;
     
+    rebuildSequenceEventsIndex();
     state.addListener(this);
 }
 
@@ -105,7 +110,7 @@ void Clip::timerCallback(){
     
     // Update stateX member values if these have changed
     updateStateMemberVersions();
-    playhead->updateStateMemberVersions();
+    playhead->updateStateMemberVersions(getClipBpm(), clipLengthInBeats);
 }
 
 void Clip::playNow()
@@ -376,12 +381,14 @@ void Clip::setClipLengthToGlobalFixedLength()
 void Clip::clearClipSequence()
 {
     // Removes all sequence events from VT
+    beginSequenceEdit();
     for (int i=state.getNumChildren() - 1; i>=0; i--){
         auto child = state.getChild(i);
         if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
             state.removeChild(i, nullptr);
         }
     }
+    commitSequenceEdit();
     
     // Send note off messages for notes being played
     shouldSendRemainingNotesOff = true;
@@ -404,6 +411,7 @@ void Clip::doubleSequence()
     saveToUndoStack();
     
     // Iterate over all sequence events and re-add them at the end with doubled length
+    beginSequenceEdit();
     int numChildrenBeforeDoubling = state.getNumChildren();
     for (int i=0; i<numChildrenBeforeDoubling; i++){
         auto child = state.getChild(i);
@@ -414,6 +422,7 @@ void Clip::doubleSequence()
         }
     }
     setClipLength(clipLengthInBeats * 2);
+    commitSequenceEdit();
 }
 
 
@@ -452,32 +461,43 @@ void Clip::quantizeSequence(double quantizationStep)
 void Clip::replaceSequence(juce::ValueTree newSequence, double newLength)
 {
     // NOTE: this should NOT be called from RT thread
-    
-    // First remove all sequence events
-    for (int i=0; i<state.getNumChildren(); i++){
-        auto child = state.getChild(i);
+    juce::Array<juce::ValueTree> newSequenceEvents;
+    for (auto child: newSequence){
         if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-            state.removeChild(i, nullptr);
-            i = i-1;
+            newSequenceEvents.add(child.createCopy());
         }
     }
+    replaceSequenceEvents(newSequenceEvents, newLength);
+}
+
+void Clip::replaceSequenceEvents(const juce::Array<juce::ValueTree>& newSequenceEvents, double newLength)
+{
+    // NOTE: this should NOT be called from RT thread
     
-    shouldSendRemainingNotesOff = true;
-    
-    // Now add the new sequence events to the clip
-    int count = 0;
-    for (int i=0; i<newSequence.getNumChildren(); i++){
-        auto child = newSequence.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT)){
-            auto childToAdd = child.createCopy();
-            state.addChild(childToAdd, -1, nullptr);
-            count += 1;
-        }
+    // Replaces all sequence events and the length in a single transaction. The new events are added to the clip
+    // state (not copied)
+    beginSequenceEdit();
+    clearClipSequence();
+    for (auto sequenceEvent: newSequenceEvents){
+        state.addChild(sequenceEvent, -1, nullptr);
     }
-    numSequenceEvents = count;
-    
-    // Finally replace length
     setClipLength(newLength);
+    commitSequenceEdit();
+}
+
+void Clip::beginSequenceEdit()
+{
+    sequenceEditDepth += 1;
+}
+
+void Clip::commitSequenceEdit()
+{
+    jassert(sequenceEditDepth > 0);
+    sequenceEditDepth -= 1;
+    if (sequenceEditDepth == 0){
+        rebuildSequenceEventsIndex();
+        sequenceNeedsUpdate = true;
+    }
 }
 
 double Clip::getPlayheadPosition()
@@ -672,7 +692,7 @@ void Clip::processSlice(juce::MidiBuffer& incommingBuffer, juce::MidiBuffer* buf
                     // object, when the chance is compute for the note on is the same chance value for the
                     // corresponding note off
                     if (eventAnnotations != nullptr && msg.isNoteOn() && eventAnnotations->chance < 1.0){
-                        eventAnnotations->lastComputedChance = juce::Random::getSystemRandom().nextFloat();
+                        eventAnnotations->lastComputedChance = chanceRandom.nextFloat();
                     }
                     // If the last computed chance is above the event chance, then skip this message
                     // as it should not be rendered in the buffer
@@ -1074,19 +1094,105 @@ int Clip::getIndexOfMatchingKeyUpInSequence(juce::MidiMessageSequence& sequence,
 
 juce::ValueTree Clip::getSequenceEventWithUUID(const juce::String& uuid)
 {
-    for (int i=state.getNumChildren() - 1; i>=0; i--){
-        auto child = state.getChild(i);
-        if (child.hasType (ShepherdIDs::SEQUENCE_EVENT) && child.getProperty(ShepherdIDs::uuid) == uuid){
-            return child;
+    // Returns an invalid ValueTree if not found
+    return sequenceEventsByUUID[uuid];
+}
+
+juce::ValueTree Clip::getSequenceEventWithHandle(int handle)
+{
+    // Returns an invalid ValueTree if not found. The index is only added to when handles are set, so it can hold
+    // stale entries of events whose handle has been re-assigned, check that the handle still matches
+    auto sequenceEvent = sequenceEventsByHandle[handle];
+    if (sequenceEvent.isValid() && (int)sequenceEvent.getProperty(ShepherdIDs::handle, -1) == handle){
+        return sequenceEvent;
+    }
+    return {};
+}
+
+void Clip::rebuildSequenceEventsIndex()
+{
+    sequenceEventsByUUID.clear();
+    sequenceEventsByHandle.clear();
+    int count = 0;
+    for (auto child: state){
+        if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+            sequenceEventsByUUID.set(child.getProperty(ShepherdIDs::uuid).toString(), child);
+            if (child.hasProperty(ShepherdIDs::handle)){
+                sequenceEventsByHandle.set((int)child.getProperty(ShepherdIDs::handle), child);
+            }
+            count += 1;
         }
     }
-    return juce::ValueTree();
+    numSequenceEvents = count;
+}
+
+std::vector<juce::ValueTree> Clip::queryCompiledEvents(const EventsQuery& query, bool& truncated)
+{
+    // NOTE: this should NOT be called from RT thread
+    
+    // Returns the matching events sorted by rendered start position (notes wrapping around the clip loop into the
+    // window go first). If more than query.maxEvents events match, only the first ones are returned and truncated is
+    // set to true (the controller can then query narrower windows)
+    if (sequenceNeedsUpdate && sequenceEditDepth == 0){
+        // Make sure the index includes the last changes instead of waiting for the timer to recompile the sequence
+        recreateSequenceAndAddToFifo();
+        sequenceNeedsUpdate = false;
+    }
+    
+    auto matchesFilters = [&query](const CompiledEvent& compiledEvent){
+        const int type = compiledEvent.sequenceEvent.getProperty(ShepherdIDs::type);
+        if (query.type >= 0 && type != query.type){
+            return false;
+        }
+        if (type == SequenceEventType::note){
+            const int midiNote = compiledEvent.sequenceEvent.getProperty(ShepherdIDs::midiNote);
+            return midiNote >= query.minMidiNote && midiNote <= query.maxMidiNote;
+        }
+        return true;
+    };
+    auto overlapsWindow = [&query](double start, double end){
+        // Events without duration are matched if they start inside the window
+        return start < query.endBeat && (end > query.startBeat || start >= query.startBeat);
+    };
+    
+    std::vector<juce::ValueTree> matchedEvents;
+    truncated = false;
+    auto addMatchedEvent = [&](const CompiledEvent& compiledEvent){
+        if (query.maxEvents >= 0 && (int)matchedEvents.size() >= query.maxEvents){
+            truncated = true;
+            return false;
+        }
+        matchedEvents.push_back(compiledEvent.sequenceEvent);
+        return true;
+    };
+    
+    // Notes wrapping around the clip loop also sound from the start of the clip until their wrapped end position
+    for (const auto& compiledEvent: compiledEventsWrappingAround){
+        if (overlapsWindow(0.0, compiledEvent.end - clipLengthInBeats) && !overlapsWindow(compiledEvent.start, compiledEvent.end) && matchesFilters(compiledEvent)){
+            if (!addMatchedEvent(compiledEvent)) { return matchedEvents; }
+        }
+    }
+    
+    // Events starting earlier than the length of the longest note before the window can't overlap it
+    auto it = std::lower_bound(compiledEvents.begin(), compiledEvents.end(), query.startBeat - compiledEventsMaxLength, [](const CompiledEvent& compiledEvent, double position){
+        return compiledEvent.start < position;
+    });
+    for (; it != compiledEvents.end() && it->start < query.endBeat; ++it){
+        if (overlapsWindow(it->start, it->end) && matchesFilters(*it)){
+            if (!addMatchedEvent(*it)) { break; }
+        }
+    }
+    return matchedEvents;
 }
 
 void Clip::removeSequenceEventWithUUID(const juce::String& uuid)
 {
-    auto sequenceEvent = getSequenceEventWithUUID(uuid);
-    if (sequenceEvent.isValid()){
+    removeSequenceEvent(getSequenceEventWithUUID(uuid));
+}
+
+void Clip::removeSequenceEvent(juce::ValueTree sequenceEvent)
+{
+    if (sequenceEvent.isValid() && sequenceEvent.getParent() == state){
         int midiNote = -1;
         if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
             midiNote = (int)sequenceEvent.getProperty(ShepherdIDs::midiNote);
@@ -1106,6 +1212,10 @@ void Clip::removeSequenceEventWithUUID(const juce::String& uuid)
 
 void Clip::valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasChanged, const juce::Identifier& property)
 {
+    if (sequenceEditDepth > 0){
+        return;  // Sequence and index are updated when the edit is committed
+    }
+    
     // Eg: change in quantization or individual note property
     if ((property == ShepherdIDs::currentQuantizationStep) ||
         (property == ShepherdIDs::clipLengthInBeats) ||
@@ -1118,28 +1228,50 @@ void Clip::valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasChange
         (property == ShepherdIDs::midiVelocity)){
         sequenceNeedsUpdate = true;
     }
+    
+    if (property == ShepherdIDs::uuid && treeWhosePropertyHasChanged.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+        // The previous UUID of the event is not known, rebuild the whole index
+        rebuildSequenceEventsIndex();
+    }
+    
+    if (property == ShepherdIDs::handle && treeWhosePropertyHasChanged.hasType(ShepherdIDs::SEQUENCE_EVENT) && treeWhosePropertyHasChanged.getParent() == state){
+        // Events are not indexed by handle when added because they might be copies of other events (with the same
+        // handle), they are indexed when the Sequencer assigns them a new handle
+        sequenceEventsByHandle.set((int)treeWhosePropertyHasChanged.getProperty(ShepherdIDs::handle), treeWhosePropertyHasChanged);
+    }
 }
 
 void Clip::valueTreeChildAdded (juce::ValueTree& parentTree, juce::ValueTree& childWhichHasBeenAdded)
 {
     // Eg: new note added
+    if (sequenceEditDepth > 0){
+        return;  // Sequence and index are updated when the edit is committed
+    }
     sequenceNeedsUpdate = true;
     
-    // Update "numSequenceEvents"
-    int count = 0;
-    for (auto child: state) { if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)) {count += 1;}}
-    numSequenceEvents = count;
+    // Update "numSequenceEvents" and UUID index
+    if (parentTree == state && childWhichHasBeenAdded.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+        sequenceEventsByUUID.set(childWhichHasBeenAdded.getProperty(ShepherdIDs::uuid).toString(), childWhichHasBeenAdded);
+        numSequenceEvents += 1;
+    }
 }
 
 void Clip::valueTreeChildRemoved (juce::ValueTree& parentTree, juce::ValueTree& childWhichHasBeenRemoved, int indexFromWhichChildWasRemoved)
 {
     // Eg: note removed
+    if (sequenceEditDepth > 0){
+        return;  // Sequence and index are updated when the edit is committed
+    }
     sequenceNeedsUpdate = true;
     
-    // Update "numSequenceEvents"
-    int count = 0;
-    for (auto child: state) { if (child.hasType(ShepherdIDs::SEQUENCE_EVENT)) {count += 1;}}
-    numSequenceEvents = count;
+    // Update "numSequenceEvents" and UUID index
+    if (parentTree == state && childWhichHasBeenRemoved.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+        sequenceEventsByUUID.remove(childWhichHasBeenRemoved.getProperty(ShepherdIDs::uuid).toString());
+        if (getSequenceEventWithHandle((int)childWhichHasBeenRemoved.getProperty(ShepherdIDs::handle, -1)) == childWhichHasBeenRemoved){
+            sequenceEventsByHandle.remove((int)childWhichHasBeenRemoved.getProperty(ShepherdIDs::handle));
+        }
+        numSequenceEvents -= 1;
+    }
 }
 
 void Clip::valueTreeChildOrderChanged (juce::ValueTree& parentTree, int oldIndex, int newIndex)
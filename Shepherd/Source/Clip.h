@@ -17,6 +17,7 @@
 #include "HardwareDevice.h"
 #include "Fifo.h"
 #include "ReleasePool.h"
+#include "ClipOverview.h"
 
 
 struct TrackSettingsStruct {
@@ -62,6 +63,7 @@ public:
     
     juce::String getUUID() { return uuid.get(); };
     juce::String getName() { return name.get(); };
+    int getHandle() { return handle.get(); };
     void stopAsyncTimer(){stopTimer();};
     
     double getLocalSliceLength();
@@ -96,6 +98,13 @@ public:
     void doubleSequence();
     void quantizeSequence(double quantizationStep);
     void replaceSequence(juce::ValueTree newSequence, double newLength);
+    void replaceSequenceEvents(const juce::Array<juce::ValueTree>& newSequenceEvents, double newLength);
+    
+    // Sequence edit transactions: while a transaction is open, added and removed events don't update the events index
+    // one by one. The index is rebuilt and the sequence recompiled only once, when the (outermost) transaction is
+    // committed. Transactions can be nested
+    void beginSequenceEdit();
+    void commitSequenceEdit();
     void resetPlayheadPosition();
     void undo();
     
@@ -115,7 +124,23 @@ public:
     int getNumSequenceEvents();
     
     juce::ValueTree getSequenceEventWithUUID(const juce::String& uuid);
+    juce::ValueTree getSequenceEventWithHandle(int handle);
     void removeSequenceEventWithUUID(const juce::String& uuid);
+    void removeSequenceEvent(juce::ValueTree sequenceEvent);
+    
+    // Range queries over the compiled sequence (see ACTION_ADDRESS_CLIP_QUERY_EVENTS). Events are matched using their
+    // rendered (quantized) positions, and notes are matched if they sound at any point of the window (including notes
+    // which started before it or which wrap around the clip loop). The note range only filters note events
+    struct EventsQuery
+    {
+        double startBeat = 0.0;
+        double endBeat = 0.0;
+        int minMidiNote = 0;
+        int maxMidiNote = 127;
+        int type = -1;  // SequenceEventType, or -1 for all types
+        int maxEvents = -1;  // -1 for no limit
+    };
+    std::vector<juce::ValueTree> queryCompiledEvents(const EventsQuery& query, bool& truncated);
     
 protected:
     
@@ -129,6 +154,7 @@ private:
     
     juce::CachedValue<juce::String> uuid;
     juce::CachedValue<juce::String> name;
+    juce::CachedValue<int> handle;
     juce::CachedValue<double> clipLengthInBeats;
     juce::CachedValue<double> bpmMultiplier;
     juce::CachedValue<bool> wrapEventsAcrossClipLoop;
@@ -145,6 +171,21 @@ private:
     double willStopRecordingAt = ShepherdDefaults::willStopRecordingAt;
     double currentQuantizationStep = ShepherdDefaults::currentQuantizationStep;
     int numSequenceEvents = 0;
+    juce::HashMap<juce::String, juce::ValueTree> sequenceEventsByUUID;  // Updated from ValueTree callbacks (see getSequenceEventWithUUID)
+    juce::HashMap<int, juce::ValueTree> sequenceEventsByHandle;  // Updated when the handle property of events is set (see getSequenceEventWithHandle)
+    void rebuildSequenceEventsIndex();
+    int sequenceEditDepth = 0;  // See beginSequenceEdit
+    
+    // Rendered events sorted by start position, rebuilt every time the sequence is recompiled (see queryCompiledEvents)
+    struct CompiledEvent
+    {
+        double start;
+        double end;  // Not wrapped to the clip length (for notes), same as start for other events
+        juce::ValueTree sequenceEvent;
+    };
+    std::vector<CompiledEvent> compiledEvents;
+    std::vector<CompiledEvent> compiledEventsWrappingAround;  // Notes which end after the clip has looped
+    double compiledEventsMaxLength = 0.0;
     double shouldUpdateClipLenthInTimerTo = -1.0;
     
     std::unique_ptr<Playhead> playhead;
@@ -191,6 +232,9 @@ private:
         
         juce::MidiMessageSequence midiSequence;
         std::vector<std::pair<juce::MidiMessage, SequenceEventAnnotations*>> rawAnnotations;
+        compiledEvents.clear();
+        compiledEventsWrappingAround.clear();
+        compiledEventsMaxLength = 0.0;
         for (int i=0; i<state.getNumChildren(); i++){
             auto sequenceEvent = state.getChild(i);
             if (sequenceEvent.hasType (ShepherdIDs::SEQUENCE_EVENT)){
@@ -230,6 +274,16 @@ private:
                         sequenceEvent.setProperty(ShepherdIDs::renderedStartTimestamp, quantizedStartTimestamp, nullptr);
                         sequenceEvent.setProperty(ShepherdIDs::renderedEndTimestamp, quantizedEndTimestamp, nullptr);
                         
+                        CompiledEvent compiledEvent {quantizedStartTimestamp, quantizedStartTimestamp, sequenceEvent};
+                        if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note) {
+                            compiledEvent.end = quantizedStartTimestamp + (double)sequenceEvent.getProperty(ShepherdIDs::duration);
+                            compiledEventsMaxLength = juce::jmax(compiledEventsMaxLength, compiledEvent.end - compiledEvent.start);
+                            if (compiledEvent.end > clipLengthInBeats){
+                                compiledEventsWrappingAround.push_back(compiledEvent);
+                            }
+                        }
+                        compiledEvents.push_back(compiledEvent);
+                        
                         SequenceEventAnnotations* eventAnnotations = new SequenceEventAnnotations();
                         eventAnnotations->sequenceEventUUID = sequenceEvent.getProperty(ShepherdIDs::uuid);
                         if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note) {
@@ -256,6 +310,20 @@ private:
             }
         }
         
+        std::stable_sort(compiledEvents.begin(), compiledEvents.end(), [](const CompiledEvent& a, const CompiledEvent& b){ return a.start < b.start; });
+        
+        // Update the summary of the clip contents used by controller displays (see ClipOverview.h). The property is
+        // only changed (and therefore sent to the controller) if the summary is different
+        ClipOverview overview (clipLengthInBeats);
+        for (const auto& compiledEvent: compiledEvents){
+            if ((int)compiledEvent.sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
+                overview.addNote(compiledEvent.start, compiledEvent.end, compiledEvent.sequenceEvent.getProperty(ShepherdIDs::midiNote));
+            } else {
+                overview.addMidiEvent();
+            }
+        }
+        state.setProperty(ShepherdIDs::sequenceOverview, juce::String(overview.serialize()), nullptr);
+        
         // Pre-process de MIDI sequence (update quantization, etc)
         preProcessSequence(midiSequence);
         
@@ -300,23 +368,28 @@ private:
     ClipSequence::Ptr clipSequenceForRTThread = new ClipSequence();
     bool sequenceNeedsUpdate = true;
     
+    // Used to compute the chance of note events in processSlice. Each clip has its own generator because clips can be
+    // processed in parallel from different threads (see RTWorkerPool.h), and juce::Random is not thread safe
+    juce::Random chanceRandom;
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Clip)
 };
 
-struct ClipList: public drow::ValueTreeObjectList<Clip>
+struct ClipList: public UUIDIndexedObjectList<Clip>
 {
     ClipList (const juce::ValueTree& v,
               std::function<juce::Range<double>()> playheadParentSliceGetter,
               std::function<GlobalSettingsStruct()> globalSettingsGetter,
               std::function<TrackSettingsStruct()> trackSettingsGetter,
               std::function<MusicalContext*()> musicalContextGetter)
-    : drow::ValueTreeObjectList<Clip> (v)
+    : UUIDIndexedObjectList<Clip> (v)
     {
         getPlayheadParentSlice = playheadParentSliceGetter;
         getGlobalSettings = globalSettingsGetter;
         getTrackSettings = trackSettingsGetter;
         getMusicalContext = musicalContextGetter;
         rebuildObjects();
+        rebuildIndex();
     }
 
     ~ClipList()
@@ -344,19 +417,8 @@ struct ClipList: public drow::ValueTreeObjectList<Clip>
         delete c;
     }
 
-    void newObjectAdded (Clip*) override    {}
-    void objectRemoved (Clip*) override     {}
     void objectOrderChanged() override      {}
     
-    Clip* getObjectWithUUID(const juce::String& uuid) {
-        for (auto* object: objects){
-            if (object->getUUID() == uuid){
-                return object;
-            }
-        }
-        return nullptr;
-    }
-    
     std::function<juce::Range<double>()> getPlayheadParentSlice;
     std::function<GlobalSettingsStruct()> getGlobalSettings;
     std::function<TrackSettingsStruct()> getTrackSettings;
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+
+/** Message received from the controller, already split into action and parameters. The action is resolved from its
+    address when the message is parsed (see ControllerActions::lookup). */
+struct ControllerMessage
+{
+    ControllerAction action = ControllerAction::unknown;
+    ControllerActionGroup group = ControllerActionGroup::none;
+    juce::StringArray parameters;
+    std::weak_ptr<void> sender;  // Connection which sent the message, replies are only sent to it (see Sequencer::sendToConnection)
+};
+
+
+/** Queue of messages received from the controller which are processed in the message thread.
+
+    Messages are parsed and pushed from the WebSockets I/O thread, which only holds a spin lock for the time it takes
+    to append the message, so it never waits for messages to be processed (some of them, like loading a session or
+    setting the sequence of a clip, are slow). Queued messages are processed in batches in the message thread.
+
+    Some messages are coalesced: if a batch contains several messages which only set a value (e.g. consecutive
+    /transport/setBpm messages sent while turning an encoder), only the latest of them is processed, at its position
+    in the batch. Messages are only coalesced if no other message which can change the same object is between them, so
+    processing the latest one at its position does not reorder them relative to the messages they interact with (e.g.
+    setSequence, editSequence, setSequence for the same clip are all processed). See getCoalescingKey for the list of
+    messages which are coalesced.
+*/
+class ControllerMessageQueue: private juce::AsyncUpdater
+{
+public:
+    /** Returns the UUID of the clip referenced by the track and clip parameters of a message (by handle or by UUID), or
+        an empty string if there is no such clip. */
+    using ClipResolver = std::function<juce::String(const juce::String& trackReference, const juce::String& clipReference)>;
+
+    ControllerMessageQueue (std::function<void(const ControllerMessage&)> _processMessage, ClipResolver _resolveClip)
+        : processMessage (std::move(_processMessage)), resolveClip (std::move(_resolveClip))
+    {
+    }
+
+    ~ControllerMessageQueue()
+    {
+        cancelPendingUpdate();
+    }
+
+    /** Can be called from any thread. */
+    void push(ControllerMessage message)
+    {
+        {
+            const juce::SpinLock::ScopedLockType sl (lock);
+            pendingMessages.push_back(std::move(message));
+        }
+        triggerAsyncUpdate();
+    }
+
+    /** Returns the object which the message can change (see ControllerActions::getCoalescingTarget): an empty string if
+        it does not change any, anyTarget if it can change any object. Must be called from the message thread. */
+    juce::String getTarget(const ControllerMessage& message) const
+    {
+        switch (ControllerActions::getCoalescingTarget(message.action, message.group)) {
+            case ControllerActions::CoalescingTarget::nothing:
+                return {};
+            case ControllerActions::CoalescingTarget::clip: {
+                // Messages which reference a clip that does not exist yet (e.g. it is created by an earlier message of
+                // the batch) can't be identified, so these are treated as if they could change anything
+                auto clipUUID = message.parameters.size() >= 2 ? resolveClip(message.parameters[0], message.parameters[1]) : juce::String();
+                return clipUUID.isNotEmpty() ? "clip" + juce::String(SERIALIZATION_SEPARATOR) + clipUUID : anyTarget;
+            }
+            case ControllerActions::CoalescingTarget::transport:
+                return "transport";
+            case ControllerActions::CoalescingTarget::metronome:
+                return "metronome";
+            case ControllerActions::CoalescingTarget::settings:
+                return "settings";
+            case ControllerActions::CoalescingTarget::everything:
+                break;
+        }
+        return anyTarget;
+    }
+
+    /** Returns a key identifying the value set by the message, or an empty string if the message can't be coalesced.
+        Messages with the same key replace each other (see ControllerActions::getCoalescingKeyParameters). The key
+        includes the target, so messages which reference the same clip by handle and by UUID have the same key. */
+    static juce::String getCoalescingKey(const ControllerMessage& message, const juce::String& target)
+    {
+        auto keyParameters = ControllerActions::getCoalescingKeyParameters(message.action, (size_t)message.parameters.size());
+        if (!keyParameters.canCoalesce || target == anyTarget){
+            return {};
+        }
+        juce::String key = juce::String((int)message.action) + SERIALIZATION_SEPARATOR + target;
+        for (size_t i=keyParameters.first; i<keyParameters.first + keyParameters.count; i++){
+            key += SERIALIZATION_SEPARATOR + message.parameters[(int)i];
+        }
+        return key;
+    }
+
+    static inline const juce::String anyTarget { "*" };
+
+private:
+    void handleAsyncUpdate() override
+    {
+        {
+            const juce::SpinLock::ScopedLockType sl (lock);
+            std::swap(pendingMessages, batch);
+        }
+
+        keys.clear();
+        targets.clear();
+        for (const auto& message: batch){
+            targets.push_back(getTarget(message));
+            keys.push_back(getCoalescingKey(message, targets.back()));
+        }
+        ControllerActions::findReplacedMessages(keys, targets, anyTarget, skip);
+
+        for (size_t i=0; i<batch.size(); i++){
+            if (!skip[i]){
+                processMessage(batch[i]);
+            }
+        }
+        batch.clear();
+    }
+
+    std::function<void(const ControllerMessage&)> processMessage;
+    ClipResolver resolveClip;
+    juce::SpinLock lock;
+    std::vector<ControllerMessage> pendingMessages;  // Protected by lock
+    std::vector<ControllerMessage> batch;  // Only accessed from the message thread
+    std::vector<juce::String> keys;
+    std::vector<juce::String> targets;
+    std::vector<bool> skip;
+};
@@ -22,31 +22,42 @@ HardwareDevice::HardwareDevice(const juce::ValueTree& _state,
     bindState();
     
     if (isTypeOutput()){
-        for (int i=0; i<midiCCParameterValues.size(); i++){
-            midiCCParameterValues[i] = 64;  // Initialize all midi ccs to 64 (middle value)
+        for (auto& value: midiCCParameterValues){
+            value = 64;  // Initialize all midi ccs to 64 (middle value)
         }
-        stateMidiCCParameterValues = ShepherdHelpers::serialize128IntArray(midiCCParameterValues); // Update the state version of the midiCCParameterValues list so change is reflected in state
+        publishMidiCCParameterValues();
     }
     
     if (isTypeInput()){
         if (stateControlChangeMapping == ""){
+            std::array<int, 128> controlChangeMapping = {};
             for (int i=0; i<controlChangeMapping.size(); i++){
                 controlChangeMapping[i] = i;  // Initialize all midi cc mappings to the input number (no transformation)
             }
             stateControlChangeMapping = ShepherdHelpers::serialize128IntArray(controlChangeMapping); // Update the state version of the controlChangeMapping list so change is reflected in state
-        } else {
-            controlChangeMapping = ShepherdHelpers::deserialize128IntArray(stateControlChangeMapping);
         }
 
         if (stateNotesMapping == ""){
+            std::array<int, 128> notesMapping = {};
             for (int i=0; i<notesMapping.size(); i++){
                 notesMapping[i] = i;  // Initialize all midi note number mappings to the input number (no transformation)
             }
             stateNotesMapping = ShepherdHelpers::serialize128IntArray(notesMapping); // Update the state version of the notesMapping list so change is reflected in state
-        } else {
-            notesMapping = ShepherdHelpers::deserialize128IntArray(stateNotesMapping);
         }
     }
+    
+    // Create the initial config snapshot (the RT thread does not yet know about this device so it can be directly assigned)
+    configForRTThread = createConfigFromState();
+    configObjectsReleasePool.add(configForRTThread);
+    
+    state.addListener(this);
+    startTimer(50); // Check if config snapshot should be updated and do it!
+}
+
+HardwareDevice::~HardwareDevice()
+{
+    stopTimer();
+    state.removeListener(this);
 }
 
 void HardwareDevice::bindState()
@@ -74,6 +85,75 @@ void HardwareDevice::bindState()
     // NOTE: unlike other stateXXX properties in other objects like Clip, midiCCParameterValues and others here should never be loaded from state, so we don't do it here
 }
 
+// -------------------------------------- CONFIG SNAPSHOT
+
+HardwareDeviceConfig::Ptr HardwareDevice::createConfigFromState()
+{
+    HardwareDeviceConfig::Ptr config = new HardwareDeviceConfig();
+    config->type = getType();
+    config->midiOutputDeviceName = midiOutputDeviceName.get();
+    config->midiOutputChannel = midiOutputChannel.get();
+    config->midiInputDeviceName = midiInputDeviceName.get();
+    config->allowedMidiInputChannel = allowedMidiInputChannel.get();
+    config->allowNoteMessages = allowNoteMessages.get();
+    config->allowControllerMessages = allowControllerMessages.get();
+    config->allowPitchBendMessages = allowPitchBendMessages.get();
+    config->allowAftertouchMessages = allowAftertouchMessages.get();
+    config->allowChannelPressureMessages = allowChannelPressureMessages.get();
+    config->controlChangeMessagesAreRelative = controlChangeMessagesAreRelative.get();
+    if (config->isTypeInput()){
+        config->controlChangeMapping = ShepherdHelpers::deserialize128IntArray(stateControlChangeMapping.get());
+        config->notesMapping = ShepherdHelpers::deserialize128IntArray(stateNotesMapping.get());
+    }
+    return config;
+}
+
+void HardwareDevice::recreateConfigAndAddToFifo()
+{
+    HardwareDeviceConfig::Ptr config = createConfigFromState();
+    configObjectsReleasePool.add(config);  // Add object to release pool so it is never deleted in the audio thread
+    if (!configObjectsFifo.push(config)){  // Add object to the fifo so it can be pulled from the audio thread
+        // Fifo is full because the RT thread has not pulled from it for a while. Try again in the next timer callback
+        // (with a new snapshot) so that the latest config always reaches the RT thread
+        configNeedsUpdate = true;
+        return;
+    }
+    
+    if (configObjectsFifo.getAvailableSpace() < 10){
+        DBG("WARNING, config fifo for hardware device " << getName() << " getting close to full or full");
+        DBG("- Available space: " << configObjectsFifo.getAvailableSpace() << ", available for reading: " << configObjectsFifo.getNumAvailableForReading());
+    }
+}
+
+void HardwareDevice::prepareSlice()
+{
+    // Pull the latest config snapshot from the fifo (if any)
+    HardwareDeviceConfig::Ptr config = nullptr;
+    while (configObjectsFifo.pull(config));
+    if (config != nullptr){
+        configForRTThread = config;
+    }
+}
+
+void HardwareDevice::timerCallback()
+{
+    if (configNeedsUpdate.exchange(false)){
+        recreateConfigAndAddToFifo();
+    }
+    if (midiCCParameterValuesChanged.exchange(false)){
+        publishMidiCCParameterValues();
+    }
+}
+
+void HardwareDevice::valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasChanged, const juce::Identifier& property)
+{
+    // This can be called from any thread (e.g. when device properties are changed from the WS thread), therefore we only
+    // flag that the config snapshot needs to be re-created and do it in the timer (message thread)
+    if ((treeWhosePropertyHasChanged == state) && (property != ShepherdIDs::midiCCParameterValuesList)){
+        configNeedsUpdate = true;
+    }
+}
+
 // -------------------------------------- OUTPUT DEVICES
 
 void HardwareDevice::sendMidi(juce::MidiMessage msg)
@@ -112,16 +192,27 @@ int HardwareDevice::getMidiCCParameterValue(int index)
     // NOTE: this function is to read the parameter value form the internal state, but it is not expected to read
     // the value from the hardware device
     jassert(index >= 0 && index < 128);
-    return midiCCParameterValues[index];
+    return midiCCParameterValues[index].load(std::memory_order_relaxed);
 }
 
 void HardwareDevice::setMidiCCParameterValue(int index, int value)
 {
     // NOTE: this function is to store the parameter value in the internal state, but it is not expected to communicate
     // this value to the hardware device
+    // NOTE: this is called from the RT thread, the state version of the values is updated later in the timer
     jassert(index >= 0 && index < 128);
-    midiCCParameterValues[index] = value;
-    stateMidiCCParameterValues = ShepherdHelpers::serialize128IntArray(midiCCParameterValues); // Update the state version of the midiCCParameterValues list so change is reflected in state
+    midiCCParameterValues[index].store(value, std::memory_order_relaxed);
+    midiCCParameterValuesChanged = true;
+}
+
+void HardwareDevice::publishMidiCCParameterValues()
+{
+    // Update the state version of the midiCCParameterValues list so changes are reflected in state
+    std::array<int, 128> values;
+    for (size_t i=0; i<values.size(); i++){
+        values[i] = midiCCParameterValues[i].load(std::memory_order_relaxed);
+    }
+    stateMidiCCParameterValues = ShepherdHelpers::serialize128IntArray(values);
 }
 
 void HardwareDevice::addMidiMessageToRenderInBufferFifo(juce::MidiMessage msg)
@@ -134,18 +225,19 @@ void HardwareDevice::addMidiMessageToRenderInBufferFifo(juce::MidiMessage msg)
     }
 }
 
-void HardwareDevice::renderPendingMidiMessagesToRenderInBuffer()
+void HardwareDevice::renderPendingMidiMessagesToRenderInBuffer(int sampleOffset)
 {
     // If there are pending MIDI messages to be rendered in the hardware device buffer buffer, send them
     juce::MidiMessage msg;
-    auto midiOutputDeviceData = getMidiOutputDeviceData(getMidiOutputDeviceName());
+    const auto& config = getRTConfig();
+    auto midiOutputDeviceData = getMidiOutputDeviceData(config.midiOutputDeviceName);
     if (midiOutputDeviceData == nullptr) { return; }
     juce::MidiBuffer* buffer = &midiOutputDeviceData->buffer;
     while (midiMessagesToRenderInBuffer.pull(msg)) {
-        int deviceMidiOutputChannel = getMidiOutputChannel();
+        int deviceMidiOutputChannel = config.midiOutputChannel;
         if ((buffer != nullptr) && (deviceMidiOutputChannel > -1)){
             msg.setChannel(deviceMidiOutputChannel);
-            buffer->addEvent(msg, 0);
+            buffer->addEvent(msg, sampleOffset);
         }
     }
 }
@@ -156,35 +248,37 @@ bool HardwareDevice::filterAndProcessIncomingMidiMessage(juce::MidiMessage& msg,
 {
     // Return false if message should not be added to incoming buffer, also modify message according to the target output device
     // (e.g. change midi ouput channel)
+    // NOTE: this is called from the RT thread, therefore config snapshots are used instead of the CachedValue members
+    const auto& config = getRTConfig();
     
-    if (allowedMidiInputChannel.get() != 0){
-        if (msg.getChannel() != allowedMidiInputChannel.get()){
+    if (config.allowedMidiInputChannel != 0){
+        if (msg.getChannel() != config.allowedMidiInputChannel){
             return false;
         }
     }
     
-    int newMidiChannel = outputDevice->getMidiOutputChannel();
+    int newMidiChannel = outputDevice->getRTConfig().midiOutputChannel;
     
     if (msg.isNoteOnOrOff() || msg.isAftertouch()){
-        int newNoteNumber = notesMapping[msg.getNoteNumber()];
+        int newNoteNumber = config.notesMapping[msg.getNoteNumber()];
         if (newNoteNumber == -1){
             return false;  // Message should be discarted
         } else {
             msg.setNoteNumber(newNoteNumber);  // Update note number according to mapping
         }
-        if ((msg.isNoteOnOrOff() && allowNoteMessages.get()) || (msg.isAftertouch() && allowAftertouchMessages.get())){
+        if ((msg.isNoteOnOrOff() && config.allowNoteMessages) || (msg.isAftertouch() && config.allowAftertouchMessages)){
             msg.setChannel(newMidiChannel);
             return true;
         }
     }
-    else if (msg.isController() && allowControllerMessages.get()){
-        int newControllerNumber = controlChangeMapping[msg.getControllerNumber()];
+    else if (msg.isController() && config.allowControllerMessages){
+        int newControllerNumber = config.controlChangeMapping[msg.getControllerNumber()];
         int newControllerValue = msg.getControllerValue();
         if (newControllerNumber == -1){
             return false;  // Message should be discarted
         } else {
             // If cc messages are from a "relative" controller, compute the absolute cc value that shoud be sent, otherwise keep original value
-            if (controlChangeMessagesAreRelative.get()){
+            if (config.controlChangeMessagesAreRelative){
                 int rawControllerValue = msg.getControllerValue();
                 int increment = 0;
                 if (rawControllerValue > 0 && rawControllerValue < 64){
@@ -210,11 +304,11 @@ bool HardwareDevice::filterAndProcessIncomingMidiMessage(juce::MidiMessage& msg,
         outputDevice->setMidiCCParameterValue(newControllerNumber, newControllerValue);  // If message is of type controller, also update the internal stored state of the controller
         return true;
     }
-    else if (msg.isPitchWheel() && allowPitchBendMessages.get()){
+    else if (msg.isPitchWheel() && config.allowPitchBendMessages){
         msg.setChannel(newMidiChannel);
         return true;
     }
-    else if (msg.isChannelPressure() && allowChannelPressureMessages.get()){
+    else if (msg.isChannelPressure() && config.allowChannelPressureMessages){
         msg.setChannel(newMidiChannel);
         return true;
     }
@@ -225,7 +319,7 @@ bool HardwareDevice::filterAndProcessIncomingMidiMessage(juce::MidiMessage& msg,
 void HardwareDevice::processAndRenderIncomingMessagesIntoBuffer(juce::MidiBuffer& bufferToFill, HardwareDevice* outputDevice)
 {
     // use getMidiInputDeviceData to get latest block of messages for the device, process them and add to the buffer
-    auto midiInputDeviceData = getMidiInputDeviceData(getMidiInputDeviceName());
+    auto midiInputDeviceData = getMidiInputDeviceData(getRTConfig().midiInputDeviceName);
     if (midiInputDeviceData == nullptr) { return; }
     juce::MidiBuffer* lastBlockOfMessages = &midiInputDeviceData->buffer;
     if (lastBlockOfMessages != nullptr){
@@ -241,12 +335,11 @@ void HardwareDevice::processAndRenderIncomingMessagesIntoBuffer(juce::MidiBuffer
 
 void HardwareDevice::setNotesMapping(juce::String& serializedNotesMapping)
 {
-    notesMapping = ShepherdHelpers::deserialize128IntArray(serializedNotesMapping);
-    stateNotesMapping = ShepherdHelpers::serialize128IntArray(notesMapping);
+    // Mappings are only stored in the state, the RT thread will get them through the config snapshot
+    stateNotesMapping = ShepherdHelpers::serialize128IntArray(ShepherdHelpers::deserialize128IntArray(serializedNotesMapping));
 }
 
 void HardwareDevice::setControlChangeMapping(juce::String& serializedControlChangeMapping)
 {
-    controlChangeMapping = ShepherdHelpers::deserialize128IntArray(serializedControlChangeMapping);
-    stateControlChangeMapping = ShepherdHelpers::serialize128IntArray(controlChangeMapping);
+    stateControlChangeMapping = ShepherdHelpers::serialize128IntArray(ShepherdHelpers::deserialize128IntArray(serializedControlChangeMapping));
 }
@@ -14,23 +14,62 @@
 #include "helpers_shepherd.h"
 #include "Fifo.h"
 #include "MusicalContext.h"
+#include "ReleasePool.h"
 
-class HardwareDevice
+
+struct HardwareDeviceConfig: juce::ReferenceCountedObject
+{
+    // Immutable snapshot of the configuration of a hardware device. It is re-created in the message thread
+    // every time one of the device properties changes and passed to the RT thread through a fifo, so that the
+    // RT thread never needs to read the device configuration from the state (which could be modified concurrently)
+    using Ptr = juce::ReferenceCountedObjectPtr<HardwareDeviceConfig>;
+    
+    HardwareDeviceType type = HardwareDeviceType::output;
+    bool isTypeInput() const { return type == HardwareDeviceType::input; };
+    bool isTypeOutput() const { return type == HardwareDeviceType::output; };
+    
+    // For output devices
+    juce::String midiOutputDeviceName = "";
+    int midiOutputChannel = -1;
+    
+    // For input devices
+    juce::String midiInputDeviceName = "";
+    int allowedMidiInputChannel = ShepherdDefaults::allowedMidiInputChannel;
+    bool allowNoteMessages = ShepherdDefaults::allowNoteMessages;
+    bool allowControllerMessages = ShepherdDefaults::allowControllerMessages;
+    bool allowPitchBendMessages = ShepherdDefaults::allowPitchBendMessages;
+    bool allowAftertouchMessages = ShepherdDefaults::allowAftertouchMessages;
+    bool allowChannelPressureMessages = ShepherdDefaults::allowChannelPressureMessages;
+    bool controlChangeMessagesAreRelative = ShepherdDefaults::controlChangeMessagesAreRelative;
+    std::array<int, 128> controlChangeMapping = {};
+    std::array<int, 128> notesMapping = {};
+};
+
+class HardwareDevice: protected juce::ValueTree::Listener,
+                      private juce::Timer
 {
 public:
     HardwareDevice(const juce::ValueTree& state,
                    std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter,
                    std::function<MidiInputDeviceData*(juce::String deviceName)> midiInputDeviceDataGetter);
+    ~HardwareDevice();
     void bindState();
     juce::ValueTree state;
     
+    // Configuration snapshot to be used from the RT thread. prepareSlice must be called at the start of
+    // every slice so the latest snapshot created in the message thread is pulled from the fifo
+    void prepareSlice();
+    const HardwareDeviceConfig& getRTConfig() const { return *configForRTThread; };
+    
     bool isTypeInput() { return type.get() == HardwareDeviceType::input; };
     bool isTypeOutput() { return type.get() == HardwareDeviceType::output; };
     bool isMidiInitialized() {
-        if (isTypeInput()){
-            return getMidiInputDeviceData(getMidiInputDeviceName()) != nullptr;
+        // NOTE: this is called from the RT thread, therefore the config snapshot is used
+        const auto& config = getRTConfig();
+        if (config.isTypeInput()){
+            return getMidiInputDeviceData(config.midiInputDeviceName) != nullptr;
         } else {
-            return getMidiOutputDeviceData(getMidiOutputDeviceName()) != nullptr;
+            return getMidiOutputDeviceData(config.midiOutputDeviceName) != nullptr;
         }
     }
     
@@ -54,7 +93,7 @@ public:
     int getMidiCCParameterValue(int index);
     void setMidiCCParameterValue(int index, int value);
     void addMidiMessageToRenderInBufferFifo(juce::MidiMessage msg);
-    void renderPendingMidiMessagesToRenderInBuffer();
+    void renderPendingMidiMessagesToRenderInBuffer(int sampleOffset);
     
     // Relevant for input devices
     juce::String getMidiInputDeviceName(){ return midiInputDeviceName.get();}
@@ -63,6 +102,10 @@ public:
     void setNotesMapping(juce::String& serializedNotesMapping);
     void setControlChangeMapping(juce::String& serializedControlChangeMapping);
     
+protected:
+    
+    void valueTreePropertyChanged (juce::ValueTree&, const juce::Identifier&) override;
+    
 private:
     juce::CachedValue<juce::String> uuid;
     juce::CachedValue<int> type;  // Should correspond to HardwareDeviceType
@@ -72,8 +115,12 @@ private:
     // For output devices
     juce::CachedValue<juce::String> midiOutputDeviceName;
     juce::CachedValue<int> midiOutputChannel;
-    std::array<int, 128> midiCCParameterValues = {0};
+    // CC values are set from the RT thread (and the threads rendering tracks for it) when CC messages are sent, so
+    // these are stored in atomics and published to the state from the timer (message thread) when they change
+    std::array<std::atomic<int>, 128> midiCCParameterValues = {};
+    std::atomic<bool> midiCCParameterValuesChanged { false };
     juce::CachedValue<juce::String> stateMidiCCParameterValues;
+    void publishMidiCCParameterValues();
     
     std::function<MidiOutputDeviceData*(juce::String deviceName)> getMidiOutputDeviceData;
     Fifo<juce::MidiMessage, 100> midiMessagesToRenderInBuffer;
@@ -87,24 +134,37 @@ private:
     juce::CachedValue<bool> allowAftertouchMessages;
     juce::CachedValue<bool> allowChannelPressureMessages;
     juce::CachedValue<bool> controlChangeMessagesAreRelative;
-    std::array<int, 128> controlChangeMapping = {};
     juce::CachedValue<juce::String> stateControlChangeMapping;
-    std::array<int, 128> notesMapping = {};
     juce::CachedValue<juce::String> stateNotesMapping;
     
     std::function<MidiInputDeviceData*(juce::String deviceName)> getMidiInputDeviceData;
+    
+    // Trigger re-creation of the config snapshot and publish changed CC values
+    void timerCallback() override;
+    
+    // Real-time thread state sharing stuff
+    HardwareDeviceConfig::Ptr createConfigFromState();
+    void recreateConfigAndAddToFifo();
+    Fifo<HardwareDeviceConfig::Ptr, 20> configObjectsFifo;
+    ReleasePool<HardwareDeviceConfig> configObjectsReleasePool;
+    HardwareDeviceConfig::Ptr configForRTThread;
+    std::atomic<bool> configNeedsUpdate { false };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HardwareDevice)
 };
 
-struct HardwareDeviceList: public drow::ValueTreeObjectList<HardwareDevice>
+struct HardwareDeviceList: public UUIDIndexedObjectList<HardwareDevice>
 {
     HardwareDeviceList (const juce::ValueTree& v,
                         std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter,
                         std::function<MidiInputDeviceData*(juce::String deviceName)> midiInputDeviceDataGetter)
-    : drow::ValueTreeObjectList<HardwareDevice> (v)
+    : UUIDIndexedObjectList<HardwareDevice> (v)
     {
         getMidiOutputDeviceData = midiOutputDeviceDataGetter;
         getMidiInputDeviceData = midiInputDeviceDataGetter;
         rebuildObjects();
+        rebuildIndex();
+        rebuildNamesIndex();
     }
 
     ~HardwareDeviceList()
@@ -129,17 +189,35 @@ struct HardwareDeviceList: public drow::ValueTreeObjectList<HardwareDevice>
         delete c;
     }
 
-    void newObjectAdded (HardwareDevice*) override    {}
-    void objectRemoved (HardwareDevice*) override     {}
-    void objectOrderChanged() override       {}
+    void newObjectAdded (HardwareDevice* device) override
+    {
+        UUIDIndexedObjectList<HardwareDevice>::newObjectAdded(device);
+        addToNamesIndex(device);
+    }
     
-    HardwareDevice* getObjectWithUUID(const juce::String& uuid) {
-        for (auto* object: objects){
-            if (object->getUUID() == uuid){
-                return object;
-            }
+    void objectRemoved (HardwareDevice* device) override
+    {
+        UUIDIndexedObjectList<HardwareDevice>::objectRemoved(device);
+        rebuildNamesIndex();  // Device names might be shared with other devices, rebuild the whole index (devices are rarely removed)
+    }
+    
+    void objectOrderChanged() override
+    {
+        rebuildNamesIndex();
+    }
+    
+    void valueTreePropertyChanged (juce::ValueTree& tree, const juce::Identifier& property) override
+    {
+        UUIDIndexedObjectList<HardwareDevice>::valueTreePropertyChanged(tree, property);
+        if (isChildTree(tree) && (property == ShepherdIDs::name || property == ShepherdIDs::shortName || property == ShepherdIDs::type)){
+            rebuildNamesIndex();
         }
-        return nullptr;
+    }
+    
+    /** Returns the first device (in list order) of the given type whose name or short name matches, or nullptr. */
+    HardwareDevice* getObjectWithName(const juce::String& name, HardwareDeviceType type) const
+    {
+        return devicesByName[getNamesIndexKey(name, type)];
     }
     
     std::function<MidiOutputDeviceData*(juce::String deviceName)> getMidiOutputDeviceData;
@@ -164,4 +242,30 @@ struct HardwareDeviceList: public drow::ValueTreeObjectList<HardwareDevice>
         }
         return availableHardwareDeviceNames;
     }
+    
+private:
+    static juce::String getNamesIndexKey(const juce::String& name, HardwareDeviceType type)
+    {
+        return juce::String((int)type) + ":" + name;
+    }
+    
+    void addToNamesIndex(HardwareDevice* device)
+    {
+        for (auto name: {device->getShortName(), device->getName()}){
+            auto key = getNamesIndexKey(name, device->getType());
+            if (!devicesByName.contains(key)){
+                devicesByName.set(key, device);
+            }
+        }
+    }
+    
+    void rebuildNamesIndex()
+    {
+        devicesByName.clear();
+        for (auto* device: objects){
+            addToNamesIndex(device);
+        }
+    }
+    
+    juce::HashMap<juce::String, HardwareDevice*> devicesByName;
 };
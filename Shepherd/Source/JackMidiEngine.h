@@ -0,0 +1,232 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "helpers_shepherd.h"
+
+#if USE_JACK_MIDI_ENGINE
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+
+/** Runs the sequencer inside the process callback of a JACK client and reads/writes JACK MIDI ports.
+
+    In this mode the sequencer is not driven by the JUCE audio device callback. Instead, in every JACK period:
+     1) the events of each JACK MIDI input port are copied to the block buffer of the corresponding MidiInputDeviceData
+        using the frame offsets set by JACK as sample positions
+     2) the renderSlice function (Sequencer::getNextMIDISlice) is called with the number of frames of the period
+     3) the buffer of each MidiOutputDeviceData is written to the corresponding JACK MIDI output port with the
+        sample positions as frame offsets
+    This gives sample-accurate MIDI input and output with a latency of one JACK period, and there is no need for
+    MIDI collectors or for the MIDI output dispatcher.
+
+    One JACK MIDI port is registered per MIDI device (named as the device), and it is connected to the first JACK
+    port whose name or alias contains the device name (if any). Ports can also be connected manually
+    (e.g. with "jack_connect" or "a2jmidid").
+*/
+class JackMidiEngine
+{
+public:
+    JackMidiEngine (std::function<void(int)> _renderSlice, std::function<void(int, double)> _prepare)
+        : renderSlice (std::move(_renderSlice)), prepare (std::move(_prepare))
+    {
+    }
+
+    ~JackMidiEngine()
+    {
+        stop();
+    }
+
+    bool start(const juce::String& clientName)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        if (client != nullptr) { return true; }
+
+        jack_status_t status;
+        client = jack_client_open(clientName.toRawUTF8(), JackNoStartServer, &status);
+        if (client == nullptr){
+            DBG("ERROR opening JACK client, is the JACK server running?");
+            return false;
+        }
+        jack_set_process_callback(client, processCallback, this);
+        jack_set_buffer_size_callback(client, bufferSizeCallback, this);
+        jack_set_sample_rate_callback(client, sampleRateCallback, this);
+        prepare((int)jack_get_buffer_size(client), (double)jack_get_sample_rate(client));
+        if (jack_activate(client) != 0){
+            DBG("ERROR activating JACK client");
+            jack_client_close(client);
+            client = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        if (client != nullptr){
+            jack_deactivate(client);
+            jack_client_close(client);
+        }
+        client = nullptr;
+        numInputPorts.store(0);
+        numOutputPorts.store(0);
+    }
+
+    bool isRunning() const { return client != nullptr; }
+
+    //==============================================================================
+
+    bool openOutputPort(MidiOutputDeviceData* deviceData)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        if (client == nullptr) { return false; }
+        int n = numOutputPorts.load();
+        if (n >= (int)outputPorts.size()) { return false; }
+
+        auto port = jack_port_register(client, getPortName(deviceData->name).toRawUTF8(), JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+        if (port == nullptr) { return false; }
+        connectToMatchingPort(port, deviceData->name, JackPortIsInput);
+
+        deviceData->identifier = jack_port_name(port);
+        deviceData->backendPortId = n;
+        outputPorts[n].port = port;
+        outputPorts[n].deviceData = deviceData;
+        numOutputPorts.store(n + 1);  // Publish new port only after it has been fully stored
+        return true;
+    }
+
+    bool openInputPort(MidiInputDeviceData* deviceData)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        if (client == nullptr) { return false; }
+        int n = numInputPorts.load();
+        if (n >= (int)inputPorts.size()) { return false; }
+
+        auto port = jack_port_register(client, getPortName(deviceData->name).toRawUTF8(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+        if (port == nullptr) { return false; }
+        connectToMatchingPort(port, deviceData->name, JackPortIsOutput);
+
+        deviceData->identifier = jack_port_name(port);
+        deviceData->backendPortId = n;
+        inputPorts[n].port = port;
+        inputPorts[n].deviceData = deviceData;
+        numInputPorts.store(n + 1);
+        return true;
+    }
+
+    std::atomic<int> numDroppedOutputEvents = {0};
+
+private:
+    //==============================================================================
+
+    static int processCallback(jack_nframes_t nframes, void* arg)
+    {
+        static_cast<JackMidiEngine*>(arg)->process(nframes);
+        return 0;
+    }
+
+    static int bufferSizeCallback(jack_nframes_t nframes, void* arg)
+    {
+        auto engine = static_cast<JackMidiEngine*>(arg);
+        engine->prepare((int)nframes, (double)jack_get_sample_rate(engine->client));
+        return 0;
+    }
+
+    static int sampleRateCallback(jack_nframes_t sampleRate, void* arg)
+    {
+        auto engine = static_cast<JackMidiEngine*>(arg);
+        engine->prepare((int)jack_get_buffer_size(engine->client), (double)sampleRate);
+        return 0;
+    }
+
+    void process(jack_nframes_t nframes)
+    {
+        // 1) Copy JACK MIDI input events to device buffers
+        int nInputs = numInputPorts.load();
+        for (int i=0; i<nInputs; i++){
+            auto deviceData = inputPorts[i].deviceData;
+            deviceData->blockBuffer.clear();
+            void* portBuffer = jack_port_get_buffer(inputPorts[i].port, nframes);
+            jack_nframes_t numEvents = jack_midi_get_event_count(portBuffer);
+            for (jack_nframes_t j=0; j<numEvents; j++){
+                jack_midi_event_t event;
+                if (jack_midi_event_get(&event, portBuffer, j) == 0){
+                    deviceData->blockBuffer.addEvent(event.buffer, (int)event.size, (int)event.time);
+                }
+            }
+        }
+
+        // 2) Render slice
+        renderSlice((int)nframes);
+
+        // 3) Write device buffers to JACK MIDI output ports
+        int nOutputs = numOutputPorts.load();
+        for (int i=0; i<nOutputs; i++){
+            void* portBuffer = jack_port_get_buffer(outputPorts[i].port, nframes);
+            jack_midi_clear_buffer(portBuffer);
+            for (const auto metadata: outputPorts[i].deviceData->buffer){
+                auto frame = (jack_nframes_t)juce::jlimit(0, (int)nframes - 1, metadata.samplePosition);
+                if (jack_midi_event_write(portBuffer, frame, metadata.data, (size_t)metadata.numBytes) != 0){
+                    numDroppedOutputEvents += 1;
+                }
+            }
+        }
+    }
+
+    juce::String getPortName(const juce::String& deviceName) const
+    {
+        // ':' is used by JACK to separate client and port names
+        return deviceName.replaceCharacter(':', '_').substring(0, jack_port_name_size() - jack_client_name_size() - 1);
+    }
+
+    void connectToMatchingPort(jack_port_t* port, const juce::String& deviceName, unsigned long flags)
+    {
+        const char** candidates = jack_get_ports(client, nullptr, JACK_DEFAULT_MIDI_TYPE, flags);
+        if (candidates == nullptr) { return; }
+        for (int i=0; candidates[i] != nullptr; i++){
+            auto candidate = jack_port_by_name(client, candidates[i]);
+            if (candidate == nullptr || jack_port_is_mine(client, candidate)) { continue; }
+
+            bool matches = juce::String(candidates[i]).contains(deviceName);
+            if (!matches){
+                char* aliases[2];
+                juce::HeapBlock<char> aliasStorage ((size_t)jack_port_name_size() * 2);
+                aliases[0] = aliasStorage.getData();
+                aliases[1] = aliasStorage.getData() + jack_port_name_size();
+                int numAliases = jack_port_get_aliases(candidate, aliases);
+                for (int j=0; j<numAliases; j++){
+                    matches = matches || juce::String(aliases[j]).contains(deviceName);
+                }
+            }
+            if (matches){
+                if (flags & JackPortIsInput){
+                    jack_connect(client, jack_port_name(port), candidates[i]);
+                } else {
+                    jack_connect(client, candidates[i], jack_port_name(port));
+                }
+                break;
+            }
+        }
+        jack_free(candidates);
+    }
+
+    //==============================================================================
+
+    template<typename DeviceDataType>
+    struct Port {
+        jack_port_t* port = nullptr;
+        DeviceDataType* deviceData = nullptr;
+    };
+
+    std::function<void(int)> renderSlice;
+    std::function<void(int, double)> prepare;
+    jack_client_t* client = nullptr;
+    std::array<Port<MidiInputDeviceData>, JACK_MIDI_ENGINE_MAX_PORTS> inputPorts;
+    std::array<Port<MidiOutputDeviceData>, JACK_MIDI_ENGINE_MAX_PORTS> outputPorts;
+    std::atomic<int> numInputPorts = {0};
+    std::atomic<int> numOutputPorts = {0};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (JackMidiEngine)
+};
+
+#endif
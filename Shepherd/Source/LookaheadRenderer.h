@@ -0,0 +1,266 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "helpers_shepherd.h"
+
+
+/** MIDI output rendered for a single slice: one buffer per MIDI output device that has messages in that slice. */
+struct LookaheadSlice
+{
+    struct Entry {
+        MidiOutputDeviceData* deviceData = nullptr;
+        juce::MidiBuffer buffer;
+    };
+
+    LookaheadSlice()
+    {
+        for (auto& entry: entries){
+            entry.buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        }
+    }
+
+    void clear()
+    {
+        numEntries = 0;
+    }
+
+    void add(MidiOutputDeviceData* deviceData, const juce::MidiBuffer& buffer)
+    {
+        if (buffer.isEmpty() || numEntries >= (int)entries.size()) { return; }
+        auto& entry = entries[(size_t)numEntries];
+        entry.deviceData = deviceData;
+        entry.buffer.clear();  // Does not free pre-allocated memory
+        entry.buffer.addEvents(buffer, 0, -1, 0);
+        numEntries += 1;
+    }
+
+    int numEntries = 0;
+    std::array<Entry, LOOKAHEAD_MAX_DEVICES_PER_SLICE> entries;
+};
+
+
+/** Renders the sequencer output ahead of time in a worker thread.
+
+    The worker thread keeps numSlicesAhead slices rendered in a ring of pre-allocated LookaheadSlice objects. The
+    audio (or timing) callback only pops the slice which is due and sends its buffers, so the CPU intensive part
+    of the sequencer runs out of the RT deadline and short scheduling hiccups of the worker are absorbed by the
+    lookahead window.
+
+    As the sequencer state (playheads, clip cues...) can't be rolled back once a slice has been rendered, commands
+    from the controller are applied by the worker at its rendering position (i.e. with up to numSlicesAhead slices
+    of latency). Clip and scene launches are quantized to the next bar after that position, so they don't change
+    slices which have already been rendered. For commands which take effect immediately (e.g. stopping the
+    transport), the pending slices can be discarded: the next slice is rendered by the RT thread (which applies the
+    command right away) while the worker refills the lookahead window after it. Only note offs and messages which
+    stop playback (e.g. MIDI stop) of the discarded slices are sent, so that no notes hang. As the state is not
+    rolled back, the sequencer continues from the position where the worker stopped, so this is only meant for
+    commands which stop playback.
+
+    MIDI input can't be rendered ahead of time. While some track needs it (input monitoring or recording), the
+    renderer can be suspended: the worker stops rendering and, once the slices already rendered have been emitted,
+    shouldRenderInRTThread returns true so that the RT thread renders the slices itself until the renderer is
+    resumed. The RT thread also renders the slices which are due when the worker has not rendered them and is not
+    rendering at the moment (e.g. after resuming or discarding slices). Switching between the worker and the RT
+    thread is decided by the RT thread so that both never render at the same time.
+*/
+class LookaheadRenderer: private juce::Thread
+{
+public:
+    LookaheadRenderer (std::function<bool(LookaheadSlice&)> _renderSlice)
+        : juce::Thread ("LookaheadRenderer"), renderSlice (std::move(_renderSlice))
+    {
+        filteredBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    }
+
+    ~LookaheadRenderer()
+    {
+        stop();
+    }
+
+    /** Starts the worker thread discarding any previously rendered slices. Must not be called while the RT thread
+        is running (e.g. call it from prepareToPlay). */
+    void start(int _numSlicesAhead)
+    {
+        stop();
+        fifo.reset();
+        renderingInRTThread = false;
+        discardRequested.store(false);
+        discardPending = false;
+        workerMayRender.store(true);
+        numSlicesAhead = juce::jlimit(1, (int)slices.size() - 1, _numSlicesAhead);
+        startThread(8);
+    }
+
+    void stop()
+    {
+        stopThread(1000);
+    }
+
+    int getNumSlicesAhead() const { return numSlicesAhead; }
+
+    /** Called from the message thread to stop/resume rendering slices in the worker thread (see class docs). */
+    void setSuspended(bool shouldBeSuspended)
+    {
+        suspendRequested.store(shouldBeSuspended);
+    }
+
+    /** Called from the message thread to discard the slices rendered ahead (see class docs). */
+    void discardPendingSlices()
+    {
+        discardRequested.store(true);
+    }
+
+    /** Called from the RT thread at the start of every slice. Returns true if the RT thread should render the slice
+        itself (and then call finishedRenderingInRTThread) instead of calling emitNextSlice. If the pending slices
+        were discarded, calls sendBuffer(deviceData, buffer) with the messages of these slices which must be sent. */
+    template<typename Function>
+    bool shouldRenderInRTThread(Function&& sendBuffer)
+    {
+        bool suspended = suspendRequested.load();
+        if (discardRequested.exchange(false)){
+            discardPending = true;
+        }
+
+        if (renderingInRTThread){
+            // The worker is stopped and all the slices it rendered were emitted, so there is nothing to discard
+            discardPending = false;
+            if (suspended){
+                return true;
+            }
+            // The worker continues rendering from the state left by the RT thread
+            renderingInRTThread = false;
+        } else if (suspended || discardPending){
+            // Stop the worker and wait until it is not rendering (slices it already rendered are emitted meanwhile)
+            workerMayRender.store(false);
+            if (workerIsRendering.load()){
+                return false;
+            }
+            if (discardPending){
+                discardRenderedSlices(sendBuffer);
+                discardPending = false;
+            }
+            if (suspended){
+                // Take over once all the slices rendered by the worker were emitted
+                renderingInRTThread = fifo.getNumReady() == 0;
+                return renderingInRTThread;
+            }
+        }
+
+        // Render the slice here if the worker has not rendered it and is not rendering at the moment, otherwise
+        // emitNextSlice reports an underrun if the worker does not finish it in time
+        if (fifo.getNumReady() > 0){
+            workerMayRender.store(true);
+            return false;
+        }
+        workerMayRender.store(false);
+        if (workerIsRendering.load() || fifo.getNumReady() > 0){
+            workerMayRender.store(true);
+            return false;
+        }
+        return true;
+    }
+
+    /** Called from the RT thread after rendering a slice when shouldRenderInRTThread returned true. */
+    void finishedRenderingInRTThread()
+    {
+        if (!renderingInRTThread){
+            // Let the worker (re)fill the lookahead window from the state left by the RT thread
+            workerMayRender.store(true);
+        }
+    }
+
+    /** Called from the RT thread. Pops the next rendered slice (if any) and calls sendBuffer(deviceData, buffer)
+        for each of its buffers. Returns false if no slice was ready (lookahead underrun). */
+    template<typename Function>
+    bool emitNextSlice(Function&& sendBuffer)
+    {
+        auto read = fifo.read(1);
+        if (read.blockSize1 == 0){
+            numUnderruns += 1;
+            return false;
+        }
+
+        auto& slice = slices[(size_t)read.startIndex1];
+        for (int i=0; i<slice.numEntries; i++){
+            auto& entry = slice.entries[(size_t)i];
+            sendBuffer(entry.deviceData, entry.buffer);
+        }
+        return true;
+    }
+
+    std::atomic<int> numUnderruns = {0};
+
+private:
+    /** Discards all the slices rendered by the worker, only sending the messages which could otherwise leave notes
+        hanging or playback running (the command which stops playback may have been applied in one of them). Called
+        from the RT thread while the worker is not rendering. */
+    template<typename Function>
+    void discardRenderedSlices(Function&& sendBuffer)
+    {
+        auto read = fifo.read(fifo.getNumReady());
+        read.forEach([this, &sendBuffer](int index){
+            auto& slice = slices[(size_t)index];
+            for (int i=0; i<slice.numEntries; i++){
+                auto& entry = slice.entries[(size_t)i];
+                filteredBuffer.clear();
+                for (const auto metadata: entry.buffer){
+                    auto msg = metadata.getMessage();
+                    if (msg.isNoteOff() || msg.isAllNotesOff() || msg.isAllSoundOff() || msg.isMidiStop()){
+                        filteredBuffer.addEvent(msg, 0);
+                    }
+                }
+                if (!filteredBuffer.isEmpty()){
+                    sendBuffer(entry.deviceData, filteredBuffer);
+                }
+            }
+        });
+    }
+
+    void run() override
+    {
+        // NOTE: the RT thread does not notify the worker when slices are emitted (that could block the RT thread), the
+        // worker polls every LOOKAHEAD_WORKER_MAX_WAIT_MS instead
+        while (!threadShouldExit()){
+            while (fifo.getNumReady() < numSlicesAhead && !threadShouldExit()){
+                int start1, size1, start2, size2;
+                fifo.prepareToWrite(1, start1, size1, start2, size2);
+                if (size1 == 0) { break; }
+                // workerIsRendering must be set before checking workerMayRender (see shouldRenderInRTThread)
+                workerIsRendering.store(true);
+                if (!workerMayRender.load()){
+                    workerIsRendering.store(false);
+                    break;
+                }
+                auto& slice = slices[(size_t)start1];
+                slice.clear();
+                bool rendered = renderSlice(slice);
+                if (rendered){
+                    fifo.finishedWrite(1);
+                }
+                workerIsRendering.store(false);
+                if (!rendered) { break; }  // Sequencer not ready to render
+            }
+            wait(LOOKAHEAD_WORKER_MAX_WAIT_MS);
+        }
+    }
+
+    std::function<bool(LookaheadSlice&)> renderSlice;
+    int numSlicesAhead = 1;
+
+    // Suspension (see shouldRenderInRTThread)
+    std::atomic<bool> suspendRequested = {false};  // Set from the message thread
+    std::atomic<bool> workerMayRender = {true};  // Set from the RT thread
+    std::atomic<bool> workerIsRendering = {false};  // Set from the worker thread
+    bool renderingInRTThread = false;  // Only accessed from the RT thread
+
+    // Discarding slices (see discardPendingSlices)
+    std::atomic<bool> discardRequested = {false};  // Set from the message thread
+    bool discardPending = false;  // Only accessed from the RT thread
+
+    juce::AbstractFifo fifo { LOOKAHEAD_MAX_SLICES };
+    std::array<LookaheadSlice, LOOKAHEAD_MAX_SLICES> slices;
+
+    juce::MidiBuffer filteredBuffer;  // Only accessed from the RT thread
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LookaheadRenderer)
+};
@@ -28,8 +28,13 @@ public:
         int numInputChannels = 0;
         int numOutputChannels = 2;
         
+        if (!sequencer.shouldUseAudioDevice())
+        {
+            // Sequencer is driven by another engine (JACK or the MIDI-only engine), don't open an audio device
+            std::cout << "Sequencer driven by external engine, not opening audio device" << std::endl;
+        }
         // Some platforms require permissions to open input channels so request that here
-        if (juce::RuntimePermissions::isRequired (juce::RuntimePermissions::recordAudio)
+        else if (juce::RuntimePermissions::isRequired (juce::RuntimePermissions::recordAudio)
             && ! juce::RuntimePermissions::isGranted (juce::RuntimePermissions::recordAudio))
         {
             juce::RuntimePermissions::request (juce::RuntimePermissions::recordAudio,
@@ -92,15 +97,14 @@ public:
         sequencer.getNextMIDISlice(sliceNumSamples);
         
         #if JUCE_DEBUG
-        // All buffers are combined into a single buffer which is then sent to the synth
-        internalSynthCombinedBuffer.clear();
-        for (auto deviceData: *sequencer.getMidiOutDevices()){
-            if (deviceData != nullptr){
-                internalSynthCombinedBuffer.addEvents(deviceData->buffer, 0, sliceNumSamples, 0);
-            }
-        }
-        
         if (sequencer.shouldRenderWithInternalSynth()){
+            // All buffers are combined into a single buffer which is then sent to the synth
+            internalSynthCombinedBuffer.clear();
+            for (auto deviceData: *sequencer.getMidiOutDevices()){
+                if (deviceData != nullptr){
+                    internalSynthCombinedBuffer.addEvents(deviceData->buffer, 0, sliceNumSamples, 0);
+                }
+            }
             sineSynth.renderNextBlock (*bufferToFill.buffer, internalSynthCombinedBuffer, bufferToFill.startSample, sliceNumSamples);
         }
         #endif
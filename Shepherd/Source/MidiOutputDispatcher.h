@@ -0,0 +1,112 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "helpers_shepherd.h"
+
+
+/** High priority thread that does the actual (potentially blocking) writes to the MIDI output devices.
+
+    The RT thread never writes to MIDI devices directly. Instead, at the end of every slice it pushes the
+    contents of the device buffers to the per-device MidiBufferFifo and sets a flag which the dispatcher polls
+    (with a short timed wait), so the RT thread never takes locks to wake it up. The dispatcher then pulls the
+    buffers and sends them to the devices. If a device is slow (or hangs), only that device's queue
+    fills up, and further buffers for that device are dropped (and counted) instead of stalling the audio thread.
+
+    MidiOutputDeviceData objects must be registered from the message thread using addDevice. Registered devices
+    must outlive the dispatcher (or the dispatcher must be stopped before they are deleted).
+*/
+class MidiOutputDispatcher: public juce::Thread
+{
+public:
+    MidiOutputDispatcher(): juce::Thread ("MidiOutputDispatcher")
+    {
+    }
+
+    ~MidiOutputDispatcher()
+    {
+        stopThread(1000);
+    }
+
+    void addDevice(MidiOutputDeviceData* deviceData)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        if (deviceData == nullptr) { return; }
+        int n = numDevices.load();
+        for (int i=0; i<n; i++){
+            if (devices[i].load() == deviceData) { return; }  // Already registered
+        }
+        if (n >= (int)devices.size()){
+            DBG("WARNING, can't register more MIDI output devices in the MIDI output dispatcher");
+            return;
+        }
+        devices[n].store(deviceData);
+        numDevices.store(n + 1);  // Publish new device only after its pointer has been stored
+    }
+
+    /** Called from the RT thread. Copies the contents of the device buffer to the device's output queue.
+        startTimeMs < 0 means that messages should be sent immediately, otherwise they will be scheduled
+        according to their sample position. */
+    bool enqueue(MidiOutputDeviceData* deviceData, double startTimeMs, double sampleRate)
+    {
+        return enqueue(deviceData, deviceData->buffer, startTimeMs, sampleRate);
+    }
+
+    /** Same as above but enqueues the given buffer instead of the device buffer (e.g. a buffer rendered ahead of time). */
+    bool enqueue(MidiOutputDeviceData* deviceData, const juce::MidiBuffer& buffer, double startTimeMs, double sampleRate)
+    {
+        if (buffer.isEmpty()) { return true; }
+        bool added = deviceData->outputQueue.push(buffer, startTimeMs, sampleRate);
+        if (added){
+            int depth = deviceData->outputQueue.getNumAvailableForReading();
+            if (depth > deviceData->maxQueueDepth.load()){
+                deviceData->maxQueueDepth.store(depth);
+            }
+            pendingBuffers = true;
+        } else {
+            deviceData->numDroppedBuffers += 1;
+        }
+        return added;
+    }
+
+    /** Called from the RT thread once all devices for the current slice have been enqueued. Only sets an atomic
+        flag (signalling a juce::WaitableEvent would lock a mutex). */
+    void notify()
+    {
+        if (pendingBuffers){
+            pendingBuffers = false;
+            buffersAvailable.store(true, std::memory_order_release);
+        }
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit()){
+            if (!buffersAvailable.exchange(false, std::memory_order_acquire)){
+                wait(MIDI_OUTPUT_DISPATCHER_POLL_INTERVAL_MS);
+                continue;
+            }
+            int n = numDevices.load();
+            for (int i=0; i<n; i++){
+                auto deviceData = devices[i].load();
+                if (deviceData->backend == nullptr && deviceData->device == nullptr) { continue; }
+                while (deviceData->outputQueue.pull([deviceData](MidiBufferFifo<MIDI_OUTPUT_QUEUE_SIZE>::Slot& slot){
+                    if (deviceData->backend != nullptr){
+                        deviceData->backend->sendBlockOfMessages(*deviceData, slot.buffer, slot.startTimeMs, slot.sampleRate);
+                    } else if (slot.startTimeMs < 0.0){
+                        deviceData->device->sendBlockOfMessagesNow(slot.buffer);
+                    } else {
+                        deviceData->device->sendBlockOfMessages(slot.buffer, slot.startTimeMs, slot.sampleRate);
+                    }
+                }));
+            }
+        }
+    }
+
+private:
+    std::array<std::atomic<MidiOutputDeviceData*>, MIDI_OUTPUT_DISPATCHER_MAX_DEVICES> devices {};
+    std::atomic<int> numDevices { 0 };
+    bool pendingBuffers = false;  // Only accessed from the RT thread
+    std::atomic<bool> buffersAvailable { false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiOutputDispatcher)
+};
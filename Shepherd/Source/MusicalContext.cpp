@@ -23,6 +23,8 @@ void MusicalContext::bindState()
     // For variables that have a "state" version and a non-cached version, also assign the non-cached one so it is loaded from state
     statePlayheadPositionInBeats.referTo(state, ShepherdIDs::playheadPositionInBeats, nullptr, ShepherdDefaults::playheadPosition);
     playheadPositionInBeats = statePlayheadPositionInBeats;
+    statePlayheadPositionTimeMs.referTo(state, ShepherdIDs::playheadPositionTimeMs, nullptr, 0);
+    statePlayheadBpm.referTo(state, ShepherdIDs::playheadBpm, nullptr, 0.0);
     stateIsPlaying.referTo(state, ShepherdIDs::playing, nullptr, ShepherdDefaults::playing);
     isPlaying = stateIsPlaying;
     stateDoingCountIn.referTo(state, ShepherdIDs::doingCountIn, nullptr, ShepherdDefaults::doingCountIn);
@@ -40,12 +42,20 @@ void MusicalContext::bindState()
 void MusicalContext::updateStateMemberVersions()
 {
     // Updates all the stateX versions of the members so that their status gets reflected in the state
-    if (statePlayheadPositionInBeats != playheadPositionInBeats){
-        statePlayheadPositionInBeats = playheadPositionInBeats;
-    }
     if (stateIsPlaying != isPlaying){
         stateIsPlaying = isPlaying;
     }
+    
+    // Playhead position is not written every time, only when a new anchor is needed (see PlayheadAnchor). Global
+    // playhead does not loop.
+    const auto nowMs = juce::Time::currentTimeMillis();
+    const double anchorBpm = isPlaying ? bpm.get() : 0.0;
+    if (playheadAnchor.needsUpdate(playheadPositionInBeats, nowMs, anchorBpm, 0.0)){
+        playheadAnchor = {playheadPositionInBeats, nowMs, anchorBpm, 0.0};
+        statePlayheadPositionTimeMs = nowMs;
+        statePlayheadBpm = anchorBpm;
+        statePlayheadPositionInBeats = playheadPositionInBeats;
+    }
     if (stateDoingCountIn != doingCountIn){
         stateDoingCountIn = doingCountIn;
     }
@@ -12,6 +12,7 @@
 
 #include <JuceHeader.h>
 #include "helpers_shepherd.h"
+#include "Playhead.h"
 
 
 class MusicalContext
@@ -68,7 +69,10 @@ private:
     double countInPlayheadPositionInBeats = ShepherdDefaults::playheadPosition;
     int barCount = ShepherdDefaults::barCount;
     
-    juce::CachedValue<double> statePlayheadPositionInBeats;
+    PlayheadAnchor playheadAnchor;
+    juce::CachedValue<double> statePlayheadPositionInBeats;  // Only updated when a new anchor is published
+    juce::CachedValue<juce::int64> statePlayheadPositionTimeMs;
+    juce::CachedValue<double> statePlayheadBpm;
     juce::CachedValue<bool> stateIsPlaying;
     juce::CachedValue<bool> stateDoingCountIn;
     juce::CachedValue<double> stateCountInPlayheadPositionInBeats;
@@ -10,6 +10,34 @@
 
 #include "Playhead.h"
 
+double PlayheadAnchor::extrapolate(juce::int64 nowMs) const
+{
+    double position = positionInBeats + (double)(nowMs - timeMs) * bpm / 60000.0;
+    if (loopLengthInBeats > 0.0){
+        position = std::fmod(position, loopLengthInBeats);
+    }
+    return position;
+}
+
+bool PlayheadAnchor::needsUpdate(double actualPositionInBeats, juce::int64 nowMs, double currentBpm, double currentLoopLengthInBeats) const
+{
+    if (timeMs == 0 || currentBpm != bpm || currentLoopLengthInBeats != loopLengthInBeats){
+        return true;
+    }
+    double errorInBeats = actualPositionInBeats - extrapolate(nowMs);
+    if (loopLengthInBeats > 0.0){
+        // Positions right before and after the loop point are close to each other
+        errorInBeats = std::remainder(errorInBeats, loopLengthInBeats);
+    }
+    if (bpm == 0.0){
+        // Stopped playhead only needs a new anchor if its position changed (e.g. it was reset)
+        return errorInBeats != 0.0;
+    }
+    return std::abs(errorInBeats) * 60000.0 / bpm > PLAYHEAD_ANCHOR_TOLERANCE_MS;
+}
+
+//==============================================================================
+
 Playhead::Playhead(const juce::ValueTree& _state,
                    std::function<juce::Range<double>()> parentSliceGetter,
                    std::function<double()> localSliceLengthGetter
@@ -26,9 +54,11 @@ void Playhead::bindState()
     stateWillPlayAt.referTo(state, ShepherdIDs::willPlayAt, nullptr, ShepherdDefaults::willPlayAt);
     stateWillStopAt.referTo(state, ShepherdIDs::willStopAt, nullptr, ShepherdDefaults::willStopAt);
     statePlayheadPositionInBeats.referTo(state, ShepherdIDs::playheadPositionInBeats, nullptr, ShepherdDefaults::playheadPosition);
+    statePlayheadPositionTimeMs.referTo(state, ShepherdIDs::playheadPositionTimeMs, nullptr, 0);
+    statePlayheadBpm.referTo(state, ShepherdIDs::playheadBpm, nullptr, 0.0);
 }
 
-void Playhead::updateStateMemberVersions()
+void Playhead::updateStateMemberVersions(double bpm, double loopLengthInBeats)
 {
     // Updates all the stateX versions of the members so that their status gets reflected in the state
     if (statePlaying != playing){
@@ -40,7 +70,14 @@ void Playhead::updateStateMemberVersions()
     if (stateWillStopAt != willStopAt){
         stateWillStopAt = willStopAt;
     }
-    if (statePlayheadPositionInBeats != playheadPositionInBeats){
+    
+    // Playhead position is not written every time, only when a new anchor is needed (see PlayheadAnchor)
+    const auto nowMs = juce::Time::currentTimeMillis();
+    const double anchorBpm = playing ? bpm : 0.0;
+    if (anchor.needsUpdate(playheadPositionInBeats, nowMs, anchorBpm, loopLengthInBeats)){
+        anchor = {playheadPositionInBeats, nowMs, anchorBpm, loopLengthInBeats};
+        statePlayheadPositionTimeMs = nowMs;
+        statePlayheadBpm = anchorBpm;
         statePlayheadPositionInBeats = playheadPositionInBeats;
     }
 }
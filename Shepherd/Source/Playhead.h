@@ -13,6 +13,26 @@
 #include <JuceHeader.h>
 #include "helpers_shepherd.h"
 
+
+/** Transport anchor published in the state instead of streaming playhead positions: the controller extrapolates the
+    current position from the position at the given time, advancing at the given bpm (0 when stopped) and wrapping
+    around the loop length (if not 0). A new anchor is only published when extrapolating from the current one drifts
+    more than PLAYHEAD_ANCHOR_TOLERANCE_MS from the actual position, or when bpm or loop length change.
+    NOTE: times are wall-clock milliseconds since epoch (juce::Time::currentTimeMillis), so controllers running in a
+    different machine need to account for the clock offset (or re-anchor with ACTION_ADDRESS_PLAYHEADS messages).
+*/
+struct PlayheadAnchor
+{
+    double positionInBeats = ShepherdDefaults::playheadPosition;
+    juce::int64 timeMs = 0;  // 0 means no anchor has been published yet
+    double bpm = 0.0;
+    double loopLengthInBeats = 0.0;
+    
+    double extrapolate(juce::int64 nowMs) const;
+    bool needsUpdate(double actualPositionInBeats, juce::int64 nowMs, double currentBpm, double currentLoopLengthInBeats) const;
+};
+
+
 class Playhead
 {
 public:
@@ -20,7 +40,7 @@ public:
              std::function<juce::Range<double>()> parentSliceGetter,
              std::function<double()> localSliceLengthGetter);
     void bindState();
-    void updateStateMemberVersions();
+    void updateStateMemberVersions(double bpm, double loopLengthInBeats);
     juce::ValueTree state;
 
     void playNow();
@@ -55,7 +75,10 @@ private:
     double willPlayAt = ShepherdDefaults::willPlayAt;
     double willStopAt = ShepherdDefaults::willStopAt;
     
-    juce::CachedValue<double> statePlayheadPositionInBeats;  // Used only so that current position is somehow stored in the state
+    PlayheadAnchor anchor;
+    juce::CachedValue<double> statePlayheadPositionInBeats;  // Only updated when a new anchor is published
+    juce::CachedValue<juce::int64> statePlayheadPositionTimeMs;
+    juce::CachedValue<double> statePlayheadBpm;
     juce::CachedValue<bool> statePlaying;
     juce::CachedValue<double> stateWillPlayAt;
     juce::CachedValue<double> stateWillStopAt;
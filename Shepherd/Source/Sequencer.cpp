@@ -34,21 +34,85 @@ Sequencer::Sequencer()
     midiTransportMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
     midiMetronomeMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
     pushMidiClockMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
-    monitoringNotesMidiBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
 
     // Init hardware devices
     initializeHardwareDevices();
 
     // Load some settings from file
+    int subSliceSetting = getIntPropertyFromSettingsFile("subSliceNumSamples");
+    if (subSliceSetting > 0){
+        samplesPerSubSlice = subSliceSetting;
+    }
+    lookaheadMs = getStringPropertyFromSettingsFile("lookaheadMs").getDoubleValue();
+    #if USE_TRACK_WORKER_POOL
+    int numTrackWorkerThreads = getIntPropertyFromSettingsFile("trackWorkerThreads");
+    if (numTrackWorkerThreads > 0){
+        // Tracks will be processed in parallel by these threads (and the thread calling getNextMIDISlice)
+        trackWorkerPool = std::make_unique<RTWorkerPool>();
+        trackWorkerPool->start(juce::jmin(numTrackWorkerThreads, TRACK_WORKER_POOL_MAX_THREADS), TRACK_WORKER_POOL_RT_PRIORITY);
+    }
+    #endif
     sendMidiClockMidiDeviceNames = getListStringPropertyFromSettingsFile("midiDevicesToSendClockTo");
     sendMidiTransportMidiDeviceNames = getListStringPropertyFromSettingsFile("midiDevicesToSendTransportTo");
     sendMetronomeMidiDeviceName = getStringPropertyFromSettingsFile("metronomeMidiDevice");
+    midiOutputSchedulingEnabled = getStringPropertyFromSettingsFile("midiOutputScheduling") == "scheduled";
+    int stateUpdatesFlushIntervalSetting = getIntPropertyFromSettingsFile("stateUpdatesFlushIntervalMs");
+    stateUpdateJournal.setFlushInterval(stateUpdatesFlushIntervalSetting > 0 ? stateUpdatesFlushIntervalSetting : STATE_UPDATES_DEFAULT_FLUSH_INTERVAL_MS);
+    int latencySetting = getIntPropertyFromSettingsFile("midiOutputSchedulingLatencyMs");
+    if (latencySetting > 0){
+        midiOutputSchedulingLatencyMs = latencySetting;
+    }
+    #if USE_ALSA_SEQ_MIDI_BACKEND
+    if (getStringPropertyFromSettingsFile("midiBackend") == "alsa"){
+        alsaSequencerMidiBackend = std::make_unique<AlsaSequencerMidiBackend>();
+        if (alsaSequencerMidiBackend->open("Shepherd")){
+            // With the ALSA backend, output events are always scheduled on the ALSA queue
+            midiOutputSchedulingEnabled = true;
+        } else {
+            std::cout << "- ERROR opening ALSA sequencer, using default MIDI backend" << std::endl;
+            alsaSequencerMidiBackend = nullptr;
+        }
+    }
+    #endif
+    #if USE_JACK_MIDI_ENGINE
+    if (getStringPropertyFromSettingsFile("midiBackend") == "jack"){
+        jackMidiEngine = std::make_unique<JackMidiEngine>([this](int sliceNumSamples){ getNextMIDISlice(sliceNumSamples); },
+                                                          [this](int samplesPerBlockExpected, double _sampleRate){ prepareSequencer(samplesPerBlockExpected, _sampleRate); });
+        if (jackMidiEngine->start("Shepherd")){
+            // getNextMIDISlice will be called from the JACK process callback, which also reads/writes MIDI device buffers
+            midiDeviceBuffersHandledExternally = true;
+            useAudioDevice = false;
+        } else {
+            std::cout << "- ERROR starting JACK client, using default MIDI backend" << std::endl;
+            jackMidiEngine = nullptr;
+        }
+    }
+    #endif
+    #if USE_MIDI_ONLY_ENGINE
+    if (useAudioDevice && getStringPropertyFromSettingsFile("engine") == "midiOnly"){
+        // No audio device will be opened, getNextMIDISlice will be called from the MIDI-only engine thread (started below)
+        midiOnlyEngine = std::make_unique<MidiOnlyEngine>([this](int sliceNumSamples){ getNextMIDISlice(sliceNumSamples); },
+                                                          [this](int samplesPerBlockExpected, double _sampleRate){ prepareSequencer(samplesPerBlockExpected, _sampleRate); });
+        useAudioDevice = false;
+    }
+    #endif
+    if (lookaheadMs > 0.0 && !midiDeviceBuffersHandledExternally){
+        // Slices will be rendered ahead of time in a worker thread, getNextMIDISlice will only send the slice which is due
+        // NOTE: lookahead is not used with the JACK engine as it writes the device buffers right after getNextMIDISlice returns
+        lookaheadRenderer = std::make_unique<LookaheadRenderer>([this](LookaheadSlice& slice){ return renderLookaheadSlice(slice); });
+        discardedMidiInputMessages.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    }
     
     // Init MIDI
     // Better to do it after hardware devices so we init devices needed in hardware devices as well
     initializeMIDIInputs();
     initializeMIDIOutputs();
-    notesMonitoringMidiOutput = juce::MidiOutput::createNewDevice(SHEPHERD_NOTES_MONITORING_MIDI_DEVICE_NAME);
+    notesMonitoringMidiOutput = std::make_unique<MidiOutputDeviceData>();
+    notesMonitoringMidiOutput->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    notesMonitoringMidiOutput->name = SHEPHERD_NOTES_MONITORING_MIDI_DEVICE_NAME;
+    notesMonitoringMidiOutput->device = juce::MidiOutput::createNewDevice(SHEPHERD_NOTES_MONITORING_MIDI_DEVICE_NAME);
+    midiOutputDispatcher.addDevice(notesMonitoringMidiOutput.get());
+    midiOutputDispatcher.startThread(9);
     
     // Init WebSockets
     initializeWS();
@@ -57,10 +121,46 @@ Sequencer::Sequencer()
     loadSessionFromFile("0");
 
     sequencerInitialized = true;
+    
+    #if USE_MIDI_ONLY_ENGINE
+    if (midiOnlyEngine != nullptr){
+        double periodMs = getStringPropertyFromSettingsFile("midiOnlyEnginePeriodMs").getDoubleValue();
+        if (periodMs <= 0.0){
+            periodMs = MIDI_ONLY_ENGINE_DEFAULT_PERIOD_MS;
+        }
+        midiOnlyEngine->start(periodMs, MIDI_ONLY_ENGINE_NOMINAL_SAMPLE_RATE, MIDI_ONLY_ENGINE_RT_PRIORITY);
+        std::cout << "Started MIDI-only engine with period " << midiOnlyEngine->getPeriodMs() << "ms (" << midiOnlyEngine->getSamplesPerSlice() << " samples per slice)" << std::endl;
+    }
+    #endif
 }
 
 Sequencer::~Sequencer()
 {
+    if (lookaheadRenderer != nullptr){
+        lookaheadRenderer->stop();
+    }
+    #if USE_MIDI_ONLY_ENGINE
+    if (midiOnlyEngine != nullptr){
+        midiOnlyEngine->stop();
+    }
+    #endif
+    #if USE_JACK_MIDI_ENGINE
+    if (jackMidiEngine != nullptr){
+        jackMidiEngine->stop();
+    }
+    #endif
+    #if USE_TRACK_WORKER_POOL
+    if (trackWorkerPool != nullptr){
+        trackWorkerPool->stop();
+    }
+    #endif
+    midiOutputDispatcher.stopThread(1000);
+    #if USE_ALSA_SEQ_MIDI_BACKEND
+    if (alsaSequencerMidiBackend != nullptr){
+        alsaSequencerMidiBackend->close();
+    }
+    #endif
+    
     #if USE_WS_SERVER
     if (wsServer.serverPtr != nullptr){
         wsServer.serverPtr->stop();
@@ -102,14 +202,18 @@ void Sequencer::saveCurrentSessionToFile(juce::String filePath)
     // play/recording state and other things which are "voaltile"
     juce::ValueTree savedState = state.getChildWithName(ShepherdIDs::SESSION).createCopy();
     savedState.setProperty (ShepherdIDs::playheadPositionInBeats, ShepherdDefaults::playheadPosition, nullptr);
+    savedState.removeProperty (ShepherdIDs::playheadPositionTimeMs, nullptr);  // Playhead anchors are re-published when loading
+    savedState.removeProperty (ShepherdIDs::playheadBpm, nullptr);
     savedState.setProperty (ShepherdIDs::playing, ShepherdDefaults::playing, nullptr);
     savedState.setProperty (ShepherdIDs::doingCountIn, ShepherdDefaults::doingCountIn, nullptr);
     savedState.setProperty (ShepherdIDs::countInPlayheadPositionInBeats, ShepherdDefaults::playheadPosition, nullptr);
     savedState.setProperty (ShepherdIDs::barCount, ShepherdDefaults::barCount, nullptr);
     for (auto t: savedState) {
         if (t.hasType(ShepherdIDs::TRACK)) {
+            t.removeProperty (ShepherdIDs::handle, nullptr);  // Handles are session-scoped, re-assigned when loading
             for (auto c: t) {
                 if (c.hasType(ShepherdIDs::CLIP)) {
+                    c.removeProperty (ShepherdIDs::handle, nullptr);
                     c.setProperty (ShepherdIDs::recording, ShepherdDefaults::recording, nullptr);
                     c.setProperty (ShepherdIDs::willStartRecordingAt, ShepherdDefaults::willStartRecordingAt, nullptr);
                     c.setProperty (ShepherdIDs::willStopRecordingAt, ShepherdDefaults::willStopRecordingAt, nullptr);
@@ -117,9 +221,11 @@ void Sequencer::saveCurrentSessionToFile(juce::String filePath)
                     c.setProperty (ShepherdIDs::willPlayAt, ShepherdDefaults::willPlayAt, nullptr);
                     c.setProperty (ShepherdIDs::willStopAt, ShepherdDefaults::willStopAt, nullptr);
                     c.setProperty (ShepherdIDs::playheadPositionInBeats, ShepherdDefaults::playheadPosition, nullptr);
+                    c.removeProperty (ShepherdIDs::playheadPositionTimeMs, nullptr);
+                    c.removeProperty (ShepherdIDs::playheadBpm, nullptr);
                     for (auto se: c) {
                         if (se.hasType(ShepherdIDs::SEQUENCE_EVENT)) {
-                            // Do nothing...
+                            se.removeProperty (ShepherdIDs::handle, nullptr);
                         }
                     }
                 }
@@ -201,13 +307,23 @@ void Sequencer::loadSession(juce::ValueTree& stateToLoad)
         if (sequencerInitialized){
             // If sequencer is playing, first stop playback (give some sleep time so
             // the RT thread has time to be executed and clips set to stop (with note offs sent)
-            if (musicalContext->playheadIsPlaying()){ shouldToggleIsPlaying = true; }
+            if (musicalContext->playheadIsPlaying()){
+                SequencerCommand command;
+                command.type = SequencerCommand::Type::transportStop;
+                enqueueCommand(command);
+            }
             juce::Time::waitForMillisecondCounter(juce::Time::getMillisecondCounter() + 50);
 
             // Remove current state VT listener
             state.removeListener(this);
         }
         
+        // Assign handles to the objects of the new session. Handles are session-scoped, so counters start again
+        nextTrackHandle = 0;
+        nextClipHandle = 0;
+        nextSequenceEventHandle = 0;
+        assignHandles(stateToLoad);
+        
         // Remove current session state and assign new one
         if (state.getChildWithName(ShepherdIDs::SESSION).isValid()){
             state.removeChild(state.getChildWithName(ShepherdIDs::SESSION), nullptr);
@@ -243,6 +359,7 @@ void Sequencer::loadSession(juce::ValueTree& stateToLoad)
                                              });
         
         // Send message to frontend indiating that Shepherd is ready to rock
+        stateUpdateJournal.flush();  // Updates of the previous session should be received before this message
         sendMessageToController(juce::OSCMessage(ACTION_ADDRESS_STARTED_MESSAGE));  // For new state synchroniser
     } else {
         DBG("ERROR: Could not load session data as it is incompatible or it has inconsistencies...");
@@ -338,7 +455,7 @@ std::vector<juce::String> Sequencer::getListStringPropertyFromSettingsFile(juce:
     return returnValue;
 }
 
-juce::String Sequencer::serliaizeOSCMessage(const juce::OSCMessage& message)
+juce::String Sequencer::serliaizeOSCMessage(const juce::OSCMessage& message, const juce::ValueTree& attachedTree)
 {
     juce::String actionName = message.getAddressPattern().toString();
     juce::StringArray actionParameters = {};
@@ -351,36 +468,538 @@ juce::String Sequencer::serliaizeOSCMessage(const juce::OSCMessage& message)
             actionParameters.add((juce::String)message[i].getFloat32());
         }
     }
+    if (attachedTree.isValid()){
+        actionParameters.add(attachedTree.toXmlString(juce::XmlElement::TextFormat().singleLine()));
+    }
     juce::String serializedParameters = actionParameters.joinIntoString(SERIALIZATION_SEPARATOR);
     juce::String actionMessage = actionName + ":" + serializedParameters;
     return actionMessage;
 }
 
-void Sequencer::sendWSMessage(const juce::OSCMessage& message) {
+std::string Sequencer::serializeOSCMessageToBinary(const juce::OSCMessage& message, const juce::ValueTree& attachedTree)
+{
+    // Binary protocol: each WebSockets binary frame contains a single MessagePack array with the address followed by
+    // the parameters with their types (so no separators need to be escaped or split). Trees are sent as binary data
+    // in the format of juce::ValueTree::writeToStream instead of XML
+    auto address = message.getAddressPattern().toString();
+    MessagePack::Writer writer;
+    writer.writeArrayHeader((juce::uint32)(1 + message.size() + (attachedTree.isValid() ? 1 : 0)));
+    writer.writeString(std::string_view(address.toRawUTF8(), address.getNumBytesAsUTF8()));
+    for (int i=0; i<message.size(); i++){
+        if (message[i].isString()){
+            const auto& string = message[i].getString();
+            writer.writeString(std::string_view(string.toRawUTF8(), string.getNumBytesAsUTF8()));
+        } else if (message[i].isInt32()){
+            writer.writeInt(message[i].getInt32());
+        } else if (message[i].isFloat32()){
+            writer.writeFloat(message[i].getFloat32());
+        } else if (message[i].isBlob()){
+            const auto& blob = message[i].getBlob();
+            writer.writeBinary(blob.getData(), blob.getSize());
+        } else {
+            writer.writeNil();
+        }
+    }
+    if (attachedTree.isValid()){
+        juce::MemoryOutputStream treeData;
+        attachedTree.writeToStream(treeData);
+        writer.writeBinary(treeData.getData(), treeData.getDataSize());
+    }
+    const auto& data = writer.getData();
+    return std::string(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+void Sequencer::sendToAllConnections(const std::function<std::string()>& serializeText, const std::function<std::string()>& serializeBinary, ConnectionSendQueue::MessageKind kind) {
     #if USE_WS_SERVER
     if (wsServer.serverPtr == nullptr){
         // If ws server is not yet running, don't try to send any message
         return;
     }
-    // Takes a OSC message object and serializes in a way that can be sent to WebSockets conencted clients
+    // The message is serialized at most once per protocol, and only if some connection uses that protocol. The
+    // serialized message is shared by the send queues of all connections (see ConnectionSendQueue.h)
+    std::shared_ptr<const std::string> serializedTextMessage;
+    std::shared_ptr<const std::string> serializedBinaryMessage;
     for(auto &a_connection : wsServer.serverPtr->get_connections()){
-        juce::String serializedMessage = serliaizeOSCMessage(message);
-        a_connection->send(serializedMessage.toStdString());
+        if (wsServer.usesBinaryProtocol(a_connection.get())){
+            if (serializedBinaryMessage == nullptr){
+                serializedBinaryMessage = std::make_shared<const std::string>(serializeBinary());
+            }
+            wsServer.send(a_connection, {serializedBinaryMessage, true, kind});
+        } else {
+            if (serializedTextMessage == nullptr){
+                serializedTextMessage = std::make_shared<const std::string>(serializeText());
+            }
+            wsServer.send(a_connection, {serializedTextMessage, false, kind});
+        }
+    }
+    #endif
+}
+
+void Sequencer::sendToConnection(const std::weak_ptr<void>& connection, const std::function<std::string()>& serializeText, const std::function<std::string()>& serializeBinary, ConnectionSendQueue::MessageKind kind) {
+    #if USE_WS_SERVER
+    auto a_connection = std::static_pointer_cast<WsServer::Connection>(connection.lock());
+    if (wsServer.serverPtr == nullptr || a_connection == nullptr){
+        // Connection was closed before the reply could be sent
+        return;
+    }
+    if (wsServer.usesBinaryProtocol(a_connection.get())){
+        wsServer.send(a_connection, {std::make_shared<const std::string>(serializeBinary()), true, kind});
+    } else {
+        wsServer.send(a_connection, {std::make_shared<const std::string>(serializeText()), false, kind});
+    }
+    #endif
+}
+
+void Sequencer::sendMessageToConnection(const std::weak_ptr<void>& connection, const juce::OSCMessage& message, const juce::ValueTree& attachedTree) {
+    const auto kind = message.getAddressPattern().toString() == ACTION_ADDRESS_FULL_STATE ? ConnectionSendQueue::MessageKind::fullState : ConnectionSendQueue::MessageKind::other;
+    sendToConnection(connection,
+                     [&]{ return serliaizeOSCMessage(message, attachedTree).toStdString(); },
+                     [&]{ return serializeOSCMessageToBinary(message, attachedTree); },
+                     kind);
+}
+
+void Sequencer::sendWSMessage(const juce::OSCMessage& message, const juce::ValueTree& attachedTree) {
+    // Takes a OSC message object and serializes in a way that can be sent to WebSockets conencted clients
+    // Full states end the resync of connections which could not keep up with state updates (see ConnectionSendQueue.h)
+    const auto kind = message.getAddressPattern().toString() == ACTION_ADDRESS_FULL_STATE ? ConnectionSendQueue::MessageKind::fullState : ConnectionSendQueue::MessageKind::other;
+    sendToAllConnections([&]{ return serliaizeOSCMessage(message, attachedTree).toStdString(); },
+                         [&]{ return serializeOSCMessageToBinary(message, attachedTree); },
+                         kind);
+}
+
+juce::var Sequencer::serializeStateUpdatesToJSON(const std::vector<const StateUpdateJournal::Update*>& updates)
+{
+    using Update = StateUpdateJournal::Update;
+    juce::Array<juce::var> serializedUpdates;
+    serializedUpdates.ensureStorageAllocated((int)updates.size());
+    for (const auto* update: updates){
+        juce::Array<juce::var> fields;
+        if (update->type == Update::Type::propertyChanged){
+            fields = {"propertyChanged", update->uuid, update->treeType, update->property.toString(), update->value.toString()};
+        } else if (update->type == Update::Type::addedChild){
+            fields = {"addedChild", update->uuid, update->treeType, update->index, update->child.toXmlString(juce::XmlElement::TextFormat().singleLine())};
+        } else if (update->type == Update::Type::replacedChildren){
+            fields = {"replacedChildren", update->uuid, update->treeType, update->property.toString(), update->child.toXmlString(juce::XmlElement::TextFormat().singleLine())};
+        } else {
+            fields = {"removedChild", update->uuid, update->treeType};
+        }
+        serializedUpdates.add(fields);
+    }
+    return serializedUpdates;
+}
+
+void Sequencer::writeStateUpdates(MessagePack::Writer& writer, const std::vector<const StateUpdateJournal::Update*>& updates)
+{
+    using Update = StateUpdateJournal::Update;
+    auto writeString = [&writer](const juce::String& string){
+        writer.writeString(std::string_view(string.toRawUTF8(), string.getNumBytesAsUTF8()));
+    };
+    writer.writeArrayHeader((juce::uint32)updates.size());
+    for (const auto* update: updates){
+        if (update->type == Update::Type::propertyChanged){
+            writer.writeArrayHeader(5);
+            writer.writeString("propertyChanged");
+            writeString(update->uuid);
+            writeString(update->treeType);
+            writeString(update->property.toString());
+            writeString(update->value.toString());
+        } else if (update->type == Update::Type::addedChild){
+            juce::MemoryOutputStream childData;
+            update->child.writeToStream(childData);
+            writer.writeArrayHeader(5);
+            writer.writeString("addedChild");
+            writeString(update->uuid);
+            writeString(update->treeType);
+            writer.writeInt(update->index);
+            writer.writeBinary(childData.getData(), childData.getDataSize());
+        } else if (update->type == Update::Type::replacedChildren){
+            juce::MemoryOutputStream childrenData;
+            update->child.writeToStream(childrenData);
+            writer.writeArrayHeader(5);
+            writer.writeString("replacedChildren");
+            writeString(update->uuid);
+            writeString(update->treeType);
+            writeString(update->property.toString());
+            writer.writeBinary(childrenData.getData(), childrenData.getDataSize());
+        } else {
+            writer.writeArrayHeader(3);
+            writer.writeString("removedChild");
+            writeString(update->uuid);
+            writeString(update->treeType);
+        }
+    }
+}
+
+std::string Sequencer::serializeStateUpdateBatch(const std::vector<const StateUpdateJournal::Update*>& updates, int previousID, bool binary)
+{
+    // A batch is sent as a single message with the ID of the batch, the ID of the previous batch sent to the
+    // connection (batches with no updates for the connection are not sent, see sendStateUpdateBatch) and the list of
+    // updates. Each update has the same parameters as the equivalent ACTION_ADDRESS_STATE_UPDATE message (except the
+    // ID):
+    //  - ["propertyChanged", uuid, type, property, value]
+    //  - ["addedChild", parentUuid, parentType, index, child]
+    //  - ["removedChild", uuid, type]
+    //  - ["replacedChildren", parentUuid, parentType, childrenType, tree of parentType with the new children] (bulk
+    //    edits, the children of the parent with childrenType are replaced by the ones in the tree)
+    // In the text protocol the list is serialized as JSON (with children as XML), in the binary protocol it is a
+    // MessagePack array (with children in the format of juce::ValueTree::writeToStream)
+    if (!binary){
+        juce::String serializedBatch = juce::String(ACTION_ADDRESS_STATE_UPDATE_BATCH) + ":" + juce::String(stateUpdateID) + SERIALIZATION_SEPARATOR + juce::String(previousID) + SERIALIZATION_SEPARATOR + juce::JSON::toString(serializeStateUpdatesToJSON(updates), true);
+        return serializedBatch.toStdString();
+    }
+    
+    MessagePack::Writer writer;
+    writer.writeArrayHeader(4);
+    writer.writeString(ACTION_ADDRESS_STATE_UPDATE_BATCH);
+    writer.writeInt(stateUpdateID);
+    writer.writeInt(previousID);
+    writeStateUpdates(writer, updates);
+    const auto& data = writer.getData();
+    return std::string(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+void Sequencer::sendStateUpdateBatch(const std::vector<StateUpdateJournal::Update>& updates)
+{
+    #if USE_WS_SERVER
+    if (wsServer.serverPtr != nullptr){
+        // Connections without subscription receive all the updates, the others only the ones selected for their
+        // subscription (see StateSubscription.h). Updates are selected once per subscription and serialized at most
+        // once per subscription and protocol. Batches with no updates for a subscription are not sent, so each batch
+        // has the ID of the previous batch sent for the same subscription (controllers use it to detect lost batches)
+        struct FilteredBatch
+        {
+            std::vector<const StateUpdateJournal::Update*> updates;
+            int previousID;
+            std::shared_ptr<const std::string> serializedText;
+            std::shared_ptr<const std::string> serializedBinary;
+        };
+        std::map<juce::String, FilteredBatch> batches;  // Subscription key -> batch (empty key for no subscription)
+        const auto nowMs = juce::Time::currentTimeMillis();
+        for(auto &a_connection : wsServer.serverPtr->get_connections()){
+            auto options = wsServer.getConnectionOptions(a_connection.get());
+            const auto key = options.subscription != nullptr ? options.subscription->getKey() : juce::String();
+            auto batchIt = batches.find(key);
+            if (batchIt == batches.end()){
+                batchIt = batches.emplace(key, FilteredBatch()).first;
+                if (options.subscription == nullptr){
+                    for (const auto& update: updates){
+                        batchIt->second.updates.push_back(&update);
+                    }
+                } else {
+                    auto& delivery = subscriptionDeliveries[key];
+                    if (delivery == nullptr){
+                        delivery = std::make_unique<StateSubscriptionDelivery>(options.subscription);
+                    }
+                    batchIt->second.updates = delivery->select(updates, nowMs);
+                }
+                auto lastSentIt = lastSentStateUpdateBatchIDs.find(key);
+                batchIt->second.previousID = lastSentIt != lastSentStateUpdateBatchIDs.end() ? lastSentIt->second : stateUpdateID - 1;
+                if (!batchIt->second.updates.empty()){
+                    lastSentStateUpdateBatchIDs[key] = stateUpdateID;
+                }
+            }
+            auto& batch = batchIt->second;
+            if (batch.updates.empty()){
+                continue;
+            }
+            if (options.binaryProtocol){
+                if (batch.serializedBinary == nullptr){
+                    batch.serializedBinary = std::make_shared<const std::string>(serializeStateUpdateBatch(batch.updates, batch.previousID, true));
+                }
+                wsServer.send(a_connection, {batch.serializedBinary, true, ConnectionSendQueue::MessageKind::stateUpdate});
+            } else {
+                if (batch.serializedText == nullptr){
+                    batch.serializedText = std::make_shared<const std::string>(serializeStateUpdateBatch(batch.updates, batch.previousID, false));
+                }
+                wsServer.send(a_connection, {batch.serializedText, false, ConnectionSendQueue::MessageKind::stateUpdate});
+            }
+        }
+        
+        // Forget the deferred updates of subscriptions which are no longer used by any connection
+        for (auto it = subscriptionDeliveries.begin(); it != subscriptionDeliveries.end();){
+            it = batches.count(it->first) > 0 ? std::next(it) : subscriptionDeliveries.erase(it);
+        }
+        for (auto it = lastSentStateUpdateBatchIDs.begin(); it != lastSentStateUpdateBatchIDs.end();){
+            it = batches.count(it->first) > 0 ? std::next(it) : lastSentStateUpdateBatchIDs.erase(it);
+        }
+    }
+    #endif
+    
+    // Keep the batch so it can be replayed to controllers which miss it. Batches are stored unfiltered and filtered by
+    // subscription when replayed
+    stateUpdatesHistory.add(stateUpdateID, updates);
+    stateUpdateID += 1;
+}
+
+bool Sequencer::replayStateUpdates(const std::weak_ptr<void>& connection, int fromID)
+{
+    // Sends the batches from fromID to the last one sent in a single ACTION_ADDRESS_STATE_UPDATE_REPLAY message, as a
+    // list of [id, updates] pairs (updates serialized as in serializeStateUpdateBatch). Returns false if some of these
+    // batches are no longer in the history, in that case the controller needs the full state.
+    // Replayed updates are filtered by the subscription of the connection but not rate limited (these are sent once)
+    if (!stateUpdatesHistory.canReplayFrom(fromID, stateUpdateID)){
+        return false;
+    }
+    
+    StateSubscription::Ptr subscription;
+    #if USE_WS_SERVER
+    if (auto a_connection = std::static_pointer_cast<WsServer::Connection>(connection.lock())){
+        subscription = wsServer.getConnectionOptions(a_connection.get()).subscription;
     }
     #endif
+    std::vector<std::pair<int, std::vector<const StateUpdateJournal::Update*>>> batches;
+    for (const auto& sentBatch: stateUpdatesHistory.getBatches()){
+        if (sentBatch.id < fromID){
+            continue;
+        }
+        std::vector<const StateUpdateJournal::Update*> selectedUpdates;
+        for (const auto& update: sentBatch.updates){
+            double maxRateHz;
+            if (subscription == nullptr || subscription->matches(update, maxRateHz)){
+                selectedUpdates.push_back(&update);
+            }
+        }
+        batches.emplace_back(sentBatch.id, std::move(selectedUpdates));
+    }
+    
+    // Sent as a full state message so that it also ends the resync of the connection (see ConnectionSendQueue.h)
+    sendToConnection(connection, [&]{
+        juce::Array<juce::var> serializedBatches;
+        for (const auto& [id, batchUpdates]: batches){
+            serializedBatches.add(juce::Array<juce::var>{id, serializeStateUpdatesToJSON(batchUpdates)});
+        }
+        return (juce::String(ACTION_ADDRESS_STATE_UPDATE_REPLAY) + ":" + juce::JSON::toString(serializedBatches, true)).toStdString();
+    }, [&]{
+        MessagePack::Writer writer;
+        writer.writeArrayHeader(2);
+        writer.writeString(ACTION_ADDRESS_STATE_UPDATE_REPLAY);
+        writer.writeArrayHeader((juce::uint32)batches.size());
+        for (const auto& [id, batchUpdates]: batches){
+            writer.writeArrayHeader(2);
+            writer.writeInt(id);
+            writeStateUpdates(writer, batchUpdates);
+        }
+        const auto& data = writer.getData();
+        return std::string(reinterpret_cast<const char*>(data.data()), data.size());
+    }, ConnectionSendQueue::MessageKind::fullState);
+    return true;
 }
 
-void Sequencer::sendMessageToController(const juce::OSCMessage& message) {
-    sendWSMessage(message);
+void Sequencer::sendClipEventsQueryResult(const std::weak_ptr<void>& connection, Clip* clip, const Clip::EventsQuery& query)
+{
+    // The reply has the UUID of the clip, the queried window, whether the result was truncated (see
+    // Clip::queryCompiledEvents) and the list of matched events. Each event is a list with the fields:
+    //  - [uuid, handle, type, renderedStartTimestamp, renderedEndTimestamp, timestamp, uTime, ...]
+    //  - followed by [midiNote, midiVelocity, duration, chance] for note events or [eventMidiBytes] for MIDI events
+    // In the text protocol the list is serialized as JSON, in the binary protocol it is a MessagePack array
+    bool truncated;
+    const auto events = clip->queryCompiledEvents(query, truncated);
+    const auto clipUUID = clip->getUUID();
+    
+    sendToConnection(connection, [&]{
+        juce::Array<juce::var> serializedEvents;
+        serializedEvents.ensureStorageAllocated((int)events.size());
+        for (const auto& sequenceEvent: events){
+            juce::Array<juce::var> fields = {
+                sequenceEvent.getProperty(ShepherdIDs::uuid),
+                sequenceEvent.getProperty(ShepherdIDs::handle, -1),
+                sequenceEvent.getProperty(ShepherdIDs::type),
+                sequenceEvent.getProperty(ShepherdIDs::renderedStartTimestamp),
+                sequenceEvent.getProperty(ShepherdIDs::renderedEndTimestamp),
+                sequenceEvent.getProperty(ShepherdIDs::timestamp),
+                sequenceEvent.getProperty(ShepherdIDs::uTime)
+            };
+            if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
+                fields.addArray(juce::Array<juce::var>{sequenceEvent.getProperty(ShepherdIDs::midiNote), sequenceEvent.getProperty(ShepherdIDs::midiVelocity), sequenceEvent.getProperty(ShepherdIDs::duration), sequenceEvent.getProperty(ShepherdIDs::chance)});
+            } else {
+                fields.add(sequenceEvent.getProperty(ShepherdIDs::eventMidiBytes).toString());
+            }
+            serializedEvents.add(fields);
+        }
+        return (juce::String(ACTION_ADDRESS_CLIP_EVENTS) + ":" + clipUUID + SERIALIZATION_SEPARATOR + juce::String(query.startBeat) + SERIALIZATION_SEPARATOR + juce::String(query.endBeat) + SERIALIZATION_SEPARATOR + juce::String(truncated ? 1 : 0) + SERIALIZATION_SEPARATOR + juce::JSON::toString(serializedEvents, true)).toStdString();
+    }, [&]{
+        MessagePack::Writer writer;
+        auto writeString = [&writer](const juce::String& string){
+            writer.writeString(std::string_view(string.toRawUTF8(), string.getNumBytesAsUTF8()));
+        };
+        writer.writeArrayHeader(6);
+        writer.writeString(ACTION_ADDRESS_CLIP_EVENTS);
+        writeString(clipUUID);
+        writer.writeDouble(query.startBeat);
+        writer.writeDouble(query.endBeat);
+        writer.writeBool(truncated);
+        writer.writeArrayHeader((juce::uint32)events.size());
+        for (const auto& sequenceEvent: events){
+            const bool isNote = (int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note;
+            writer.writeArrayHeader(isNote ? 11 : 8);
+            writeString(sequenceEvent.getProperty(ShepherdIDs::uuid).toString());
+            writer.writeInt((int)sequenceEvent.getProperty(ShepherdIDs::handle, -1));
+            writer.writeInt((int)sequenceEvent.getProperty(ShepherdIDs::type));
+            writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::renderedStartTimestamp));
+            writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::renderedEndTimestamp));
+            writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::timestamp));
+            writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::uTime));
+            if (isNote){
+                writer.writeInt((int)sequenceEvent.getProperty(ShepherdIDs::midiNote));
+                writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::midiVelocity));
+                writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::duration));
+                writer.writeDouble(sequenceEvent.getProperty(ShepherdIDs::chance));
+            } else {
+                writeString(sequenceEvent.getProperty(ShepherdIDs::eventMidiBytes).toString());
+            }
+        }
+        const auto& data = writer.getData();
+        return std::string(reinterpret_cast<const char*>(data.data()), data.size());
+    });
 }
 
-void Sequencer::wsMessageReceived (const juce::String& serializedMessage)
+void Sequencer::sendDueDeferredStateUpdates()
 {
-    juce::String action = serializedMessage.substring(0, serializedMessage.indexOf(":"));
-    juce::String serializedParameters = serializedMessage.substring(serializedMessage.indexOf(":") + 1);
-    juce::StringArray actionParameters;
-    actionParameters.addTokens (serializedParameters, (juce::String)SERIALIZATION_SEPARATOR, "");
-    processMessageFromController(action, actionParameters);
+    // Rate limited updates deferred by subscriptions are sent with the next batch. If some are due and there are no
+    // other pending updates, send a batch now so they are not delayed until the next state change
+    const auto nowMs = juce::Time::currentTimeMillis();
+    for (const auto& [key, delivery]: subscriptionDeliveries){
+        if (delivery->hasDueDeferredUpdates(nowMs)){
+            if (stateUpdateJournal.hasPendingUpdates()){
+                stateUpdateJournal.flush();
+            } else {
+                sendStateUpdateBatch({});
+            }
+            return;
+        }
+    }
+}
+
+void Sequencer::editClipSequence(Clip* clip, const std::function<void()>& edit)
+{
+    // Bulk edits of the sequence are sent to the controller as a single update with all the resulting events, instead
+    // of one update per added or removed event (see StateUpdateJournal::beginReplacingChildren)
+    stateUpdateJournal.beginReplacingChildren(clip->state);
+    clip->beginSequenceEdit();
+    edit();
+    clip->commitSequenceEdit();
+    stateUpdateJournal.endReplacingChildren(clip->state, ShepherdIDs::SEQUENCE_EVENT);
+}
+
+void Sequencer::sendMessageToController(const juce::OSCMessage& message, const juce::ValueTree& attachedTree) {
+    sendWSMessage(message, attachedTree);
+}
+
+void Sequencer::sendStateSnapshot(const std::weak_ptr<void>& connection, bool compress)
+{
+    // The copy of the state is made here so that the snapshot is consistent with stateUpdateID. Chunks are sent as
+    // [ACTION_ADDRESS_STATE_SNAPSHOT_CHUNK, updateID, chunkIndex, numChunks, encoding, data], with data encoded as base64
+    // in the text protocol. The first chunk is sent as a full state so that it ends the resync of the connection (see
+    // ConnectionSendQueue.h) and the updates sent while the snapshot is being sent reach the controller
+    StateSnapshotSender::Job job;
+    job.snapshot = state.createCopy();
+    job.updateID = stateUpdateID;
+    job.compress = compress;
+    job.sendChunk = [this, connection](const StateSnapshotSender::Chunk& chunk){
+        const juce::String encoding = chunk.compressed ? "valuetree+gzip" : "valuetree";
+        sendToConnection(connection, [&]{
+            juce::String serializedChunk = juce::String(ACTION_ADDRESS_STATE_SNAPSHOT_CHUNK) + ":" + juce::String(chunk.updateID) + SERIALIZATION_SEPARATOR + juce::String(chunk.index) + SERIALIZATION_SEPARATOR + juce::String(chunk.numChunks) + SERIALIZATION_SEPARATOR + encoding + SERIALIZATION_SEPARATOR + juce::Base64::toBase64(chunk.data, chunk.size);
+            return serializedChunk.toStdString();
+        }, [&]{
+            MessagePack::Writer writer;
+            writer.writeArrayHeader(6);
+            writer.writeString(ACTION_ADDRESS_STATE_SNAPSHOT_CHUNK);
+            writer.writeInt(chunk.updateID);
+            writer.writeInt(chunk.index);
+            writer.writeInt(chunk.numChunks);
+            writer.writeString(encoding.toStdString());
+            writer.writeBinary(chunk.data, chunk.size);
+            const auto& data = writer.getData();
+            return std::string(reinterpret_cast<const char*>(data.data()), data.size());
+        }, chunk.index == 0 ? ConnectionSendQueue::MessageKind::fullState : ConnectionSendQueue::MessageKind::other);
+    };
+    job.getQueuedBytes = [this, connection]{
+        #if USE_WS_SERVER
+        auto a_connection = std::static_pointer_cast<WsServer::Connection>(connection.lock());
+        if (a_connection == nullptr){
+            return -1;
+        }
+        auto sendQueue = wsServer.getConnectionOptions(a_connection.get()).sendQueue;
+        return sendQueue != nullptr ? (int)sendQueue->getStats().queuedBytes : 0;
+        #else
+        return -1;
+        #endif
+    };
+    stateSnapshotSender.addJob(std::move(job));
+}
+
+void Sequencer::wsMessageReceived (const juce::String& serializedMessage, std::weak_ptr<void> sender)
+{
+    // Called from the WebSockets I/O thread for messages using the text protocol
+    int separatorIndex = serializedMessage.indexOf(":");
+    auto address = serializedMessage.substring(0, separatorIndex);
+    juce::StringArray parameters;
+    parameters.addTokens (serializedMessage.substring(separatorIndex + 1), (juce::String)SERIALIZATION_SEPARATOR, "");
+    queueMessageFromController(std::string_view(address.toRawUTF8(), address.getNumBytesAsUTF8()), std::move(parameters), std::move(sender));
+}
+
+void Sequencer::wsBinaryMessageReceived (const void* data, size_t size, std::weak_ptr<void> sender)
+{
+    // Called from the WebSockets I/O thread for messages using the binary protocol (see serializeOSCMessageToBinary).
+    // Parameters are converted to strings as that is what processMessageFromController expects
+    MessagePack::Reader reader(data, size);
+    MessagePack::Value value;
+    if (!reader.read(value) || value.type != MessagePack::Value::Type::array || value.size == 0){
+        DBG("Malformed binary message received from controller");
+        return;
+    }
+    const auto numParameters = value.size - 1;
+    if (!reader.read(value) || value.type != MessagePack::Value::Type::string){
+        DBG("Malformed binary message received from controller");
+        return;
+    }
+    const auto address = value.getString();
+    juce::StringArray parameters;
+    for (juce::uint32 i=0; i<numParameters; i++){
+        if (!reader.read(value)){
+            DBG("Malformed binary message received from controller");
+            return;
+        }
+        switch (value.type) {
+            case MessagePack::Value::Type::string:
+            case MessagePack::Value::Type::binary:
+                parameters.add(juce::String::fromUTF8(reinterpret_cast<const char*>(value.bytes), (int)value.size));
+                break;
+            case MessagePack::Value::Type::integer:
+                parameters.add(juce::String((juce::int64)value.intValue));
+                break;
+            case MessagePack::Value::Type::floatingPoint:
+                parameters.add(juce::String(value.doubleValue));
+                break;
+            case MessagePack::Value::Type::boolean:
+                parameters.add(value.boolValue ? "1" : "0");
+                break;
+            case MessagePack::Value::Type::nil:
+                parameters.add({});
+                break;
+            case MessagePack::Value::Type::array:
+                DBG("Nested arrays are not supported in messages received from controller");
+                return;
+        }
+    }
+    queueMessageFromController(address, std::move(parameters), std::move(sender));
+}
+
+void Sequencer::queueMessageFromController(std::string_view address, juce::StringArray parameters, std::weak_ptr<void> sender)
+{
+    // Messages are only parsed in the WebSockets I/O thread, and then processed in the message thread (see
+    // ControllerMessageQueue.h) so that slow messages don't delay the ones received after them
+    auto actionInfo = ControllerActions::lookup(address);
+    if (actionInfo.action == ControllerAction::unknown){
+        DBG("Unknown action received from controller: " << juce::String::fromUTF8(address.data(), (int)address.size()));
+        return;
+    }
+    ControllerMessage message;
+    message.action = actionInfo.action;
+    message.group = actionInfo.group;
+    message.parameters = std::move(parameters);
+    message.sender = std::move(sender);
+    controllerMessageQueue.push(std::move(message));
 }
 
 void Sequencer::initializeWS() {
@@ -443,7 +1062,15 @@ void Sequencer::initializeMIDIInputs()
                 for (int i=0; i<midiInDevices.size(); i++){
                     if (midiInDevices[i] != nullptr) {
                         if (midiInDevices[i]->identifier == initializedMidiDevice->identifier){
-                            midiInDevices[i]->device->stop();
+                            if (midiDeviceBuffersHandledExternally) { break; }  // JACK ports stay registered, no need to re-initialize them
+                            if (midiInDevices[i]->device != nullptr){
+                                midiInDevices[i]->device->stop();
+                            }
+                            #if USE_ALSA_SEQ_MIDI_BACKEND
+                            if (alsaSequencerMidiBackend != nullptr){
+                                alsaSequencerMidiBackend->closeInputPort(midiInDevices[i]);
+                            }
+                            #endif
                             auto reinitializedMidiDeviceData = initializeMidiInputDevice(hwDevice->getMidiInputDeviceName());
                             midiInDevices.set(i, reinitializedMidiDeviceData);
                             break;
@@ -574,6 +1201,35 @@ MidiOutputDeviceData* Sequencer::initializeMidiOutputDevice(juce::String deviceN
         return deviceData;
     }
     
+    #if USE_JACK_MIDI_ENGINE
+    if (jackMidiEngine != nullptr){
+        MidiOutputDeviceData* deviceData = new MidiOutputDeviceData();
+        deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        deviceData->name = deviceName;
+        if (jackMidiEngine->openOutputPort(deviceData)){
+            return deviceData;
+        }
+        delete deviceData;
+        std::cout << "- ERROR " << deviceName << ". Could not register JACK MIDI output port" << std::endl;
+        return nullptr;
+    }
+    #endif
+    
+    #if USE_ALSA_SEQ_MIDI_BACKEND
+    if (alsaSequencerMidiBackend != nullptr){
+        MidiOutputDeviceData* deviceData = new MidiOutputDeviceData();
+        deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        deviceData->name = deviceName;
+        if (alsaSequencerMidiBackend->openOutputPort(deviceData)){
+            midiOutputDispatcher.addDevice(deviceData);
+            return deviceData;
+        }
+        delete deviceData;
+        std::cout << "- ERROR " << deviceName << ". No matching ALSA sequencer port found (check available ports with 'aconnect -o')" << std::endl;
+        return nullptr;
+    }
+    #endif
+    
     auto midiOutputs = juce::MidiOutput::getAvailableDevices();
     juce::String outDeviceIdentifier = "";
     for (int i=0; i<midiOutputs.size(); i++){
@@ -588,6 +1244,11 @@ MidiOutputDeviceData* Sequencer::initializeMidiOutputDevice(juce::String deviceN
     deviceData->name = deviceName;
     deviceData->device = juce::MidiOutput::openDevice(outDeviceIdentifier);
     if (deviceData->device != nullptr){
+        if (midiOutputSchedulingEnabled){
+            // The background thread is needed for MidiOutput::sendBlockOfMessages to send messages at their timestamps
+            deviceData->device->startBackgroundThread();
+        }
+        midiOutputDispatcher.addDevice(deviceData);
         return deviceData;
     } else {
         delete deviceData; // Delete created MidiOutputDeviceData to avoid memory leaks with created buffer
@@ -619,6 +1280,40 @@ MidiInputDeviceData* Sequencer::initializeMidiInputDevice(juce::String deviceNam
 {
     JUCE_ASSERT_MESSAGE_THREAD
     
+    #if USE_JACK_MIDI_ENGINE
+    if (jackMidiEngine != nullptr){
+        MidiInputDeviceData* deviceData = new MidiInputDeviceData();
+        deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        deviceData->blockBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        deviceData->name = deviceName;
+        if (jackMidiEngine->openInputPort(deviceData)){
+            return deviceData;
+        }
+        delete deviceData;
+        std::cout << "- ERROR " << deviceName << ". Could not register JACK MIDI input port" << std::endl;
+        return nullptr;
+    }
+    #endif
+    
+    #if USE_ALSA_SEQ_MIDI_BACKEND
+    if (alsaSequencerMidiBackend != nullptr){
+        MidiInputDeviceData* deviceData = new MidiInputDeviceData();
+        deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        deviceData->blockBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+        deviceData->collector.ensureStorageAllocated(MIDI_BUFFER_MIN_BYTES);
+        deviceData->name = deviceName;
+        if (sampleRate > 0){
+            deviceData->collector.reset(sampleRate);
+        }
+        if (alsaSequencerMidiBackend->openInputPort(deviceData)){
+            return deviceData;
+        }
+        delete deviceData;
+        std::cout << "- ERROR " << deviceName << ". No matching ALSA sequencer port found (check available ports with 'aconnect -i')" << std::endl;
+        return nullptr;
+    }
+    #endif
+    
     auto midiInputs = juce::MidiInput::getAvailableDevices();
     juce::String inDeviceIdentifier = "";
     for (int i=0; i<midiInputs.size(); i++){
@@ -629,6 +1324,7 @@ MidiInputDeviceData* Sequencer::initializeMidiInputDevice(juce::String deviceNam
     
     MidiInputDeviceData* deviceData = new MidiInputDeviceData();
     deviceData->buffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
+    deviceData->blockBuffer.ensureSize(MIDI_BUFFER_MIN_BYTES);
     deviceData->collector.ensureStorageAllocated(MIDI_BUFFER_MIN_BYTES);
     deviceData->identifier = inDeviceIdentifier;
     deviceData->name = deviceName;
@@ -671,7 +1367,17 @@ void Sequencer::collectorsRetrieveLatestBlockOfMessages(int sliceNumSamples)
 {
     for (auto deviceData: midiInDevices){
         if (deviceData != nullptr){
-            deviceData->collector.removeNextBlockOfMessages (deviceData->buffer, sliceNumSamples);
+            deviceData->collector.removeNextBlockOfMessages (deviceData->blockBuffer, sliceNumSamples);
+        }
+    }
+}
+
+void Sequencer::extractMidiDeviceInputSubSliceBuffers(int subSliceOffset, int subSliceNumSamples)
+{
+    for (auto deviceData: midiInDevices){
+        if (deviceData != nullptr){
+            deviceData->buffer.clear();
+            deviceData->buffer.addEvents(deviceData->blockBuffer, subSliceOffset, subSliceNumSamples, -subSliceOffset);
         }
     }
 }
@@ -689,7 +1395,7 @@ void Sequencer::clearMidiDeviceInputBuffers()
 {
     for (auto deviceData: midiInDevices){
         if (deviceData != nullptr){
-            deviceData->buffer.clear();
+            deviceData->blockBuffer.clear();
         }
     }
 }
@@ -713,14 +1419,115 @@ void Sequencer::clearMidiTrackBuffers()
 
 void Sequencer::sendMidiDeviceOutputBuffers()
 {
+    if (midiDeviceBuffersHandledExternally){
+        // Output buffers will be written to the MIDI ports by the engine once getNextMIDISlice returns
+        return;
+    }
+    
+    // If scheduled output is enabled, sample positions of the events in the buffers will be converted to absolute
+    // times starting at the time of the first sample of the slice, otherwise messages will be sent immediately
+    double startTimeMs = -1.0;
+    if (midiOutputSchedulingEnabled){
+        startTimeMs = midiOutputTimeBase.getSliceStartTimeMs() + midiOutputSchedulingLatencyMs;
+    }
     for (auto deviceData: midiOutDevices){
         if (deviceData != nullptr && deviceData->name != INTERNAL_OUTPUT_MIDI_DEVICE_NAME){
-            deviceData->device->sendBlockOfMessagesNow(deviceData->buffer);
+            midiOutputDispatcher.enqueue(deviceData, startTimeMs, sampleRate);
+        }
+    }
+}
+
+void Sequencer::reportMidiOutputQueueStats()
+{
+    // Report buffers dropped because of a MIDI output device not consuming messages fast enough
+    for (auto deviceData: midiOutDevices){
+        if (deviceData != nullptr){
+            int numDroppedBuffers = deviceData->numDroppedBuffers.load();
+            if (numDroppedBuffers != deviceData->lastReportedNumDroppedBuffers){
+                std::cout << "WARNING, MIDI output queue for device " << deviceData->name << " is full. Dropped buffers: " << numDroppedBuffers << " (max queue depth: " << deviceData->maxQueueDepth.load() << ")" << std::endl;
+                deviceData->lastReportedNumDroppedBuffers = numDroppedBuffers;
+            }
         }
     }
 }
 
-void Sequencer::writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vector<juce::String> midiOutDeviceNames)
+bool Sequencer::renderLookaheadSlice(LookaheadSlice& slice)
+{
+    // Called from the lookahead worker thread, runs steps 2) to 9) and 12) and stores the resulting device buffers in the slice
+    // MIDI input is not collected here as it would be processed at the rendering position instead of at the time it was
+    // received (the lookahead renderer is suspended when tracks need MIDI input, see updateLookaheadSuspension)
+    int blockNumSamples = samplesPerBlock.load();
+    if (!sequencerInitialized || blockNumSamples == 0){
+        return false;
+    }
+    
+    renderMIDISlice(blockNumSamples, false);
+    
+    for (auto deviceData: midiOutDevices){
+        if (deviceData != nullptr && deviceData->name != INTERNAL_OUTPUT_MIDI_DEVICE_NAME){
+            slice.add(deviceData, deviceData->buffer);
+        }
+    }
+    if ((notesMonitoringMidiOutput->device != nullptr) && (activeUiNotesMonitoringTrack != "")){
+        slice.add(notesMonitoringMidiOutput.get(), notesMonitoringMidiOutput->buffer);
+    }
+    return true;
+}
+
+void Sequencer::discardLookahead()
+{
+    // Discard the slices already rendered ahead so that changes requested from the controller which take effect
+    // immediately (i.e. not quantized to the next bar) are applied by the next slice instead of after the lookahead window
+    if (lookaheadRenderer == nullptr){
+        return;
+    }
+    lookaheadRenderer->discardPendingSlices();
+}
+
+void Sequencer::updateLookaheadSuspension()
+{
+    // MIDI input must be processed at the time it is received, so slices are rendered in the RT thread while any track
+    // monitors its input or has clips recording (or cued to record)
+    if (lookaheadRenderer == nullptr){
+        return;
+    }
+    bool midiInputNeeded = false;
+    for (auto track: tracks->objects){
+        if (track->inputMonitoringEnabled() || track->hasClipsCuedToRecordOrRecording()){
+            midiInputNeeded = true;
+            break;
+        }
+    }
+    lookaheadRenderer->setSuspended(midiInputNeeded);
+}
+
+void Sequencer::reportLookaheadUnderruns()
+{
+    if (lookaheadRenderer == nullptr) { return; }
+    if (juce::Time::getMillisecondCounter() - lastTimeLookaheadUnderrunsReported < LOOKAHEAD_UNDERRUNS_REPORT_INTERVAL_MS) { return; }
+    lastTimeLookaheadUnderrunsReported = juce::Time::getMillisecondCounter();
+    
+    int numUnderruns = lookaheadRenderer->numUnderruns.exchange(0);
+    if (numUnderruns > 0){
+        std::cout << "WARNING, lookahead worker could not render " << numUnderruns << " slices in time, consider increasing lookaheadMs" << std::endl;
+    }
+}
+
+#if USE_MIDI_ONLY_ENGINE
+void Sequencer::reportMidiOnlyEngineStats()
+{
+    if (midiOnlyEngine == nullptr) { return; }
+    if (juce::Time::getMillisecondCounter() - lastTimeMidiOnlyEngineStatsReported < MIDI_ONLY_ENGINE_STATS_REPORT_INTERVAL_MS) { return; }
+    lastTimeMidiOnlyEngineStatsReported = juce::Time::getMillisecondCounter();
+    
+    auto report = midiOnlyEngine->jitterStats.getAndReset();
+    std::cout << "MIDI-only engine (" << (midiOnlyEngine->isRealtime() ? "SCHED_FIFO" : "not realtime") << ", " << midiOnlyEngine->getPeriodMs() << "ms period): "
+              << report.numPeriods << " periods, mean jitter " << report.meanAbsJitterUs << "us, max jitter " << report.maxAbsJitterUs << "us, "
+              << "max wake up latency " << report.maxWakeUpLatencyUs << "us, overruns " << report.numOverruns << std::endl;
+}
+#endif
+
+void Sequencer::writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vector<juce::String> midiOutDeviceNames, int sampleOffset)
 {
     for (auto deviceName: midiOutDeviceNames){
         auto deviceData = getMidiOutputDeviceData(deviceName);
@@ -728,7 +1535,7 @@ void Sequencer::writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vect
             auto bufferToWrite = &deviceData->buffer;
             if (bufferToWrite != nullptr){
                 if (buffer.getNumEvents() > 0){
-                    bufferToWrite->addEvents(buffer, 0, samplesPerSlice, 0);
+                    bufferToWrite->addEvents(buffer, 0, samplesPerSlice, sampleOffset);
                 }
             }
         }
@@ -817,6 +1624,7 @@ void Sequencer::initializeHardwareDevices()
         // Remove existing child (if any?)
         state.removeChild(state.getChildWithName(ShepherdIDs::HARDWARE_DEVICES), nullptr);
     }
+    assignHandles(hardwareDevicesState);
     state.addChild(hardwareDevicesState, -1, nullptr);
     hardwareDevices = std::make_unique<HardwareDeviceList>(state.getChildWithName(ShepherdIDs::HARDWARE_DEVICES),
                                                            [this](juce::String deviceName){return getMidiOutputDeviceData(deviceName);},
@@ -834,13 +1642,21 @@ void Sequencer::initializeHardwareDevices()
 
 HardwareDevice* Sequencer::getHardwareDeviceByName(juce::String name, HardwareDeviceType type)
 {
-    for (auto device: hardwareDevices->objects){
-        if ((device->getShortName() == name || device->getName() == name) && (type == device->getType())){
+    // If no hardware device is available with that name and for that type, returns null pointer
+    return hardwareDevices->getObjectWithName(name, type);
+}
+
+HardwareDevice* Sequencer::getHardwareDeviceWithHandleOrName(const juce::String& deviceReference, HardwareDeviceType type)
+{
+    int handle = ShepherdHelpers::parseHandle(deviceReference);
+    if (handle > -1){
+        auto* device = hardwareDevices->getObjectWithHandle(handle);
+        if (device != nullptr && device->getType() == type){
             return device;
         }
+        return nullptr;
     }
-    // If no hardware device is available with that name and for that type, simply return null pointer
-    return nullptr;
+    return getHardwareDeviceByName(deviceReference, type);
 }
 
 Track* Sequencer::getTrackWithUUID(juce::String trackUUID)
@@ -848,12 +1664,65 @@ Track* Sequencer::getTrackWithUUID(juce::String trackUUID)
     return tracks->getObjectWithUUID(trackUUID);
 }
 
+Track* Sequencer::getTrackWithHandleOrUUID(const juce::String& trackReference)
+{
+    int handle = ShepherdHelpers::parseHandle(trackReference);
+    if (handle > -1){
+        return tracks->getObjectWithHandle(handle);
+    }
+    return tracks->getObjectWithUUID(trackReference);
+}
+
+void Sequencer::assignHandles(juce::ValueTree tree)
+{
+    // Assigns new handles to all the tracks, clips, sequence events and hardware devices in the given tree. Handles
+    // are always re-assigned (even if the tree already has them) because the tree could be a copy of an existing one.
+    // This is called before trees are added to the state and also when a tree has been added (see valueTreeChildAdded),
+    // in which case no "propertyChanged" update is sent as the added tree (with its handles) is sent to the controller
+    int* nextHandle = nullptr;
+    if (tree.hasType(ShepherdIDs::TRACK)){
+        nextHandle = &nextTrackHandle;
+    } else if (tree.hasType(ShepherdIDs::CLIP)){
+        nextHandle = &nextClipHandle;
+    } else if (tree.hasType(ShepherdIDs::SEQUENCE_EVENT)){
+        nextHandle = &nextSequenceEventHandle;
+    } else if (tree.hasType(ShepherdIDs::HARDWARE_DEVICE)){
+        nextHandle = &nextHardwareDeviceHandle;
+    }
+    if (nextHandle != nullptr){
+        tree.setPropertyExcludingListener(this, ShepherdIDs::handle, *nextHandle, nullptr);
+        *nextHandle += 1;
+    }
+    for (auto child: tree){
+        assignHandles(child);
+    }
+}
+
 //==============================================================================
 void Sequencer::prepareSequencer (int samplesPerBlockExpected, double _sampleRate)
 {
+    if (lookaheadRenderer != nullptr){
+        // Stop the worker thread as it reads the members updated below
+        lookaheadRenderer->stop();
+    }
+    
     sampleRate = _sampleRate;
     samplesPerSlice = samplesPerBlockExpected; // We store samplesPerBlockExpected calling it samplesPerSlice as in our MIDI sequencer context we call our processig blocks "slices"
+    if (samplesPerSubSlice > 0){
+        // Blocks will be processed in smaller sub-slices (see getNextMIDISlice)
+        samplesPerSlice = juce::jmin(samplesPerSubSlice, samplesPerBlockExpected);
+    }
     resetMidiInCollectors (_sampleRate);
+    midiOutputTimeBase.prepare(_sampleRate);
+    
+    samplesPerBlock = samplesPerBlockExpected;
+    
+    if (lookaheadRenderer != nullptr){
+        // Re-start the worker thread (slices rendered with the previous block size are discarded)
+        int numSlicesAhead = (int)std::ceil(lookaheadMs * _sampleRate / 1000.0 / (double)samplesPerBlockExpected);
+        lookaheadRenderer->start(numSlicesAhead);
+        std::cout << "Lookahead rendering enabled with " << lookaheadRenderer->getNumSlicesAhead() << " slices ahead (" << lookaheadRenderer->getNumSlicesAhead() * samplesPerBlockExpected * 1000.0 / _sampleRate << "ms)" << std::endl;
+    }
 }
 
 /** Process each audio block (in our case, we call it "slice" and only process MIDI data), ask each track to provide notes to be triggered during that slice, handle MIDI input and global playhead transport.
@@ -863,10 +1732,14 @@ void Sequencer::prepareSequencer (int samplesPerBlockExpected, double _sampleRat
  struecutred as follows:
  
  1) Check if main component has been fully initialized, if not do not proceed with getNextMIDISlice as we might be referencing some objects which have not yet been fully initialized (Tracks, HardwareDevices...)
+
+ If "lookaheadMs" is set in the settings, steps 2) to 9) and 12) are not run here but in the lookahead worker thread (see renderLookaheadSlice and LookaheadRenderer.h), which renders slices ahead of time. getNextMIDISlice then only sends the buffers of the slice which is due. MIDI input is not used by the worker thread, so lookahead rendering is suspended while any track needs it (input monitoring or recording) and, in that case, slices are rendered here as usual (see updateLookaheadSuspension). Slices which are due and have not been rendered by the worker thread (e.g. after the slices rendered ahead are discarded when stopping the transport, see discardLookahead) are also rendered here.
     
- 2) Clear all MIDI buffers so we can re-fill them with events corresponding to the current slice. These includes hardware device buffers, track buffers and other auxiliary buffers. Clearing the buffers does not free their pre-allocated memory, so this is fine in the RT thread.
+ 2) Clear hardware device MIDI buffers so we can re-fill them with events corresponding to the current slice. Clearing the buffers does not free their pre-allocated memory, so this is fine in the RT thread. Also pull the latest hardware device config snapshots so that device settings are not read from the state in the RT thread, collect the MIDI messages received from the MIDI inputs during the slice, and pull the commands sent from the controller (clip/scene launch, transport, tempo, see SequencerCommand.h) from the command queue.
+ 
+ Steps 3) to 9), and 12) are run for every sub-slice of the slice (see processSubSlice). If "subSliceNumSamples" is set in the settings, slices are split in sub-slices of that number of samples so that cue checks, bar counter and count-in work at a finer resolution than the audio device block size. Otherwise, there is a single sub-slice spanning the whole slice. Sub-slices are also split at the position of commands with a target beat or sample time, so that these commands are applied at the exact sample. In each sub-slice, track and auxiliary buffers are cleared, the part of the input buffers corresponding to the sub-slice is extracted, and generated messages are added to the hardware device buffers at the sub-slice offset.
      
- 3) Check if tempo or meter should be updated and, in case we're doing a count in, check if count in finishes in this slice
+ 3) Apply the commands from the controller which are due, check if tempo or meter should be updated and, in case we're doing a count in, check if count in finishes in this slice
      
  4) Update musical context bar counter
     
@@ -874,17 +1747,17 @@ void Sequencer::prepareSequencer (int samplesPerBlockExpected, double _sampleRat
 
  6) Check if global playhead should be start/stopped and act accordingly
 
- 7) Process the current slice in each track: trigger playing clips' notes and, if needed, record incoming MIDI in clip(s)
+ 7) Process the current slice in each track: trigger playing clips' notes and, if needed, record incoming MIDI in clip(s). If "trackWorkerThreads" is set in the settings, tracks are processed in parallel using a pool of worker threads (see processTrackGroupSlice and RTWorkerPool.h)
     
  8) Add generated MIDI buffers per track to the corresponding hardware device MIDI output buffer. Note that several tracks might be using the same hardware device (albeit using different MIDI channels) so at this point MIDI from several tracks might be merged in the hardware device MIDI buffers.
           
  9) Render metronome and clock MIDI messages into MIDI clock and metronome auxiliary buffers. Also render MIDI clock messages in Push's MIDI buffer, used to synchronize Push colour animations with Shepherd session tempo. Copy metronome and clock messages to the corresponding hardware device buffers according to Shepherd settings.
      
- 10) Send the actual messages added to each hardware device's MIDI buffer
+ 10) Send the actual messages added to each hardware device's MIDI buffer. Buffers are copied to per-device queues and the actual writes to the MIDI devices happen in the MIDI output dispatcher thread, so a slow device can't block the RT thread. If scheduled MIDI output is enabled, messages are not sent immediately but at the time corresponding to their position in the slice (plus a fixed latency). When running as a JACK client, this step is skipped and the buffers are written to the JACK MIDI ports after getNextMIDISlice returns (see JackMidiEngine.h).
      
- 11) Send monitored track notes to the notes MIDI output (if any selected). This is used by the Shepherd Controller to show feedback about notes being currently played.
+ 11) Send monitored track notes to the notes MIDI output (if any selected). This is used by the Shepherd Controller to show feedback about notes being currently played. Notes are collected while processing each sub-slice.
 
- 12) Update playhead position if global playhead is playing
+ 12) Update playhead position if global playhead is playing (at the end of each sub-slice)
  
  See comments in the implementation for more details about each step.
  
@@ -896,19 +1769,109 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
         return;
     }
     
+    if (midiOutputSchedulingEnabled){
+        // Advance the time base used to compute the timestamps of the MIDI messages that will be sent in step 10
+        midiOutputTimeBase.processSlice(juce::Time::getMillisecondCounterHiRes(), sliceNumSamples);
+    }
+    
+    double startTimeMs = midiOutputSchedulingEnabled ? midiOutputTimeBase.getSliceStartTimeMs() + midiOutputSchedulingLatencyMs : -1.0;
+    auto sendLookaheadBuffer = [this, startTimeMs](MidiOutputDeviceData* deviceData, const juce::MidiBuffer& buffer){
+        midiOutputDispatcher.enqueue(deviceData, buffer, deviceData == notesMonitoringMidiOutput.get() ? -1.0 : startTimeMs, sampleRate);
+    };
+    if (lookaheadRenderer != nullptr && !lookaheadRenderer->shouldRenderInRTThread(sendLookaheadBuffer)){
+        // Steps 2) to 9) and 12) have already been run in the lookahead worker thread, only send the slice which is due
+        // MIDI input is not used while rendering ahead, but collectors are emptied so that messages don't pile up
+        if (!midiDeviceBuffersHandledExternally){
+            for (auto deviceData: midiInDevices){
+                if (deviceData != nullptr){
+                    deviceData->collector.removeNextBlockOfMessages (discardedMidiInputMessages, sliceNumSamples);
+                }
+            }
+        }
+        lookaheadRenderer->emitNextSlice(sendLookaheadBuffer);
+        midiOutputDispatcher.notify();
+        return;
+    }
+    
+    renderMIDISlice(sliceNumSamples, true);
+    if (lookaheadRenderer != nullptr){
+        lookaheadRenderer->finishedRenderingInRTThread();
+    }
+    
+    // 10) -------------------------------------------------------------------------------------------------
+    
+    sendMidiDeviceOutputBuffers();
+    
+    // 11) -------------------------------------------------------------------------------------------------
+    
+    // NOTE: notes are added to the buffer while processing each sub-slice
+    if ((notesMonitoringMidiOutput->device != nullptr) && (activeUiNotesMonitoringTrack != "")){
+        midiOutputDispatcher.enqueue(notesMonitoringMidiOutput.get(), -1.0, sampleRate);
+    }
+    
+    // Let the MIDI output dispatcher thread know that messages enqueued in steps 10 and 11 should be sent
+    midiOutputDispatcher.notify();
+}
+
+void Sequencer::renderMIDISlice (int sliceNumSamples, bool collectMidiInput)
+{
     // 2) -------------------------------------------------------------------------------------------------
     
-    clearMidiDeviceInputBuffers();
+    if (!midiDeviceBuffersHandledExternally){
+        // If MIDI I/O is handled externally, input block buffers have already been filled by the engine
+        clearMidiDeviceInputBuffers();
+    }
     clearMidiDeviceOutputBuffers();
+    notesMonitoringMidiOutput->buffer.clear();
+    
+    for (auto device: hardwareDevices->objects){
+        device->prepareSlice();  // Pull config snapshots from the device fifo
+    }
+    
+    // Collect messages from different MIDI inputs for the whole slice
+    if (!midiDeviceBuffersHandledExternally && collectMidiInput){
+        collectorsRetrieveLatestBlockOfMessages(sliceNumSamples);
+    }
+    
+    // Pull commands sent from the controller since the last slice
+    pullCommands();
+    
+    // 3) to 9) ---------------------------------------------------------------------------------------------
+    
+    // Process the slice in sub-slices of (at most) samplesPerSubSlice samples. While a sub-slice is being processed,
+    // samplesPerSlice is set to its length so that all the timing logic (clips, musical context) works at sub-slice resolution
+    // Sub-slices are also split at the position of pending commands with a target time so that these are applied at
+    // the exact sample (see applyDueCommands)
+    int maxSubSliceNumSamples = samplesPerSubSlice > 0 ? samplesPerSubSlice : sliceNumSamples;
+    int subSliceOffset = 0;
+    while (subSliceOffset < sliceNumSamples){
+        int numSamples = juce::jmin(maxSubSliceNumSamples, sliceNumSamples - subSliceOffset);
+        if (numPendingCommands > 0){
+            numSamples = getNumSamplesUntilNextPendingCommand(numSamples);
+        }
+        samplesPerSlice = numSamples;
+        processSubSlice(subSliceOffset, numSamples);
+        subSliceOffset += numSamples;
+        renderedSampleCount += numSamples;
+    }
+    samplesPerSlice = juce::jmin(maxSubSliceNumSamples, sliceNumSamples);
+}
+
+void Sequencer::processSubSlice (int subSliceOffset, int subSliceNumSamples)
+{
     clearMidiTrackBuffers();
     midiClockMessages.clear();
     midiTransportMessages.clear();
     midiMetronomeMessages.clear();
     pushMidiClockMessages.clear();
-    monitoringNotesMidiBuffer.clear();
     
     // 3) -------------------------------------------------------------------------------------------------
     
+    // Apply commands from the controller which are due (these can change clip cues, tempo, meter or transport)
+    if (numPendingCommands > 0){
+        applyDueCommands();
+    }
+    
     // Check if tempo/meter should be updated
     if (nextBpm > 0.0){
         musicalContext->setBpm(nextBpm);
@@ -940,16 +1903,16 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
     
     // 5) -------------------------------------------------------------------------------------------------
     
-    // Collect messages from different MIDI inputs and put them into a single buffer
-    collectorsRetrieveLatestBlockOfMessages(sliceNumSamples);
+    // Get the part of the MIDI input device buffers corresponding to the current sub-slice
+    extractMidiDeviceInputSubSliceBuffers(subSliceOffset, subSliceNumSamples);
     
     for (auto inputDevice: hardwareDevices->objects){
         // NOTE: iterating hardwareDevices could be problematic without a lock if devices are
         // added/removed. However this not something that will be happening as hw devices should
         // not be created or removed...
 
-        if (inputDevice->isTypeInput() && inputDevice->isMidiInitialized()){
-            auto inputDeviceData = getMidiInputDeviceData(inputDevice->getMidiInputDeviceName());
+        if (inputDevice->getRTConfig().isTypeInput() && inputDevice->isMidiInitialized()){
+            auto inputDeviceData = getMidiInputDeviceData(inputDevice->getRTConfig().midiInputDeviceName);
             if (inputDeviceData == nullptr) { continue; }
             juce::MidiBuffer& deviceLastBlockOfMessages = inputDeviceData->buffer;
             
@@ -967,7 +1930,7 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
             for (auto track: tracks->objects){
                 track->processInputMessagesFromInputHardwareDevice(inputDevice,
                                                                    musicalContext->getSliceLengthInBeats(),
-                                                                   sliceNumSamples,
+                                                                   subSliceNumSamples,
                                                                    musicalContext->getCountInPlayheadPositionInBeats(),
                                                                    musicalContext->getPlayheadPositionInBeats(),
                                                                    musicalContext->getMeter(),
@@ -1003,20 +1966,31 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
     
     // 7) -------------------------------------------------------------------------------------------------
     
-    for (auto track: tracks->objects){
-        track->clipsPrepareSlice();  // Pull sequences form the clip fifo
-    }
-    
-    if (musicalContext->playheadIsPlaying()){
+    bool playheadIsPlaying = musicalContext->playheadIsPlaying();
+    #if USE_TRACK_WORKER_POOL
+    if (trackWorkerPool != nullptr){
+        // Process tracks in parallel. Each track only writes to its own buffers, which are merged into the device
+        // buffers in track order in step 8) so the output does not depend on the number of threads
+        auto processTrackGroupTask = [this, playheadIsPlaying](int trackIndex){ processTrackGroupSlice(trackIndex, playheadIsPlaying); };
+        trackWorkerPool->parallelFor(tracks->objects.size(), processTrackGroupTask);
+    } else
+    #endif
+    {
         for (auto track: tracks->objects){
-            track->clipsProcessSlice();  // No need to pass buffers here because Clip objects will retrieve them from its parent track object
+            track->clipsPrepareSlice();  // Pull sequences form the clip fifo
+        }
+        
+        if (playheadIsPlaying){
+            for (auto track: tracks->objects){
+                track->clipsProcessSlice();  // No need to pass buffers here because Clip objects will retrieve them from its parent track object
+            }
         }
     }
     
     // 8) -------------------------------------------------------------------------------------------------
     
     for (auto track: tracks->objects){
-        track->writeLastSliceMidiBufferToHardwareDeviceMidiBuffer();
+        track->writeLastSliceMidiBufferToHardwareDeviceMidiBuffer(subSliceOffset);
     }
     
     for (auto outputDevice: hardwareDevices->objects){
@@ -1024,8 +1998,8 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
         // NOTE: iterating hardwareDevices could be problematic without a lock if devices are
         // added/removed. However this not something that will be happening as hw devices should
         // not be created or removed...
-        if (outputDevice->isTypeOutput() && outputDevice->isMidiInitialized()){
-            outputDevice->renderPendingMidiMessagesToRenderInBuffer();
+        if (outputDevice->getRTConfig().isTypeOutput() && outputDevice->isMidiInitialized()){
+            outputDevice->renderPendingMidiMessagesToRenderInBuffer(subSliceOffset);
         }
     }
     
@@ -1047,7 +2021,7 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
         if (lastTimePushMidiClockBurstStarted > -1.0){
             double timeNow = juce::Time::getMillisecondCounter();
             if (timeNow - lastTimePushMidiClockBurstStarted < PUSH_MIDI_CLOCK_BURST_DURATION_MILLISECONDS){
-                pushMidiClockMessages.addEvents(midiClockMessages, 0, sliceNumSamples, 0);
+                pushMidiClockMessages.addEvents(midiClockMessages, 0, subSliceNumSamples, 0);
             } else if (timeNow - lastTimePushMidiClockBurstStarted > PUSH_MIDI_CLOCK_BURST_DURATION_MILLISECONDS){
                 musicalContext->renderMidiStopInSlice(pushMidiClockMessages);
                 lastTimePushMidiClockBurstStarted = -1.0;
@@ -1057,22 +2031,17 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
     
     // Add metronome, MIDI clock, and transport messages to the corresponding hardware device buffers according to settings
     // Also send MIDI clock message to Push
-    writeMidiToDevicesMidiBuffer(midiClockMessages, sendMidiClockMidiDeviceNames);
-    writeMidiToDevicesMidiBuffer(midiTransportMessages, sendMidiTransportMidiDeviceNames);
+    writeMidiToDevicesMidiBuffer(midiClockMessages, sendMidiClockMidiDeviceNames, subSliceOffset);
+    writeMidiToDevicesMidiBuffer(midiTransportMessages, sendMidiTransportMidiDeviceNames, subSliceOffset);
     if (sendMetronomeMidiDeviceName != ""){
-        writeMidiToDevicesMidiBuffer(midiMetronomeMessages, {sendMetronomeMidiDeviceName});
+        writeMidiToDevicesMidiBuffer(midiMetronomeMessages, {sendMetronomeMidiDeviceName}, subSliceOffset);
     }
     if (sendPushLikeMidiClockBursts){
-        writeMidiToDevicesMidiBuffer(pushMidiClockMessages, sendPushMidiClockDeviceNames);
+        writeMidiToDevicesMidiBuffer(pushMidiClockMessages, sendPushMidiClockDeviceNames, subSliceOffset);
     }
     
-    
-    // 10) -------------------------------------------------------------------------------------------------
-    
-    sendMidiDeviceOutputBuffers();
-    
-    // 11) -------------------------------------------------------------------------------------------------
-    if ((notesMonitoringMidiOutput != nullptr) && (activeUiNotesMonitoringTrack != "")){
+    // Add monitored track notes to the notes MIDI output buffer (will be sent in step 11)
+    if ((notesMonitoringMidiOutput->device != nullptr) && (activeUiNotesMonitoringTrack != "")){
         auto track = getTrackWithUUID(activeUiNotesMonitoringTrack);
         if (track != nullptr){
             auto buffer = track->getLastSliceMidiBuffer();
@@ -1080,10 +2049,9 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
                 for (auto event: *buffer){
                     auto msg = event.getMessage();
                     if (msg.isNoteOnOrOff() && msg.getChannel() == track->getMidiOutputChannel()){
-                        monitoringNotesMidiBuffer.addEvent(msg, event.samplePosition);
+                        notesMonitoringMidiOutput->buffer.addEvent(msg, subSliceOffset + event.samplePosition);
                     }
                 }
-                notesMonitoringMidiOutput->sendBlockOfMessagesNow(monitoringNotesMidiBuffer);
             }
         }
     }
@@ -1099,6 +2067,29 @@ void Sequencer::getNextMIDISlice (int sliceNumSamples)
     }
 }
 
+void Sequencer::processTrackGroupSlice(int trackIndex, bool playheadIsPlaying)
+{
+    // Run step 7) for the track at trackIndex and for all the following tracks which share its output hardware
+    // device (clips update the MIDI CC values stored in the device, so these tracks can't run in parallel).
+    // If the track is not the first one using its device, it has already been processed in another task.
+    auto& trackObjects = tracks->objects;
+    auto device = trackObjects.getUnchecked(trackIndex)->getOutputHardwareDevice();
+    if (device != nullptr){
+        for (int i=0; i<trackIndex; i++){
+            if (trackObjects.getUnchecked(i)->getOutputHardwareDevice() == device) { return; }
+        }
+    }
+    for (int i=trackIndex; i<trackObjects.size(); i++){
+        auto track = trackObjects.getUnchecked(i);
+        if (i == trackIndex || (device != nullptr && track->getOutputHardwareDevice() == device)){
+            track->clipsPrepareSlice();
+            if (playheadIsPlaying){
+                track->clipsProcessSlice();
+            }
+        }
+    }
+}
+
 //==============================================================================
 
 GlobalSettingsStruct Sequencer::getGlobalSettings()
@@ -1132,6 +2123,26 @@ void Sequencer::timerCallback()
     
     // Update musical context stateX members
     musicalContext->updateStateMemberVersions();
+    
+    // Send rate limited state updates which were deferred and are now due
+    sendDueDeferredStateUpdates();
+    
+    // Check if MIDI output queues are dropping buffers
+    reportMidiOutputQueueStats();
+    
+    // Check if controller connections are dropping messages
+    #if USE_WS_SERVER
+    wsServer.reportSendQueueStats();
+    #endif
+    
+    #if USE_MIDI_ONLY_ENGINE
+    // Report timing stats of the MIDI-only engine
+    reportMidiOnlyEngineStats();
+    #endif
+    
+    // Check if slices can be rendered ahead of time and report slices which were not rendered in time by the lookahead worker
+    updateLookaheadSuspension();
+    reportLookaheadUnderruns();
 }
 
 //==============================================================================
@@ -1163,364 +2174,626 @@ void Sequencer::duplicateScene(int sceneN)
 
 //==============================================================================
 
-void Sequencer::processMessageFromController (const juce::String action, juce::StringArray parameters)
+void Sequencer::enqueueCommand(const SequencerCommand& command)
+{
+    // Can be called from any thread, the command will be applied by the thread rendering the slices
+    if (!commandQueue.push(command)){
+        std::cout << "WARNING, sequencer command queue is full, command dropped" << std::endl;
+    }
+}
+
+void Sequencer::pullCommands()
+{
+    // Move commands from the queue to the list of pending commands (in the order they were received). If the list of
+    // pending commands is full, the remaining commands are left in the queue until some pending commands are applied
+    while (numPendingCommands < (int)pendingCommands.size() && commandQueue.pull(pendingCommands[(size_t)numPendingCommands])){
+        numPendingCommands += 1;
+    }
+}
+
+int Sequencer::getNumSamplesUntilNextPendingCommand(int maxNumSamples)
+{
+    // Returns the number of samples until the next pending command which is not yet due (or maxNumSamples if no
+    // command is due in the next maxNumSamples samples). This is used to split the slice so that commands land at
+    // the exact sample.
+    int numSamples = maxNumSamples;
+    for (int i=0; i<numPendingCommands; i++){
+        const auto& command = pendingCommands[(size_t)i];
+        int samplesUntilCommand = 0;
+        if (command.targetSample > -1){
+            samplesUntilCommand = (int)juce::jmin((juce::int64)maxNumSamples, command.targetSample - renderedSampleCount);
+        } else if (command.targetBeat > -1.0 && musicalContext->playheadIsPlaying()){
+            double beatsUntilCommand = command.targetBeat - musicalContext->getPlayheadPositionInBeats();
+            double samplesPerBeat = 60.0 * sampleRate / musicalContext->getBpm();
+            samplesUntilCommand = (int)juce::jmin((double)maxNumSamples, std::ceil(beatsUntilCommand * samplesPerBeat - 1e-6));
+        }
+        if (samplesUntilCommand > 0){
+            numSamples = juce::jmin(numSamples, samplesUntilCommand);
+        }
+    }
+    return numSamples;
+}
+
+void Sequencer::applyDueCommands()
+{
+    // Apply pending commands which are due at the start of the current sub-slice and keep the others (in order)
+    double playheadPositionInBeats = musicalContext->getPlayheadPositionInBeats();
+    bool playheadIsPlaying = musicalContext->playheadIsPlaying();
+    int numRemainingCommands = 0;
+    for (int i=0; i<numPendingCommands; i++){
+        const auto command = pendingCommands[(size_t)i];
+        bool isDue = true;
+        if (command.targetSample > -1){
+            isDue = command.targetSample <= renderedSampleCount;
+        } else if (command.targetBeat > -1.0 && playheadIsPlaying){
+            isDue = command.targetBeat <= playheadPositionInBeats + 1e-9;
+        }
+        if (isDue){
+            applyCommand(command);
+        } else {
+            pendingCommands[(size_t)numRemainingCommands] = command;
+            numRemainingCommands += 1;
+        }
+    }
+    numPendingCommands = numRemainingCommands;
+}
+
+void Sequencer::applyCommand(const SequencerCommand& command)
+{
+    // Called from the thread rendering the slices (see applyDueCommands)
+    switch (command.type) {
+        case SequencerCommand::Type::clipPlay:
+        case SequencerCommand::Type::clipStop:
+        case SequencerCommand::Type::clipPlayStop: {
+            // Drop the command if the track/clip were removed or moved since it was sent
+            if (command.trackIndex < 0 || command.trackIndex >= tracks->objects.size()) { return; }
+            auto track = tracks->objects[command.trackIndex];
+            if (track->getHandle() != command.trackHandle) { return; }
+            if (command.clipIndex < 0 || command.clipIndex >= track->getNumberOfClips()) { return; }
+            auto clip = track->getClipAt(command.clipIndex);
+            if (clip->getHandle() != command.clipHandle) { return; }
+            if (command.type == SequencerCommand::Type::clipPlay){
+                if (!clip->isPlaying()){
+                    track->stopAllPlayingClipsExceptFor(command.clipIndex, false, true, false);
+                    clip->togglePlayStop();
+                }
+            } else if (command.type == SequencerCommand::Type::clipStop){
+                if (clip->isPlaying()){
+                    clip->togglePlayStop();
+                }
+            } else {
+                if (!clip->isPlaying()){
+                    track->stopAllPlayingClipsExceptFor(command.clipIndex, false, true, false);
+                }
+                clip->togglePlayStop();
+            }
+            break;
+        }
+        case SequencerCommand::Type::scenePlay:
+            if (command.clipIndex >= 0){
+                playScene(command.clipIndex);
+            }
+            break;
+        case SequencerCommand::Type::transportPlay:
+        case SequencerCommand::Type::transportStop:
+        case SequencerCommand::Type::transportPlayStop:
+            if (musicalContext->playheadIsPlaying()){
+                // If it is playing, stop it (unless command is "play")
+                if (command.type != SequencerCommand::Type::transportPlay){
+                    shouldToggleIsPlaying = true;
+                }
+            } else if (command.type != SequencerCommand::Type::transportStop && !musicalContext->playheadIsDoingCountIn()){
+                // If it is not playing, check if there are record-armed clips and, if so, do count-in before playing
+                bool recordCuedClipsFound = false;
+                for (auto track: tracks->objects){
+                    if (track->hasClipsCuedToRecord()){
+                        recordCuedClipsFound = true;
+                        break;
+                    }
+                }
+                if (recordCuedClipsFound){
+                    musicalContext->setPlayheadIsDoingCountIn(true);
+                } else {
+                    shouldToggleIsPlaying = true;
+                }
+            }
+            break;
+        case SequencerCommand::Type::setBpm:
+            nextBpm = command.value;
+            break;
+        case SequencerCommand::Type::setMeter:
+            if (!musicalContext->playheadIsDoingCountIn()){
+                // Don't allow chaning meter while doing count in, this could lead to severe disaster
+                nextMeter = (int)command.value;
+            }
+            break;
+    }
+}
+
+//==============================================================================
+
+void Sequencer::processMessageFromController (const ControllerMessage& message)
 {
-    if (action.startsWith(ACTION_ADDRESS_CLIP)) {
+    // Actions are resolved from their address when messages are parsed (see ControllerActions.h), so dispatching is
+    // done with switch statements instead of comparing addresses
+    const auto action = message.action;
+    const auto& parameters = message.parameters;
+    switch (message.group) {
+    case ControllerActionGroup::clip: {
+        // Tracks and clips can be referenced by handle or by UUID
         jassert(parameters.size() >= 2);
-        juce::String trackUUID = parameters[0];
-        juce::String clipUUID = parameters[1];
-        auto* track = getTrackWithUUID(trackUUID);
-        if (track != nullptr){
-            auto* clip = track->getClipWithUUID(clipUUID);
-            if (clip != nullptr){
-                if (action == ACTION_ADDRESS_CLIP_PLAY){
-                    if (!clip->isPlaying()){
-                        track->stopAllPlayingClipsExceptFor(clipUUID, false, true, false);
-                        clip->togglePlayStop();
+        auto* track = getTrackWithHandleOrUUID(parameters[0]);
+        if (track == nullptr) { break; }
+        auto* clip = track->getClipWithHandleOrUUID(parameters[1]);
+        if (clip == nullptr) { break; }
+        switch (action) {
+            case ControllerAction::clipPlay:
+            case ControllerAction::clipStop:
+            case ControllerAction::clipPlayStop: {
+                // Clip cues are changed by the RT thread (see applyCommand). An optional 3rd parameter sets the
+                // global playhead position (in beats) at which the command should be applied
+                // NOTE: play/stop cues are quantized to the next bar, so when rendering ahead of time these don't change
+                // slices which have already been rendered (no need to discard the lookahead window)
+                SequencerCommand command;
+                if (action == ControllerAction::clipPlay){
+                    command.type = SequencerCommand::Type::clipPlay;
+                } else if (action == ControllerAction::clipStop){
+                    command.type = SequencerCommand::Type::clipStop;
+                } else {
+                    command.type = SequencerCommand::Type::clipPlayStop;
+                }
+                command.trackIndex = tracks->objects.indexOf(track);
+                command.clipIndex = track->getIndexOfClipWithUUID(clip->getUUID());
+                command.trackHandle = track->getHandle();
+                command.clipHandle = clip->getHandle();
+                command.targetBeat = parameters.size() > 2 ? parameters[2].getDoubleValue() : -1.0;
+                enqueueCommand(command);
+                break;
+            }
+            case ControllerAction::clipRecordOnOff:
+                if (!clip->isPlaying()){
+                    track->stopAllPlayingClipsExceptFor(clip->getUUID(), false, true, false);
+                }
+                clip->toggleRecord();
+                // Stop rendering slices ahead of time before recording starts
+                updateLookaheadSuspension();
+                break;
+            case ControllerAction::clipClear:
+                editClipSequence(clip, [clip]{ clip->clearClip(); });
+                break;
+            case ControllerAction::clipDouble:
+                editClipSequence(clip, [clip]{ clip->doubleSequence(); });
+                break;
+            case ControllerAction::clipUndo:
+                editClipSequence(clip, [clip]{ clip->undo(); });
+                break;
+            case ControllerAction::clipQuantize: {
+                jassert(parameters.size() == 3);
+                double quantizationStep = (double)parameters[2].getFloatValue();
+                clip->quantizeSequence(quantizationStep);
+                break;
+            }
+            case ControllerAction::clipSetLength: {
+                jassert(parameters.size() == 3);
+                double newLength = (double)parameters[2].getFloatValue();
+                clip->setClipLength(newLength);
+                break;
+            }
+            case ControllerAction::clipSetBpmMultiplier: {
+                jassert(parameters.size() == 3);
+                double newBpmMultiplier = (double)parameters[2].getFloatValue();
+                clip->setBpmMultiplier(newBpmMultiplier);
+                break;
+            }
+            case ControllerAction::clipSetSequence: {
+                // New sequence data is passed in JSON format, eg:
+                /*{
+                   "clipLength": 6,
+                   "sequenceEvents": [
+                     {"type": 1, "midiNote": 79, "midiVelocity": 1.0, "timestamp": 0.29, "duration": 0.65},  // type 1 = note event
+                     {"type": 1, "midiNote": 73, "midiVelocity": 1.0, "timestamp": 2.99, "duration": 1.42},
+                     {"type": 0, "eventMidiBytes": "73,21,56", "timestamp": 2.99},  // type 0 = generic midi message
+                     ...
+                   ]
+                }*/
+                // Events are decoded directly from the JSON string, without building a juce::var tree first (see
+                // SequenceJsonParser.h)
+                SequenceJsonParser::SetSequence sequenceData;
+                if (!SequenceJsonParser::parseSetSequence(std::string_view(parameters[2].toRawUTF8(), parameters[2].getNumBytesAsUTF8()), sequenceData)){
+                    DBG("Malformed sequence data received from controller");
+                    break;
+                }
+                juce::Array<juce::ValueTree> newSequenceEvents;
+                newSequenceEvents.ensureStorageAllocated((int)sequenceData.sequenceEvents.size());
+                for (const auto& eventData: sequenceData.sequenceEvents){
+                    if (eventData.type == SequenceEventType::note){
+                        newSequenceEvents.add(ShepherdHelpers::createSequenceEventOfTypeNote(eventData.timestamp, eventData.midiNote, eventData.midiVelocity, eventData.duration));
+                    } else if (eventData.type == SequenceEventType::midi){
+                        newSequenceEvents.add(ShepherdHelpers::createSequenceEventFromMidiBytesString(eventData.timestamp, juce::String::fromUTF8(eventData.eventMidiBytes.data(), (int)eventData.eventMidiBytes.size())));
                     }
-                } else if (action == ACTION_ADDRESS_CLIP_STOP){
-                    if (clip->isPlaying()){
-                        clip->togglePlayStop();
+                }
+                // Replace all existing events and the length in a single transaction
+                editClipSequence(clip, [&]{ clip->replaceSequenceEvents(newSequenceEvents, sequenceData.clipLength); });
+                break;
+            }
+            case ControllerAction::clipEditSequence: {
+                // New sequence data is passed in JSON format, eg:
+                /*{
+                   "action": "removeEvent" | "editEvent" | "addEvent",  // One of these three options
+                   "eventUUID":  "356cbbdjgf...", // Used by "removeEvent" and "editEvent" only
+                   "eventHandle": 123,  // Can be used instead of "eventUUID"
+                   "eventData": {
+                        "type": 1,
+                        "midiNote": 79,
+                        "midiVelocity": 1.0,
+                        ... // All the event properties that should be updated or "added" (in case of a new event)
                     }
-                } else if (action == ACTION_ADDRESS_CLIP_PLAY_STOP){
-                    if (!clip->isPlaying()){
-                        track->stopAllPlayingClipsExceptFor(clipUUID, false, true, false);
+                }*/
+                using Event = SequenceJsonParser::Event;
+                SequenceJsonParser::EditSequence editSequenceData;
+                if (!SequenceJsonParser::parseEditSequence(std::string_view(parameters[2].toRawUTF8(), parameters[2].getNumBytesAsUTF8()), editSequenceData)){
+                    DBG("Malformed sequence edit data received from controller");
+                    break;
+                }
+                const auto& editAction = editSequenceData.action;
+                const auto& eventData = editSequenceData.eventData;
+                if (editAction == "removeEvent" || editAction == "editEvent"){
+                    juce::ValueTree sequenceEvent;
+                    if (editSequenceData.hasEventHandle){
+                        sequenceEvent = clip->getSequenceEventWithHandle(editSequenceData.eventHandle);
+                    } else {
+                        sequenceEvent = clip->getSequenceEventWithUUID(juce::String::fromUTF8(editSequenceData.eventUUID.data(), (int)editSequenceData.eventUUID.size()));
                     }
-                    clip->togglePlayStop();
-                } else if (action == ACTION_ADDRESS_CLIP_RECORD_ON_OFF){
-                    if (!clip->isPlaying()){
-                        track->stopAllPlayingClipsExceptFor(clipUUID, false, true, false);
+                    if (!sequenceEvent.isValid()){
+                        break;
                     }
-                    clip->toggleRecord();
-                } else if (action == ACTION_ADDRESS_CLIP_CLEAR){
-                    clip->clearClip();
-                } else if (action == ACTION_ADDRESS_CLIP_DOUBLE){
-                    clip->doubleSequence();
-                } else if (action == ACTION_ADDRESS_CLIP_UNDO){
-                    clip->undo();
-                } else if (action == ACTION_ADDRESS_CLIP_QUANTIZE){
-                    jassert(parameters.size() == 3);
-                    double quantizationStep = (double)parameters[2].getFloatValue();
-                    clip->quantizeSequence(quantizationStep);
-                } else if (action == ACTION_ADDRESS_CLIP_SET_LENGTH){
-                    jassert(parameters.size() == 3);
-                    double newLength = (double)parameters[2].getFloatValue();
-                    clip->setClipLength(newLength);
-                } else if (action == ACTION_ADDRESS_CLIP_SET_BPM_MULTIPLIER){
-                    jassert(parameters.size() == 3);
-                    double newBpmMultiplier = (double)parameters[2].getFloatValue();
-                    clip->setBpmMultiplier(newBpmMultiplier);
-                } else if (action == ACTION_ADDRESS_CLIP_SET_SEQUENCE) {
-                    // New sequence data is passed in JSON format, eg:
-                    /*{
-                       "clipLength": 6,
-                       "sequenceEvents": [
-                         {"type": 1, "midiNote": 79, "midiVelocity": 1.0, "timestamp": 0.29, "duration": 0.65},  // type 1 = note event
-                         {"type": 1, "midiNote": 73, "midiVelocity": 1.0, "timestamp": 2.99, "duration": 1.42},
-                         {"type": 0, "eventMidiBytes": "73,21,56", "timestamp": 2.99},  // type 0 = generic midi message
-                         ...
-                       ]
-                    }*/
-                    juce::var sequenceData = juce::JSON::parse(parameters[2]);
-                    // Remove all existing notes from sequence and set length to new clip length
-                    clip->clearClipSequence();
-                    clip->setClipLength((double)sequenceData["clipLength"]);
-                    // Add new sequence events to the sequence
-                    juce::Array<juce::var>* sequenceEvents = sequenceData["sequenceEvents"].getArray();
-                    for (juce::var eventData: *sequenceEvents){
-                        if ((int)eventData["type"] == SequenceEventType::note){
-                            double timestamp = (double)eventData["timestamp"];
-                            int midiNote = (int)eventData["midiNote"];
-                            float midiVelocity = (float)eventData["midiVelocity"];
-                            double duration = (double)eventData["duration"];
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventOfTypeNote(timestamp, midiNote, midiVelocity, duration), -1, nullptr);
-                        } else if ((int)eventData["type"] == SequenceEventType::midi){
-                            double timestamp = (double)eventData["timestamp"];
-                            juce::String eventMidiBytes = eventData["eventMidiBytes"].toString();
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventFromMidiBytesString(timestamp, eventMidiBytes), -1, nullptr);
+                    if (editAction == "removeEvent"){
+                        clip->removeSequenceEvent(sequenceEvent);
+                    } else if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
+                        if (eventData.has(Event::midiNoteField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::midiNote, eventData.midiNote, nullptr);
                         }
-                    }
-                } else if (action == ACTION_ADDRESS_CLIP_EDIT_SEQUENCE) {
-                    // New sequence data is passed in JSON format, eg:
-                    /*{
-                       "action": "removeEvent" | "editEvent" | "addEvent",  // One of these three options
-                       "eventUUID":  "356cbbdjgf...", // Used by "removeEvent" and "editEvent" only
-                       "eventData": {
-                            "type": 1,
-                            "midiNote": 79,
-                            "midiVelocity": 1.0,
-                            ... // All the event properties that should be updated or "added" (in case of a new event)
+                        if (eventData.has(Event::midiVelocityField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::midiVelocity, eventData.midiVelocity, nullptr);
                         }
-                    }*/
-                    juce::var editSequenceData = juce::JSON::parse(parameters[2]);
-                    juce::String editAction = editSequenceData["action"].toString();
-                    if (editAction == "removeEvent"){
-                        clip->removeSequenceEventWithUUID(editSequenceData["eventUUID"]);
-                    } else if (editAction == "editEvent"){
-                        juce::ValueTree sequenceEvent = clip->getSequenceEventWithUUID(editSequenceData["eventUUID"]);
-                        if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::note){
-                            juce::var eventData = editSequenceData["eventData"];
-                            if (eventData.hasProperty("midiNote")) {
-                                sequenceEvent.setProperty(ShepherdIDs::midiNote, (int)eventData["midiNote"], nullptr);
-                            }
-                            if (eventData.hasProperty("midiVelocity")) {
-                                sequenceEvent.setProperty(ShepherdIDs::midiVelocity, (float)eventData["midiVelocity"], nullptr);
-                            }
-                            if (eventData.hasProperty("chance")) {
-                                sequenceEvent.setProperty(ShepherdIDs::chance, (float)eventData["chance"], nullptr);
-                            }
-                            if (eventData.hasProperty("timestamp")) {
-                                sequenceEvent.setProperty(ShepherdIDs::timestamp, (double)eventData["timestamp"], nullptr);
-                            }
-                            if (eventData.hasProperty("utime")) {
-                                sequenceEvent.setProperty(ShepherdIDs::uTime, (double)eventData["utime"], nullptr);
-                            }
-                            if (eventData.hasProperty("duration")) {
-                                sequenceEvent.setProperty(ShepherdIDs::duration, (double)eventData["duration"], nullptr);
-                            }
-                        } else if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::midi){
-                            juce::var eventData = editSequenceData["eventData"];
-                            if (eventData.hasProperty("timestamp")) {
-                                sequenceEvent.setProperty(ShepherdIDs::timestamp, (double)eventData["timestamp"], nullptr);
-                            }
-                            if (eventData.hasProperty("utime")) {
-                                sequenceEvent.setProperty(ShepherdIDs::uTime, (double)eventData["utime"], nullptr);
-                            }
-                            if (eventData.hasProperty("eventMidiBytes")) {
-                                sequenceEvent.setProperty(ShepherdIDs::eventMidiBytes, (float)eventData["eventMidiBytes"], nullptr);
-                            }
+                        if (eventData.has(Event::chanceField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::chance, eventData.chance, nullptr);
+                        }
+                        if (eventData.has(Event::timestampField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::timestamp, eventData.timestamp, nullptr);
+                        }
+                        if (eventData.has(Event::utimeField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::uTime, eventData.utime, nullptr);
+                        }
+                        if (eventData.has(Event::durationField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::duration, eventData.duration, nullptr);
+                        }
+                    } else if ((int)sequenceEvent.getProperty(ShepherdIDs::type) == SequenceEventType::midi){
+                        if (eventData.has(Event::timestampField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::timestamp, eventData.timestamp, nullptr);
                         }
-                    } else if (editAction == "addEvent") {
-                        // Create new sequence event
-                        juce::var eventData = editSequenceData["eventData"];
-                        if ((int)eventData["type"] == SequenceEventType::note){
-                            double timestamp = (double)eventData["timestamp"];
-                            int midiNote = (int)eventData["midiNote"];
-                            float midiVelocity = (float)eventData["midiVelocity"];
-                            double duration = (double)eventData["duration"];
-                            double utime = (double)eventData["utime"];
-                            float chance = (float)eventData["chance"];
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventOfTypeNote(timestamp, midiNote, midiVelocity, duration, utime, chance), -1, nullptr);
-                        } else if ((int)eventData["type"] == SequenceEventType::midi){
-                            double timestamp = (double)eventData["timestamp"];
-                            juce::String eventMidiBytes = eventData["eventMidiBytes"].toString();
-                            double utime = (double)eventData["utime"];
-                            clip->state.addChild(ShepherdHelpers::createSequenceEventFromMidiBytesString(timestamp, eventMidiBytes, utime), -1, nullptr);
+                        if (eventData.has(Event::utimeField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::uTime, eventData.utime, nullptr);
                         }
+                        if (eventData.has(Event::eventMidiBytesField)) {
+                            sequenceEvent.setProperty(ShepherdIDs::eventMidiBytes, juce::String::fromUTF8(eventData.eventMidiBytes.data(), (int)eventData.eventMidiBytes.size()), nullptr);
+                        }
+                    }
+                } else if (editAction == "addEvent") {
+                    // Create new sequence event
+                    if (eventData.type == SequenceEventType::note){
+                        clip->state.addChild(ShepherdHelpers::createSequenceEventOfTypeNote(eventData.timestamp, eventData.midiNote, eventData.midiVelocity, eventData.duration, eventData.utime, eventData.chance), -1, nullptr);
+                    } else if (eventData.type == SequenceEventType::midi){
+                        clip->state.addChild(ShepherdHelpers::createSequenceEventFromMidiBytesString(eventData.timestamp, juce::String::fromUTF8(eventData.eventMidiBytes.data(), (int)eventData.eventMidiBytes.size()), eventData.utime), -1, nullptr);
                     }
                 }
+                break;
+            }
+            case ControllerAction::clipQueryEvents: {
+                // Parameters: track, clip, startBeat, endBeat and, optionally, minMidiNote, maxMidiNote, type
+                // (SequenceEventType, -1 for all) and maxEvents (-1 for no limit). The reply is only sent to the
+                // controller which made the query (see sendClipEventsQueryResult)
+                jassert(parameters.size() >= 4);
+                Clip::EventsQuery query;
+                query.startBeat = parameters[2].getDoubleValue();
+                query.endBeat = parameters[3].getDoubleValue();
+                if (parameters.size() > 5){
+                    query.minMidiNote = parameters[4].getIntValue();
+                    query.maxMidiNote = parameters[5].getIntValue();
+                }
+                if (parameters.size() > 6){
+                    query.type = parameters[6].getIntValue();
+                }
+                if (parameters.size() > 7){
+                    query.maxEvents = parameters[7].getIntValue();
+                }
+                sendClipEventsQueryResult(message.sender, clip, query);
+                break;
             }
+            default:
+                break;
         }
+        break;
+    }
         
-    } else if (action.startsWith(ACTION_ADDRESS_TRACK)) {
+    case ControllerActionGroup::track: {
+        // Tracks can be referenced by handle or by UUID
         jassert(parameters.size() >= 1);
-        juce::String trackUUID = parameters[0];
-        auto* track = getTrackWithUUID(trackUUID);
-        if (track != nullptr){
-            if (action == ACTION_ADDRESS_TRACK_SET_INPUT_MONITORING){
+        auto* track = getTrackWithHandleOrUUID(parameters[0]);
+        if (track == nullptr) { break; }
+        switch (action) {
+            case ControllerAction::trackSetInputMonitoring: {
                 jassert(parameters.size() == 2);
                 bool trueFalse = parameters[1].getIntValue() == 1;
                 track->setInputMonitoring(trueFalse);
-            } else if (action == ACTION_ADDRESS_TRACK_SET_ACTIVE_UI_NOTES_MONITORING_TRACK){
-                activeUiNotesMonitoringTrack = trackUUID;
-            } else if (action == ACTION_ADDRESS_TRACK_SET_HARDWARE_DEVICE){
+                break;
+            }
+            case ControllerAction::trackSetActiveUiNotesMonitoringTrack:
+                activeUiNotesMonitoringTrack = track->getUUID();
+                break;
+            case ControllerAction::trackSetHardwareDevice: {
                 jassert(parameters.size() == 2);
-                juce::String deviceName = parameters[1];
-                track->setOutputHardwareDeviceByName(deviceName); // if device can't be found, it won't set it 
+                // Device can be referenced by handle or by name. If device can't be found, it won't set it
+                auto* device = getHardwareDeviceWithHandleOrName(parameters[1], HardwareDeviceType::output);
+                if (device != nullptr){
+                    track->setOutputHardwareDevice(device);
+                }
+                break;
             }
+            default:
+                break;
         }
+        break;
+    }
                
-    } else if (action.startsWith(ACTION_ADDRESS_DEVICE)) {
+    case ControllerActionGroup::device: {
+        // Devices can be referenced by handle or by name
         jassert(parameters.size() >= 1);
-        juce::String deviceName = parameters[0];
-        if (action == ACTION_ADDRESS_DEVICE_SEND_ALL_NOTES_OFF_TO_DEVICE){
-            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::output);
-            if (device == nullptr) return;
-            device->sendAllNotesOff();
-        } else if (action == ACTION_ADDRESS_DEVICE_LOAD_DEVICE_PRESET){
-            jassert(parameters.size() == 3);
-            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::output);
-            if (device == nullptr) return;
-            int bank = parameters[1].getIntValue();
-            int preset = parameters[2].getIntValue();
-            device->loadPreset(bank, preset);
-        } else if (action == ACTION_ADDRESS_DEVICE_SEND_MIDI){
-            jassert(parameters.size() == 4);
-            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::output);
-            if (device == nullptr) return;
-            juce::MidiMessage msg = juce::MidiMessage(parameters[1].getIntValue(), parameters[2].getIntValue(), parameters[3].getIntValue());
-            device->sendMidi(msg);
-        } else if (action == ACTION_ADDRESS_DEVICE_SET_NOTES_MAPPING){
-            jassert(parameters.size() == 2);
-            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::input);
-            if (device == nullptr) return;
-            juce::String serializedMapping = parameters[1];  // 128 ints serialized into string, separated by comas
-            device->setNotesMapping(serializedMapping);
-        } else if (action == ACTION_ADDRESS_DEVICE_SET_CC_MAPPING){
-            jassert(parameters.size() == 2);
-            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::input);
-            if (device == nullptr) return;
-            juce::String serializedMapping = parameters[1];  // 128 ints serialized into string, separated by comas
-            device->setControlChangeMapping(serializedMapping);
-        } else if (action == ACTION_ADDRESS_DEVICE_SET_MIDI_CHANNEL){
-            jassert(parameters.size() == 2);
-            auto device = getHardwareDeviceByName(deviceName, HardwareDeviceType::output);
-            if (device == nullptr) return;
-            int newChannel = parameters[1].getIntValue();
-            if (newChannel >= 1 && newChannel <= 16) {
-                device->state.setProperty(ShepherdIDs::midiChannel, newChannel, nullptr);
+        juce::String deviceReference = parameters[0];
+        switch (action) {
+            case ControllerAction::deviceSendAllNotesOff: {
+                auto device = getHardwareDeviceWithHandleOrName(deviceReference, HardwareDeviceType::output);
+                if (device == nullptr) return;
+                device->sendAllNotesOff();
+                break;
+            }
+            case ControllerAction::deviceLoadDevicePreset: {
+                jassert(parameters.size() == 3);
+                auto device = getHardwareDeviceWithHandleOrName(deviceReference, HardwareDeviceType::output);
+                if (device == nullptr) return;
+                int bank = parameters[1].getIntValue();
+                int preset = parameters[2].getIntValue();
+                device->loadPreset(bank, preset);
+                break;
+            }
+            case ControllerAction::deviceSendMidi: {
+                jassert(parameters.size() == 4);
+                auto device = getHardwareDeviceWithHandleOrName(deviceReference, HardwareDeviceType::output);
+                if (device == nullptr) return;
+                juce::MidiMessage msg = juce::MidiMessage(parameters[1].getIntValue(), parameters[2].getIntValue(), parameters[3].getIntValue());
+                device->sendMidi(msg);
+                break;
+            }
+            case ControllerAction::deviceSetNotesMapping: {
+                jassert(parameters.size() == 2);
+                auto device = getHardwareDeviceWithHandleOrName(deviceReference, HardwareDeviceType::input);
+                if (device == nullptr) return;
+                juce::String serializedMapping = parameters[1];  // 128 ints serialized into string, separated by comas
+                device->setNotesMapping(serializedMapping);
+                break;
+            }
+            case ControllerAction::deviceSetCCMapping: {
+                jassert(parameters.size() == 2);
+                auto device = getHardwareDeviceWithHandleOrName(deviceReference, HardwareDeviceType::input);
+                if (device == nullptr) return;
+                juce::String serializedMapping = parameters[1];  // 128 ints serialized into string, separated by comas
+                device->setControlChangeMapping(serializedMapping);
+                break;
+            }
+            case ControllerAction::deviceSetMidiChannel: {
+                jassert(parameters.size() == 2);
+                auto device = getHardwareDeviceWithHandleOrName(deviceReference, HardwareDeviceType::output);
+                if (device == nullptr) return;
+                int newChannel = parameters[1].getIntValue();
+                if (newChannel >= 1 && newChannel <= 16) {
+                    device->state.setProperty(ShepherdIDs::midiChannel, newChannel, nullptr);
+                }
+                break;
             }
+            default:
+                break;
         }
+        break;
+    }
     
-    } else if (action.startsWith(ACTION_ADDRESS_SCENE)) {
-        jassert(parameters.size() == 1);
+    case ControllerActionGroup::scene: {
+        jassert(parameters.size() >= 1);
         int sceneNum = parameters[0].getIntValue();
-        if (action == ACTION_ADDRESS_SCENE_PLAY){
-            playScene(sceneNum);
-        } else if (action == ACTION_ADDRESS_SCENE_DUPLICATE){
+        if (action == ControllerAction::scenePlay){
+            SequencerCommand command;
+            command.type = SequencerCommand::Type::scenePlay;
+            command.clipIndex = sceneNum;
+            command.targetBeat = parameters.size() > 1 ? parameters[1].getDoubleValue() : -1.0;
+            enqueueCommand(command);
+        } else if (action == ControllerAction::sceneDuplicate){
             duplicateScene(sceneNum);
         }
+        break;
+    }
          
-    } else if (action.startsWith(ACTION_ADDRESS_TRANSPORT)) {
-        if (action == ACTION_ADDRESS_TRANSPORT_PLAY_STOP){
-            jassert(parameters.size() == 0);
-            if (musicalContext->playheadIsPlaying()){
-                // If it is playing, stop it
-                shouldToggleIsPlaying = true;
-            } else{
-                // If it is not playing, check if there are record-armed clips and, if so, do count-in before playing
-                bool recordCuedClipsFound = false;
-                for (auto track: tracks->objects){
-                    if (track->hasClipsCuedToRecord()){
-                        recordCuedClipsFound = true;
-                        break;
-                    }
+    case ControllerActionGroup::transport: {
+        // Transport and tempo changes are applied by the RT thread (see applyCommand). An optional last parameter sets
+        // the global playhead position (in beats) at which the command should be applied
+        SequencerCommand command;
+        switch (action) {
+            case ControllerAction::transportPlayStop:
+            case ControllerAction::transportStop:
+                jassert(parameters.size() <= 1);
+                command.type = action == ControllerAction::transportStop ? SequencerCommand::Type::transportStop : SequencerCommand::Type::transportPlayStop;
+                command.targetBeat = parameters.size() > 0 ? parameters[0].getDoubleValue() : -1.0;
+                enqueueCommand(command);
+                if (musicalContext->playheadIsPlaying() && parameters.size() == 0){
+                    // Stopping takes effect immediately, don't play the slices already rendered ahead
+                    // NOTE: slices are discarded after enqueuing the command, so that the slice rendered next applies it
+                    discardLookahead();
                 }
-                if (recordCuedClipsFound){
-                    musicalContext->setPlayheadIsDoingCountIn(true);
-                } else {
-                    shouldToggleIsPlaying = true;
+                break;
+            case ControllerAction::transportPlay:
+                jassert(parameters.size() <= 1);
+                command.type = SequencerCommand::Type::transportPlay;
+                command.targetBeat = parameters.size() > 0 ? parameters[0].getDoubleValue() : -1.0;
+                enqueueCommand(command);
+                break;
+            case ControllerAction::transportSetBpm: {
+                jassert(parameters.size() >= 1);
+                float newBpm = parameters[0].getFloatValue();
+                if (newBpm > 0.0 && newBpm < 400.0){
+                    command.type = SequencerCommand::Type::setBpm;
+                    command.value = (double)newBpm;
+                    command.targetBeat = parameters.size() > 1 ? parameters[1].getDoubleValue() : -1.0;
+                    enqueueCommand(command);
                 }
+                break;
             }
-        } else if (action == ACTION_ADDRESS_TRANSPORT_PLAY){
-            jassert(parameters.size() == 0);
-            if (musicalContext->playheadIsPlaying()){
-                // If it is playing, do nothing
-            } else{
-                // If it is not playing, check if there are record-armed clips and, if so, do count-in before playing
-                bool recordCuedClipsFound = false;
-                for (auto track: tracks->objects){
-                    if (track->hasClipsCuedToRecord()){
-                        recordCuedClipsFound = true;
-                        break;
-                    }
-                }
-                if (recordCuedClipsFound){
-                    musicalContext->setPlayheadIsDoingCountIn(true);
-                } else {
-                    shouldToggleIsPlaying = true;
+            case ControllerAction::transportSetMeter: {
+                jassert(parameters.size() >= 1);
+                int newMeter = parameters[0].getIntValue();
+                if (newMeter > 0){
+                    command.type = SequencerCommand::Type::setMeter;
+                    command.value = (double)newMeter;
+                    command.targetBeat = parameters.size() > 1 ? parameters[1].getDoubleValue() : -1.0;
+                    enqueueCommand(command);
                 }
+                break;
             }
-        } else if (action == ACTION_ADDRESS_TRANSPORT_STOP){
-            jassert(parameters.size() == 0);
-            if (musicalContext->playheadIsPlaying()){
-                // If it is playing, stop it
-                shouldToggleIsPlaying = true;
-            } else{
-                // If it is not playing, do nothing
-            }
-        } else if (action == ACTION_ADDRESS_TRANSPORT_SET_BPM){
-            jassert(parameters.size() == 1);
-            float newBpm = parameters[0].getFloatValue();
-            if (newBpm > 0.0 && newBpm < 400.0){
-                nextBpm = (double)newBpm;
-            }
-        } else if (action == ACTION_ADDRESS_TRANSPORT_SET_METER){
-            jassert(parameters.size() == 1);
-            int newMeter = parameters[0].getIntValue();
-            if (newMeter > 0 && !musicalContext->playheadIsDoingCountIn()){
-                // Don't allow chaning meter while doing count in, this could lead to severe disaster
-                nextMeter = newMeter;
-            }
+            default:
+                break;
         }
+        break;
+    }
         
-    } else if (action.startsWith(ACTION_ADDRESS_METRONOME)) {
-        if (action == ACTION_ADDRESS_METRONOME_ON){
-            jassert(parameters.size() == 0);
+    case ControllerActionGroup::metronome:
+        jassert(parameters.size() == 0);
+        if (action == ControllerAction::metronomeOn){
             musicalContext->setMetronome(true);
-        } else if (action == ACTION_ADDRESS_METRONOME_OFF){
-            jassert(parameters.size() == 0);
+        } else if (action == ControllerAction::metronomeOff){
             musicalContext->setMetronome(false);
-        } else if (action == ACTION_ADDRESS_METRONOME_ON_OFF){
-            jassert(parameters.size() == 0);
+        } else if (action == ControllerAction::metronomeOnOff){
             musicalContext->toggleMetronome();
         }
+        break;
         
-    } else if (action.startsWith(ACTION_ADDRESS_SETTINGS)) {
-        if (action == ACTION_ADDRESS_SETTINGS_LOAD_SESSION) {
-            jassert(parameters.size() == 1);
-            juce::String filePath = parameters[0];
-            loadSessionFromFile(filePath);
-            
-        } else if (action == ACTION_ADDRESS_SETTINGS_SAVE_SESSION){
-            jassert(parameters.size() == 1);
-            juce::String filePath = parameters[0];
-            saveCurrentSessionToFile(filePath);
+    case ControllerActionGroup::settings:
+        switch (action) {
+            case ControllerAction::settingsLoadSession: {
+                jassert(parameters.size() == 1);
+                juce::String filePath = parameters[0];
+                loadSessionFromFile(filePath);
+                break;
+            }
+            case ControllerAction::settingsSaveSession: {
+                jassert(parameters.size() == 1);
+                juce::String filePath = parameters[0];
+                saveCurrentSessionToFile(filePath);
+                break;
+            }
+            case ControllerAction::settingsNewSession: {
+                jassert(parameters.size() == 2);
+                int numTracks = parameters[0].getIntValue();
+                int numScenes = parameters[1].getIntValue();
+                loadNewEmptySession(numTracks, numScenes);
+                break;
+            }
+            case ControllerAction::settingsFixedVelocity:
+                jassert(parameters.size() == 1);
+                fixedVelocity = parameters[0].getIntValue();
+                break;
+            case ControllerAction::settingsFixedLength:
+                jassert(parameters.size() == 1);
+                fixedLengthRecordingBars = parameters[0].getIntValue();
+                
+                // If there are empty clips cued to record and playhead is stopped, also update their length
+                for (int track_num=0; track_num<tracks->objects.size(); track_num++){
+                    auto track = tracks->objects[track_num];
+                    for (int clip_num=0; clip_num<track->getNumberOfClips(); clip_num++){
+                        auto clip = track->getClipAt(clip_num);
+                        if (!clip->hasSequenceEvents() && clip->isCuedToStartRecording() && !clip->isRecording() && !clip->isPlaying()){
+                            clip->setClipLengthToGlobalFixedLength();
+                        }
+                    }
+                }
+                break;
+            case ControllerAction::settingsToggleRecordAutomation:
+                jassert(parameters.size() == 0);
+                recordAutomationEnabled = !recordAutomationEnabled;
+                break;
+            case ControllerAction::settingsToggleDebugSynth:
+                renderWithInternalSynth = !renderWithInternalSynth;
+                break;
+            default:
+                break;
+        }
+        break;
         
-        } else if (action == ACTION_ADDRESS_SETTINGS_NEW_SESSION){
-            jassert(parameters.size() == 2);
-            int numTracks = parameters[0].getIntValue();
-            int numScenes = parameters[1].getIntValue();
-            loadNewEmptySession(numTracks, numScenes);
-            
-        } else if (action == ACTION_ADDRESS_SETTINGS_FIXED_VELOCITY){
-            jassert(parameters.size() == 1);
-            fixedVelocity = parameters[0].getIntValue();
-        } else if (action == ACTION_ADDRESS_SETTINGS_FIXED_LENGTH){
-            jassert(parameters.size() == 1);
-            fixedLengthRecordingBars = parameters[0].getIntValue();
-            
-            // If there are empty clips cued to record and playhead is stopped, also update their length
-            for (int track_num=0; track_num<tracks->objects.size(); track_num++){
-                auto track = tracks->objects[track_num];
-                for (int clip_num=0; clip_num<track->getNumberOfClips(); clip_num++){
-                    auto clip = track->getClipAt(clip_num);
-                    if (!clip->hasSequenceEvents() && clip->isCuedToStartRecording() && !clip->isRecording() && !clip->isPlaying()){
-                        clip->setClipLengthToGlobalFixedLength();
+    case ControllerActionGroup::other:
+        if (action == ControllerAction::getState) {
+            jassert(parameters.size() >= 1);
+            // Replies are only sent to the connection which requested the state
+            juce::String stateType = parameters[0];
+            if (stateType.startsWith("since:")){
+                // Resync of a controller which missed some state updates (e.g. after a dropped message or a short
+                // disconnection): replay the batches it missed if these are still in the history, otherwise send the
+                // full state
+                stateUpdateJournal.flush();
+                if (!replayStateUpdates(message.sender, stateType.fromFirstOccurrenceOf("since:", false, false).getIntValue())){
+                    stateType = "full";
+                }
+            }
+            if (stateType == "snapshot"){
+                // Same as "full" but serialized in the background and sent in chunks, optionally compressed
+                stateUpdateJournal.flush();
+                sendStateSnapshot(message.sender, parameters[1] == "gzip");
+            } else if (stateType == "full"){
+                stateUpdateJournal.flush();  // Pending updates are sent first, full state has the ID of the next batch
+                juce::OSCMessage returnMessage = juce::OSCMessage(ACTION_ADDRESS_FULL_STATE);
+                returnMessage.addInt32(stateUpdateID);
+                sendMessageToConnection(message.sender, returnMessage, state);  // State is sent as XML or binary depending on protocol
+            } else if (stateType == "playheads"){
+                // Cheap resync of the playhead positions extrapolated by the controller (see PlayheadAnchor): current
+                // time, global playhead position and uuid/position pairs for the clips that are playing
+                stateUpdateJournal.flush();  // Pending anchors are sent first so these are not re-applied after resync
+                juce::OSCMessage returnMessage = juce::OSCMessage(ACTION_ADDRESS_PLAYHEADS);
+                returnMessage.addString(juce::String(juce::Time::currentTimeMillis()));
+                returnMessage.addFloat32((float)musicalContext->getPlayheadPositionInBeats());
+                for (auto track: tracks->objects){
+                    for (int i=0; i<track->getNumberOfClips(); i++){
+                        auto clip = track->getClipAt(i);
+                        if (clip->isPlaying()){
+                            returnMessage.addString(clip->getUUID());
+                            returnMessage.addFloat32((float)clip->getPlayheadPosition());
+                        }
                     }
                 }
+                sendMessageToConnection(message.sender, returnMessage);
             }
-            
-        } else if (action == ACTION_ADDRESS_TRANSPORT_RECORD_AUTOMATION){
+        } else if (action == ControllerAction::shepherdControllerReady) {
             jassert(parameters.size() == 0);
-            recordAutomationEnabled = !recordAutomationEnabled;
-        
-        } else if (action == ACTION_ADDRESS_SETTINGS_TOGGLE_DEBUG_SYNTH){
-            renderWithInternalSynth = !renderWithInternalSynth;
+            // Set midi in connection to false so the method to initialize midi in is retrieggered at next timer call
+            // This is to prevent issues caused by the order in which frontend and backend are started (if using virtual midi
+            // devices in the contorller app that should be connected here, these will need reconnection after controller
+            // restarts)
+            shouldTryInitializeMidiInputs = true;
+            
+            // Also in dev mode trigger reload ui
+            #if JUCE_DEBUG
+            juce::Time::waitForMillisecondCounter(juce::Time::getMillisecondCounter() + 2000);
+            sendActionMessage(ACTION_UPDATE_DEVUI_RELOAD_BROWSER);
+            #endif
         }
+        break;
         
-    } else if (action == ACTION_ADDRESS_GET_STATE) {
-        jassert(parameters.size() == 1);
-        juce::String stateType = parameters[0];
-        if (stateType == "full"){
-            juce::OSCMessage returnMessage = juce::OSCMessage(ACTION_ADDRESS_FULL_STATE);
-            returnMessage.addInt32(stateUpdateID);
-            returnMessage.addString(state.toXmlString(juce::XmlElement::TextFormat().singleLine()));
-            sendMessageToController(returnMessage);
-        }
-    } else if (action == ACTION_ADDRESS_SHEPHERD_CONTROLLER_READY) {
-        jassert(parameters.size() == 0);
-        // Set midi in connection to false so the method to initialize midi in is retrieggered at next timer call
-        // This is to prevent issues caused by the order in which frontend and backend are started (if using virtual midi
-        // devices in the contorller app that should be connected here, these will need reconnection after controller
-        // restarts)
-        shouldTryInitializeMidiInputs = true;
-        
-        // Also in dev mode trigger reload ui
-        #if JUCE_DEBUG
-        juce::Time::waitForMillisecondCounter(juce::Time::getMillisecondCounter() + 2000);
-        sendActionMessage(ACTION_UPDATE_DEVUI_RELOAD_BROWSER);
-        #endif
+    case ControllerActionGroup::none:
+        break;
     }
 }
 
@@ -1531,16 +2804,8 @@ void Sequencer::valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasC
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
     // jassert(juce::MessageManager::getInstance()->isThisTheMessageThread());
     
-    // Send state update to UI
-    juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
-    message.addString("propertyChanged");
-    message.addInt32(stateUpdateID);
-    message.addString(treeWhosePropertyHasChanged[ShepherdIDs::uuid].toString());
-    message.addString(treeWhosePropertyHasChanged.getType().toString());
-    message.addString(property.toString());
-    message.addString(treeWhosePropertyHasChanged[property].toString());
-    sendMessageToController(message);
-    stateUpdateID += 1;
+    // Record state update to be sent to UI in the next batch
+    stateUpdateJournal.recordPropertyChanged(treeWhosePropertyHasChanged, property);
 }
 
 void Sequencer::valueTreeChildAdded (juce::ValueTree& parentTree, juce::ValueTree& childWhichHasBeenAdded)
@@ -1548,16 +2813,11 @@ void Sequencer::valueTreeChildAdded (juce::ValueTree& parentTree, juce::ValueTre
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
     // jassert(juce::MessageManager::getInstance()->isThisTheMessageThread());
     
-    // Send state update to UI
-    juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
-    message.addString("addedChild");
-    message.addInt32(stateUpdateID);
-    message.addString(parentTree[ShepherdIDs::uuid].toString());
-    message.addString(parentTree.getType().toString());
-    message.addInt32(parentTree.indexOf(childWhichHasBeenAdded));
-    message.addString(childWhichHasBeenAdded.toXmlString(juce::XmlElement::TextFormat().singleLine()));
-    sendMessageToController(message);
-    stateUpdateID += 1;
+    // Assign new handles to the added objects before recording the state update so the controller gets them
+    assignHandles(childWhichHasBeenAdded);
+    
+    // Record state update to be sent to UI in the next batch
+    stateUpdateJournal.recordChildAdded(parentTree, childWhichHasBeenAdded);
 }
 
 void Sequencer::valueTreeChildRemoved (juce::ValueTree& parentTree, juce::ValueTree& childWhichHasBeenRemoved, int indexFromWhichChildWasRemoved)
@@ -1565,14 +2825,8 @@ void Sequencer::valueTreeChildRemoved (juce::ValueTree& parentTree, juce::ValueT
     // We should never call this function from the realtime thread because editing VT might not be RT safe...
     // jassert(juce::MessageManager::getInstance()->isThisTheMessageThread());
     
-    // Send state update to UI
-    juce::OSCMessage message = juce::OSCMessage(ACTION_ADDRESS_STATE_UPDATE);
-    message.addString("removedChild");
-    message.addInt32(stateUpdateID);
-    message.addString(childWhichHasBeenRemoved[ShepherdIDs::uuid].toString());
-    message.addString(childWhichHasBeenRemoved.getType().toString());
-    sendMessageToController(message);
-    stateUpdateID += 1;
+    // Record state update to be sent to UI in the next batch
+    stateUpdateJournal.recordChildRemoved(parentTree, childWhichHasBeenRemoved);
 }
 
 void Sequencer::valueTreeChildOrderChanged (juce::ValueTree& parentTree, int oldIndex, int newIndex)
@@ -18,6 +18,26 @@
 #include "Playhead.h"
 #include "Clip.h"
 #include "Track.h"
+#include "MidiOutputTimeBase.h"
+#include "MidiOutputDispatcher.h"
+#include "AlsaSequencerMidiBackend.h"
+#include "JackMidiEngine.h"
+#include "LookaheadRenderer.h"
+#include "SequencerCommand.h"
+#include "ControllerMessageQueue.h"
+#include "StateUpdateJournal.h"
+#include "StateSubscription.h"
+#include "StateSnapshotSender.h"
+#include "MpscFifo.h"
+#include "MessagePack.h"
+#include "SequenceJsonParser.h"
+#include "ConnectionSendQueue.h"
+#if USE_MIDI_ONLY_ENGINE
+#include "MidiOnlyEngine.h"
+#endif
+#if USE_TRACK_WORKER_POOL
+#include "RTWorkerPool.h"
+#endif
 #if USE_WS_SERVER
 #include "server_ws.hpp"
 #endif
@@ -55,7 +75,142 @@ public:
     Sequencer* sequencerPtr;
     #if USE_WS_SERVER
     std::unique_ptr<WsServer> serverPtr;
-    #endif 
+    
+    // Options selected by each connection with messages handled by the server itself (not by the Sequencer)
+    struct ConnectionOptions
+    {
+        bool binaryProtocol = false;  // See ACTION_ADDRESS_SET_PROTOCOL
+        StateSubscription::Ptr subscription;  // See ACTION_ADDRESS_SUBSCRIBE, nullptr means all state updates
+        std::shared_ptr<ConnectionSendQueue> sendQueue;  // Created when the first message is sent (see send)
+        int connectionNumber = 0;  // Only used to identify connections when reporting send queue stats
+        juce::uint64 lastReportedMessagesDropped = 0;
+    };
+    
+    ConnectionOptions getConnectionOptions(const WsServer::Connection* connection)
+    {
+        const juce::ScopedLock sl (connectionOptionsLock);
+        auto it = connectionOptions.find(connection);
+        return it != connectionOptions.end() ? it->second : ConnectionOptions();
+    }
+    
+    // Connections use the text protocol unless they select the binary one (see ACTION_ADDRESS_SET_PROTOCOL)
+    bool usesBinaryProtocol(const WsServer::Connection* connection)
+    {
+        return getConnectionOptions(connection).binaryProtocol;
+    }
+    
+    void setUsesBinaryProtocol(const WsServer::Connection* connection, bool binary)
+    {
+        const juce::ScopedLock sl (connectionOptionsLock);
+        auto& options = connectionOptions[connection];
+        options.binaryProtocol = binary;
+        if (options.sendQueue != nullptr){
+            options.sendQueue->setResyncMessage(createResyncMessage(binary));
+        }
+    }
+    
+    // Messages are not sent directly but added to the send queue of the connection, which is drained from the
+    // WebSockets I/O thread as the messages are written (see ConnectionSendQueue.h). Can be called from any thread
+    void send(const std::shared_ptr<WsServer::Connection>& connection, ConnectionSendQueue::Message message)
+    {
+        auto sendQueue = getSendQueue(connection.get());
+        auto next = sendQueue->push(std::move(message));
+        if (next.has_value()){
+            sendNext(connection, sendQueue, std::move(*next));
+        }
+    }
+    
+    // Prints a warning for the connections which dropped messages since the last report
+    void reportSendQueueStats()
+    {
+        const juce::ScopedLock sl (connectionOptionsLock);
+        for (auto& [connection, options]: connectionOptions){
+            if (options.sendQueue == nullptr){
+                continue;
+            }
+            auto stats = options.sendQueue->getStats();
+            if (stats.messagesDropped != options.lastReportedMessagesDropped){
+                std::cout << "WARNING, WebSockets connection " << options.connectionNumber << " is not consuming messages fast enough. Dropped messages: " << stats.messagesDropped << " (overflows: " << stats.overflows << ", max queued messages: " << stats.maxQueuedMessages << ", sent: " << stats.messagesSent << " messages/" << stats.bytesSent << " bytes)" << std::endl;
+                options.lastReportedMessagesDropped = stats.messagesDropped;
+            }
+        }
+    }
+    
+    // Parameters of ACTION_ADDRESS_SUBSCRIBE are the kind of rule, its value and optionally a max rate in Hz. Parameters
+    // of ACTION_ADDRESS_UNSUBSCRIBE are the kind and value of the rule to remove (or none to remove all the rules)
+    void updateSubscription(const WsServer::Connection* connection, bool subscribe, const juce::StringArray& parameters)
+    {
+        const juce::ScopedLock sl (connectionOptionsLock);
+        auto& subscription = connectionOptions[connection].subscription;
+        if (!subscribe && parameters.size() == 0){
+            subscription = nullptr;
+            return;
+        }
+        StateSubscription::Kind kind;
+        if (parameters.size() < 2 || !StateSubscription::parseKind(parameters[0], kind)){
+            DBG("Invalid subscription message received from controller");
+            return;
+        }
+        if (subscribe){
+            subscription = StateSubscription::withRule(subscription, {kind, parameters[1], parameters.size() > 2 ? parameters[2].getDoubleValue() : 0.0});
+        } else {
+            subscription = StateSubscription::withoutRule(subscription, kind, parameters[1]);
+        }
+    }
+    
+    void removeConnection(const WsServer::Connection* connection)
+    {
+        const juce::ScopedLock sl (connectionOptionsLock);
+        connectionOptions.erase(connection);
+    }
+    
+private:
+    std::shared_ptr<ConnectionSendQueue> getSendQueue(const WsServer::Connection* connection)
+    {
+        const juce::ScopedLock sl (connectionOptionsLock);
+        auto& options = connectionOptions[connection];
+        if (options.sendQueue == nullptr){
+            options.sendQueue = std::make_shared<ConnectionSendQueue>(WS_SEND_QUEUE_MAX_MESSAGES, WS_SEND_QUEUE_MAX_BYTES, createResyncMessage(options.binaryProtocol));
+            options.connectionNumber = ++numConnectionsWithSendQueue;
+        }
+        return options.sendQueue;
+    }
+    
+    static void sendNext(std::weak_ptr<WsServer::Connection> weakConnection, std::shared_ptr<ConnectionSendQueue> sendQueue, ConnectionSendQueue::Message message)
+    {
+        // The callback holds a weak reference to the connection as the connection holds the callback until it is called
+        auto connection = weakConnection.lock();
+        if (connection == nullptr){
+            return;
+        }
+        auto data = message.data;
+        connection->send(*data, [weakConnection, sendQueue, data](const SimpleWeb::error_code& error){
+            auto next = sendQueue->sent(!error);
+            if (next.has_value()){
+                sendNext(weakConnection, sendQueue, std::move(*next));
+            }
+        }, message.binary ? 130 : 129);  // 130 = binary frame, 129 = text frame
+    }
+    
+    static ConnectionSendQueue::Message createResyncMessage(bool binary)
+    {
+        ConnectionSendQueue::Message message;
+        message.binary = binary;
+        if (binary){
+            MessagePack::Writer writer;
+            writer.writeArrayHeader(1);
+            writer.writeString(ACTION_ADDRESS_RESYNC);
+            message.data = std::make_shared<const std::string>(writer.getData().begin(), writer.getData().end());
+        } else {
+            message.data = std::make_shared<const std::string>(ACTION_ADDRESS_RESYNC ":");
+        }
+        return message;
+    }
+    
+    std::map<const WsServer::Connection*, ConnectionOptions> connectionOptions;
+    juce::CriticalSection connectionOptionsLock;
+    int numConnectionsWithSendQueue = 0;
+    #endif
 };
 
 
@@ -75,11 +230,13 @@ public:
     void debugState();
     
     // Public method for receiving WS messages
-    void wsMessageReceived  (const juce::String& serializedMessage);
+    void wsMessageReceived  (const juce::String& serializedMessage, std::weak_ptr<void> sender = {});
+    void wsBinaryMessageReceived  (const void* data, size_t size, std::weak_ptr<void> sender = {});
     
     // Other useful public functions
     juce::File getDataLocation();
-    bool shouldRenderWithInternalSynth() { return renderWithInternalSynth;}
+    bool shouldRenderWithInternalSynth() { return renderWithInternalSynth && lookaheadRenderer == nullptr;}  // Device buffers are written by the lookahead worker thread, don't read them from the audio thread
+    bool shouldUseAudioDevice() { return useAudioDevice;}  // If false, getNextMIDISlice is called by another engine (JACK or MIDI-only engine) and no audio device should be opened
     juce::OwnedArray<MidiOutputDeviceData>* getMidiOutDevices() {return &midiOutDevices;}
     //std::unique_ptr<HardwareDeviceList>& getHardwareDevices() {return hardwareDevices;}
     
@@ -95,6 +252,8 @@ protected:
 
 private:
     GlobalSettingsStruct getGlobalSettings();
+    void renderMIDISlice (int sliceNumSamples, bool collectMidiInput);
+    void processSubSlice (int subSliceOffset, int subSliceNumSamples);
     
     bool sequencerInitialized = false;
     
@@ -111,15 +270,78 @@ private:
     std::vector<juce::String> getListStringPropertyFromSettingsFile(juce::String propertyName);
     
     // Communication with controller
+    // NOTE: controllerMessageQueue is declared before wsServer so that it is destroyed after it
+    ControllerMessageQueue controllerMessageQueue {
+        [this](const ControllerMessage& message){ processMessageFromController(message); },
+        [this](const juce::String& trackReference, const juce::String& clipReference){
+            auto* track = getTrackWithHandleOrUUID(trackReference);
+            auto* clip = track != nullptr ? track->getClipWithHandleOrUUID(clipReference) : nullptr;
+            return clip != nullptr ? clip->getUUID() : juce::String();
+        }
+    };
     ShepherdWebSocketsServer wsServer;
     void initializeWS();
     
-    juce::String serliaizeOSCMessage(const juce::OSCMessage& message);
-    void sendMessageToController(const juce::OSCMessage& message);
-    void sendWSMessage(const juce::OSCMessage& message);
-    // wsMessageReceived is defined in the public API
-    void processMessageFromController (const juce::String action, juce::StringArray parameters);
-    int stateUpdateID = 0;
+    // If attachedTree is valid, it is sent as the last parameter of the message (see sendWSMessage)
+    juce::String serliaizeOSCMessage(const juce::OSCMessage& message, const juce::ValueTree& attachedTree = {});
+    std::string serializeOSCMessageToBinary(const juce::OSCMessage& message, const juce::ValueTree& attachedTree = {});
+    void sendMessageToController(const juce::OSCMessage& message, const juce::ValueTree& attachedTree = {});
+    void sendWSMessage(const juce::OSCMessage& message, const juce::ValueTree& attachedTree = {});
+    // Sends a message to all connections, serializing it at most once per protocol
+    void sendToAllConnections(const std::function<std::string()>& serializeText, const std::function<std::string()>& serializeBinary, ConnectionSendQueue::MessageKind kind = ConnectionSendQueue::MessageKind::other);
+    // Sends a message only to the given connection (e.g. the sender of a ControllerMessage), if it is still open
+    void sendToConnection(const std::weak_ptr<void>& connection, const std::function<std::string()>& serializeText, const std::function<std::string()>& serializeBinary, ConnectionSendQueue::MessageKind kind = ConnectionSendQueue::MessageKind::other);
+    void sendMessageToConnection(const std::weak_ptr<void>& connection, const juce::OSCMessage& message, const juce::ValueTree& attachedTree = {});
+    // wsMessageReceived and wsBinaryMessageReceived are defined in the public API
+    void queueMessageFromController(std::string_view address, juce::StringArray parameters, std::weak_ptr<void> sender);
+    void processMessageFromController (const ControllerMessage& message);
+    int stateUpdateID = 0;  // Incremented for every batch of state updates sent to the controller
+    
+    // State changes are not sent to the controller as they happen, but in batches (see StateUpdateJournal.h)
+    StateUpdateJournal stateUpdateJournal { [this](const std::vector<StateUpdateJournal::Update>& updates){ sendStateUpdateBatch(updates); } };
+    void sendStateUpdateBatch(const std::vector<StateUpdateJournal::Update>& updates);
+    std::string serializeStateUpdateBatch(const std::vector<const StateUpdateJournal::Update*>& updates, int previousID, bool binary);
+    static juce::var serializeStateUpdatesToJSON(const std::vector<const StateUpdateJournal::Update*>& updates);
+    static void writeStateUpdates(MessagePack::Writer& writer, const std::vector<const StateUpdateJournal::Update*>& updates);
+    
+    // Recently sent batches of updates, so that controllers which missed some of them can ask for these to be replayed
+    // instead of asking for the full state (see replayStateUpdates)
+    StateUpdateHistory stateUpdatesHistory { STATE_UPDATES_HISTORY_MAX_BATCHES, STATE_UPDATES_HISTORY_MAX_UPDATES };
+    bool replayStateUpdates(const std::weak_ptr<void>& connection, int fromID);
+    void editClipSequence(Clip* clip, const std::function<void()>& edit);
+    // Replies to ACTION_ADDRESS_CLIP_QUERY_EVENTS with the compiled events of the clip in the queried window
+    void sendClipEventsQueryResult(const std::weak_ptr<void>& connection, Clip* clip, const Clip::EventsQuery& query);
+    
+    // Full state snapshots are serialized and sent in chunks from a background thread (see StateSnapshotSender.h)
+    // NOTE: declared after wsServer so that it is stopped before wsServer is destroyed
+    StateSnapshotSender stateSnapshotSender;
+    void sendStateSnapshot(const std::weak_ptr<void>& connection, bool compress);
+    
+    // Connections can subscribe to parts of the state (see StateSubscription.h). Deferred rate limited updates are
+    // kept per subscription (keyed by StateSubscription::getKey)
+    std::map<juce::String, std::unique_ptr<StateSubscriptionDelivery>> subscriptionDeliveries;
+    std::map<juce::String, int> lastSentStateUpdateBatchIDs;  // Per subscription key (empty key for no subscription)
+    void sendDueDeferredStateUpdates();
+    
+    // Session-scoped integer handles which the controller can use instead of UUIDs (or device names) to reference
+    // objects (see assignHandles). Each object type has its own counter so that handles are dense per type
+    void assignHandles(juce::ValueTree tree);
+    int nextTrackHandle = 0;
+    int nextClipHandle = 0;
+    int nextSequenceEventHandle = 0;
+    int nextHardwareDeviceHandle = 0;
+    
+    // Commands which change clip/transport state are not applied in the thread which receives them but are queued and
+    // applied by the thread rendering the slices (see SequencerCommand.h)
+    MpscFifo<SequencerCommand, SEQUENCER_COMMAND_QUEUE_SIZE> commandQueue;
+    std::array<SequencerCommand, SEQUENCER_COMMAND_QUEUE_SIZE> pendingCommands;  // Commands pulled from the queue which are not yet due
+    int numPendingCommands = 0;
+    juce::int64 renderedSampleCount = 0;  // Number of samples rendered since the sequencer started
+    void enqueueCommand(const SequencerCommand& command);
+    void pullCommands();
+    int getNumSamplesUntilNextPendingCommand(int maxNumSamples);
+    void applyDueCommands();
+    void applyCommand(const SequencerCommand& command);
     
     // Midi devices and other midi stuff
     bool midiOutputDeviceAlreadyInitialized(const juce::String& deviceName);
@@ -134,6 +356,7 @@ private:
     void clearMidiDeviceInputBuffers();
     void collectorsRetrieveLatestBlockOfMessages(int sliceNumSamples);
     void resetMidiInCollectors(double sampleRate);
+    void extractMidiDeviceInputSubSliceBuffers(int subSliceOffset, int subSliceNumSamples);
     
     void initializeMIDIOutputs();
     bool shouldTryInitializeMidiOutputs = false;
@@ -144,8 +367,55 @@ private:
     void clearMidiDeviceOutputBuffers();
     void clearMidiTrackBuffers();
     void sendMidiDeviceOutputBuffers();
-    void writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vector<juce::String> midiOutDeviceNames);
-    std::unique_ptr<juce::MidiOutput> notesMonitoringMidiOutput;
+    void writeMidiToDevicesMidiBuffer(juce::MidiBuffer& buffer, std::vector<juce::String> midiOutDeviceNames, int sampleOffset);
+    void reportMidiOutputQueueStats();
+    std::unique_ptr<MidiOutputDeviceData> notesMonitoringMidiOutput;
+    
+    // Scheduled MIDI output: instead of sending all the messages of a slice "now", messages are sent at a timestamp
+    // computed from their sample position in the slice (plus some fixed latency)
+    bool midiOutputSchedulingEnabled = false;
+    double midiOutputSchedulingLatencyMs = MIDI_OUTPUT_SCHEDULING_DEFAULT_LATENCY_MS;
+    MidiOutputTimeBase midiOutputTimeBase;
+    
+    // All writes to MIDI output devices are done in the dispatcher thread so that the RT thread never blocks
+    // NOTE: this must be declared after midiOutDevices and notesMonitoringMidiOutput so that it is destroyed first
+    MidiOutputDispatcher midiOutputDispatcher;
+    
+    #if USE_ALSA_SEQ_MIDI_BACKEND
+    // Optional native ALSA sequencer backend for MIDI input/output devices (enabled with "midiBackend": "alsa")
+    std::unique_ptr<AlsaSequencerMidiBackend> alsaSequencerMidiBackend;
+    #endif
+    
+    // If true, input device buffers are filled and output device buffers are sent by the engine which calls getNextMIDISlice
+    // (see JackMidiEngine.h) instead of using the MIDI collectors and the MIDI output dispatcher
+    bool midiDeviceBuffersHandledExternally = false;
+    #if USE_JACK_MIDI_ENGINE
+    std::unique_ptr<JackMidiEngine> jackMidiEngine;
+    #endif
+    
+    // Engines other than the audio device callback which can drive getNextMIDISlice
+    bool useAudioDevice = true;
+    #if USE_MIDI_ONLY_ENGINE
+    std::unique_ptr<MidiOnlyEngine> midiOnlyEngine;
+    juce::uint32 lastTimeMidiOnlyEngineStatsReported = 0;
+    void reportMidiOnlyEngineStats();
+    #endif
+    
+    // Lookahead rendering (see LookaheadRenderer.h)
+    double lookaheadMs = 0.0;  // If > 0, slices are rendered this amount of time ahead in a worker thread
+    std::unique_ptr<LookaheadRenderer> lookaheadRenderer;
+    bool renderLookaheadSlice(LookaheadSlice& slice);
+    void discardLookahead();
+    void updateLookaheadSuspension();
+    juce::MidiBuffer discardedMidiInputMessages;  // MIDI input received while slices are rendered ahead (not used)
+    juce::uint32 lastTimeLookaheadUnderrunsReported = 0;
+    void reportLookaheadUnderruns();
+    
+    // Parallel processing of tracks (see step 7 in getNextMIDISlice)
+    #if USE_TRACK_WORKER_POOL
+    std::unique_ptr<RTWorkerPool> trackWorkerPool;
+    #endif
+    void processTrackGroupSlice(int trackIndex, bool playheadIsPlaying);
         
     // Aux MIDI buffers
     // We call .ensure_size for these buffers to make sure we don't to allocations in the RT thread
@@ -153,16 +423,18 @@ private:
     juce::MidiBuffer midiTransportMessages;
     juce::MidiBuffer midiMetronomeMessages;
     juce::MidiBuffer pushMidiClockMessages;
-    juce::MidiBuffer monitoringNotesMidiBuffer;
     
     // Hardware devices
     std::unique_ptr<HardwareDeviceList> hardwareDevices;
     void initializeHardwareDevices();
     HardwareDevice* getHardwareDeviceByName(juce::String name, HardwareDeviceType type);
+    HardwareDevice* getHardwareDeviceWithHandleOrName(const juce::String& deviceReference, HardwareDeviceType type);
     
     // Transport and basic settings
     double sampleRate = 0.0;
     int samplesPerSlice = 0;
+    int samplesPerSubSlice = 0;  // If > 0, slices are processed in sub-slices of this length (see getNextMIDISlice)
+    std::atomic<int> samplesPerBlock = {0};  // Length of the slices passed to getNextMIDISlice
     bool shouldToggleIsPlaying = false;
     juce::CachedValue<juce::String> name;
     juce::CachedValue<int> fixedLengthRecordingBars;
@@ -187,6 +459,7 @@ private:
     std::unique_ptr<TrackList> tracks;
     juce::String activeUiNotesMonitoringTrack = "";
     Track* getTrackWithUUID(juce::String trackUUID);
+    Track* getTrackWithHandleOrUUID(const juce::String& trackReference);
     
     // Scenes
     void playScene(int sceneN);
@@ -209,11 +482,40 @@ void ShepherdWebSocketsServer::run()
     serverPtr.reset(&server);
     
     auto &source_coms_endpoint = server.endpoint["^/shepherd_coms/?$"];
-    source_coms_endpoint.on_message = [&server, this](std::shared_ptr<WsServer::Connection> /*connection*/, std::shared_ptr<WsServer::InMessage> in_message) {
+    source_coms_endpoint.on_message = [&server, this](std::shared_ptr<WsServer::Connection> connection, std::shared_ptr<WsServer::InMessage> in_message) {
+        if (sequencerPtr == nullptr){
+            return;
+        }
+        if ((in_message->fin_rsv_opcode & 0x0f) == 2){
+            // Binary frame
+            std::string data = in_message->string();
+            sequencerPtr->wsBinaryMessageReceived(data.data(), data.size(), connection);
+            return;
+        }
         juce::String message = juce::String(in_message->string());
-        if (sequencerPtr != nullptr){
-            sequencerPtr->wsMessageReceived(message);
+        if (message.startsWith(ACTION_ADDRESS_SET_PROTOCOL ":")){
+            setUsesBinaryProtocol(connection.get(), message.fromFirstOccurrenceOf(":", false, false) == "binary");
+            return;
         }
+        // A bare ACTION_ADDRESS_UNSUBSCRIBE (with no parameters) removes all the rules of the subscription
+        const bool isSubscribe = message.startsWith(ACTION_ADDRESS_SUBSCRIBE ":");
+        if (isSubscribe || message.startsWith(ACTION_ADDRESS_UNSUBSCRIBE ":") || message == ACTION_ADDRESS_UNSUBSCRIBE){
+            juce::StringArray parameters;
+            parameters.addTokens (message.fromFirstOccurrenceOf(":", false, false), (juce::String)SERIALIZATION_SEPARATOR, "");
+            parameters.removeEmptyStrings();
+            updateSubscription(connection.get(), isSubscribe, parameters);
+            return;
+        }
+        sequencerPtr->wsMessageReceived(message, connection);
+    };
+    source_coms_endpoint.on_open = [this](std::shared_ptr<WsServer::Connection> connection) {
+        removeConnection(connection.get());  // Make sure no options are left from a previous connection at the same address
+    };
+    source_coms_endpoint.on_close = [this](std::shared_ptr<WsServer::Connection> connection, int /*status*/, const std::string& /*reason*/) {
+        removeConnection(connection.get());
+    };
+    source_coms_endpoint.on_error = [this](std::shared_ptr<WsServer::Connection> connection, const SimpleWeb::error_code& /*error*/) {
+        removeConnection(connection.get());
     };
     
     server.start([this](unsigned short port) {
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+
+/** Command sent from the controller (or any other non-RT thread) to the thread rendering the slices. Commands are
+    pushed to a pre-allocated MPSC queue (see MpscFifo.h) and are applied at the start of a sub-slice, so they never
+    race with the RT thread.
+
+    Tracks and clips are referenced by index rather than by pointer (the objects could be deleted before the command is
+    applied). As tracks and clips can be reordered or removed in the meantime, commands also carry the handle of the
+    target track and clip (see Sequencer::assignHandles), and commands whose index no longer points to an object with
+    that handle are dropped.
+
+    By default a command is applied at the start of the next slice. If targetSample is set, the command is applied
+    when the rendered sample count (see Sequencer::renderedSampleCount) reaches it. If targetBeat is set, the command
+    is applied when the global playhead reaches that position (or at the start of the next slice if the global
+    playhead is not playing). In both cases, the slice is split so that the command lands at the exact sample.
+*/
+struct SequencerCommand
+{
+    enum class Type {
+        clipPlay,
+        clipStop,
+        clipPlayStop,
+        scenePlay,
+        transportPlay,
+        transportStop,
+        transportPlayStop,
+        setBpm,
+        setMeter
+    };
+
+    Type type = Type::transportPlayStop;
+    int trackIndex = -1;
+    int clipIndex = -1;  // Also used as scene number for Type::scenePlay
+    int trackHandle = -1;
+    int clipHandle = -1;
+    double value = 0.0;  // BPM for Type::setBpm, meter for Type::setMeter
+    double targetBeat = -1.0;
+    juce::int64 targetSample = -1;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+
+/** Background thread which serializes full state snapshots and sends them to the controller in chunks (see
+    ACTION_ADDRESS_STATE_SNAPSHOT_CHUNK).
+
+    Snapshots are copies of the state made in the message thread (so they are consistent with the ID of the next batch
+    of state updates), which are then serialized here using the binary format of juce::ValueTree::writeToStream,
+    optionally compressed with zlib. Serializing and sending a large state does therefore not block the message thread,
+    and because chunks are only handed to the connection when its send queue is almost empty, other messages (e.g.
+    state updates) are interleaved with them instead of waiting for the whole snapshot to be sent.
+
+    Jobs must be added from the message thread.
+*/
+class StateSnapshotSender: public juce::Thread
+{
+public:
+    struct Chunk
+    {
+        int updateID;  // ID of the next batch of state updates when the snapshot was made
+        int index;
+        int numChunks;
+        bool compressed;
+        const void* data;
+        size_t size;
+    };
+
+    struct Job
+    {
+        juce::ValueTree snapshot;
+        int updateID = 0;
+        bool compress = false;
+        std::function<void(const Chunk&)> sendChunk;
+        std::function<int()> getQueuedBytes;  // Bytes queued in the connection, or -1 if it was closed (job is cancelled)
+    };
+
+    StateSnapshotSender(): juce::Thread ("StateSnapshotSender")
+    {
+    }
+
+    ~StateSnapshotSender()
+    {
+        stopThread(2000);
+    }
+
+    void addJob(Job job)
+    {
+        JUCE_ASSERT_MESSAGE_THREAD
+        {
+            const juce::ScopedLock sl (jobsLock);
+            jobs.push_back(std::move(job));
+        }
+        if (!isThreadRunning()){
+            startThread();
+        }
+        notify();
+    }
+
+private:
+    void run() override
+    {
+        while (!threadShouldExit()){
+            Job job;
+            {
+                const juce::ScopedLock sl (jobsLock);
+                if (!jobs.empty()){
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+            }
+            if (job.sendChunk == nullptr){
+                wait(-1);
+                continue;
+            }
+            process(job);
+        }
+    }
+
+    void process(Job& job)
+    {
+        juce::MemoryOutputStream serializedSnapshot;
+        if (job.compress){
+            juce::GZIPCompressorOutputStream compressedStream (serializedSnapshot);
+            job.snapshot.writeToStream(compressedStream);
+            compressedStream.flush();
+        } else {
+            job.snapshot.writeToStream(serializedSnapshot);
+        }
+        job.snapshot = {};  // Release the copy of the state as soon as possible
+
+        const auto* data = static_cast<const char*>(serializedSnapshot.getData());
+        const auto size = serializedSnapshot.getDataSize();
+        const auto numChunks = juce::jmax(1, (int)((size + STATE_SNAPSHOT_CHUNK_SIZE - 1) / STATE_SNAPSHOT_CHUNK_SIZE));
+        for (int i=0; i<numChunks; i++){
+            // Wait for the connection to consume what was already queued so the snapshot does not fill its send queue
+            int queuedBytes;
+            while ((queuedBytes = job.getQueuedBytes()) > STATE_SNAPSHOT_MAX_QUEUED_BYTES){
+                if (threadShouldExit()) { return; }
+                wait(5);
+            }
+            if (queuedBytes < 0){
+                return;  // Connection closed
+            }
+            const auto offset = (size_t)i * STATE_SNAPSHOT_CHUNK_SIZE;
+            job.sendChunk({job.updateID, i, numChunks, job.compress, data + offset, juce::jmin((size_t)STATE_SNAPSHOT_CHUNK_SIZE, size - offset)});
+        }
+    }
+
+    juce::CriticalSection jobsLock;
+    std::deque<Job> jobs;
+
+    JUCE_DECLARE_NON_COPYABLE (StateSnapshotSender)
+};
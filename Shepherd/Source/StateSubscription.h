@@ -0,0 +1,266 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+#include "StateUpdateJournal.h"
+
+
+/** Parts of the state a controller connection is subscribed to (see ACTION_ADDRESS_SUBSCRIBE). Connections without
+    subscription rules receive all the state updates, otherwise an update is only sent if it matches one of the rules:
+     - nodeType: updates of trees of the given type (for added children, the type of the added child)
+     - subtree: updates of the tree with the given uuid or any of its descendants
+     - property: changes of the given property in any tree
+    Rules can have a max rate (in Hz) which limits how often the changes of each property of each tree are sent to the
+    connection (see StateSubscriptionDelivery).
+
+    Subscriptions are immutable, a new one is created every time a rule is added or removed. In this way the WebSockets
+    I/O thread (which handles the subscription messages) can share them with the message thread without locking.
+*/
+class StateSubscription
+{
+public:
+    using Ptr = std::shared_ptr<const StateSubscription>;
+
+    enum class Kind { nodeType, subtree, property };
+
+    struct Rule
+    {
+        Kind kind = Kind::nodeType;
+        juce::String value;
+        double maxRateHz = 0.0;  // 0 means no limit
+    };
+
+    /** Parses the kind names used in ACTION_ADDRESS_SUBSCRIBE messages ("type", "subtree" and "property"). */
+    static bool parseKind(const juce::String& name, Kind& kind)
+    {
+        if (name == "type"){
+            kind = Kind::nodeType;
+        } else if (name == "subtree"){
+            kind = Kind::subtree;
+        } else if (name == "property"){
+            kind = Kind::property;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /** Returns a copy of the subscription with the given rule added (or replaced if there was one with the same kind
+        and value). Can be called on a nullptr subscription. */
+    static Ptr withRule(const Ptr& subscription, const Rule& rule)
+    {
+        auto newSubscription = std::make_shared<StateSubscription>();
+        if (subscription != nullptr){
+            for (const auto& existingRule: subscription->rules){
+                if (existingRule.kind != rule.kind || existingRule.value != rule.value){
+                    newSubscription->rules.push_back(existingRule);
+                }
+            }
+        }
+        newSubscription->rules.push_back(rule);
+        newSubscription->updateKey();
+        return newSubscription;
+    }
+
+    /** Returns a copy of the subscription without the rule with the given kind and value, or nullptr if no rules are
+        left (i.e. the connection receives all the updates again). */
+    static Ptr withoutRule(const Ptr& subscription, Kind kind, const juce::String& value)
+    {
+        if (subscription == nullptr){
+            return nullptr;
+        }
+        auto newSubscription = std::make_shared<StateSubscription>();
+        for (const auto& existingRule: subscription->rules){
+            if (existingRule.kind != kind || existingRule.value != value){
+                newSubscription->rules.push_back(existingRule);
+            }
+        }
+        if (newSubscription->rules.empty()){
+            return nullptr;
+        }
+        newSubscription->updateKey();
+        return newSubscription;
+    }
+
+    /** Returns true if the update matches any of the rules. maxRateHz is set to the most permissive rate limit of the
+        matching rules (0 if any of them has no limit). */
+    bool matches(const StateUpdateJournal::Update& update, double& maxRateHz) const
+    {
+        bool matched = false;
+        maxRateHz = 0.0;
+        for (const auto& rule: rules){
+            if (!ruleMatches(rule, update)){
+                continue;
+            }
+            if (rule.maxRateHz <= 0.0){
+                maxRateHz = 0.0;
+                return true;
+            }
+            maxRateHz = matched ? juce::jmax(maxRateHz, rule.maxRateHz) : rule.maxRateHz;
+            matched = true;
+        }
+        return matched;
+    }
+
+    /** Key which is the same for all the subscriptions with the same rules. Connections with equal subscriptions share
+        the filtered and serialized batches. */
+    const juce::String& getKey() const { return key; }
+
+private:
+    static bool ruleMatches(const Rule& rule, const StateUpdateJournal::Update& update)
+    {
+        using Update = StateUpdateJournal::Update;
+        switch (rule.kind) {
+            case Kind::nodeType:
+                if (update.type == Update::Type::addedChild){
+                    return update.child.getType().toString() == rule.value;
+                }
+                if (update.type == Update::Type::replacedChildren){
+                    return update.property.toString() == rule.value || update.treeType == rule.value;
+                }
+                return update.treeType == rule.value;
+            case Kind::subtree:
+                return update.path.contains(rule.value);
+            case Kind::property:
+                return update.type == Update::Type::propertyChanged && update.property.toString() == rule.value;
+        }
+        return false;
+    }
+
+    void updateKey()
+    {
+        juce::StringArray serializedRules;
+        for (const auto& rule: rules){
+            serializedRules.add(juce::String((int)rule.kind) + SERIALIZATION_SEPARATOR + rule.value + SERIALIZATION_SEPARATOR + juce::String(rule.maxRateHz));
+        }
+        serializedRules.sort(false);
+        key = serializedRules.joinIntoString("|");
+    }
+
+    std::vector<Rule> rules;
+    juce::String key;
+};
+
+
+/** Selects which updates of each batch are sent to the connections with a given subscription. Property changes
+    which match rules with a max rate are sent at most once per rate interval (per tree and property): changes which
+    arrive before the interval has passed are deferred (only the last value is kept) and sent with the first batch
+    after the interval has passed (see Sequencer::sendDueDeferredStateUpdates).
+
+    Must only be used from the message thread.
+*/
+class StateSubscriptionDelivery
+{
+public:
+    using Update = StateUpdateJournal::Update;
+
+    StateSubscriptionDelivery (StateSubscription::Ptr _subscription)
+        : subscription (std::move(_subscription))
+    {
+    }
+
+    /** Returns the deferred updates which are now due followed by the updates of the batch which should be sent
+        (deferred updates are older than the ones in the batch). The returned pointers are valid until the next call. */
+    const std::vector<const Update*>& select(const std::vector<Update>& updates, juce::int64 nowMs)
+    {
+        selected.clear();
+        released.clear();
+
+        // Deferred changes of removed (or replaced) trees would reference trees which no longer exist in the
+        // controller. These are discarded even if the structural update itself does not match the subscription
+        for (const auto& update: updates){
+            removeDeferredUpdatesInvalidatedBy(update);
+        }
+        std::vector<DeferredUpdate> stillDeferred;
+        for (auto& deferredUpdate: deferred){
+            auto key = getKey(deferredUpdate.update);
+            if (nowMs - lastSentMs[key] >= deferredUpdate.intervalMs){
+                lastSentMs.set(key, nowMs);
+                released.push_back(std::move(deferredUpdate.update));
+            } else {
+                stillDeferred.push_back(std::move(deferredUpdate));
+            }
+        }
+        deferred = std::move(stillDeferred);
+        for (const auto& update: released){
+            selected.push_back(&update);
+        }
+
+        for (const auto& update: updates){
+            // Changes deferred earlier in this same batch must also be discarded if their tree is removed later on
+            removeDeferredUpdatesInvalidatedBy(update);
+            double maxRateHz;
+            if (!subscription->matches(update, maxRateHz)){
+                continue;
+            }
+            if (maxRateHz > 0.0 && update.type == Update::Type::propertyChanged){
+                defer(update, maxRateHz);
+            } else {
+                selected.push_back(&update);
+            }
+        }
+        return selected;
+    }
+
+    bool hasDueDeferredUpdates(juce::int64 nowMs) const
+    {
+        for (const auto& deferredUpdate: deferred){
+            if (nowMs - lastSentMs[getKey(deferredUpdate.update)] >= deferredUpdate.intervalMs){
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct DeferredUpdate
+    {
+        Update update;
+        juce::int64 intervalMs;
+    };
+
+    static juce::String getKey(const Update& update)
+    {
+        // Trees without uuid (e.g. the settings) are identified by their type and path from the root of the state
+        const auto tree = update.uuid.isNotEmpty() ? update.uuid : update.treeType + "@" + update.path.joinIntoString("/");
+        return tree + SERIALIZATION_SEPARATOR + update.property.toString();
+    }
+
+    void defer(const Update& update, double maxRateHz)
+    {
+        const auto intervalMs = (juce::int64)(1000.0 / maxRateHz);
+        const auto key = getKey(update);
+        for (auto& deferredUpdate: deferred){
+            if (getKey(deferredUpdate.update) == key){
+                deferredUpdate.update.value = update.value;  // Last write wins
+                deferredUpdate.intervalMs = intervalMs;
+                return;
+            }
+        }
+        deferred.push_back({update, intervalMs});
+    }
+
+    void removeDeferredUpdatesInvalidatedBy(const Update& update)
+    {
+        if (update.type == Update::Type::removedChild){
+            removeDeferredUpdatesInSubtree(update.uuid);
+        } else if (update.type == Update::Type::replacedChildren){
+            removeDeferredUpdatesInSubtree(update.uuid, false);
+        }
+    }
+
+    void removeDeferredUpdatesInSubtree(const juce::String& uuid, bool includingRoot = true)
+    {
+        deferred.erase(std::remove_if(deferred.begin(), deferred.end(), [&uuid, includingRoot](const DeferredUpdate& deferredUpdate){
+            return deferredUpdate.update.path.contains(uuid) && (includingRoot || deferredUpdate.update.uuid != uuid);
+        }), deferred.end());
+    }
+
+    StateSubscription::Ptr subscription;
+    std::vector<DeferredUpdate> deferred;
+    std::vector<Update> released;  // Deferred updates sent in the last batch (selected points to them)
+    std::vector<const Update*> selected;
+    juce::HashMap<juce::String, juce::int64> lastSentMs;  // Time at which each rate limited property was last sent
+
+    JUCE_DECLARE_NON_COPYABLE (StateSubscriptionDelivery)
+};
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "defines_shepherd.h"
+
+
+/** Journal of the state changes which have to be sent to the controller. Changes are recorded from the ValueTree
+    listener callbacks of the Sequencer and are flushed periodically, so that all the changes made during a flush
+    interval are sent to the controller in a single batch (see Sequencer::sendStateUpdateBatch).
+
+    Property changes are coalesced: if a property of a tree changes several times before the journal is flushed, only
+    the last value is sent, at the position of the first change (e.g. when turning an encoder which sets the BPM, or
+    playhead positions which are updated more often than the journal is flushed). Added and removed children are
+    never coalesced. Added children are copied when recorded, so the batch contains them as they were when added
+    (later changes to them are recorded as separate updates).
+
+    Bulk edits of the children of a tree (e.g. replacing the whole sequence of a clip) can be recorded as a single
+    update by wrapping them in beginReplacingChildren/endReplacingChildren: changes to the tree's children are not
+    recorded while replacing, and a single replacedChildren update with copies of the resulting children is recorded
+    at the end.
+
+    All methods must be called from the message thread. State changes made from other threads (e.g. the RT thread) would
+    be recorded concurrently with a flush, so these must be published to the state from the message thread instead (see
+    HardwareDevice::publishMidiCCParameterValues).
+*/
+class StateUpdateJournal: private juce::Timer
+{
+public:
+    struct Update
+    {
+        enum class Type { propertyChanged, addedChild, removedChild, replacedChildren };
+
+        Type type = Type::propertyChanged;
+        juce::String uuid;  // Parent uuid for Type::addedChild and Type::replacedChildren
+        juce::String treeType;  // Parent type for Type::addedChild and Type::replacedChildren
+        juce::Identifier property;  // Only for Type::propertyChanged (for Type::replacedChildren, type of the replaced children)
+        juce::var value;  // Only for Type::propertyChanged
+        int index = -1;  // Only for Type::addedChild
+        juce::ValueTree child;  // Only for Type::addedChild (for Type::replacedChildren, tree of the parent type with the new children)
+        juce::StringArray path;  // Uuids from the root of the state to the affected tree (the child for Type::addedChild), used to filter updates by subtree (see StateSubscription.h)
+    };
+
+    StateUpdateJournal (std::function<void(const std::vector<Update>&)> _sendBatch)
+        : sendBatch (std::move(_sendBatch))
+    {
+    }
+
+    ~StateUpdateJournal()
+    {
+        stopTimer();
+    }
+
+    void setFlushInterval(int milliseconds)
+    {
+        startTimer(milliseconds);
+    }
+
+    void recordPropertyChanged(const juce::ValueTree& tree, const juce::Identifier& property)
+    {
+        jassert(juce::MessageManager::existsAndIsCurrentThread());
+        if (isReplacingChildren(tree.getParent())){
+            return;
+        }
+        auto uuid = tree[ShepherdIDs::uuid].toString();
+        const auto pendingIndex = getPendingPropertyUpdateIndex(tree, uuid, property);
+        if (pendingIndex >= 0){
+            // Last write wins
+            updates[(size_t)pendingIndex].value = tree[property];
+            return;
+        }
+        Update update;
+        update.type = Update::Type::propertyChanged;
+        update.uuid = uuid;
+        update.treeType = tree.getType().toString();
+        update.property = property;
+        update.value = tree[property];
+        update.path = getUuidPath(tree);
+        if (uuid.isNotEmpty()){
+            pendingPropertyUpdates.set(uuid + SERIALIZATION_SEPARATOR + property.toString(), (int)updates.size());
+        } else {
+            pendingPropertyUpdatesOfTreesWithoutUuid.push_back({tree, (int)updates.size()});
+        }
+        updates.push_back(std::move(update));
+    }
+
+    void recordChildAdded(const juce::ValueTree& parentTree, const juce::ValueTree& child)
+    {
+        jassert(juce::MessageManager::existsAndIsCurrentThread());
+        if (isReplacingChildren(parentTree)){
+            return;
+        }
+        Update update;
+        update.type = Update::Type::addedChild;
+        update.uuid = parentTree[ShepherdIDs::uuid].toString();
+        update.treeType = parentTree.getType().toString();
+        update.index = parentTree.indexOf(child);
+        update.child = child.createCopy();
+        update.path = getUuidPath(child);
+        updates.push_back(std::move(update));
+    }
+
+    void recordChildRemoved(const juce::ValueTree& parentTree, const juce::ValueTree& child)
+    {
+        jassert(juce::MessageManager::existsAndIsCurrentThread());
+        if (isReplacingChildren(parentTree)){
+            return;
+        }
+        Update update;
+        update.type = Update::Type::removedChild;
+        update.uuid = child[ShepherdIDs::uuid].toString();
+        update.treeType = child.getType().toString();
+        update.path = getUuidPath(parentTree);  // Child is already detached from its parent
+        update.path.add(update.uuid);
+        updates.push_back(std::move(update));
+    }
+    
+    void beginReplacingChildren(const juce::ValueTree& parentTree)
+    {
+        auto uuid = parentTree[ShepherdIDs::uuid].toString();
+        parentsReplacingChildren.set(uuid, parentsReplacingChildren[uuid] + 1);
+    }
+    
+    /** Records the children of the given type which parentTree has now as a single update. Nested calls only record
+        the update when the outermost one ends. */
+    void endReplacingChildren(const juce::ValueTree& parentTree, const juce::Identifier& childType)
+    {
+        auto uuid = parentTree[ShepherdIDs::uuid].toString();
+        jassert(parentsReplacingChildren.contains(uuid));
+        auto depth = parentsReplacingChildren[uuid] - 1;
+        if (depth > 0){
+            parentsReplacingChildren.set(uuid, depth);
+            return;
+        }
+        parentsReplacingChildren.remove(uuid);
+        
+        Update update;
+        update.type = Update::Type::replacedChildren;
+        update.uuid = uuid;
+        update.treeType = parentTree.getType().toString();
+        update.property = childType;
+        update.child = juce::ValueTree(parentTree.getType());
+        for (auto child: parentTree){
+            if (child.hasType(childType)){
+                update.child.appendChild(child.createCopy(), nullptr);
+            }
+        }
+        update.path = getUuidPath(parentTree);
+        updates.push_back(std::move(update));
+    }
+    
+    bool hasPendingUpdates() const
+    {
+        return !updates.empty();
+    }
+
+    /** Sends the pending updates (if any) as a batch. This is also called before sending messages which must not be
+        received before the pending updates (e.g. the full state). */
+    void flush()
+    {
+        if (updates.empty()){
+            return;
+        }
+        sendBatch(updates);
+        updates.clear();
+        pendingPropertyUpdates.clear();
+        pendingPropertyUpdatesOfTreesWithoutUuid.clear();
+    }
+
+private:
+    void timerCallback() override
+    {
+        flush();
+    }
+    
+    /** Index in updates of the pending change of the property of the tree, or -1 if there is none. Trees are identified
+        by uuid, except the ones without uuid (e.g. the root of the state and the settings) which are compared by
+        identity, as all of them would have the same key. */
+    int getPendingPropertyUpdateIndex(const juce::ValueTree& tree, const juce::String& uuid, const juce::Identifier& property) const
+    {
+        if (uuid.isNotEmpty()){
+            auto key = uuid + SERIALIZATION_SEPARATOR + property.toString();
+            return pendingPropertyUpdates.contains(key) ? pendingPropertyUpdates[key] : -1;
+        }
+        for (const auto& [pendingTree, index]: pendingPropertyUpdatesOfTreesWithoutUuid){
+            if (pendingTree == tree && updates[(size_t)index].property == property){
+                return index;
+            }
+        }
+        return -1;
+    }
+    
+    bool isReplacingChildren(const juce::ValueTree& parentTree) const
+    {
+        return parentsReplacingChildren.size() > 0 && parentTree.isValid() && parentsReplacingChildren.contains(parentTree[ShepherdIDs::uuid].toString());
+    }
+    
+    static juce::StringArray getUuidPath(const juce::ValueTree& tree)
+    {
+        juce::StringArray path;
+        for (auto t = tree; t.isValid(); t = t.getParent()){
+            path.insert(0, t[ShepherdIDs::uuid].toString());
+        }
+        return path;
+    }
+
+    std::function<void(const std::vector<Update>&)> sendBatch;
+    std::vector<Update> updates;
+    juce::HashMap<juce::String, int> pendingPropertyUpdates;  // Index in updates of the pending change of a property
+    std::vector<std::pair<juce::ValueTree, int>> pendingPropertyUpdatesOfTreesWithoutUuid;  // Tree and index in updates
+    juce::HashMap<juce::String, int> parentsReplacingChildren;  // Uuid -> nesting depth (see beginReplacingChildren)
+
+    JUCE_DECLARE_NON_COPYABLE (StateUpdateJournal)
+};
+
+
+/** Recently sent batches of updates, so that controllers which missed some of them can ask for these to be replayed
+    instead of asking for the full state (see Sequencer::replayStateUpdates). Batches are kept unfiltered. The oldest
+    ones are forgotten when more than maxBatches batches or maxUpdates updates are kept (the last batch is always kept).
+
+    Must only be used from the message thread.
+*/
+class StateUpdateHistory
+{
+public:
+    struct Batch
+    {
+        int id;
+        std::vector<StateUpdateJournal::Update> updates;
+    };
+
+    StateUpdateHistory (size_t _maxBatches, size_t _maxUpdates)
+        : maxBatches (_maxBatches), maxUpdates (_maxUpdates)
+    {
+    }
+
+    /** Adds a sent batch. Batches must be added in the order of their IDs, without gaps. */
+    void add(int id, const std::vector<StateUpdateJournal::Update>& updates)
+    {
+        jassert(batches.empty() || id == batches.back().id + 1);
+        batches.push_back({id, updates});
+        numUpdates += updates.size();
+        while (batches.size() > maxBatches || (batches.size() > 1 && numUpdates > maxUpdates)){
+            numUpdates -= batches.front().updates.size();
+            batches.pop_front();
+        }
+    }
+
+    /** Returns true if all the batches from fromID up to the last one sent are kept, nextID being the ID of the next
+        batch which will be sent (fromID == nextID means there is nothing to replay). */
+    bool canReplayFrom(int fromID, int nextID) const
+    {
+        if (fromID > nextID){
+            return false;
+        }
+        if (fromID < nextID && (batches.empty() || fromID < batches.front().id)){
+            return false;
+        }
+        return true;
+    }
+
+    const std::deque<Batch>& getBatches() const { return batches; }
+
+private:
+    size_t maxBatches;
+    size_t maxUpdates;
+    std::deque<Batch> batches;
+    size_t numUpdates = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (StateUpdateHistory)
+};
@@ -39,6 +39,7 @@ void Track::bindState()
 {
     uuid.referTo(state, ShepherdIDs::uuid, nullptr, ShepherdDefaults::emptyString);
     name.referTo(state, ShepherdIDs::name, nullptr, ShepherdDefaults::emptyString);
+    handle.referTo(state, ShepherdIDs::handle, nullptr, -1);
     
     inputMonitoring.referTo(state, ShepherdIDs::inputMonitoring, nullptr, ShepherdDefaults::inputMonitoring);
     hardwareDeviceName.referTo(state, ShepherdIDs::outputHardwareDeviceName, nullptr, ShepherdDefaults::emptyString);
@@ -72,7 +73,7 @@ juce::MidiBuffer* Track::getMidiOutputDeviceBufferIfDevice()
         // If device is null pointer, it means no hardware device is yet assinged and no therefore no corresponding MIDI buffer
         return nullptr;
     }
-    auto midiOutputDeviceData = getMidiOutputDeviceData(outputHwDevice->getMidiOutputDeviceName());
+    auto midiOutputDeviceData = getMidiOutputDeviceData(outputHwDevice->getRTConfig().midiOutputDeviceName);
     if (midiOutputDeviceData == nullptr) { return nullptr; }
     juce::MidiBuffer* bufferToFill = &midiOutputDeviceData->buffer;
     if (bufferToFill == nullptr){
@@ -86,7 +87,7 @@ juce::MidiBuffer* Track::getMidiOutputDeviceBufferIfDevice()
 juce::String Track::getMidiOutputDeviceName()
 {
     if (outputHwDevice != nullptr){
-        return outputHwDevice->getMidiOutputDeviceName();
+        return outputHwDevice->getRTConfig().midiOutputDeviceName;
     } else {
         return "";
     }
@@ -95,7 +96,7 @@ juce::String Track::getMidiOutputDeviceName()
 int Track::getMidiOutputChannel()
 {
     if (outputHwDevice != nullptr){
-        return outputHwDevice->getMidiOutputChannel();
+        return outputHwDevice->getRTConfig().midiOutputChannel;
     } else {
         return -1;
     }
@@ -128,7 +129,7 @@ void Track::processInputMessagesFromInputHardwareDevice(HardwareDevice* inputDev
                                                         int meter,
                                                         bool playheadIsDoingCountIn)
 {
-    if (inputDevice->isTypeOutput()) {return;}  // Provided device is not of type input
+    if (inputDevice->getRTConfig().isTypeOutput()) {return;}  // Provided device is not of type input
     if (getOutputHardwareDevice() == nullptr){return;} // Track's output device has not been initialized
     if (!hasClipsCuedToRecordOrRecording() && !inputMonitoringEnabled()) {return;}  // If track has no clips cued to record/recording and is not input monitoring, don't handle input data
     
@@ -206,6 +207,24 @@ Clip* Track::getClipWithUUID(juce::String clipUUID)
     return clips->getObjectWithUUID(clipUUID);
 }
 
+Clip* Track::getClipWithHandleOrUUID(const juce::String& clipReference)
+{
+    int handle = ShepherdHelpers::parseHandle(clipReference);
+    if (handle > -1){
+        return clips->getObjectWithHandle(handle);
+    }
+    return clips->getObjectWithUUID(clipReference);
+}
+
+int Track::getIndexOfClipWithUUID(juce::String clipUUID)
+{
+    auto* clip = clips->getObjectWithUUID(clipUUID);
+    if (clip == nullptr){
+        return -1;
+    }
+    return clips->objects.indexOf(clip);
+}
+
 
 /** Stop all track clips that are currently playing
     @param now             stop clips immediately, otherwise wait until next quatized step
@@ -265,13 +284,9 @@ void Track::stopAllPlayingClipsExceptFor(int clipN, bool now, bool deCue, bool r
 */
 void Track::stopAllPlayingClipsExceptFor(juce::String clipUUID, bool now, bool deCue, bool reCue)
 {
-
-    for (int i=0; i<clips->objects.size(); i++){
-        auto clip = clips->objects[i];
-        if (clip->getUUID() == clipUUID){
-            stopAllPlayingClipsExceptFor(i, now, deCue, reCue);
-            return;
-        }
+    int clipN = getIndexOfClipWithUUID(clipUUID);
+    if (clipN > -1){
+        stopAllPlayingClipsExceptFor(clipN, now, deCue, reCue);
     }
 }
 
@@ -345,10 +360,10 @@ juce::MidiBuffer* Track::getLastSliceMidiBuffer()
     return &lastSliceMidiBuffer;
 }
 
-void Track::writeLastSliceMidiBufferToHardwareDeviceMidiBuffer()
+void Track::writeLastSliceMidiBufferToHardwareDeviceMidiBuffer(int sampleOffset)
 {
     juce::MidiBuffer* hardwareDeviceMidiBuffer = getMidiOutputDeviceBufferIfDevice();
     if (hardwareDeviceMidiBuffer != nullptr){
-        hardwareDeviceMidiBuffer->addEvents(lastSliceMidiBuffer, 0, getGlobalSettings().samplesPerSlice, 0);
+        hardwareDeviceMidiBuffer->addEvents(lastSliceMidiBuffer, 0, getGlobalSettings().samplesPerSlice, sampleOffset);
     }
 }
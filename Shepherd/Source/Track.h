@@ -32,10 +32,12 @@ public:
     
     juce::String getUUID() { return uuid.get(); };
     juce::String getName() { return name.get(); };
+    int getHandle() { return handle.get(); };
     
     void setOutputHardwareDeviceByName(juce::String deviceName);
     HardwareDevice* getOutputHardwareDevice();
     
+    // NOTE: these read from the output hardware device config snapshot and are meant to be used from the RT thread
     juce::String getMidiOutputDeviceName();
     int getMidiOutputChannel();
     
@@ -57,6 +59,8 @@ public:
     
     Clip* getClipAt(int clipN);
     Clip* getClipWithUUID(juce::String clipUUID);
+    Clip* getClipWithHandleOrUUID(const juce::String& clipReference);
+    int getIndexOfClipWithUUID(juce::String clipUUID);
     void stopAllPlayingClips(bool now, bool deCue, bool reCue);
     void stopAllPlayingClipsExceptFor(int clipN, bool now, bool deCue, bool reCue);
     void stopAllPlayingClipsExceptFor(juce::String clipUUID, bool now, bool deCue, bool reCue);
@@ -71,12 +75,13 @@ public:
     
     void clearMidiBuffers();
     juce::MidiBuffer* getLastSliceMidiBuffer();
-    void writeLastSliceMidiBufferToHardwareDeviceMidiBuffer();
+    void writeLastSliceMidiBufferToHardwareDeviceMidiBuffer(int sampleOffset);
 
 private:
     
     juce::CachedValue<juce::String> uuid;
     juce::CachedValue<juce::String> name;
+    juce::CachedValue<int> handle;
     
     juce::CachedValue<juce::String> hardwareDeviceName;
     juce::CachedValue<bool> inputMonitoring;
@@ -103,7 +108,7 @@ private:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Track)
 };
 
-struct TrackList: public drow::ValueTreeObjectList<Track>
+struct TrackList: public UUIDIndexedObjectList<Track>
 {
     TrackList (const juce::ValueTree& v,
                std::function<juce::Range<double>()> playheadParentSliceGetter,
@@ -111,7 +116,7 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
                std::function<MusicalContext*()> musicalContextGetter,
                std::function<HardwareDevice*(juce::String deviceName, HardwareDeviceType type)> hardwareDeviceGetter,
                std::function<MidiOutputDeviceData*(juce::String deviceName)> midiOutputDeviceDataGetter)
-    : drow::ValueTreeObjectList<Track> (v)
+    : UUIDIndexedObjectList<Track> (v)
     {
         getPlayheadParentSlice = playheadParentSliceGetter;
         getGlobalSettings = globalSettingsGetter;
@@ -119,6 +124,7 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
         getHardwareDeviceByName = hardwareDeviceGetter;
         getMidiOutputDeviceData = midiOutputDeviceDataGetter;
         rebuildObjects();
+        rebuildIndex();
     }
 
     ~TrackList()
@@ -146,19 +152,8 @@ struct TrackList: public drow::ValueTreeObjectList<Track>
         delete c;
     }
 
-    void newObjectAdded (Track*) override    {}
-    void objectRemoved (Track*) override     {}
     void objectOrderChanged() override       {}
     
-    Track* getObjectWithUUID(const juce::String& uuid) {
-        for (auto* object: objects){
-            if (object->getUUID() == uuid){
-                return object;
-            }
-        }
-        return nullptr;
-    }
-    
     std::function<juce::Range<double>()> getPlayheadParentSlice;
     std::function<GlobalSettingsStruct()> getGlobalSettings;
     std::function<MusicalContext*()> getMusicalContext;
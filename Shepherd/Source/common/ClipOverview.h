@@ -0,0 +1,124 @@
+// Fixed-size summary of the contents of a clip for controller displays (see Clip::recreateSequenceAndAddToFifo). It is
+// computed when the clip sequence is recompiled and stored in the sequenceOverview property of the clip, so that
+// controllers can draw overviews of clips without having to go through all their sequence events. Controllers parse the
+// serialized overview (see pyshepherd ClipOverview), so its layout must not change without updating them.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/** Occupancy bitmap of numColumns x numRows cells plus pitch range and event counts. Columns split the clip length in
+    equal parts and rows split the pitch range of the notes of the clip (from the lowest note in row 0 to the highest
+    one in the last row, each row being a single note if the range is small enough). A cell is occupied if any note of
+    the corresponding pitches sounds during the corresponding part of the clip (notes which wrap around the clip loop
+    occupy the cells at the end and at the start of the clip).
+
+    Serialized as "numNotes,numMidiEvents,minMidiNote,maxMidiNote,bitmap" where the bitmap has one 64 bit hexadecimal
+    number per row (starting from row 0) in which bit N is set if column N is occupied. minMidiNote and maxMidiNote are
+    -1 if there are no notes.
+*/
+class ClipOverview
+{
+public:
+    static constexpr int numColumns = 64;
+    static constexpr int numRows = 16;
+
+    explicit ClipOverview (double _lengthInBeats)
+        : lengthInBeats (_lengthInBeats)
+    {
+    }
+
+    /** Adds a note rendered at [start, end) (end can be beyond the clip length if the note wraps around the loop). */
+    void addNote(double start, double end, int midiNote)
+    {
+        notes.push_back({start, end, midiNote});
+        minMidiNote = numNotes == 0 ? midiNote : std::min(minMidiNote, midiNote);
+        maxMidiNote = numNotes == 0 ? midiNote : std::max(maxMidiNote, midiNote);
+        numNotes += 1;
+        bitmapIsComputed = false;
+    }
+
+    void addMidiEvent()
+    {
+        numMidiEvents += 1;
+    }
+
+    int getNumNotes() const { return numNotes; }
+    int getNumMidiEvents() const { return numMidiEvents; }
+    int getMinMidiNote() const { return numNotes > 0 ? minMidiNote : -1; }
+    int getMaxMidiNote() const { return numNotes > 0 ? maxMidiNote : -1; }
+
+    bool isOccupied(int column, int row)
+    {
+        computeBitmap();
+        return (rows[(size_t)row] >> column) & 1;
+    }
+
+    std::string serialize()
+    {
+        computeBitmap();
+        std::string serialized = std::to_string(numNotes) + "," + std::to_string(numMidiEvents) + "," + std::to_string(getMinMidiNote()) + "," + std::to_string(getMaxMidiNote()) + ",";
+        serialized.reserve(serialized.size() + numRows * 16);
+        static const char* hexDigits = "0123456789abcdef";
+        for (auto row: rows){
+            for (int shift=60; shift>=0; shift-=4){
+                serialized += hexDigits[(row >> shift) & 0xf];
+            }
+        }
+        return serialized;
+    }
+
+private:
+    struct Note
+    {
+        double start;
+        double end;
+        int midiNote;
+    };
+
+    void computeBitmap()
+    {
+        // Rows depend on the pitch range of all the notes, so the bitmap is computed once all notes have been added
+        if (bitmapIsComputed) { return; }
+        rows.fill(0);
+        bitmapIsComputed = true;
+        if (lengthInBeats <= 0.0 || numNotes == 0) { return; }
+
+        const int pitchRange = maxMidiNote - minMidiNote + 1;
+        for (const auto& note: notes){
+            const int row = pitchRange <= numRows ? note.midiNote - minMidiNote : (note.midiNote - minMidiNote) * numRows / pitchRange;
+            if (note.end <= lengthInBeats){
+                setColumns(row, note.start, note.end);
+            } else {
+                setColumns(row, note.start, lengthInBeats);
+                setColumns(row, 0.0, note.end - lengthInBeats);
+            }
+        }
+    }
+
+    void setColumns(int row, double start, double end)
+    {
+        // Columns from the one containing start to the one containing the end of the note (notes with no duration
+        // still occupy the column where they start)
+        const int firstColumn = std::clamp((int)std::floor(start / lengthInBeats * numColumns), 0, numColumns - 1);
+        const int lastColumn = std::clamp((int)std::ceil(end / lengthInBeats * numColumns) - 1, firstColumn, numColumns - 1);
+        for (int column=firstColumn; column<=lastColumn; column++){
+            rows[(size_t)row] |= uint64_t(1) << column;
+        }
+    }
+
+    double lengthInBeats;
+    std::vector<Note> notes;
+    int numNotes = 0;
+    int numMidiEvents = 0;
+    int minMidiNote = 0;
+    int maxMidiNote = 0;
+    std::array<uint64_t, numRows> rows {};
+    bool bitmapIsComputed = false;
+};
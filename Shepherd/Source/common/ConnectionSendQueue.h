@@ -0,0 +1,164 @@
+// Bounded queue of messages waiting to be sent to a controller connection (see ShepherdWebSocketsServer::send). Messages
+// are plain std::strings so that the same serialized message can be shared by the queues of all the connections.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+
+/** Queue of the messages to send to a single connection. Only one message per connection is handed to the WebSockets
+    library at a time: the next one is taken from the queue when the previous one has been written to the socket (which
+    happens in the WebSockets I/O thread). Messages are serialized once and shared (immutable) by the queues of all the
+    connections, so a slow connection only holds references to them.
+
+    The queue is bounded by number of messages and bytes. If a message does not fit, the connection is considered to
+    be stalled: all queued messages are dropped and replaced by a resync message, and the following state updates are
+    also dropped until a full state is queued (the controller is expected to request one when receiving the resync
+    message). In this way memory used by stalled connections is bounded and they recover with a consistent state.
+    After an overflow, messages which are not state updates are queued even if they don't fit on their own, so that
+    these are never lost. A full state which overflows the queue does not need a resync as it replaces all the rest.
+
+    All methods are thread safe.
+*/
+class ConnectionSendQueue
+{
+public:
+    enum class MessageKind
+    {
+        other,
+        stateUpdate,  // Can be dropped while waiting for a resync
+        fullState  // Ends the resync
+    };
+
+    struct Message
+    {
+        std::shared_ptr<const std::string> data;
+        bool binary = false;
+        MessageKind kind = MessageKind::other;
+    };
+
+    struct Stats
+    {
+        uint64_t messagesSent = 0;
+        uint64_t bytesSent = 0;
+        uint64_t messagesDropped = 0;
+        uint64_t overflows = 0;
+        size_t queuedMessages = 0;
+        size_t queuedBytes = 0;
+        size_t maxQueuedMessages = 0;  // High watermark
+        bool resyncPending = false;
+    };
+
+    ConnectionSendQueue (size_t _maxMessages, size_t _maxBytes, Message _resyncMessage)
+        : maxMessages (_maxMessages), maxBytes (_maxBytes), resyncMessage (std::move(_resyncMessage))
+    {
+    }
+
+    /** Sets the message queued when the connection overflows (it depends on the protocol used by the connection). */
+    void setResyncMessage(Message message)
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+        resyncMessage = std::move(message);
+    }
+
+    /** Adds a message to the queue. If no message is being sent, returns the message which should be sent now (the
+        caller must then call sent once it has been written). */
+    std::optional<Message> push(Message message)
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+        if (message.kind == MessageKind::stateUpdate && resyncPending){
+            stats.messagesDropped += 1;
+            return std::nullopt;
+        }
+        if (message.kind == MessageKind::fullState){
+            resyncPending = false;
+        }
+        if (queue.size() + 1 > maxMessages || queuedBytes + message.data->size() > maxBytes){
+            overflow(message.kind != MessageKind::fullState);  // A full state resyncs the connection by itself
+            if (message.kind == MessageKind::stateUpdate){
+                stats.messagesDropped += 1;
+                return takeNextIfIdle();
+            }
+        }
+        enqueue(std::move(message));
+        return takeNextIfIdle();
+    }
+
+    /** Called when the message being sent has been written (or failed). Returns the next message to send, if any. */
+    std::optional<Message> sent(bool success)
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+        if (success){
+            stats.messagesSent += 1;
+            stats.bytesSent += inFlightBytes;
+        }
+        sending = false;
+        inFlightBytes = 0;
+        return takeNextIfIdle();
+    }
+
+    Stats getStats() const
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+        Stats currentStats = stats;
+        currentStats.queuedMessages = queue.size();
+        currentStats.queuedBytes = queuedBytes;
+        currentStats.resyncPending = resyncPending;
+        return currentStats;
+    }
+
+private:
+    void enqueue(Message message)
+    {
+        queuedBytes += message.data->size();
+        queue.push_back(std::move(message));
+        if (queue.size() > stats.maxQueuedMessages){
+            stats.maxQueuedMessages = queue.size();
+        }
+    }
+
+    void overflow(bool needsResync)
+    {
+        // Queued messages are dropped (the message being sent is not in the queue anymore) and replaced by the resync
+        stats.overflows += 1;
+        stats.messagesDropped += queue.size();
+        queue.clear();
+        queuedBytes = 0;
+        if (needsResync){
+            resyncPending = true;
+            if (resyncMessage.data != nullptr){
+                enqueue(resyncMessage);
+            }
+        }
+    }
+
+    std::optional<Message> takeNextIfIdle()
+    {
+        if (sending || queue.empty()){
+            return std::nullopt;
+        }
+        Message next = std::move(queue.front());
+        queue.pop_front();
+        queuedBytes -= next.data->size();
+        sending = true;
+        inFlightBytes = next.data->size();
+        return next;
+    }
+
+    const size_t maxMessages;
+    const size_t maxBytes;
+    Message resyncMessage;
+
+    mutable std::mutex mutex;
+    std::deque<Message> queue;
+    size_t queuedBytes = 0;
+    bool sending = false;
+    size_t inFlightBytes = 0;
+    bool resyncPending = false;
+    Stats stats;
+};
@@ -0,0 +1,383 @@
+// Addresses of the messages exchanged with the controller, and lookup table used to dispatch incoming messages. The
+// table is built at compile time, so the WebSockets thread resolves the action of a message when parsing it and the
+// Sequencer only switches on the action (see Sequencer::processMessageFromController).
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+#define ACTION_ADDRESS_TRANSPORT "/transport"
+#define ACTION_ADDRESS_TRANSPORT_PLAY_STOP "/transport/playStop"
+#define ACTION_ADDRESS_TRANSPORT_PLAY "/transport/play"
+#define ACTION_ADDRESS_TRANSPORT_STOP "/transport/stop"
+#define ACTION_ADDRESS_TRANSPORT_SET_BPM "/transport/setBpm"
+#define ACTION_ADDRESS_TRANSPORT_SET_METER "/transport/setMeter"
+
+#define ACTION_ADDRESS_CLIP "/clip"
+#define ACTION_ADDRESS_CLIP_PLAY "/clip/play"
+#define ACTION_ADDRESS_CLIP_STOP "/clip/stop"
+#define ACTION_ADDRESS_CLIP_PLAY_STOP "/clip/playStop"
+#define ACTION_ADDRESS_CLIP_RECORD_ON_OFF "/clip/recordOnOff"
+#define ACTION_ADDRESS_CLIP_CLEAR "/clip/clear"
+#define ACTION_ADDRESS_CLIP_DOUBLE "/clip/double"
+#define ACTION_ADDRESS_CLIP_QUANTIZE "/clip/quantize"
+#define ACTION_ADDRESS_CLIP_UNDO "/clip/undo"
+#define ACTION_ADDRESS_CLIP_SET_LENGTH "/clip/setLength"
+#define ACTION_ADDRESS_CLIP_SET_BPM_MULTIPLIER "/clip/setBpmMultiplier"
+#define ACTION_ADDRESS_CLIP_SET_SEQUENCE "/clip/setSequence"
+#define ACTION_ADDRESS_CLIP_EDIT_SEQUENCE "/clip/editSequence"
+#define ACTION_ADDRESS_CLIP_QUERY_EVENTS "/clip/queryEvents"
+#define ACTION_ADDRESS_CLIP_EVENTS "/clip/events"  // Reply to ACTION_ADDRESS_CLIP_QUERY_EVENTS
+
+#define ACTION_ADDRESS_TRACK "/track"
+#define ACTION_ADDRESS_TRACK_SET_INPUT_MONITORING "/track/setInputMonitoring"
+#define ACTION_ADDRESS_TRACK_SET_ACTIVE_UI_NOTES_MONITORING_TRACK "/track/setActiveUiNotesMonitoringTrack"
+#define ACTION_ADDRESS_TRACK_SET_HARDWARE_DEVICE "/track/setOutputHardwareDevice"
+
+#define ACTION_ADDRESS_DEVICE "/device"
+#define ACTION_ADDRESS_DEVICE_SEND_ALL_NOTES_OFF_TO_DEVICE "/device/sendAllNotesOff"
+#define ACTION_ADDRESS_DEVICE_LOAD_DEVICE_PRESET "/device/loadDevicePreset"
+#define ACTION_ADDRESS_DEVICE_SEND_MIDI "/device/sendMidi"
+#define ACTION_ADDRESS_DEVICE_SET_NOTES_MAPPING "/device/setNotesMapping"
+#define ACTION_ADDRESS_DEVICE_SET_CC_MAPPING "/device/setCCMapping"
+#define ACTION_ADDRESS_DEVICE_SET_MIDI_CHANNEL "/device/setMidiChannel"
+
+#define ACTION_ADDRESS_SCENE "/scene"
+#define ACTION_ADDRESS_SCENE_DUPLICATE "/scene/duplicate"
+#define ACTION_ADDRESS_SCENE_PLAY "/scene/play"
+
+#define ACTION_ADDRESS_METRONOME "/metronome"
+#define ACTION_ADDRESS_METRONOME_ON "/metronome/on"
+#define ACTION_ADDRESS_METRONOME_OFF "/metronome/off"
+#define ACTION_ADDRESS_METRONOME_ON_OFF "/metronome/onOff"
+
+#define ACTION_ADDRESS_SETTINGS "/settings"
+#define ACTION_ADDRESS_SETTINGS_LOAD_SESSION "/settings/load"
+#define ACTION_ADDRESS_SETTINGS_SAVE_SESSION "/settings/save"
+#define ACTION_ADDRESS_SETTINGS_NEW_SESSION "/settings/new"
+#define ACTION_ADDRESS_SETTINGS_FIXED_VELOCITY "/settings/fixedVelocity"
+#define ACTION_ADDRESS_SETTINGS_FIXED_LENGTH "/settings/fixedLength"
+#define ACTION_ADDRESS_TRANSPORT_RECORD_AUTOMATION "/settings/toggleRecordAutomation"
+#define ACTION_ADDRESS_SETTINGS_TOGGLE_DEBUG_SYNTH "/settings/debugSynthOnOff"
+
+#define ACTION_ADDRESS_GET_STATE "/get_state"
+#define ACTION_ADDRESS_FULL_STATE "/full_state"
+#define ACTION_ADDRESS_STATE_SNAPSHOT_CHUNK "/state_snapshot_chunk"  // Reply to ACTION_ADDRESS_GET_STATE "snapshot" (see StateSnapshotSender.h)
+#define ACTION_ADDRESS_PLAYHEADS "/playheads"
+#define ACTION_ADDRESS_RESYNC "/resync"  // Sent to connections which could not keep up (see ConnectionSendQueue.h), should request the full state
+#define ACTION_ADDRESS_STATE_UPDATE "/state_update"
+#define ACTION_ADDRESS_STATE_UPDATE_BATCH "/state_update_batch"
+#define ACTION_ADDRESS_STATE_UPDATE_REPLAY "/state_update_replay"  // Reply to ACTION_ADDRESS_GET_STATE "since:<id>"
+
+#define ACTION_ADDRESS_SHEPHERD_CONTROLLER_READY "/shepherdControllerReady"
+#define ACTION_ADDRESS_ALIVE_MESSAGE "/alive"
+#define ACTION_ADDRESS_STARTED_MESSAGE "/app_started"
+
+// Selects the protocol used by a connection ("text" or "binary", see Sequencer::serializeOSCMessageToBinary). This
+// message is handled by the WebSockets server for the connection which sends it, it is not part of the actions table
+#define ACTION_ADDRESS_SET_PROTOCOL "/setProtocol"
+
+// Add and remove rules of the subscription of a connection, so that it only receives the state updates it is
+// interested in (see StateSubscription.h). Like ACTION_ADDRESS_SET_PROTOCOL, these are handled by the WebSockets server
+#define ACTION_ADDRESS_SUBSCRIBE "/subscribe"
+#define ACTION_ADDRESS_UNSUBSCRIBE "/unsubscribe"
+
+
+enum class ControllerActionGroup
+{
+    none,
+    clip,
+    track,
+    device,
+    scene,
+    transport,
+    metronome,
+    settings,
+    other
+};
+
+enum class ControllerAction
+{
+    unknown,
+    transportPlayStop,
+    transportPlay,
+    transportStop,
+    transportSetBpm,
+    transportSetMeter,
+    clipPlay,
+    clipStop,
+    clipPlayStop,
+    clipRecordOnOff,
+    clipClear,
+    clipDouble,
+    clipQuantize,
+    clipUndo,
+    clipSetLength,
+    clipSetBpmMultiplier,
+    clipSetSequence,
+    clipEditSequence,
+    clipQueryEvents,
+    trackSetInputMonitoring,
+    trackSetActiveUiNotesMonitoringTrack,
+    trackSetHardwareDevice,
+    deviceSendAllNotesOff,
+    deviceLoadDevicePreset,
+    deviceSendMidi,
+    deviceSetNotesMapping,
+    deviceSetCCMapping,
+    deviceSetMidiChannel,
+    sceneDuplicate,
+    scenePlay,
+    metronomeOn,
+    metronomeOff,
+    metronomeOnOff,
+    settingsLoadSession,
+    settingsSaveSession,
+    settingsNewSession,
+    settingsFixedVelocity,
+    settingsFixedLength,
+    settingsToggleRecordAutomation,
+    settingsToggleDebugSynth,
+    getState,
+    shepherdControllerReady
+};
+
+struct ControllerActionInfo
+{
+    std::string_view address;
+    ControllerAction action = ControllerAction::unknown;
+    ControllerActionGroup group = ControllerActionGroup::none;
+};
+
+
+namespace ControllerActions
+{
+
+/** All actions that can be received from the controller. */
+inline constexpr std::array<ControllerActionInfo, 41> actions {{
+    {ACTION_ADDRESS_TRANSPORT_PLAY_STOP, ControllerAction::transportPlayStop, ControllerActionGroup::transport},
+    {ACTION_ADDRESS_TRANSPORT_PLAY, ControllerAction::transportPlay, ControllerActionGroup::transport},
+    {ACTION_ADDRESS_TRANSPORT_STOP, ControllerAction::transportStop, ControllerActionGroup::transport},
+    {ACTION_ADDRESS_TRANSPORT_SET_BPM, ControllerAction::transportSetBpm, ControllerActionGroup::transport},
+    {ACTION_ADDRESS_TRANSPORT_SET_METER, ControllerAction::transportSetMeter, ControllerActionGroup::transport},
+    {ACTION_ADDRESS_CLIP_PLAY, ControllerAction::clipPlay, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_STOP, ControllerAction::clipStop, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_PLAY_STOP, ControllerAction::clipPlayStop, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_RECORD_ON_OFF, ControllerAction::clipRecordOnOff, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_CLEAR, ControllerAction::clipClear, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_DOUBLE, ControllerAction::clipDouble, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_QUANTIZE, ControllerAction::clipQuantize, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_UNDO, ControllerAction::clipUndo, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_SET_LENGTH, ControllerAction::clipSetLength, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_SET_BPM_MULTIPLIER, ControllerAction::clipSetBpmMultiplier, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_SET_SEQUENCE, ControllerAction::clipSetSequence, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_EDIT_SEQUENCE, ControllerAction::clipEditSequence, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_CLIP_QUERY_EVENTS, ControllerAction::clipQueryEvents, ControllerActionGroup::clip},
+    {ACTION_ADDRESS_TRACK_SET_INPUT_MONITORING, ControllerAction::trackSetInputMonitoring, ControllerActionGroup::track},
+    {ACTION_ADDRESS_TRACK_SET_ACTIVE_UI_NOTES_MONITORING_TRACK, ControllerAction::trackSetActiveUiNotesMonitoringTrack, ControllerActionGroup::track},
+    {ACTION_ADDRESS_TRACK_SET_HARDWARE_DEVICE, ControllerAction::trackSetHardwareDevice, ControllerActionGroup::track},
+    {ACTION_ADDRESS_DEVICE_SEND_ALL_NOTES_OFF_TO_DEVICE, ControllerAction::deviceSendAllNotesOff, ControllerActionGroup::device},
+    {ACTION_ADDRESS_DEVICE_LOAD_DEVICE_PRESET, ControllerAction::deviceLoadDevicePreset, ControllerActionGroup::device},
+    {ACTION_ADDRESS_DEVICE_SEND_MIDI, ControllerAction::deviceSendMidi, ControllerActionGroup::device},
+    {ACTION_ADDRESS_DEVICE_SET_NOTES_MAPPING, ControllerAction::deviceSetNotesMapping, ControllerActionGroup::device},
+    {ACTION_ADDRESS_DEVICE_SET_CC_MAPPING, ControllerAction::deviceSetCCMapping, ControllerActionGroup::device},
+    {ACTION_ADDRESS_DEVICE_SET_MIDI_CHANNEL, ControllerAction::deviceSetMidiChannel, ControllerActionGroup::device},
+    {ACTION_ADDRESS_SCENE_DUPLICATE, ControllerAction::sceneDuplicate, ControllerActionGroup::scene},
+    {ACTION_ADDRESS_SCENE_PLAY, ControllerAction::scenePlay, ControllerActionGroup::scene},
+    {ACTION_ADDRESS_METRONOME_ON, ControllerAction::metronomeOn, ControllerActionGroup::metronome},
+    {ACTION_ADDRESS_METRONOME_OFF, ControllerAction::metronomeOff, ControllerActionGroup::metronome},
+    {ACTION_ADDRESS_METRONOME_ON_OFF, ControllerAction::metronomeOnOff, ControllerActionGroup::metronome},
+    {ACTION_ADDRESS_SETTINGS_LOAD_SESSION, ControllerAction::settingsLoadSession, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_SETTINGS_SAVE_SESSION, ControllerAction::settingsSaveSession, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_SETTINGS_NEW_SESSION, ControllerAction::settingsNewSession, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_SETTINGS_FIXED_VELOCITY, ControllerAction::settingsFixedVelocity, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_SETTINGS_FIXED_LENGTH, ControllerAction::settingsFixedLength, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_TRANSPORT_RECORD_AUTOMATION, ControllerAction::settingsToggleRecordAutomation, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_SETTINGS_TOGGLE_DEBUG_SYNTH, ControllerAction::settingsToggleDebugSynth, ControllerActionGroup::settings},
+    {ACTION_ADDRESS_GET_STATE, ControllerAction::getState, ControllerActionGroup::other},
+    {ACTION_ADDRESS_SHEPHERD_CONTROLLER_READY, ControllerAction::shepherdControllerReady, ControllerActionGroup::other},
+}};
+
+constexpr size_t tableSizeBits = 8;
+constexpr size_t tableSize = 1 << tableSizeBits;  // Much larger than the number of actions so that a perfect seed is found quickly
+
+constexpr uint32_t hash(std::string_view address)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (char c: address){
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+constexpr size_t getSlot(uint32_t addressHash, uint32_t seed)
+{
+    // Multiplicative hashing of the address hash combined with the seed
+    return (size_t)(((addressHash ^ seed) * 2654435769u) >> (32 - tableSizeBits));
+}
+
+constexpr bool seedIsPerfect(uint32_t seed)
+{
+    std::array<bool, tableSize> used {};
+    for (const auto& info: actions){
+        size_t slot = getSlot(hash(info.address), seed);
+        if (used[slot]) { return false; }
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findPerfectSeed()
+{
+    for (uint32_t seed=0; seed<10000; seed++){
+        if (seedIsPerfect(seed)) { return seed; }
+    }
+    return 0xFFFFFFFF;
+}
+
+/** Seed for which all actions land in different slots of the table (found at compile time). */
+inline constexpr uint32_t perfectSeed = findPerfectSeed();
+static_assert(perfectSeed != 0xFFFFFFFF, "No perfect hash seed found for the controller actions, increase tableSize");
+
+constexpr std::array<int8_t, tableSize> buildTable()
+{
+    std::array<int8_t, tableSize> table {};
+    for (auto& slot: table){
+        slot = -1;
+    }
+    for (size_t i=0; i<actions.size(); i++){
+        table[getSlot(hash(actions[i].address), perfectSeed)] = (int8_t)i;
+    }
+    return table;
+}
+
+/** Index in actions of the action in each slot (or -1). */
+inline constexpr std::array<int8_t, tableSize> table = buildTable();
+
+/** Returns the action corresponding to the address (group none and action unknown if the address is not known).
+    Cost is one hash of the address and a single string comparison. */
+constexpr ControllerActionInfo lookup(std::string_view address)
+{
+    int8_t index = table[getSlot(hash(address), perfectSeed)];
+    if (index < 0 || actions[(size_t)index].address != address){
+        return {};
+    }
+    return actions[(size_t)index];
+}
+
+/** Parameters of a message which, together with its action and its target (see getCoalescingTarget), identify the
+    value set by the message. Messages with the same action, target and values for these parameters replace each other
+    (see ControllerMessageQueue). */
+struct CoalescingKeyParameters
+{
+    bool canCoalesce = false;
+    size_t first = 0;
+    size_t count = 0;
+};
+
+constexpr CoalescingKeyParameters getCoalescingKeyParameters(ControllerAction action, size_t numParameters)
+{
+    switch (action) {
+        case ControllerAction::transportSetBpm:
+        case ControllerAction::transportSetMeter:
+            // The optional 2nd parameter is the beat at which the change is scheduled. Changes scheduled at different
+            // beats must all be applied, so the beat is part of the key
+            return numParameters > 1 ? CoalescingKeyParameters{true, 1, 1} : CoalescingKeyParameters{true, 0, 0};
+        case ControllerAction::settingsFixedVelocity:
+        case ControllerAction::settingsFixedLength:
+            return {true, 0, 0};
+        case ControllerAction::clipSetSequence:
+        case ControllerAction::clipSetLength:
+        case ControllerAction::clipSetBpmMultiplier:
+            // These replace a property of a single clip, which is identified by the target (the track and clip
+            // parameters can reference the same clip by handle or by UUID, so these are not part of the key)
+            if (numParameters >= 2){
+                return {true, 0, 0};
+            }
+            return {};
+        default:
+            return {};
+    }
+}
+
+/** Objects which can be changed by the messages of an action. A message is only replaced by a later message with the
+    same coalescing key if no other message which can change the same object is between them, so that messages are
+    never reordered relative to the other messages which change the same object (see findReplacedMessages). */
+enum class CoalescingTarget
+{
+    nothing,  // The message does not change the state (e.g. queries)
+    clip,  // The clip referenced by the track and clip parameters
+    transport,
+    metronome,
+    settings,
+    everything  // The message can change any object (e.g. loading a session or removing a track)
+};
+
+constexpr CoalescingTarget getCoalescingTarget(ControllerAction action, ControllerActionGroup group)
+{
+    switch (action) {
+        case ControllerAction::getState:
+        case ControllerAction::shepherdControllerReady:
+            return CoalescingTarget::nothing;
+        case ControllerAction::settingsLoadSession:
+        case ControllerAction::settingsSaveSession:
+        case ControllerAction::settingsNewSession:
+            return CoalescingTarget::everything;
+        default:
+            break;
+    }
+    switch (group) {
+        case ControllerActionGroup::clip:
+            return CoalescingTarget::clip;
+        case ControllerActionGroup::transport:
+            return CoalescingTarget::transport;
+        case ControllerActionGroup::metronome:
+            return CoalescingTarget::metronome;
+        case ControllerActionGroup::settings:
+            return CoalescingTarget::settings;
+        default:
+            return CoalescingTarget::everything;
+    }
+}
+
+/** Finds the messages of a batch which are replaced by a later message with the same coalescing key. For each message,
+    keys has its coalescing key (empty if it can't be coalesced) and targets identifies the object it can change (empty
+    for CoalescingTarget::nothing and anyTarget for CoalescingTarget::everything). */
+template <typename String>
+void findReplacedMessages(const std::vector<String>& keys, const std::vector<String>& targets, const String& anyTarget, std::vector<bool>& replaced)
+{
+    // Iterate the batch backwards so that the latest message with a given key is kept. "open" has the keys (and
+    // targets) of the messages which can still replace earlier ones
+    replaced.assign(keys.size(), false);
+    std::vector<std::pair<String, String>> open;
+    for (size_t i=keys.size(); i-- > 0;){
+        const auto& key = keys[i];
+        const auto& target = targets[i];
+        if (key != String()){
+            auto it = std::find_if(open.begin(), open.end(), [&key](const auto& openKey){ return openKey.first == key; });
+            if (it != open.end()){
+                replaced[i] = true;
+                continue;
+            }
+        }
+        if (target == anyTarget){
+            open.clear();
+        } else if (target != String()){
+            open.erase(std::remove_if(open.begin(), open.end(), [&target](const auto& openKey){ return openKey.second == target; }), open.end());
+        }
+        if (key != String()){
+            open.push_back({key, target});
+        }
+    }
+}
+
+}  // namespace ControllerActions
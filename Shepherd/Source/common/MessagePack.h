@@ -0,0 +1,288 @@
+// Minimal MessagePack (https://msgpack.org) writer and reader used by the binary controller protocol (see
+// Sequencer::serializeOSCMessageToBinary). Only the types needed by the protocol are supported: nil, booleans,
+// integers, floats, strings, binary data and arrays (maps and extension types are not). The Python counterpart of the
+// reader is _read_message_pack in pyshepherd/state_synchronizer.py, both need to be updated if new types are used.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+
+namespace MessagePack
+{
+
+/** Appends MessagePack encoded values to a byte buffer. Values are always written using the smallest encoding. */
+class Writer
+{
+public:
+    void writeNil()
+    {
+        data.push_back(0xc0);
+    }
+
+    void writeBool(bool value)
+    {
+        data.push_back(value ? 0xc3 : 0xc2);
+    }
+
+    void writeInt(int64_t value)
+    {
+        if (value >= 0){
+            if (value < 128){
+                data.push_back((uint8_t)value);  // positive fixint
+            } else if (value <= 0xff){
+                data.push_back(0xcc);
+                writeBigEndian((uint64_t)value, 1);
+            } else if (value <= 0xffff){
+                data.push_back(0xcd);
+                writeBigEndian((uint64_t)value, 2);
+            } else if (value <= 0xffffffffLL){
+                data.push_back(0xce);
+                writeBigEndian((uint64_t)value, 4);
+            } else {
+                data.push_back(0xcf);
+                writeBigEndian((uint64_t)value, 8);
+            }
+        } else {
+            if (value >= -32){
+                data.push_back((uint8_t)(int8_t)value);  // negative fixint
+            } else if (value >= INT8_MIN){
+                data.push_back(0xd0);
+                writeBigEndian((uint64_t)value, 1);
+            } else if (value >= INT16_MIN){
+                data.push_back(0xd1);
+                writeBigEndian((uint64_t)value, 2);
+            } else if (value >= INT32_MIN){
+                data.push_back(0xd2);
+                writeBigEndian((uint64_t)value, 4);
+            } else {
+                data.push_back(0xd3);
+                writeBigEndian((uint64_t)value, 8);
+            }
+        }
+    }
+
+    void writeFloat(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        data.push_back(0xca);
+        writeBigEndian(bits, 4);
+    }
+
+    void writeDouble(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        data.push_back(0xcb);
+        writeBigEndian(bits, 8);
+    }
+
+    void writeString(std::string_view value)
+    {
+        const auto size = value.size();
+        if (size < 32){
+            data.push_back((uint8_t)(0xa0 | size));  // fixstr
+        } else if (size <= 0xff){
+            data.push_back(0xd9);
+            writeBigEndian(size, 1);
+        } else if (size <= 0xffff){
+            data.push_back(0xda);
+            writeBigEndian(size, 2);
+        } else {
+            data.push_back(0xdb);
+            writeBigEndian(size, 4);
+        }
+        data.insert(data.end(), value.begin(), value.end());
+    }
+
+    void writeBinary(const void* bytes, size_t size)
+    {
+        if (size <= 0xff){
+            data.push_back(0xc4);
+            writeBigEndian(size, 1);
+        } else if (size <= 0xffff){
+            data.push_back(0xc5);
+            writeBigEndian(size, 2);
+        } else {
+            data.push_back(0xc6);
+            writeBigEndian(size, 4);
+        }
+        const auto* begin = static_cast<const uint8_t*>(bytes);
+        data.insert(data.end(), begin, begin + size);
+    }
+
+    void writeArrayHeader(uint32_t numElements)
+    {
+        if (numElements < 16){
+            data.push_back((uint8_t)(0x90 | numElements));  // fixarray
+        } else if (numElements <= 0xffff){
+            data.push_back(0xdc);
+            writeBigEndian(numElements, 2);
+        } else {
+            data.push_back(0xdd);
+            writeBigEndian(numElements, 4);
+        }
+    }
+
+    const std::vector<uint8_t>& getData() const { return data; }
+    void clear() { data.clear(); }
+
+private:
+    void writeBigEndian(uint64_t value, int numBytes)
+    {
+        for (int i=numBytes - 1; i>=0; i--){
+            data.push_back((uint8_t)(value >> (8 * i)));
+        }
+    }
+
+    std::vector<uint8_t> data;
+};
+
+
+/** Value decoded by Reader. Strings and binary data point into the buffer being read (they are not copied). */
+struct Value
+{
+    enum class Type { nil, boolean, integer, floatingPoint, string, binary, array };
+
+    Type type = Type::nil;
+    bool boolValue = false;
+    int64_t intValue = 0;
+    double doubleValue = 0.0;
+    const uint8_t* bytes = nullptr;  // For strings and binary data
+    uint32_t size = 0;  // Length of strings and binary data, number of elements of arrays
+
+    std::string_view getString() const { return std::string_view(reinterpret_cast<const char*>(bytes), size); }
+};
+
+
+/** Reads MessagePack encoded values from a byte buffer. Arrays are read as a header (Value::Type::array with the number
+    of elements in Value::size) followed by their elements, which are read with subsequent calls to read. */
+class Reader
+{
+public:
+    Reader (const void* bytes, size_t size)
+        : data(static_cast<const uint8_t*>(bytes)), end(static_cast<const uint8_t*>(bytes) + size)
+    {
+    }
+
+    bool atEnd() const { return data == end; }
+
+    /** Reads the next value. Returns false if the data is malformed or truncated, or uses an unsupported type. */
+    bool read(Value& value)
+    {
+        uint8_t marker;
+        if (!readBytes(&marker, 1)){
+            return false;
+        }
+
+        if (marker <= 0x7f){
+            return setInt(value, marker);
+        } else if (marker >= 0xe0){
+            return setInt(value, (int8_t)marker);
+        } else if ((marker & 0xe0) == 0xa0){
+            return readBytesValue(value, Value::Type::string, marker & 0x1f);
+        } else if ((marker & 0xf0) == 0x90){
+            value.type = Value::Type::array;
+            value.size = marker & 0x0f;
+            return true;
+        }
+
+        uint64_t n;
+        switch (marker) {
+            case 0xc0: value.type = Value::Type::nil; return true;
+            case 0xc2: value.type = Value::Type::boolean; value.boolValue = false; return true;
+            case 0xc3: value.type = Value::Type::boolean; value.boolValue = true; return true;
+            case 0xcc: return readBigEndian(n, 1) && setInt(value, (int64_t)n);
+            case 0xcd: return readBigEndian(n, 2) && setInt(value, (int64_t)n);
+            case 0xce: return readBigEndian(n, 4) && setInt(value, (int64_t)n);
+            case 0xcf: return readBigEndian(n, 8) && setInt(value, (int64_t)n);
+            case 0xd0: return readBigEndian(n, 1) && setInt(value, (int8_t)n);
+            case 0xd1: return readBigEndian(n, 2) && setInt(value, (int16_t)n);
+            case 0xd2: return readBigEndian(n, 4) && setInt(value, (int32_t)n);
+            case 0xd3: return readBigEndian(n, 8) && setInt(value, (int64_t)n);
+            case 0xca: {
+                if (!readBigEndian(n, 4)) { return false; }
+                uint32_t bits = (uint32_t)n;
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                value.type = Value::Type::floatingPoint;
+                value.doubleValue = f;
+                return true;
+            }
+            case 0xcb: {
+                if (!readBigEndian(n, 8)) { return false; }
+                double d;
+                std::memcpy(&d, &n, sizeof(d));
+                value.type = Value::Type::floatingPoint;
+                value.doubleValue = d;
+                return true;
+            }
+            case 0xd9: return readBigEndian(n, 1) && readBytesValue(value, Value::Type::string, n);
+            case 0xda: return readBigEndian(n, 2) && readBytesValue(value, Value::Type::string, n);
+            case 0xdb: return readBigEndian(n, 4) && readBytesValue(value, Value::Type::string, n);
+            case 0xc4: return readBigEndian(n, 1) && readBytesValue(value, Value::Type::binary, n);
+            case 0xc5: return readBigEndian(n, 2) && readBytesValue(value, Value::Type::binary, n);
+            case 0xc6: return readBigEndian(n, 4) && readBytesValue(value, Value::Type::binary, n);
+            case 0xdc:
+            case 0xdd:
+                if (!readBigEndian(n, marker == 0xdc ? 2 : 4)) { return false; }
+                value.type = Value::Type::array;
+                value.size = (uint32_t)n;
+                return true;
+            default:
+                return false;  // Maps, extension types and reserved markers are not supported
+        }
+    }
+
+private:
+    static bool setInt(Value& value, int64_t intValue)
+    {
+        value.type = Value::Type::integer;
+        value.intValue = intValue;
+        return true;
+    }
+
+    bool readBytes(uint8_t* destination, size_t numBytes)
+    {
+        if ((size_t)(end - data) < numBytes){
+            return false;
+        }
+        std::memcpy(destination, data, numBytes);
+        data += numBytes;
+        return true;
+    }
+
+    bool readBigEndian(uint64_t& value, int numBytes)
+    {
+        uint8_t buffer[8];
+        if (!readBytes(buffer, (size_t)numBytes)){
+            return false;
+        }
+        value = 0;
+        for (int i=0; i<numBytes; i++){
+            value = (value << 8) | buffer[i];
+        }
+        return true;
+    }
+
+    bool readBytesValue(Value& value, Value::Type type, uint64_t numBytes)
+    {
+        if ((uint64_t)(end - data) < numBytes){
+            return false;
+        }
+        value.type = type;
+        value.bytes = data;
+        value.size = (uint32_t)numBytes;
+        data += numBytes;
+        return true;
+    }
+
+    const uint8_t* data;
+    const uint8_t* end;
+};
+
+}  // namespace MessagePack
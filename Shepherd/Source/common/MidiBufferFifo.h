@@ -0,0 +1,75 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+
+/** Lock-free single producer single consumer fifo of MIDI buffers.
+
+    Unlike Fifo<juce::MidiBuffer>, buffers are not copy-assigned (which would allocate) but their contents are
+    copied into slots which are pre-allocated when the fifo is created. Together with each buffer, the time at
+    which the first sample of the buffer should be sent and the sample rate are stored so that the consumer can
+    schedule the messages of the buffer if needed.
+*/
+template<size_t Size = 32>
+struct MidiBufferFifo
+{
+    struct Slot {
+        juce::MidiBuffer buffer;
+        double startTimeMs = 0.0;  // Negative values mean "send now"
+        double sampleRate = 0.0;
+    };
+
+    MidiBufferFifo(int bufferSizeInBytes)
+    {
+        for (auto& slot: slots){
+            slot.buffer.ensureSize(bufferSizeInBytes);
+        }
+    }
+
+    size_t getSize() const noexcept { return Size; }
+
+    bool push(const juce::MidiBuffer& buffer, double startTimeMs, double sampleRate)
+    {
+        auto write = fifo.write(1);
+        if( write.blockSize1 > 0 )
+        {
+            auto& slot = slots[static_cast<size_t>(write.startIndex1)];
+            slot.buffer.clear();  // Does not free pre-allocated memory
+            slot.buffer.addEvents(buffer, 0, -1, 0);
+            slot.startTimeMs = startTimeMs;
+            slot.sampleRate = sampleRate;
+            return true;
+        }
+
+        return false;
+    }
+
+    /** Calls the given function with the oldest slot in the fifo (if any) and then releases the slot.
+        Returns false if the fifo was empty. */
+    template<typename Function>
+    bool pull(Function&& processSlot)
+    {
+        auto read = fifo.read(1);
+        if( read.blockSize1 > 0 )
+        {
+            processSlot(slots[static_cast<size_t>(read.startIndex1)]);
+            return true;
+        }
+
+        return false;
+    }
+
+    int getNumAvailableForReading() const
+    {
+        return fifo.getNumReady();
+    }
+
+    int getAvailableSpace() const
+    {
+        return fifo.getFreeSpace();
+    }
+
+private:
+    juce::AbstractFifo fifo { Size };
+    std::array<Slot, Size> slots;
+};
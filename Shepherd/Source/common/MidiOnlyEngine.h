@@ -0,0 +1,179 @@
+// Used by Sequencer when no audio device is wanted (engine set to "midiOnly" in the backend settings). The timing loop uses
+// POSIX clocks and scheduling calls directly because the JUCE thread classes don't give control over SCHED_FIFO
+// priority and absolute wake-up times.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <utility>
+
+
+/** Statistics about the measured duration of the periods of a periodic thread. Updated from the periodic thread
+    and read (and reset) from any other thread, so all members are atomics and no locks are used. */
+struct PeriodJitterStats
+{
+    struct Report {
+        int64_t numPeriods = 0;
+        int64_t numOverruns = 0;        // Periods in which the thread woke up more than a full period late
+        double meanAbsJitterUs = 0.0;   // Mean absolute deviation of the measured period from the nominal period
+        double maxAbsJitterUs = 0.0;    // Max absolute deviation of the measured period from the nominal period
+        double maxWakeUpLatencyUs = 0.0;  // Max delay between the requested wake up time and the actual wake up time
+    };
+
+    void addPeriod(int64_t measuredPeriodNs, int64_t nominalPeriodNs, int64_t wakeUpLatencyNs)
+    {
+        int64_t absJitterNs = std::abs(measuredPeriodNs - nominalPeriodNs);
+        numPeriods.fetch_add(1, std::memory_order_relaxed);
+        sumAbsJitterNs.fetch_add(absJitterNs, std::memory_order_relaxed);
+        updateMax(maxAbsJitterNs, absJitterNs);
+        updateMax(maxWakeUpLatencyNs, wakeUpLatencyNs);
+        if (wakeUpLatencyNs > nominalPeriodNs){
+            numOverruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Report getAndReset()
+    {
+        Report report;
+        report.numPeriods = numPeriods.exchange(0);
+        report.numOverruns = numOverruns.exchange(0);
+        int64_t sum = sumAbsJitterNs.exchange(0);
+        report.meanAbsJitterUs = report.numPeriods > 0 ? (double)sum / (double)report.numPeriods / 1000.0 : 0.0;
+        report.maxAbsJitterUs = (double)maxAbsJitterNs.exchange(0) / 1000.0;
+        report.maxWakeUpLatencyUs = (double)maxWakeUpLatencyNs.exchange(0) / 1000.0;
+        return report;
+    }
+
+private:
+    static void updateMax(std::atomic<int64_t>& currentMax, int64_t value)
+    {
+        int64_t current = currentMax.load(std::memory_order_relaxed);
+        while (value > current && !currentMax.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    std::atomic<int64_t> numPeriods {0};
+    std::atomic<int64_t> numOverruns {0};
+    std::atomic<int64_t> sumAbsJitterNs {0};
+    std::atomic<int64_t> maxAbsJitterNs {0};
+    std::atomic<int64_t> maxWakeUpLatencyNs {0};
+};
+
+
+/** Drives the sequencer from a dedicated high resolution thread instead of from an audio device callback.
+
+    The thread wakes up at absolute times separated by a fixed period (using clock_nanosleep with TIMER_ABSTIME on
+    CLOCK_MONOTONIC, so errors do not accumulate) and calls renderSlice with a fixed number of samples. The sample
+    rate reported to the sequencer is adjusted so that a slice of samplesPerSlice samples lasts exactly one period,
+    as the sequencer expects all slices to have the same length.
+
+    If possible, the thread runs with SCHED_FIFO priority (this requires the rtprio limit to be set for the user
+    running the app, otherwise the thread runs with normal priority and isRealtime() returns false).
+*/
+class MidiOnlyEngine
+{
+public:
+    MidiOnlyEngine (std::function<void(int)> _renderSlice, std::function<void(int, double)> _prepare)
+        : renderSlice (std::move(_renderSlice)), prepare (std::move(_prepare))
+    {
+    }
+
+    ~MidiOnlyEngine()
+    {
+        stop();
+    }
+
+    /** Starts the engine thread. The period is rounded so that it corresponds to an integer number of samples at
+        the nominal sample rate. */
+    bool start(double periodMs, double nominalSampleRate, int realtimePriority)
+    {
+        if (thread.joinable() || periodMs <= 0.0 || nominalSampleRate <= 0.0) { return false; }
+
+        samplesPerSlice = std::max(1, (int)std::round(periodMs * nominalSampleRate / 1000.0));
+        periodNs = (int64_t)std::round(periodMs * 1000000.0);
+        sampleRate = samplesPerSlice * 1000000000.0 / (double)periodNs;
+        prepare(samplesPerSlice, sampleRate);
+
+        shouldExit = false;
+        thread = std::thread([this, realtimePriority]{ run(realtimePriority); });
+        return true;
+    }
+
+    void stop()
+    {
+        shouldExit = true;
+        if (thread.joinable()){
+            thread.join();
+        }
+    }
+
+    bool isRunning() const { return thread.joinable(); }
+    bool isRealtime() const { return realtime.load(); }
+    int getSamplesPerSlice() const { return samplesPerSlice; }
+    double getSampleRate() const { return sampleRate; }
+    double getPeriodMs() const { return (double)periodNs / 1000000.0; }
+
+    PeriodJitterStats jitterStats;
+
+private:
+    static int64_t toNs(const timespec& t) { return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec; }
+
+    static timespec fromNs(int64_t ns)
+    {
+        timespec t;
+        t.tv_sec = (time_t)(ns / 1000000000);
+        t.tv_nsec = (long)(ns % 1000000000);
+        return t;
+    }
+
+    static int64_t nowNs()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return toNs(now);
+    }
+
+    void run(int realtimePriority)
+    {
+        sched_param param;
+        param.sched_priority = realtimePriority;
+        realtime = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+
+        int64_t nextWakeUpNs = nowNs();
+        int64_t lastWakeUpNs = nextWakeUpNs;
+        while (!shouldExit){
+            nextWakeUpNs += periodNs;
+            timespec wakeUpTime = fromNs(nextWakeUpNs);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeUpTime, nullptr) == EINTR) {}
+
+            int64_t wakeUpNs = nowNs();
+            jitterStats.addPeriod(wakeUpNs - lastWakeUpNs, periodNs, wakeUpNs - nextWakeUpNs);
+            lastWakeUpNs = wakeUpNs;
+            if (wakeUpNs - nextWakeUpNs > periodNs * maxPeriodsBehind){
+                // We fell too far behind (e.g. system was suspended), don't try to catch up with all missed periods
+                nextWakeUpNs = wakeUpNs;
+            }
+
+            renderSlice(samplesPerSlice);
+        }
+    }
+
+    std::function<void(int)> renderSlice;
+    std::function<void(int, double)> prepare;
+    std::thread thread;
+    std::atomic<bool> shouldExit {false};
+    std::atomic<bool> realtime {false};
+    int samplesPerSlice = 0;
+    int64_t periodNs = 0;
+    double sampleRate = 0.0;
+    int64_t maxPeriodsBehind = 10;
+};
@@ -0,0 +1,89 @@
+// Used by the "scheduled" MIDI output mode (see midiOutputScheduling in Sequencer) to turn positions in the rendered
+// slices into the times passed to MidiOutput::sendBlockOfMessages
+
+#pragma once
+
+#include <cmath>
+
+
+/** Maps sample positions of the slices rendered in the audio callback to absolute times (in milliseconds)
+    that can be used to schedule MIDI output.
+
+    Audio callbacks do not arrive at perfectly regular intervals, but the stream of samples they render is
+    isochronous. The time base is "anchored" at the time of the first callback and from there times are
+    computed by counting rendered samples. The anchor is slowly moved to follow the observed callback times
+    (to compensate for drift between the audio clock and the system clock), and it is reset if the observed
+    time diverges too much from the expected one (e.g. after an xrun or after the audio device is restarted).
+*/
+class MidiOutputTimeBase
+{
+public:
+    MidiOutputTimeBase() {}
+
+    void prepare(double _sampleRate)
+    {
+        sampleRate = _sampleRate;
+        reset();
+    }
+
+    void reset()
+    {
+        anchored = false;
+        samplesSinceAnchor = 0.0;
+    }
+
+    /** Must be called once per slice (at the start of the audio callback) with the current time in
+        milliseconds and the number of samples in the slice. Returns the time at which the first sample of
+        the slice corresponds. */
+    double processSlice(double timeNowMs, int sliceNumSamples)
+    {
+        if (sampleRate <= 0.0){
+            return timeNowMs;
+        }
+
+        if (!anchored){
+            anchorTimeMs = timeNowMs;
+            samplesSinceAnchor = 0.0;
+            anchored = true;
+        }
+
+        double expectedTimeMs = anchorTimeMs + samplesSinceAnchor * 1000.0 / sampleRate;
+        double errorMs = timeNowMs - expectedTimeMs;
+        if (std::abs(errorMs) > resyncThresholdMs){
+            // Time base has diverged too much, re-anchor
+            anchorTimeMs = timeNowMs;
+            samplesSinceAnchor = 0.0;
+            expectedTimeMs = timeNowMs;
+        } else {
+            // Slowly follow the observed callback times
+            anchorTimeMs += errorMs * driftCorrectionFactor;
+            expectedTimeMs += errorMs * driftCorrectionFactor;
+        }
+
+        sliceStartTimeMs = expectedTimeMs;
+        samplesSinceAnchor += sliceNumSamples;
+        return sliceStartTimeMs;
+    }
+
+    /** Returns the time corresponding to the start of the last processed slice. */
+    double getSliceStartTimeMs() const { return sliceStartTimeMs; }
+
+    /** Returns the time corresponding to a sample position of the last processed slice. */
+    double getTimeForSamplePosition(int samplePosition) const
+    {
+        if (sampleRate <= 0.0){
+            return sliceStartTimeMs;
+        }
+        return sliceStartTimeMs + samplePosition * 1000.0 / sampleRate;
+    }
+
+    double resyncThresholdMs = 50.0;
+    double driftCorrectionFactor = 0.005;
+
+private:
+    double sampleRate = 0.0;
+    bool anchored = false;
+    double anchorTimeMs = 0.0;
+    double samplesSinceAnchor = 0.0;
+    double sliceStartTimeMs = 0.0;
+};
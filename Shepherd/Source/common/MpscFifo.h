@@ -0,0 +1,75 @@
+// Bounded queue based on Dmitry Vyukov's bounded MPMC queue, simplified for a single consumer. Used for the queue of
+// commands sent to the thread rendering the slices (see SequencerCommand.h), which can be pushed to from any thread.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+/** Lock-free FIFO with pre-allocated slots which can be pushed to from any number of threads and pulled from a
+    single thread (e.g. the RT thread). Same interface as Fifo (which only supports a single producer).
+    push and pull never allocate or block; push returns false if the FIFO is full.
+    Size must be a power of 2.
+*/
+template<typename T, size_t Size = 64>
+struct MpscFifo
+{
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "MpscFifo size must be a power of 2");
+
+    MpscFifo()
+    {
+        for (size_t i=0; i<Size; i++){
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t getSize() const noexcept { return Size; }
+
+    /** Can be called from any thread. */
+    bool push(const T& t)
+    {
+        size_t position = writePosition.load(std::memory_order_relaxed);
+        while (true){
+            auto& slot = slots[position & (Size - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+            if (diff == 0){
+                // Slot is free, try to claim it
+                if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+                    slot.value = t;
+                    slot.sequence.store(position + 1, std::memory_order_release);  // Publish to the consumer
+                    return true;
+                }
+            } else if (diff < 0){
+                return false;  // Full
+            } else {
+                position = writePosition.load(std::memory_order_relaxed);  // Another producer claimed the slot
+            }
+        }
+    }
+
+    /** Must always be called from the same thread. */
+    bool pull(T& t)
+    {
+        auto& slot = slots[readPosition & (Size - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != readPosition + 1){
+            return false;  // Empty (or the producer which claimed the slot has not finished writing it yet)
+        }
+        t = slot.value;
+        slot.sequence.store(readPosition + Size, std::memory_order_release);  // Make the slot available for the next lap
+        readPosition += 1;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence {0};
+        T value {};
+    };
+
+    std::array<Slot, Size> slots;
+    alignas(64) std::atomic<size_t> writePosition {0};
+    alignas(64) size_t readPosition = 0;  // Only accessed from the consumer thread
+};
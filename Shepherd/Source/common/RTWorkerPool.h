@@ -0,0 +1,189 @@
+// Used by Sequencer to process tracks in parallel when "trackWorkerThreads" is set (see processTrackGroupSlice). Idle
+// workers sleep on a futex rather than on a juce::WaitableEvent, which would take a lock when the RT thread wakes them.
+
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/** Pool of worker threads used to run a batch of independent tasks in parallel from the RT thread.
+
+    parallelFor(numTasks, function) calls function(taskIndex) once for every task index and returns once all tasks
+    have finished. The calling thread also runs tasks, so with N workers up to N+1 tasks run at the same time.
+    Tasks are claimed from a shared atomic counter, so workers which finish early keep taking the remaining tasks
+    and the load is balanced even if tasks have very different costs.
+
+    No memory is allocated and no locks are taken in parallelFor. Idle workers spin for a number of iterations
+    (so they react quickly to consecutive batches, e.g. one batch per slice) and then sleep on a futex (Linux) or
+    yield (other platforms) until the next batch is started. parallelFor must always be called from the same thread.
+*/
+class RTWorkerPool
+{
+public:
+    RTWorkerPool (int _spinIterations = 20000): spinIterations (_spinIterations)
+    {
+    }
+
+    ~RTWorkerPool()
+    {
+        stop();
+    }
+
+    /** Starts numWorkers threads. If possible, threads run with SCHED_FIFO priority (use a priority lower than the
+        one of the calling thread). */
+    void start(int numWorkers, int realtimePriority)
+    {
+        stop();
+        shouldExit = false;
+        for (int i=0; i<numWorkers; i++){
+            workers.emplace_back([this, realtimePriority]{ run(realtimePriority); });
+        }
+    }
+
+    void stop()
+    {
+        shouldExit = true;
+        generation.fetch_add(1);
+        wakeWorkers();
+        for (auto& worker: workers){
+            if (worker.joinable()){
+                worker.join();
+            }
+        }
+        workers.clear();
+    }
+
+    int getNumWorkers() const { return (int)workers.size(); }
+
+    /** Calls function(taskIndex) for taskIndex in [0, numTasks) using the worker threads and the calling thread.
+        Returns once all tasks have finished. If the pool has no workers, tasks are run in the calling thread. */
+    template<typename Function>
+    void parallelFor(int numTasks, Function& function)
+    {
+        if (numTasks <= 0) { return; }
+        if (numTasks > maxTasksPerBatch) { numTasks = maxTasksPerBatch; }
+        if (workers.empty() || numTasks == 1){
+            for (int i=0; i<numTasks; i++){
+                function(i);
+            }
+            return;
+        }
+
+        // Publish the new batch. batchState is stored last so that workers claiming a task see the new task function
+        taskContext = &function;
+        taskFunction = [](void* context, int taskIndex){ (*static_cast<Function*>(context))(taskIndex); };
+        completedTasks.store(0, std::memory_order_relaxed);
+        uint32_t newGeneration = generation.load(std::memory_order_relaxed) + 1;
+        batchState.store(((uint64_t)newGeneration << 32) | ((uint64_t)numTasks << 16), std::memory_order_release);
+        generation.store(newGeneration);
+        wakeWorkers();
+
+        runTasks();
+
+        // Wait for tasks claimed by workers to finish
+        int spins = 0;
+        while (completedTasks.load(std::memory_order_acquire) < numTasks){
+            if (++spins > spinIterations){
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    void runTasks()
+    {
+        int taskIndex;
+        while (claimTask(taskIndex)){
+            taskFunction(taskContext, taskIndex);
+            completedTasks.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+
+    bool claimTask(int& taskIndex)
+    {
+        // The generation, number of tasks and next task index of the current batch are packed in a single atomic
+        // so that a worker which is late can't claim a task of a batch using the settings of a previous batch
+        uint64_t state = batchState.load(std::memory_order_acquire);
+        while (true){
+            uint64_t index = state & 0xFFFF;
+            uint64_t numTasks = (state >> 16) & 0xFFFF;
+            if (index >= numTasks) { return false; }
+            if (batchState.compare_exchange_weak(state, state + 1, std::memory_order_acq_rel, std::memory_order_acquire)){
+                taskIndex = (int)index;
+                return true;
+            }
+        }
+    }
+
+    void run(int realtimePriority)
+    {
+        sched_param param;
+        param.sched_priority = realtimePriority;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);  // Keep running with normal priority if it fails
+
+        uint32_t lastGeneration = generation.load(std::memory_order_acquire);
+        while (!shouldExit){
+            // Spin for a while waiting for the next batch, then sleep
+            int spins = 0;
+            while (generation.load(std::memory_order_acquire) == lastGeneration){
+                if (++spins > spinIterations){
+                    sleepWhileGenerationIs(lastGeneration);
+                    spins = 0;
+                }
+            }
+            lastGeneration = generation.load(std::memory_order_acquire);
+            if (shouldExit) { return; }
+            runTasks();
+        }
+    }
+
+    void sleepWhileGenerationIs(uint32_t value)
+    {
+        #if defined(__linux__)
+        numSleepingWorkers.fetch_add(1);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&generation), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+        numSleepingWorkers.fetch_sub(1);
+        #else
+        (void)value;
+        std::this_thread::yield();
+        #endif
+    }
+
+    void wakeWorkers()
+    {
+        #if defined(__linux__)
+        // Only do the syscall if some worker is (about to be) sleeping. If a worker increments numSleepingWorkers
+        // after this check, the futex wait will return immediately as the generation has already changed
+        // (sequentially consistent operations are used for generation and numSleepingWorkers)
+        if (numSleepingWorkers.load() > 0){
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&generation), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+        }
+        #endif
+    }
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit integer");
+
+    const int spinIterations;
+    std::vector<std::thread> workers;
+    std::atomic<bool> shouldExit {false};
+    std::atomic<uint32_t> generation {0};
+    std::atomic<int> numSleepingWorkers {0};
+
+    // Current batch
+    static constexpr int maxTasksPerBatch = 0xFFFF;
+    void (*taskFunction)(void*, int) = nullptr;
+    void* taskContext = nullptr;
+    std::atomic<uint64_t> batchState {0};  // generation (32 bits) | number of tasks (16 bits) | next task index (16 bits)
+    std::atomic<int> completedTasks {0};
+};
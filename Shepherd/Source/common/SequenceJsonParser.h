@@ -0,0 +1,367 @@
+// Streaming parser for the JSON payloads of the /clip/setSequence and /clip/editSequence actions (see
+// Sequencer::processMessageFromController). Events are decoded directly into SequenceJsonParser::Event structs while
+// the JSON is read, without building a juce::var tree and looking properties up by name. Unknown keys are skipped.
+// Values are converted in the same way juce::var would do it (e.g. missing numbers are 0, numbers can be sent as
+// strings) so that the result is the same as with juce::JSON::parse. Payloads which are not valid JSON are rejected as a
+// whole (nothing is applied to the clip).
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace SequenceJsonParser
+{
+
+struct Event
+{
+    // Flags set in Event::fields for the properties present in the JSON object (editSequence only updates these)
+    enum Field : uint32_t
+    {
+        typeField = 1 << 0,
+        timestampField = 1 << 1,
+        midiNoteField = 1 << 2,
+        midiVelocityField = 1 << 3,
+        durationField = 1 << 4,
+        utimeField = 1 << 5,
+        chanceField = 1 << 6,
+        eventMidiBytesField = 1 << 7
+    };
+
+    uint32_t fields = 0;
+    int type = 0;  // SequenceEventType
+    double timestamp = 0.0;
+    int midiNote = 0;
+    float midiVelocity = 0.0f;
+    double duration = 0.0;
+    double utime = 0.0;
+    float chance = 0.0f;
+    std::string eventMidiBytes;
+
+    bool has(Field field) const { return (fields & field) != 0; }
+};
+
+/** {"clipLength": 6, "sequenceEvents": [{"type": 1, "midiNote": 79, ...}, ...]} */
+struct SetSequence
+{
+    double clipLength = 0.0;
+    std::vector<Event> sequenceEvents;
+};
+
+/** {"action": "editEvent", "eventUUID": "...", "eventHandle": 123, "eventData": {...}} */
+struct EditSequence
+{
+    std::string action;
+    std::string eventUUID;
+    bool hasEventHandle = false;
+    int eventHandle = 0;
+    Event eventData;
+};
+
+
+class Parser
+{
+public:
+    explicit Parser (std::string_view _json)
+        : json (_json)
+    {
+    }
+
+    /** Returns false if the JSON is malformed (output might then be partially filled). */
+    bool parseSetSequence(SetSequence& output)
+    {
+        output = SetSequence();
+        return parseObject([this, &output](std::string_view key){
+            if (key == "clipLength"){
+                return parseNumber(output.clipLength);
+            } else if (key == "sequenceEvents"){
+                return parseArray([this, &output]{
+                    output.sequenceEvents.emplace_back();
+                    return parseEvent(output.sequenceEvents.back());
+                });
+            }
+            return skipValue();
+        }) && atEnd();
+    }
+
+    bool parseEditSequence(EditSequence& output)
+    {
+        output = EditSequence();
+        return parseObject([this, &output](std::string_view key){
+            if (key == "action"){
+                return parseString(output.action);
+            } else if (key == "eventUUID"){
+                return parseString(output.eventUUID);
+            } else if (key == "eventHandle"){
+                double handle;
+                output.hasEventHandle = true;
+                return parseNumber(handle) && (output.eventHandle = (int)handle, true);
+            } else if (key == "eventData"){
+                return parseEvent(output.eventData);
+            }
+            return skipValue();
+        }) && atEnd();
+    }
+
+private:
+    bool parseEvent(Event& event)
+    {
+        return parseObject([this, &event](std::string_view key){
+            double number;
+            if (key == "type"){
+                event.fields |= Event::typeField;
+                return parseNumber(number) && (event.type = (int)number, true);
+            } else if (key == "timestamp"){
+                event.fields |= Event::timestampField;
+                return parseNumber(event.timestamp);
+            } else if (key == "midiNote"){
+                event.fields |= Event::midiNoteField;
+                return parseNumber(number) && (event.midiNote = (int)number, true);
+            } else if (key == "midiVelocity"){
+                event.fields |= Event::midiVelocityField;
+                return parseNumber(number) && (event.midiVelocity = (float)number, true);
+            } else if (key == "duration"){
+                event.fields |= Event::durationField;
+                return parseNumber(event.duration);
+            } else if (key == "utime"){
+                event.fields |= Event::utimeField;
+                return parseNumber(event.utime);
+            } else if (key == "chance"){
+                event.fields |= Event::chanceField;
+                return parseNumber(number) && (event.chance = (float)number, true);
+            } else if (key == "eventMidiBytes"){
+                event.fields |= Event::eventMidiBytesField;
+                return parseValueAsString(event.eventMidiBytes);
+            }
+            return skipValue();
+        });
+    }
+
+    // Calls parseMember for every key, which must consume the value
+    template <typename Function>
+    bool parseObject(Function&& parseMember)
+    {
+        if (!consume('{')) { return false; }
+        if (consume('}')) { return true; }
+        do {
+            if (!parseString(key) || !consume(':')) { return false; }
+            if (!parseMember(std::string_view(key))) { return false; }
+        } while (consume(','));
+        return consume('}');
+    }
+
+    // Calls parseElement for every element, which must consume it
+    template <typename Function>
+    bool parseArray(Function&& parseElement)
+    {
+        if (!consume('[')) { return false; }
+        if (consume(']')) { return true; }
+        do {
+            if (!parseElement()) { return false; }
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool parseString(std::string& output)
+    {
+        output.clear();
+        if (!consume('"')) { return false; }
+        while (pos < json.size()){
+            // Copy runs of characters without escapes at once
+            const auto runStart = pos;
+            while (pos < json.size() && json[pos] != '"' && json[pos] != '\\'){
+                pos++;
+            }
+            output.append(json.data() + runStart, pos - runStart);
+            if (pos >= json.size()) { return false; }
+            if (json[pos] == '"'){
+                pos++;
+                return true;
+            }
+            pos++;  // Backslash
+            if (pos >= json.size()) { return false; }
+            const char escaped = json[pos++];
+            switch (escaped) {
+                case '"': output += '"'; break;
+                case '\\': output += '\\'; break;
+                case '/': output += '/'; break;
+                case 'b': output += '\b'; break;
+                case 'f': output += '\f'; break;
+                case 'n': output += '\n'; break;
+                case 'r': output += '\r'; break;
+                case 't': output += '\t'; break;
+                case 'u': {
+                    uint32_t codePoint;
+                    if (!parseHex4(codePoint)) { return false; }
+                    if (codePoint >= 0xd800 && codePoint <= 0xdbff && json.substr(pos, 2) == "\\u"){
+                        pos += 2;
+                        uint32_t lowSurrogate;
+                        if (!parseHex4(lowSurrogate) || lowSurrogate < 0xdc00 || lowSurrogate > 0xdfff) { return false; }
+                        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (lowSurrogate - 0xdc00);
+                    }
+                    appendUTF8(output, codePoint);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    // Numbers, strings with numbers, booleans and null are accepted (like when converting a juce::var to a number)
+    bool parseNumber(double& output)
+    {
+        skipWhitespace();
+        if (pos >= json.size()) { return false; }
+        const char c = json[pos];
+        if (c == '"'){
+            if (!parseString(stringValue)) { return false; }
+            output = std::strtod(stringValue.c_str(), nullptr);
+            return true;
+        } else if (matchLiteral("true")){
+            output = 1.0;
+            return true;
+        } else if (matchLiteral("false") || matchLiteral("null")){
+            output = 0.0;
+            return true;
+        }
+        std::string_view token;
+        if (!parseNumberToken(token)) { return false; }
+        char buffer[64];
+        if (token.size() >= sizeof(buffer)) { return false; }
+        token.copy(buffer, token.size());
+        buffer[token.size()] = '\0';
+        output = std::strtod(buffer, nullptr);
+        return true;
+    }
+
+    // Strings are returned as they are, other scalar values as their JSON text (like juce::var::toString)
+    bool parseValueAsString(std::string& output)
+    {
+        skipWhitespace();
+        if (pos < json.size() && json[pos] == '"'){
+            return parseString(output);
+        }
+        const auto start = pos;
+        if (!skipValue()) { return false; }
+        output.assign(json.data() + start, pos - start);
+        return true;
+    }
+
+    bool skipValue()
+    {
+        skipWhitespace();
+        if (pos >= json.size()) { return false; }
+        const char c = json[pos];
+        if (c == '{'){
+            return parseObject([this](std::string_view){ return skipValue(); });
+        } else if (c == '['){
+            return parseArray([this]{ return skipValue(); });
+        } else if (c == '"'){
+            return parseString(stringValue);
+        } else if (matchLiteral("true") || matchLiteral("false") || matchLiteral("null")){
+            return true;
+        }
+        std::string_view token;
+        return parseNumberToken(token);
+    }
+
+    bool parseNumberToken(std::string_view& token)
+    {
+        const auto start = pos;
+        if (pos < json.size() && (json[pos] == '-' || json[pos] == '+')) { pos++; }
+        while (pos < json.size() && ((json[pos] >= '0' && json[pos] <= '9') || json[pos] == '.' || json[pos] == 'e' || json[pos] == 'E' || json[pos] == '-' || json[pos] == '+')){
+            pos++;
+        }
+        token = json.substr(start, pos - start);
+        return !token.empty();
+    }
+
+    bool parseHex4(uint32_t& output)
+    {
+        if (pos + 4 > json.size()) { return false; }
+        output = 0;
+        for (int i=0; i<4; i++){
+            const char c = json[pos++];
+            output <<= 4;
+            if (c >= '0' && c <= '9') { output |= (uint32_t)(c - '0'); }
+            else if (c >= 'a' && c <= 'f') { output |= (uint32_t)(c - 'a' + 10); }
+            else if (c >= 'A' && c <= 'F') { output |= (uint32_t)(c - 'A' + 10); }
+            else { return false; }
+        }
+        return true;
+    }
+
+    static void appendUTF8(std::string& output, uint32_t codePoint)
+    {
+        if (codePoint < 0x80){
+            output += (char)codePoint;
+        } else if (codePoint < 0x800){
+            output += (char)(0xc0 | (codePoint >> 6));
+            output += (char)(0x80 | (codePoint & 0x3f));
+        } else if (codePoint < 0x10000){
+            output += (char)(0xe0 | (codePoint >> 12));
+            output += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+            output += (char)(0x80 | (codePoint & 0x3f));
+        } else {
+            output += (char)(0xf0 | (codePoint >> 18));
+            output += (char)(0x80 | ((codePoint >> 12) & 0x3f));
+            output += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+            output += (char)(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    bool matchLiteral(std::string_view literal)
+    {
+        if (json.substr(pos, literal.size()) == literal){
+            pos += literal.size();
+            return true;
+        }
+        return false;
+    }
+
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (pos < json.size() && json[pos] == c){
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void skipWhitespace()
+    {
+        while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\n' || json[pos] == '\r' || json[pos] == '\t')){
+            pos++;
+        }
+    }
+
+    bool atEnd()
+    {
+        skipWhitespace();
+        return pos == json.size();
+    }
+
+    std::string_view json;
+    size_t pos = 0;
+    std::string key;  // Reused to avoid allocating for every key
+    std::string stringValue;
+};
+
+inline bool parseSetSequence(std::string_view json, SetSequence& output)
+{
+    return Parser(json).parseSetSequence(output);
+}
+
+inline bool parseEditSequence(std::string_view json, EditSequence& output)
+{
+    return Parser(json).parseEditSequence(output);
+}
+
+}  // namespace SequenceJsonParser
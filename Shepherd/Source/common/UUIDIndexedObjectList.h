@@ -0,0 +1,93 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "drow_ValueTreeObjectList.h"
+#include "defines_shepherd.h"
+
+
+/** drow::ValueTreeObjectList which keeps hash indices of its objects by UUID and by handle, so that getObjectWithUUID
+    and getObjectWithHandle do not need to iterate all objects. The UUID index is updated when objects are added to or
+    removed from the list (i.e. when children are added to or removed from the parent ValueTree).
+
+    Handles are session-scoped integers assigned by the Sequencer (see Sequencer::assignHandles) and stored in the
+    "handle" property of the object state. Objects are indexed by handle when that property is set (or when the index
+    is rebuilt), and not when they are added, because an added ValueTree might be a copy which still carries the
+    handle of the object it was copied from.
+
+    Sub-classes must call rebuildIndex after rebuildObjects, and if they override newObjectAdded, objectRemoved or
+    valueTreePropertyChanged they must call the implementations of this class. ObjectType must implement getUUID.
+*/
+template<typename ObjectType>
+class UUIDIndexedObjectList: public drow::ValueTreeObjectList<ObjectType>
+{
+public:
+    UUIDIndexedObjectList (const juce::ValueTree& parentTree)
+        : drow::ValueTreeObjectList<ObjectType> (parentTree)
+    {
+    }
+
+    ObjectType* getObjectWithUUID(const juce::String& uuid) const
+    {
+        return objectsByUUID[uuid];  // nullptr if not found
+    }
+
+    ObjectType* getObjectWithHandle(int handle) const
+    {
+        return objectsByHandle[handle];  // nullptr if out of range or not found
+    }
+
+    void newObjectAdded (ObjectType* object) override
+    {
+        objectsByUUID.set(object->getUUID(), object);
+    }
+
+    void objectRemoved (ObjectType* object) override
+    {
+        objectsByUUID.remove(object->getUUID());
+        int handle = getHandle(object->state);
+        if (objectsByHandle[handle] == object){
+            objectsByHandle.set(handle, nullptr);
+        }
+    }
+
+    void valueTreePropertyChanged (juce::ValueTree& tree, const juce::Identifier& property) override
+    {
+        if (property == ShepherdIDs::handle && this->isChildTree(tree)){
+            // The previous handle of the object is not known, rebuild the whole index
+            rebuildHandlesIndex();
+        }
+    }
+
+protected:
+    void rebuildIndex()
+    {
+        objectsByUUID.clear();
+        for (auto* object: this->objects){
+            objectsByUUID.set(object->getUUID(), object);
+        }
+        rebuildHandlesIndex();
+    }
+
+private:
+    static int getHandle(const juce::ValueTree& tree)
+    {
+        return (int)tree.getProperty(ShepherdIDs::handle, -1);
+    }
+
+    void rebuildHandlesIndex()
+    {
+        objectsByHandle.clearQuick();
+        for (auto* object: this->objects){
+            int handle = getHandle(object->state);
+            if (handle >= 0){
+                if (handle >= objectsByHandle.size()){
+                    objectsByHandle.resize(handle + 1);  // Fills with nullptr
+                }
+                objectsByHandle.set(handle, object);
+            }
+        }
+    }
+
+    juce::HashMap<juce::String, ObjectType*> objectsByUUID;
+    juce::Array<ObjectType*> objectsByHandle;
+};
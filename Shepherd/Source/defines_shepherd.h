@@ -26,67 +26,41 @@
 #define CREATE_INTERNAL_HW_OUTPUT_DEVICES 0
 #endif
 
+#ifndef USE_ALSA_SEQ_MIDI_BACKEND
+#define USE_ALSA_SEQ_MIDI_BACKEND 0  // Linux only, requires linking with -lasound (must also be enabled in backendSettings.json)
+#endif
+#define ALSA_SEQ_OUTPUT_BUFFER_SIZE 65536
+#define ALSA_SEQ_MIDI_EVENT_ENCODER_SIZE 256
+#define ALSA_SEQ_MAX_OUTPUT_PORTS 128
+#define ALSA_SEQ_MAX_INPUT_PORTS 64
+
+#ifndef USE_JACK_MIDI_ENGINE
+#define USE_JACK_MIDI_ENGINE 0  // Requires JACK headers and linking with -ljack
+#endif
+#define JACK_MIDI_ENGINE_MAX_PORTS 64
+
+#ifndef USE_MIDI_ONLY_ENGINE
+#define USE_MIDI_ONLY_ENGINE JUCE_LINUX  // Uses clock_nanosleep, not available on macOS
+#endif
+#define MIDI_ONLY_ENGINE_DEFAULT_PERIOD_MS 1.0
+#define MIDI_ONLY_ENGINE_NOMINAL_SAMPLE_RATE 48000.0
+#define MIDI_ONLY_ENGINE_RT_PRIORITY 80
+#define MIDI_ONLY_ENGINE_STATS_REPORT_INTERVAL_MS 10000
+
+#define LOOKAHEAD_MAX_SLICES 64  // Max number of slices rendered ahead of time (+1)
+#define LOOKAHEAD_MAX_DEVICES_PER_SLICE 32
+#define LOOKAHEAD_WORKER_MAX_WAIT_MS 2
+#define LOOKAHEAD_UNDERRUNS_REPORT_INTERVAL_MS 10000
+
+#ifndef USE_TRACK_WORKER_POOL
+#define USE_TRACK_WORKER_POOL (JUCE_LINUX || JUCE_MAC)  // Uses pthreads
+#endif
+#define TRACK_WORKER_POOL_MAX_THREADS 8
+#define TRACK_WORKER_POOL_RT_PRIORITY 70
+
 #define INTERNAL_OUTPUT_MIDI_DEVICE_NAME "ShpInternalOutput"
 
-#define ACTION_ADDRESS_TRANSPORT "/transport"
-#define ACTION_ADDRESS_TRANSPORT_PLAY_STOP "/transport/playStop"
-#define ACTION_ADDRESS_TRANSPORT_PLAY "/transport/play"
-#define ACTION_ADDRESS_TRANSPORT_STOP "/transport/stop"
-#define ACTION_ADDRESS_TRANSPORT_SET_BPM "/transport/setBpm"
-#define ACTION_ADDRESS_TRANSPORT_SET_METER "/transport/setMeter"
-
-#define ACTION_ADDRESS_CLIP "/clip"
-#define ACTION_ADDRESS_CLIP_PLAY "/clip/play"
-#define ACTION_ADDRESS_CLIP_STOP "/clip/stop"
-#define ACTION_ADDRESS_CLIP_PLAY_STOP "/clip/playStop"
-#define ACTION_ADDRESS_CLIP_RECORD_ON_OFF "/clip/recordOnOff"
-#define ACTION_ADDRESS_CLIP_CLEAR "/clip/clear"
-#define ACTION_ADDRESS_CLIP_DOUBLE "/clip/double"
-#define ACTION_ADDRESS_CLIP_QUANTIZE "/clip/quantize"
-#define ACTION_ADDRESS_CLIP_UNDO "/clip/undo"
-#define ACTION_ADDRESS_CLIP_SET_LENGTH "/clip/setLength"
-#define ACTION_ADDRESS_CLIP_SET_BPM_MULTIPLIER "/clip/setBpmMultiplier"
-#define ACTION_ADDRESS_CLIP_SET_SEQUENCE "/clip/setSequence"
-#define ACTION_ADDRESS_CLIP_EDIT_SEQUENCE "/clip/editSequence"
-
-#define ACTION_ADDRESS_TRACK "/track"
-#define ACTION_ADDRESS_TRACK_SET_INPUT_MONITORING "/track/setInputMonitoring"
-#define ACTION_ADDRESS_TRACK_SET_ACTIVE_UI_NOTES_MONITORING_TRACK "/track/setActiveUiNotesMonitoringTrack"
-#define ACTION_ADDRESS_TRACK_SET_HARDWARE_DEVICE "/track/setOutputHardwareDevice"
-
-#define ACTION_ADDRESS_DEVICE "/device"
-#define ACTION_ADDRESS_DEVICE_SEND_ALL_NOTES_OFF_TO_DEVICE "/device/sendAllNotesOff"
-#define ACTION_ADDRESS_DEVICE_LOAD_DEVICE_PRESET "/device/loadDevicePreset"
-#define ACTION_ADDRESS_DEVICE_SEND_MIDI "/device/sendMidi"
-#define ACTION_ADDRESS_DEVICE_SET_NOTES_MAPPING "/device/setNotesMapping"
-#define ACTION_ADDRESS_DEVICE_SET_CC_MAPPING "/device/setCCMapping"
-#define ACTION_ADDRESS_DEVICE_SET_MIDI_CHANNEL "/device/setMidiChannel"
-
-#define ACTION_ADDRESS_SCENE "/scene"
-#define ACTION_ADDRESS_SCENE_DUPLICATE "/scene/duplicate"
-#define ACTION_ADDRESS_SCENE_PLAY "/scene/play"
-
-#define ACTION_ADDRESS_METRONOME "/metronome"
-#define ACTION_ADDRESS_METRONOME_ON "/metronome/on"
-#define ACTION_ADDRESS_METRONOME_OFF "/metronome/off"
-#define ACTION_ADDRESS_METRONOME_ON_OFF "/metronome/onOff"
-
-#define ACTION_ADDRESS_SETTINGS "/settings"
-#define ACTION_ADDRESS_SETTINGS_LOAD_SESSION "/settings/load"
-#define ACTION_ADDRESS_SETTINGS_SAVE_SESSION "/settings/save"
-#define ACTION_ADDRESS_SETTINGS_NEW_SESSION "/settings/new"
-#define ACTION_ADDRESS_SETTINGS_FIXED_VELOCITY "/settings/fixedVelocity"
-#define ACTION_ADDRESS_SETTINGS_FIXED_LENGTH "/settings/fixedLength"
-#define ACTION_ADDRESS_TRANSPORT_RECORD_AUTOMATION "/settings/toggleRecordAutomation"
-#define ACTION_ADDRESS_SETTINGS_TOGGLE_DEBUG_SYNTH "/settings/debugSynthOnOff"
-
-#define ACTION_ADDRESS_GET_STATE "/get_state"
-#define ACTION_ADDRESS_FULL_STATE "/full_state"
-#define ACTION_ADDRESS_STATE_UPDATE "/state_update"
-
-#define ACTION_ADDRESS_SHEPHERD_CONTROLLER_READY "/shepherdControllerReady"
-#define ACTION_ADDRESS_ALIVE_MESSAGE "/alive"
-#define ACTION_ADDRESS_STARTED_MESSAGE "/app_started"
+#include "ControllerActions.h"  // ACTION_ADDRESS_* defines and action lookup table
 
 #define SERIALIZATION_SEPARATOR ";"
 
@@ -108,6 +82,25 @@
 
 #define PUSH_MIDI_CLOCK_BURST_DURATION_MILLISECONDS 500
 
+#define MIDI_OUTPUT_SCHEDULING_DEFAULT_LATENCY_MS 10
+
+#define MIDI_OUTPUT_QUEUE_SIZE 32
+#define MIDI_OUTPUT_DISPATCHER_MAX_DEVICES 64
+#define MIDI_OUTPUT_DISPATCHER_POLL_INTERVAL_MS 1  // Max extra latency of immediate MIDI output (see MidiOutputDispatcher)
+
+#define SEQUENCER_COMMAND_QUEUE_SIZE 256  // Must be a power of 2 (see MpscFifo.h)
+
+#define STATE_UPDATES_DEFAULT_FLUSH_INTERVAL_MS 50  // Can be changed with the "stateUpdatesFlushIntervalMs" setting
+#define STATE_UPDATES_HISTORY_MAX_BATCHES 1024  // Batches of updates kept to be replayed to controllers which missed some (see ACTION_ADDRESS_STATE_UPDATE_REPLAY)
+#define STATE_UPDATES_HISTORY_MAX_UPDATES 20000
+#define STATE_SNAPSHOT_CHUNK_SIZE (64 * 1024)  // See StateSnapshotSender.h
+#define STATE_SNAPSHOT_MAX_QUEUED_BYTES (2 * STATE_SNAPSHOT_CHUNK_SIZE)  // Chunks are only queued if the connection has less than that queued
+
+#define WS_SEND_QUEUE_MAX_MESSAGES 1024  // Per connection, see ConnectionSendQueue.h
+#define WS_SEND_QUEUE_MAX_BYTES (16 * 1024 * 1024)
+
+#define PLAYHEAD_ANCHOR_TOLERANCE_MS 25  // Max drift of the extrapolated playhead positions before a new anchor is published (see PlayheadAnchor)
+
 
 namespace ShepherdDefaults
 {
@@ -165,9 +158,12 @@ DECLARE_ID (version)
 DECLARE_ID (name)
 DECLARE_ID (shortName)
 DECLARE_ID (uuid)
+DECLARE_ID (handle)
 DECLARE_ID (type)
 DECLARE_ID (length)
 DECLARE_ID (playheadPositionInBeats)
+DECLARE_ID (playheadPositionTimeMs)
+DECLARE_ID (playheadBpm)
 DECLARE_ID (shouldToggleIsPlaying)
 DECLARE_ID (doingCountIn)
 DECLARE_ID (countInPlayheadPositionInBeats)
@@ -198,6 +194,7 @@ DECLARE_ID (midiVelocity)
 DECLARE_ID (duration)
 DECLARE_ID (renderedStartTimestamp)
 DECLARE_ID (renderedEndTimestamp)
+DECLARE_ID (sequenceOverview)
 DECLARE_ID (chance)
 DECLARE_ID (dataLocation)
 DECLARE_ID (midiOutputDeviceName)
@@ -222,11 +219,29 @@ enum SequenceEventType { midi, note };
 
 enum HardwareDeviceType { input, output };
 
+struct MidiOutputDeviceData;
+
+// Interface for MIDI output backends other than JUCE's MidiOutput (see AlsaSequencerMidiBackend.h)
+struct MidiOutputBackend {
+    virtual ~MidiOutputBackend() {}
+    virtual void sendBlockOfMessages(MidiOutputDeviceData& deviceData, const juce::MidiBuffer& buffer, double startTimeMs, double sampleRate) = 0;
+};
+
 struct MidiOutputDeviceData {
     juce::String identifier;
     juce::String name;
     std::unique_ptr<juce::MidiOutput> device;
     juce::MidiBuffer buffer;
+    
+    // If backend is set, messages are sent using the backend instead of the JUCE MidiOutput device
+    MidiOutputBackend* backend = nullptr;
+    int backendPortId = -1;
+    
+    // Buffers pending to be sent by the MIDI output dispatcher thread (see MidiOutputDispatcher.h) and queue stats
+    MidiBufferFifo<MIDI_OUTPUT_QUEUE_SIZE> outputQueue { MIDI_BUFFER_MIN_BYTES };
+    std::atomic<int> maxQueueDepth { 0 };
+    std::atomic<int> numDroppedBuffers { 0 };
+    int lastReportedNumDroppedBuffers = 0;
 };
 
 struct MidiInputDeviceData {
@@ -234,7 +249,9 @@ struct MidiInputDeviceData {
     juce::String name;
     std::unique_ptr<juce::MidiInput> device;
     juce::MidiMessageCollector collector;
-    juce::MidiBuffer buffer; // to store results of removeNextBlockOfMessages
+    juce::MidiBuffer blockBuffer; // to store results of removeNextBlockOfMessages (messages for the whole slice)
+    juce::MidiBuffer buffer; // messages of blockBuffer for the sub-slice being processed (see Sequencer::getNextMIDISlice)
+    int backendPortId = -1;  // Set if messages are received using a backend other than the JUCE MidiInput device
 };
 
 struct GlobalSettingsStruct {
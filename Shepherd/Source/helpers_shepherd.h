@@ -11,12 +11,24 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "MidiBufferFifo.h"
 #include "defines_shepherd.h"
 #include "drow_ValueTreeObjectList.h"
+#include "UUIDIndexedObjectList.h"
 
 namespace ShepherdHelpers
 {
 
+    inline int parseHandle(const juce::String& reference)
+    {
+        // Objects can be referenced from the controller either by handle (see Sequencer::assignHandles) or by UUID.
+        // Handles are short decimal numbers while UUIDs have 32 hex characters. Returns -1 if reference is not a handle
+        if (reference.isEmpty() || reference.length() > 9 || !reference.containsOnly("0123456789")){
+            return -1;
+        }
+        return reference.getIntValue();
+    }
+
     inline bool sameMidiMessageWithSameTimestamp(juce::MidiMessage& m1, juce::MidiMessage& m2)
     {
         // Check that two midi messages are exactly the same and have the same timestamp
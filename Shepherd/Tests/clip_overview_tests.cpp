@@ -0,0 +1,149 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <array>
+#include "ClipOverview.h"
+#include "test_runner.h"
+
+static std::string emptyBitmap() {
+    return std::string(ClipOverview::numRows * 16, '0');
+}
+
+void runClipOverviewTests() {
+    TestRunner::run("ClipOverview - Empty clip", []() {
+        ClipOverview overview(8.0);
+        if (overview.serialize() != "0,0,-1,-1," + emptyBitmap()) {
+            return TestResult{false, "Unexpected serialization: " + overview.serialize()};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Counts and pitch range", []() {
+        ClipOverview overview(8.0);
+        overview.addNote(0.0, 1.0, 64);
+        overview.addMidiEvent();
+        overview.addNote(2.0, 3.0, 60);
+        overview.addNote(4.0, 4.5, 67);
+        overview.addMidiEvent();
+        if (overview.getNumNotes() != 3 || overview.getNumMidiEvents() != 2) {
+            return TestResult{false, "Wrong event counts"};
+        }
+        if (overview.getMinMidiNote() != 60 || overview.getMaxMidiNote() != 67) {
+            return TestResult{false, "Wrong pitch range"};
+        }
+        if (overview.serialize().rfind("3,2,60,67,", 0) != 0) {
+            return TestResult{false, "Wrong serialization header: " + overview.serialize()};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Notes occupy the columns they span", []() {
+        // 64 columns over 16 beats: 4 columns per beat. Small pitch ranges use one row per note
+        ClipOverview overview(16.0);
+        overview.addNote(1.0, 2.0, 60);
+        overview.addNote(3.1, 3.1, 62);  // Zero duration note still occupies the column where it starts
+        for (int column = 0; column < ClipOverview::numColumns; column++) {
+            bool expected = column >= 4 && column <= 7;
+            if (overview.isOccupied(column, 0) != expected) {
+                return TestResult{false, "Wrong occupancy of row 0 at column " + std::to_string(column)};
+            }
+            if (overview.isOccupied(column, 1)) {
+                return TestResult{false, "Row of missing note 61 should be empty"};
+            }
+            if (overview.isOccupied(column, 2) != (column == 12)) {
+                return TestResult{false, "Wrong occupancy of row 2 at column " + std::to_string(column)};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Wide pitch ranges are scaled to the rows", []() {
+        ClipOverview overview(4.0);
+        overview.addNote(0.0, 1.0, 0);
+        overview.addNote(0.0, 1.0, 64);
+        overview.addNote(0.0, 1.0, 127);
+        if (!overview.isOccupied(0, 0) || !overview.isOccupied(0, 8) || !overview.isOccupied(0, ClipOverview::numRows - 1)) {
+            return TestResult{false, "Notes not in the expected rows"};
+        }
+        int numOccupiedRows = 0;
+        for (int row = 0; row < ClipOverview::numRows; row++) {
+            numOccupiedRows += overview.isOccupied(0, row) ? 1 : 0;
+        }
+        if (numOccupiedRows != 3) {
+            return TestResult{false, "Expected 3 occupied rows, got " + std::to_string(numOccupiedRows)};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Notes wrapping around the clip loop", []() {
+        ClipOverview overview(16.0);
+        overview.addNote(15.0, 17.0, 60);  // Ends at beat 1 after looping
+        for (int column = 0; column < ClipOverview::numColumns; column++) {
+            bool expected = column >= 60 || column <= 3;
+            if (overview.isOccupied(column, 0) != expected) {
+                return TestResult{false, "Wrong occupancy at column " + std::to_string(column)};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Bitmap serialization layout", []() {
+        ClipOverview overview(64.0);
+        overview.addNote(0.0, 1.0, 50);  // Row 0, column 0
+        overview.addNote(63.0, 64.0, 51);  // Row 1, column 63
+        overview.addMidiEvent();
+        std::string expected = "2,1,50,51,0000000000000001" "8000000000000000" + std::string((ClipOverview::numRows - 2) * 16, '0');
+        if (overview.serialize() != expected) {
+            return TestResult{false, "Unexpected serialization: " + overview.serialize()};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Zero length clip has empty bitmap", []() {
+        ClipOverview overview(0.0);
+        overview.addNote(0.0, 1.0, 60);
+        if (overview.serialize() != "1,0,60,60," + emptyBitmap()) {
+            return TestResult{false, "Unexpected serialization: " + overview.serialize()};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ClipOverview - Benchmark (10k notes clip)", []() {
+        // Not a pass/fail test, it prints the time to compute and serialize the overview of a large clip (which is
+        // done every time its sequence is recompiled) and the size of the result
+        const int numIterations = 100;
+        std::srand(42);
+        std::vector<std::array<double, 3>> notes;
+        for (int i = 0; i < 10000; i++) {
+            double start = (std::rand() % 6400) / 100.0;
+            notes.push_back({start, start + (std::rand() % 400) / 100.0, (double)(36 + std::rand() % 48)});
+        }
+        size_t serializedSize = 0;
+        auto startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numIterations; i++) {
+            ClipOverview overview(64.0);
+            for (const auto& note : notes) {
+                overview.addNote(note[0], note[1], (int)note[2]);
+            }
+            serializedSize = overview.serialize().size();
+        }
+        double overviewMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() / numIterations;
+        std::cout << std::endl;
+        std::cout << "    overview: " << overviewMs << " ms per clip, " << serializedSize << " bytes" << std::endl;
+        std::cout << "    ";
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd Clip Overview Tests" << std::endl;
+    std::cout << "============================" << std::endl;
+
+    runClipOverviewTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
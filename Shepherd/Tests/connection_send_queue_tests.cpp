@@ -0,0 +1,187 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "ConnectionSendQueue.h"
+#include "test_runner.h"
+
+using Message = ConnectionSendQueue::Message;
+using MessageKind = ConnectionSendQueue::MessageKind;
+
+static Message makeMessage(const std::string& data, MessageKind kind = MessageKind::other) {
+    return Message{std::make_shared<const std::string>(data), false, kind};
+}
+
+static ConnectionSendQueue makeQueue(size_t maxMessages, size_t maxBytes) {
+    return ConnectionSendQueue(maxMessages, maxBytes, makeMessage("/resync:"));
+}
+
+void runConnectionSendQueueTests() {
+    TestRunner::run("ConnectionSendQueue - Only one message is in flight at a time", []() {
+        auto queue = makeQueue(10, 1000);
+        auto first = queue.push(makeMessage("a"));
+        if (!first.has_value() || *first->data != "a") {
+            return TestResult{false, "First message should be sent immediately"};
+        }
+        if (queue.push(makeMessage("b")).has_value() || queue.push(makeMessage("c")).has_value()) {
+            return TestResult{false, "Messages should be queued while another one is in flight"};
+        }
+        auto second = queue.sent(true);
+        auto third = second.has_value() ? queue.sent(true) : std::nullopt;
+        if (!second.has_value() || *second->data != "b" || !third.has_value() || *third->data != "c") {
+            return TestResult{false, "Queued messages should be sent in order"};
+        }
+        if (queue.sent(true).has_value()) {
+            return TestResult{false, "Nothing should be left to send"};
+        }
+        auto stats = queue.getStats();
+        if (stats.messagesSent != 3 || stats.bytesSent != 3 || stats.maxQueuedMessages != 2 || stats.queuedMessages != 0) {
+            return TestResult{false, "Unexpected stats"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ConnectionSendQueue - Messages are shared, not copied", []() {
+        auto queue = makeQueue(10, 1000);
+        auto data = std::make_shared<const std::string>("shared");
+        auto sent = queue.push(Message{data, false, MessageKind::other});
+        if (!sent.has_value() || sent->data.get() != data.get()) {
+            return TestResult{false, "Queue should hand out the same buffer it was given"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ConnectionSendQueue - Overflow drops queued messages and queues a resync", []() {
+        auto queue = makeQueue(3, 1000);
+        queue.push(makeMessage("in flight", MessageKind::stateUpdate));
+        for (int i = 0; i < 3; i++) {
+            queue.push(makeMessage("update " + std::to_string(i), MessageKind::stateUpdate));
+        }
+        queue.push(makeMessage("overflowing update", MessageKind::stateUpdate));
+        auto stats = queue.getStats();
+        if (stats.overflows != 1 || stats.messagesDropped != 4 || !stats.resyncPending || stats.queuedMessages != 1) {
+            return TestResult{false, "Unexpected stats after overflow"};
+        }
+        auto next = queue.sent(true);
+        if (!next.has_value() || *next->data != "/resync:") {
+            return TestResult{false, "Resync message should be sent after the message in flight"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ConnectionSendQueue - Byte limit triggers overflow", []() {
+        auto queue = makeQueue(100, 10);
+        queue.push(makeMessage("in flight"));
+        queue.push(makeMessage("12345"));
+        queue.push(makeMessage("123456", MessageKind::stateUpdate));
+        auto stats = queue.getStats();
+        if (stats.overflows != 1 || !stats.resyncPending) {
+            return TestResult{false, "Exceeding the byte limit should overflow"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ConnectionSendQueue - State updates are dropped until a full state is queued", []() {
+        auto queue = makeQueue(3, 1000);
+        queue.push(makeMessage("in flight"));
+        queue.push(makeMessage("1", MessageKind::stateUpdate));
+        queue.push(makeMessage("2", MessageKind::stateUpdate));
+        queue.push(makeMessage("3", MessageKind::stateUpdate));
+        queue.push(makeMessage("4", MessageKind::stateUpdate));  // Overflows
+        queue.push(makeMessage("5", MessageKind::stateUpdate));  // Dropped, resync pending
+        queue.push(makeMessage("full state", MessageKind::fullState));
+        queue.push(makeMessage("6", MessageKind::stateUpdate));  // Queued again
+        std::vector<std::string> sent;
+        for (auto next = queue.sent(true); next.has_value(); next = queue.sent(true)) {
+            sent.push_back(*next->data);
+        }
+        const std::vector<std::string> expected = {"/resync:", "full state", "6"};
+        if (sent != expected) {
+            return TestResult{false, "Unexpected messages sent after resync"};
+        }
+        if (queue.getStats().resyncPending) {
+            return TestResult{false, "Full state should end the resync"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ConnectionSendQueue - Full state bigger than the limit is queued without resync", []() {
+        auto queue = makeQueue(10, 16);
+        queue.push(makeMessage("in flight"));
+        queue.push(makeMessage("update", MessageKind::stateUpdate));
+        queue.push(makeMessage(std::string(100, 'x'), MessageKind::fullState));
+        std::vector<std::string> sent;
+        for (auto next = queue.sent(true); next.has_value(); next = queue.sent(true)) {
+            sent.push_back(*next->data);
+        }
+        if (sent.size() != 1 || sent[0].size() != 100) {
+            return TestResult{false, "Full state bigger than the byte limit should still be sent (and replace queued updates)"};
+        }
+        if (queue.getStats().resyncPending) {
+            return TestResult{false, "Full state should not need a resync"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ConnectionSendQueue - Concurrent producers and drain", []() {
+        auto queue = makeQueue(1000000, 1000000000);
+        const int numProducers = 4;
+        const int messagesPerProducer = 10000;
+        std::atomic<int> numSent { 0 };
+        std::atomic<bool> producing { true };
+        std::vector<std::thread> producers;
+        std::mutex pendingMutex;
+        std::vector<Message> toSend;
+        for (int p = 0; p < numProducers; p++) {
+            producers.emplace_back([&]() {
+                for (int i = 0; i < messagesPerProducer; i++) {
+                    auto next = queue.push(makeMessage("m"));
+                    if (next.has_value()) {
+                        const std::lock_guard<std::mutex> lock (pendingMutex);
+                        toSend.push_back(std::move(*next));
+                    }
+                }
+            });
+        }
+        // Simulated I/O thread: "writes" the message handed out and asks for the next one
+        std::thread io([&]() {
+            while (true) {
+                std::optional<Message> current;
+                {
+                    const std::lock_guard<std::mutex> lock (pendingMutex);
+                    if (!toSend.empty()) {
+                        current = std::move(toSend.back());
+                        toSend.pop_back();
+                    } else if (!producing) {
+                        break;
+                    }
+                }
+                while (current.has_value()) {
+                    numSent++;
+                    current = queue.sent(true);
+                }
+            }
+        });
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        producing = false;
+        io.join();
+        if (numSent != numProducers * messagesPerProducer) {
+            return TestResult{false, "Sent " + std::to_string(numSent.load()) + " messages"};
+        }
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd Connection Send Queue Tests" << std::endl;
+    std::cout << "====================================" << std::endl;
+
+    runConnectionSendQueueTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
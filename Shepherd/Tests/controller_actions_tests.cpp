@@ -0,0 +1,236 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include "ControllerActions.h"
+#include "test_runner.h"
+
+// Lookups are resolved at compile time too
+static_assert(ControllerActions::lookup(ACTION_ADDRESS_CLIP_PLAY).action == ControllerAction::clipPlay, "");
+static_assert(ControllerActions::lookup("/clip/unknown").action == ControllerAction::unknown, "");
+
+struct ParsedMessage {
+    std::string_view address;
+    std::vector<std::string_view> parameters;
+};
+
+// Same parsing as Sequencer::wsMessageReceived (address, ":", parameters separated by SERIALIZATION_SEPARATOR)
+static void parseMessage(std::string_view serializedMessage, ParsedMessage& parsed) {
+    auto separatorIndex = serializedMessage.find(':');
+    parsed.address = serializedMessage.substr(0, separatorIndex);
+    parsed.parameters.clear();
+    if (separatorIndex == std::string_view::npos) return;
+    auto serializedParameters = serializedMessage.substr(separatorIndex + 1);
+    size_t start = 0;
+    while (start <= serializedParameters.size()) {
+        auto end = serializedParameters.find(';', start);
+        if (end == std::string_view::npos) end = serializedParameters.size();
+        parsed.parameters.push_back(serializedParameters.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+// Dispatch as it was done before the action table: check the group prefix and then compare the address with each of
+// the addresses in the group, in table order
+static int dispatchWithComparisons(std::string_view action) {
+    for (size_t i = 0; i < ControllerActions::actions.size(); i++) {
+        auto address = ControllerActions::actions[i].address;
+        auto groupPrefix = address.substr(0, address.find('/', 1));
+        if (action.substr(0, groupPrefix.size()) == groupPrefix && action == address) {
+            return (int)ControllerActions::actions[i].action;
+        }
+    }
+    return 0;
+}
+
+// Clips known by the resolver used in the tests, which can be referenced by UUID or by handle like in the Sequencer
+static std::string resolveClip(std::string_view track, std::string_view clip) {
+    if (track != "t1" && track != "1") return "";
+    if (clip == "c1" || clip == "1") return "c1";
+    if (clip == "c2" || clip == "2") return "c2";
+    return "";
+}
+
+// Same target as ControllerMessageQueue::getTarget
+static std::string getTarget(const ParsedMessage& parsed) {
+    auto info = ControllerActions::lookup(parsed.address);
+    switch (ControllerActions::getCoalescingTarget(info.action, info.group)) {
+        case ControllerActions::CoalescingTarget::nothing: return "";
+        case ControllerActions::CoalescingTarget::clip: {
+            auto clipUUID = parsed.parameters.size() >= 2 ? resolveClip(parsed.parameters[0], parsed.parameters[1]) : "";
+            return clipUUID.empty() ? "*" : "clip;" + clipUUID;
+        }
+        case ControllerActions::CoalescingTarget::transport: return "transport";
+        case ControllerActions::CoalescingTarget::metronome: return "metronome";
+        case ControllerActions::CoalescingTarget::settings: return "settings";
+        case ControllerActions::CoalescingTarget::everything: return "*";
+    }
+    return "*";
+}
+
+// Same key as ControllerMessageQueue::getCoalescingKey
+static std::string getCoalescingKey(std::string_view serializedMessage) {
+    ParsedMessage parsed;
+    parseMessage(serializedMessage, parsed);
+    auto action = ControllerActions::lookup(parsed.address).action;
+    auto keyParameters = ControllerActions::getCoalescingKeyParameters(action, parsed.parameters.size());
+    auto target = getTarget(parsed);
+    if (!keyParameters.canCoalesce || target == "*") return "";
+    std::string key = std::to_string((int)action) + ";" + target;
+    for (size_t i = keyParameters.first; i < keyParameters.first + keyParameters.count; i++) {
+        key += ";" + std::string(parsed.parameters[i]);
+    }
+    return key;
+}
+
+// Returns the indices of the messages of the batch which are processed, as in ControllerMessageQueue::handleAsyncUpdate
+static std::vector<size_t> getProcessedMessages(const std::vector<std::string>& batch) {
+    std::vector<std::string> keys, targets;
+    for (const auto& message : batch) {
+        ParsedMessage parsed;
+        parseMessage(message, parsed);
+        targets.push_back(getTarget(parsed));
+        keys.push_back(getCoalescingKey(message));
+    }
+    std::vector<bool> replaced;
+    ControllerActions::findReplacedMessages(keys, targets, std::string("*"), replaced);
+    std::vector<size_t> processed;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (!replaced[i]) processed.push_back(i);
+    }
+    return processed;
+}
+
+void runControllerActionsTests() {
+    TestRunner::run("ControllerActions - All actions are found", []() {
+        for (const auto& info : ControllerActions::actions) {
+            auto found = ControllerActions::lookup(info.address);
+            if (found.action != info.action || found.group != info.group) {
+                return TestResult{false, "Wrong action for " + std::string(info.address)};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ControllerActions - Unknown addresses", []() {
+        for (const char* address : {"", "/clip", "/clip/", "/clip/playX", "/clip/pla", "/transport", "/full_state", "/state_update", "clip/play"}) {
+            if (ControllerActions::lookup(address).action != ControllerAction::unknown) {
+                return TestResult{false, std::string("Unknown address resolved: ") + address};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ControllerActions - Coalescing keys", []() {
+        // Consecutive tempo changes replace each other, but changes scheduled at different beats are all kept
+        if (getCoalescingKey("/transport/setBpm:120") != getCoalescingKey("/transport/setBpm:121")) {
+            return TestResult{false, "Immediate tempo changes should be coalesced"};
+        }
+        if (getCoalescingKey("/transport/setBpm:120;8") == getCoalescingKey("/transport/setBpm:90;16")) {
+            return TestResult{false, "Tempo changes scheduled at different beats should not be coalesced"};
+        }
+        if (getCoalescingKey("/transport/setBpm:120;8") == getCoalescingKey("/transport/setBpm:90")) {
+            return TestResult{false, "Scheduled and immediate tempo changes should not be coalesced"};
+        }
+        if (getCoalescingKey("/transport/setBpm:120;8") != getCoalescingKey("/transport/setBpm:90;8")) {
+            return TestResult{false, "Tempo changes scheduled at the same beat should be coalesced"};
+        }
+        if (getCoalescingKey("/transport/setMeter:4;8") == getCoalescingKey("/transport/setMeter:3;12")) {
+            return TestResult{false, "Meter changes scheduled at different beats should not be coalesced"};
+        }
+        if (getCoalescingKey("/transport/setMeter:4") == getCoalescingKey("/transport/setBpm:4")) {
+            return TestResult{false, "Different actions should not be coalesced"};
+        }
+        if (getCoalescingKey("/clip/setLength:t1;c1;8") != getCoalescingKey("/clip/setLength:t1;c1;16")
+            || getCoalescingKey("/clip/setLength:t1;c1;8") == getCoalescingKey("/clip/setLength:t1;c2;8")) {
+            return TestResult{false, "Clip setters should be coalesced per clip"};
+        }
+        if (getCoalescingKey("/clip/setLength:t1;c1;8") != getCoalescingKey("/clip/setLength:1;1;16")) {
+            return TestResult{false, "Clip referenced by handle and by UUID should have the same key"};
+        }
+        for (const char* message : {"/clip/play:t1;c1", "/scene/play:1", "/transport/playStop:", "/clip/setLength:t1", "/clip/setLength:t1;c3;8"}) {
+            if (!getCoalescingKey(message).empty()) {
+                return TestResult{false, std::string("Message should not be coalesced: ") + message};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ControllerActions - Coalescing does not reorder messages", []() {
+        const std::vector<std::pair<std::vector<std::string>, std::vector<size_t>>> cases = {
+            // Consecutive setters are coalesced, also when the clip is referenced in different ways
+            {{"/transport/setBpm:120", "/transport/setBpm:121", "/transport/setBpm:122"}, {2}},
+            {{"/clip/setLength:t1;c1;8", "/clip/setLength:1;1;16"}, {1}},
+            // Messages which don't change the state, or change other objects, don't separate them
+            {{"/transport/setBpm:120", "/get_state:playheads", "/transport/setBpm:121"}, {1, 2}},
+            {{"/clip/setSequence:t1;c1;{}", "/clip/setSequence:t1;c2;{}", "/clip/setSequence:t1;c1;{}"}, {1, 2}},
+            // Other messages which change the same object do
+            {{"/clip/setSequence:t1;c1;{}", "/clip/editSequence:t1;c1;{}", "/clip/setSequence:t1;c1;{}"}, {0, 1, 2}},
+            {{"/clip/setSequence:t1;c1;{}", "/clip/setLength:1;1;8", "/clip/setSequence:1;1;{}"}, {0, 1, 2}},
+            {{"/transport/setBpm:120", "/transport/play:", "/transport/setBpm:121"}, {0, 1, 2}},
+            // And so do messages which can change anything, or reference clips which can't be resolved
+            {{"/transport/setBpm:120", "/settings/load:session", "/transport/setBpm:121"}, {0, 1, 2}},
+            {{"/clip/setLength:t1;c1;8", "/clip/clear:t1;c3", "/clip/setLength:t1;c1;16"}, {0, 1, 2}},
+        };
+        for (const auto& [batch, expected] : cases) {
+            if (getProcessedMessages(batch) != expected) {
+                return TestResult{false, "Wrong messages processed in batch starting with " + batch[0] + " then " + batch[1]};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("ControllerActions - Benchmark (messages per second)", []() {
+        // Not a pass/fail test, it prints the throughput of parsing and dispatching a mix of typical messages
+        // with the action table and with string comparisons
+        std::vector<std::string> messages = {
+            "/transport/setBpm:121.5",
+            "/clip/play:8a9b5c36-b2a4-4c6e-8f5e-1d1d9c1b2e3f;4f1e2d3c-5b6a-4978-8a9b-0c1d2e3f4a5b",
+            "/clip/editSequence:8a9b5c36-b2a4-4c6e-8f5e-1d1d9c1b2e3f;4f1e2d3c-5b6a-4978-8a9b-0c1d2e3f4a5b;{\"action\": \"removeEvent\"}",
+            "/scene/play:3",
+            "/metronome/onOff:",
+            "/device/sendMidi:Push2Live;144;60;127",
+            "/settings/fixedVelocity:100",
+            "/shepherdControllerReady:",
+        };
+        const int numIterations = 200000;
+        ParsedMessage parsed;
+        long long checksum = 0;
+
+        auto startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numIterations; i++) {
+            for (const auto& message : messages) {
+                parseMessage(message, parsed);
+                checksum += (int)ControllerActions::lookup(parsed.address).action + (long long)parsed.parameters.size();
+            }
+        }
+        double tableSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numIterations; i++) {
+            for (const auto& message : messages) {
+                parseMessage(message, parsed);
+                checksum += dispatchWithComparisons(parsed.address) + (long long)parsed.parameters.size();
+            }
+        }
+        double comparisonsSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        double numMessages = (double)numIterations * (double)messages.size();
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+        std::cout << "    action table: " << numMessages / tableSeconds / 1e6 << " M messages/s" << std::endl;
+        std::cout << "    string comparisons: " << numMessages / comparisonsSeconds / 1e6 << " M messages/s" << std::endl;
+        std::cout << "    ";
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd Controller Actions Tests" << std::endl;
+    std::cout << "=================================" << std::endl;
+
+    runControllerActionsTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
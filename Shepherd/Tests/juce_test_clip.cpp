@@ -0,0 +1,113 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "Clip.h"
+#include "helpers_shepherd.h"
+
+// Forward declarations from main file
+struct TestResult {
+    bool passed = true;
+    juce::String message;
+};
+
+class TestRunner {
+public:
+    static void run(const juce::String& testName, std::function<TestResult()> test);
+};
+
+static GlobalSettingsStruct clipTestGlobalSettings() {
+    GlobalSettingsStruct settings;
+    settings.sampleRate = 44100.0;
+    settings.samplesPerSlice = 512;
+    return settings;
+}
+
+// Clip of the given length (in beats) with the given notes, each one as {timestamp, midiNote, duration}
+struct TestClip {
+    juce::ValueTree musicalContextState { ShepherdIDs::MUSICAL_CONTEXT };
+    MusicalContext musicalContext { clipTestGlobalSettings, musicalContextState };
+    juce::ValueTree state { ShepherdIDs::CLIP };
+    std::unique_ptr<Clip> clip;
+
+    TestClip(double lengthInBeats, std::initializer_list<std::array<double, 3>> notes) {
+        state.setProperty(ShepherdIDs::uuid, "c1", nullptr);
+        clip = std::make_unique<Clip>(state,
+                                      []{ return juce::Range<double>(); },
+                                      clipTestGlobalSettings,
+                                      []{ return TrackSettingsStruct{1, nullptr}; },
+                                      [this]{ return &musicalContext; });
+        clip->stopAsyncTimer();
+        juce::Array<juce::ValueTree> sequenceEvents;
+        int i = 0;
+        for (const auto& note : notes) {
+            auto sequenceEvent = ShepherdHelpers::createSequenceEventOfTypeNote(note[0], (int)note[1], 1.0f, note[2]);
+            sequenceEvent.setProperty(ShepherdIDs::uuid, "n" + juce::String(i++), nullptr);
+            sequenceEvents.add(sequenceEvent);
+        }
+        clip->replaceSequenceEvents(sequenceEvents, lengthInBeats);
+    }
+
+    // Uuids of the events matched by the query, separated by spaces
+    juce::String query(double startBeat, double endBeat, int maxEvents = -1, bool* truncated = nullptr) {
+        Clip::EventsQuery eventsQuery;
+        eventsQuery.startBeat = startBeat;
+        eventsQuery.endBeat = endBeat;
+        eventsQuery.maxEvents = maxEvents;
+        bool wasTruncated;
+        juce::StringArray uuids;
+        for (const auto& sequenceEvent : clip->queryCompiledEvents(eventsQuery, wasTruncated)) {
+            uuids.add(sequenceEvent[ShepherdIDs::uuid].toString());
+        }
+        if (truncated != nullptr) *truncated = wasTruncated;
+        return uuids.joinIntoString(" ");
+    }
+};
+
+void runClipTests() {
+    TestRunner::run("Clip::queryCompiledEvents - Notes starting before the window are matched", []() {
+        // n0 is the longest note, so the search starts 4 beats before the window (see compiledEventsMaxLength)
+        TestClip testClip(8.0, {{0.0, 60, 4.0}, {1.0, 62, 0.25}, {3.0, 64, 0.25}, {3.5, 65, 1.0}, {5.0, 67, 0.5}});
+        auto matched = testClip.query(3.5, 3.6);
+        if (matched != "n0 n3") {
+            return TestResult{false, "Expected n0 n3, got " + matched};
+        }
+        matched = testClip.query(4.0, 5.0);
+        if (matched != "n3") {
+            return TestResult{false, "Notes ending at the window start should not be matched, got " + matched};
+        }
+        matched = testClip.query(0.0, 8.0);
+        if (matched != "n0 n1 n2 n3 n4") {
+            return TestResult{false, "Expected all the notes sorted by start, got " + matched};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("Clip::queryCompiledEvents - Notes wrapping around the clip loop are matched once", []() {
+        TestClip testClip(8.0, {{1.0, 60, 0.5}, {7.5, 62, 1.0}});
+        auto matched = testClip.query(0.0, 0.25);
+        if (matched != "n1") {
+            return TestResult{false, "Wrapped part of n1 should match at the start of the clip, got " + matched};
+        }
+        matched = testClip.query(0.0, 8.0);
+        if (matched != "n0 n1") {
+            return TestResult{false, "Note matched both wrapped and unwrapped should only be returned once, got " + matched};
+        }
+        matched = testClip.query(0.5, 1.0);
+        if (matched != "") {
+            return TestResult{false, "Wrapped part of n1 ends at 0.5, got " + matched};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("Clip::queryCompiledEvents - Max events", []() {
+        TestClip testClip(8.0, {{7.5, 60, 1.0}, {0.0, 62, 1.0}, {0.1, 64, 1.0}});
+        bool truncated = false;
+        auto matched = testClip.query(0.0, 1.0, 2, &truncated);
+        if (matched != "n0 n1" || !truncated) {
+            return TestResult{false, "Expected the wrapped note first and the result truncated, got " + matched};
+        }
+        matched = testClip.query(0.0, 1.0, 3, &truncated);
+        if (matched != "n0 n1 n2" || truncated) {
+            return TestResult{false, "Result should not be truncated if all the events fit, got " + matched};
+        }
+        return TestResult{true, ""};
+    });
+}
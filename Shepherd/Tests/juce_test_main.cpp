@@ -45,13 +45,24 @@ int TestRunner::failCount = 0;
 // Test declarations
 void runJuceBasicTests();
 void runMusicalContextTests();
+void runMidiLoopbackTests();
+void runStateUpdateJournalTests();
+void runStateSubscriptionTests();
+void runClipTests();
 
 int main() {
+    // Creates the MessageManager, so the thread running the tests is the message thread (e.g. for StateUpdateJournal)
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    
     std::cout << "Shepherd JUCE-based Tests" << std::endl;
     std::cout << "=========================" << std::endl;
     
     runJuceBasicTests();
     runMusicalContextTests();
+    runMidiLoopbackTests();
+    runStateUpdateJournalTests();
+    runStateSubscriptionTests();
+    runClipTests();
     
     TestRunner::printSummary();
     return TestRunner::getFailCount() > 0 ? 1 : 0;
@@ -0,0 +1,169 @@
+// Measures the jitter of the MIDI clock sent by the "immediate" and "scheduled" MIDI output modes (see
+// midiOutputScheduling in Sequencer) through a real virtual MIDI port: a virtual output is created with
+// MidiOutput::createNewDevice and opened as a MidiInput in the same process, and the times at which clock messages
+// are received are compared with the times they should be sent at. The test is skipped if there is no MIDI
+// subsystem available (e.g. no ALSA sequencer) or the virtual port can't be opened as an input.
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "MusicalContext.h"
+#include "MidiOutputTimeBase.h"
+#include "helpers_shepherd.h"
+#include <iostream>
+#include <random>
+#include <thread>
+
+// Forward declarations from main file
+struct TestResult {
+    bool passed = true;
+    juce::String message;
+};
+
+class TestRunner {
+public:
+    static void run(const juce::String& testName, std::function<TestResult()> test);
+};
+
+static GlobalSettingsStruct loopbackGlobalSettings() {
+    GlobalSettingsStruct settings;
+    settings.sampleRate = 44100.0;
+    settings.samplesPerSlice = 512;
+    return settings;
+}
+
+// Collects the reception times of MIDI clock messages (called from the MIDI input thread)
+class ClockReceiver: public juce::MidiInputCallback {
+public:
+    void handleIncomingMidiMessage(juce::MidiInput*, const juce::MidiMessage& message) override {
+        if (!message.isMidiClock()) return;
+        const juce::SpinLock::ScopedLockType sl(lock);
+        receivedTimesMs.push_back(juce::Time::getMillisecondCounterHiRes());
+    }
+
+    std::vector<double> getReceivedTimesMs() {
+        const juce::SpinLock::ScopedLockType sl(lock);
+        return receivedTimesMs;
+    }
+
+    void clear() {
+        const juce::SpinLock::ScopedLockType sl(lock);
+        receivedTimesMs.clear();
+    }
+
+private:
+    juce::SpinLock lock;
+    std::vector<double> receivedTimesMs;
+};
+
+struct JitterStats {
+    int numTicks = 0;
+    double maxDeviationMs = 0.0;  // Max deviation of the intervals between received ticks from the nominal interval
+    double meanDeviationMs = 0.0;
+};
+
+static JitterStats computeJitter(const std::vector<double>& timesMs, double nominalIntervalMs) {
+    JitterStats stats;
+    stats.numTicks = (int)timesMs.size();
+    if (timesMs.size() < 2) return stats;
+    for (size_t i = 1; i < timesMs.size(); i++) {
+        double deviationMs = std::abs(timesMs[i] - timesMs[i - 1] - nominalIntervalMs);
+        stats.maxDeviationMs = juce::jmax(stats.maxDeviationMs, deviationMs);
+        stats.meanDeviationMs += deviationMs;
+    }
+    stats.meanDeviationMs /= (double)(timesMs.size() - 1);
+    return stats;
+}
+
+// Runs the sequencer clock for durationMs as if driven by an audio device (with callback jitter) and sends each
+// slice to the output like MidiOutputDispatcher does in the given mode
+static JitterStats measureClockJitter(juce::MidiOutput& output, ClockReceiver& receiver, bool scheduled, double durationMs) {
+    const auto settings = loopbackGlobalSettings();
+    const double sliceDurationMs = settings.samplesPerSlice * 1000.0 / settings.sampleRate;
+    const double latencyMs = 10.0;
+
+    juce::ValueTree state(ShepherdIDs::MUSICAL_CONTEXT);
+    MusicalContext context(loopbackGlobalSettings, state);
+    context.setBpm(120.0);
+    context.setPlayheadIsPlaying(true);
+    double beatsPerSlice = settings.samplesPerSlice * context.getBpm() / (60.0 * settings.sampleRate);
+
+    MidiOutputTimeBase timeBase;
+    timeBase.prepare(settings.sampleRate);
+    juce::MidiBuffer buffer;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> callbackJitterMs(0.0, 3.0);
+
+    receiver.clear();
+    const double startTimeMs = juce::Time::getMillisecondCounterHiRes() + 10.0;
+    const int numSlices = (int)(durationMs / sliceDurationMs);
+    for (int slice = 0; slice < numSlices; slice++) {
+        double callbackTimeMs = startTimeMs + slice * sliceDurationMs + callbackJitterMs(rng);
+        while (juce::Time::getMillisecondCounterHiRes() < callbackTimeMs) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        timeBase.processSlice(juce::Time::getMillisecondCounterHiRes(), settings.samplesPerSlice);
+        buffer.clear();
+        context.renderMidiClockInSlice(buffer);
+        context.setPlayheadPosition(context.getPlayheadPositionInBeats() + beatsPerSlice);
+        if (scheduled) {
+            output.sendBlockOfMessages(buffer, timeBase.getSliceStartTimeMs() + latencyMs, settings.sampleRate);
+        } else {
+            output.sendBlockOfMessagesNow(buffer);
+        }
+    }
+    // Wait for the scheduled messages to be sent and received
+    juce::Thread::sleep((int)latencyMs + 100);
+
+    return computeJitter(receiver.getReceivedTimesMs(), 60000.0 / (context.getBpm() * 24.0));
+}
+
+void runMidiLoopbackTests() {
+    TestRunner::run("MIDI output - Clock jitter through a virtual loopback port", []() {
+        const juce::String portName = "Shepherd loopback test " + juce::String(juce::Time::currentTimeMillis());
+        auto output = juce::MidiOutput::createNewDevice(portName);
+        if (output == nullptr) {
+            std::cout << "(skipped, virtual MIDI ports are not available) ";
+            return TestResult{true, ""};
+        }
+
+        ClockReceiver receiver;
+        std::unique_ptr<juce::MidiInput> input;
+        for (const auto& device : juce::MidiInput::getAvailableDevices()) {
+            if (device.name == portName) {
+                input = juce::MidiInput::openDevice(device.identifier, &receiver);
+                break;
+            }
+        }
+        if (input == nullptr) {
+            std::cout << "(skipped, the virtual MIDI port can't be opened as an input) ";
+            return TestResult{true, ""};
+        }
+        input->start();
+        output->startBackgroundThread();  // Needed by sendBlockOfMessages
+
+        const double durationMs = 3000.0;
+        auto immediate = measureClockJitter(*output, receiver, false, durationMs);
+        auto scheduled = measureClockJitter(*output, receiver, true, durationMs);
+        input->stop();
+        output->stopBackgroundThread();
+
+        std::cout << "(immediate: " << immediate.numTicks << " ticks, jitter mean " << immediate.meanDeviationMs
+                  << " ms, max " << immediate.maxDeviationMs << " ms; scheduled: " << scheduled.numTicks
+                  << " ticks, jitter mean " << scheduled.meanDeviationMs << " ms, max " << scheduled.maxDeviationMs
+                  << " ms) ";
+
+        // 120 bpm sends 48 ticks per second, allow for a few ticks at the edges of the measurement
+        const int expectedTicks = (int)(durationMs / 1000.0 * 48.0);
+        if (immediate.numTicks < expectedTicks - 3 || scheduled.numTicks < expectedTicks - 3) {
+            return TestResult{false, "Clock messages were lost in the loopback port"};
+        }
+        // Immediate output jitters by up to a slice (11.6 ms), scheduled output should only show the scheduling
+        // precision of the MIDI output thread
+        if (scheduled.meanDeviationMs >= immediate.meanDeviationMs) {
+            return TestResult{false, "Scheduled output should have less jitter than immediate output"};
+        }
+        if (scheduled.meanDeviationMs > 2.0) {
+            return TestResult{false, "Scheduled output jitter is too high: " + juce::String(scheduled.meanDeviationMs) + " ms"};
+        }
+        return TestResult{true, ""};
+    });
+}
@@ -0,0 +1,152 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "StateSubscription.h"
+
+// Forward declarations from main file
+struct TestResult {
+    bool passed = true;
+    juce::String message;
+};
+
+class TestRunner {
+public:
+    static void run(const juce::String& testName, std::function<TestResult()> test);
+};
+
+using Update = StateUpdateJournal::Update;
+
+static Update propertyChange(const juce::String& path, const juce::Identifier& property, const juce::var& value) {
+    Update update;
+    update.type = Update::Type::propertyChanged;
+    update.path = juce::StringArray::fromTokens(path, "/", "");
+    update.uuid = update.path[update.path.size() - 1];
+    update.treeType = "TREE";
+    update.property = property;
+    update.value = value;
+    return update;
+}
+
+static Update removedChild(const juce::String& path) {
+    Update update;
+    update.type = Update::Type::removedChild;
+    update.path = juce::StringArray::fromTokens(path, "/", "");
+    update.uuid = update.path[update.path.size() - 1];
+    update.treeType = "TREE";
+    return update;
+}
+
+static Update replacedChildren(const juce::String& path) {
+    Update update;
+    update.type = Update::Type::replacedChildren;
+    update.path = juce::StringArray::fromTokens(path, "/", "");
+    update.uuid = update.path[update.path.size() - 1];
+    update.treeType = "TREE";
+    update.property = "CHILD";
+    update.child = juce::ValueTree("TREE");
+    return update;
+}
+
+// Values of the selected updates, as "uuid.property=value" (or "uuid:type" for structural updates)
+static juce::String describe(const std::vector<const Update*>& selected) {
+    juce::StringArray descriptions;
+    for (auto update : selected) {
+        if (update->type == Update::Type::propertyChanged) {
+            descriptions.add(update->uuid + "." + update->property.toString() + "=" + update->value.toString());
+        } else {
+            descriptions.add(update->uuid + ":" + juce::String((int)update->type));
+        }
+    }
+    return descriptions.joinIntoString(" ");
+}
+
+static StateSubscription::Ptr rateLimitedSubscription() {
+    // Playhead positions at most 10 times per second, anything in the subtree of t1 without limit
+    auto subscription = StateSubscription::withRule(nullptr, {StateSubscription::Kind::property, "playheadPositionInBeats", 10.0});
+    return StateSubscription::withRule(subscription, {StateSubscription::Kind::subtree, "t1", 0.0});
+}
+
+void runStateSubscriptionTests() {
+    TestRunner::run("StateSubscriptionDelivery - Rate limited changes are deferred and coalesced", []() {
+        StateSubscriptionDelivery delivery(StateSubscription::withRule(nullptr, {StateSubscription::Kind::property, "playheadPositionInBeats", 10.0}));
+
+        auto selected = describe(delivery.select({propertyChange("r/c1", "playheadPositionInBeats", 1), propertyChange("r/c1", "name", "x")}, 1000));
+        if (selected != "") {
+            return TestResult{false, "Rate limited change should be deferred and other changes not selected: " + selected};
+        }
+        if (!delivery.hasDueDeferredUpdates(1000)) {
+            return TestResult{false, "Change deferred for the first time should be due"};
+        }
+        selected = describe(delivery.select({}, 1000));
+        if (selected != "c1.playheadPositionInBeats=1") {
+            return TestResult{false, "Due change should be released with the next batch: " + selected};
+        }
+
+        delivery.select({propertyChange("r/c1", "playheadPositionInBeats", 2)}, 1030);
+        delivery.select({propertyChange("r/c1", "playheadPositionInBeats", 3)}, 1060);
+        if (delivery.hasDueDeferredUpdates(1090)) {
+            return TestResult{false, "Change should not be due before the rate interval has passed"};
+        }
+        selected = describe(delivery.select({propertyChange("r/c2", "playheadPositionInBeats", 7)}, 1100));
+        if (selected != "c1.playheadPositionInBeats=3") {
+            return TestResult{false, "Only the last value of the deferred change should be released: " + selected};
+        }
+        selected = describe(delivery.select({}, 1100));
+        if (selected != "c2.playheadPositionInBeats=7") {
+            return TestResult{false, "Changes of each tree should be limited separately: " + selected};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateSubscriptionDelivery - Changes without rate limit are selected in order", []() {
+        StateSubscriptionDelivery delivery(rateLimitedSubscription());
+        auto selected = describe(delivery.select({
+            propertyChange("r/t1", "name", "a"),
+            propertyChange("r/t2", "name", "b"),
+            propertyChange("r/t1/c1", "name", "c"),
+            removedChild("r/t1/c2"),
+        }, 1000));
+        if (selected != "t1.name=a c1.name=c c2:" + juce::String((int)Update::Type::removedChild)) {
+            return TestResult{false, "Wrong selection: " + selected};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateSubscriptionDelivery - Deferred changes of removed or replaced trees are discarded", []() {
+        StateSubscriptionDelivery delivery(StateSubscription::withRule(nullptr, {StateSubscription::Kind::property, "playheadPositionInBeats", 10.0}));
+        delivery.select({
+            propertyChange("r/t1", "playheadPositionInBeats", 1),
+            propertyChange("r/t1/c1", "playheadPositionInBeats", 2),
+            propertyChange("r/t2/c3", "playheadPositionInBeats", 3),
+        }, 1000);
+
+        // Replacing the children of t1 discards the changes of c1 but not the ones of t1 itself, and removing c3 discards
+        // its changes (the structural updates themselves do not match the subscription)
+        auto selected = describe(delivery.select({replacedChildren("r/t1"), removedChild("r/t2/c3")}, 1000));
+        if (selected != "t1.playheadPositionInBeats=1") {
+            return TestResult{false, "Wrong selection after replacing/removing trees: " + selected};
+        }
+
+        // Changes deferred earlier in the same batch as the removal are discarded too
+        delivery.select({propertyChange("r/t1/c4", "playheadPositionInBeats", 4), removedChild("r/t1/c4")}, 2000);
+        if (delivery.hasDueDeferredUpdates(3000)) {
+            return TestResult{false, "Change of a tree removed in the same batch should be discarded"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateSubscriptionDelivery - Trees without uuid are limited separately by type and path", []() {
+        StateSubscriptionDelivery delivery(StateSubscription::withRule(nullptr, {StateSubscription::Kind::property, "value", 10.0}));
+        auto settingsChange = [](const juce::String& treeType, const juce::String& parentUuid, int value) {
+            Update update = propertyChange(parentUuid, "value", value);
+            update.path.add("");  // The tree has no uuid
+            update.uuid = "";
+            update.treeType = treeType;
+            return update;
+        };
+        delivery.select({settingsChange("SETTINGS", "a", 1), settingsChange("SETTINGS", "b", 2), settingsChange("OTHER", "a", 3), settingsChange("SETTINGS", "a", 4)}, 1000);
+        auto selected = delivery.select({}, 1000);
+        if (selected.size() != 3 || (int)selected[0]->value != 4 || (int)selected[1]->value != 2 || (int)selected[2]->value != 3) {
+            return TestResult{false, "Expected the last value of each tree, got " + describe(selected)};
+        }
+        return TestResult{true, ""};
+    });
+}
@@ -0,0 +1,225 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "StateUpdateJournal.h"
+
+// Forward declarations from main file
+struct TestResult {
+    bool passed = true;
+    juce::String message;
+};
+
+class TestRunner {
+public:
+    static void run(const juce::String& testName, std::function<TestResult()> test);
+};
+
+using Update = StateUpdateJournal::Update;
+
+// Journal which keeps the batches it sends so that tests can check them
+struct RecordingJournal {
+    std::vector<std::vector<Update>> batches;
+    StateUpdateJournal journal { [this](const std::vector<Update>& updates){ batches.push_back(updates); } };
+
+    std::vector<Update> flush() {
+        batches.clear();
+        journal.flush();
+        return batches.empty() ? std::vector<Update>() : batches[0];
+    }
+};
+
+static juce::ValueTree createTree(const juce::Identifier& type, const juce::String& uuid) {
+    juce::ValueTree tree(type);
+    if (uuid.isNotEmpty()) {
+        tree.setProperty(ShepherdIDs::uuid, uuid, nullptr);
+    }
+    return tree;
+}
+
+static void setProperty(RecordingJournal& recorder, juce::ValueTree tree, const juce::Identifier& property, const juce::var& value) {
+    tree.setProperty(property, value, nullptr);
+    recorder.journal.recordPropertyChanged(tree, property);
+}
+
+void runStateUpdateJournalTests() {
+    TestRunner::run("StateUpdateJournal - Property changes are coalesced at the position of the first change", []() {
+        RecordingJournal recorder;
+        auto root = createTree("ROOT", "r");
+        auto clip = createTree("CLIP", "c1");
+        root.appendChild(clip, nullptr);
+
+        setProperty(recorder, root, "bpm", 120);
+        setProperty(recorder, clip, "playheadPositionInBeats", 1.0);
+        setProperty(recorder, root, "bpm", 121);
+        setProperty(recorder, root, "meter", 3);
+        setProperty(recorder, root, "bpm", 122);
+
+        auto updates = recorder.flush();
+        if (updates.size() != 3) {
+            return TestResult{false, "Expected 3 updates, got " + juce::String((int)updates.size())};
+        }
+        if (updates[0].property != juce::Identifier("bpm") || (int)updates[0].value != 122) {
+            return TestResult{false, "BPM change should be first, with the last value"};
+        }
+        if (updates[1].uuid != "c1" || updates[2].property != juce::Identifier("meter")) {
+            return TestResult{false, "Other changes should keep their order"};
+        }
+        if (updates[1].path != juce::StringArray("r", "c1")) {
+            return TestResult{false, "Wrong path: " + updates[1].path.joinIntoString("/")};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateUpdateJournal - Trees without uuid are coalesced per tree", []() {
+        RecordingJournal recorder;
+        auto root = createTree("ROOT", "");
+        auto settingsA = createTree("SETTINGS", "");
+        auto settingsB = createTree("SETTINGS", "");
+        root.appendChild(settingsA, nullptr);
+        root.appendChild(settingsB, nullptr);
+
+        setProperty(recorder, settingsA, "value", 1);
+        setProperty(recorder, settingsB, "value", 2);
+        setProperty(recorder, settingsA, "value", 3);
+        setProperty(recorder, settingsB, "value", 4);
+
+        auto updates = recorder.flush();
+        if (updates.size() != 2) {
+            return TestResult{false, "Expected one update per tree, got " + juce::String((int)updates.size())};
+        }
+        if ((int)updates[0].value != 3 || (int)updates[1].value != 4) {
+            return TestResult{false, "Each tree should keep its own last value"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateUpdateJournal - Flushing starts a new batch", []() {
+        RecordingJournal recorder;
+        auto root = createTree("ROOT", "r");
+
+        setProperty(recorder, root, "bpm", 120);
+        if (recorder.flush().size() != 1) {
+            return TestResult{false, "First batch should have the change"};
+        }
+        if (recorder.journal.hasPendingUpdates() || !recorder.flush().empty()) {
+            return TestResult{false, "Nothing should be pending after a flush"};
+        }
+        setProperty(recorder, root, "bpm", 121);
+        auto updates = recorder.flush();
+        if (updates.size() != 1 || (int)updates[0].value != 121) {
+            return TestResult{false, "Changes after a flush should not be coalesced with the flushed ones"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateUpdateJournal - Children are copied when added and never coalesced", []() {
+        RecordingJournal recorder;
+        auto track = createTree("TRACK", "t1");
+        auto clip = createTree("CLIP", "c1");
+
+        track.appendChild(clip, nullptr);
+        recorder.journal.recordChildAdded(track, clip);
+        setProperty(recorder, clip, "name", "changed");
+        track.removeChild(clip, nullptr);
+        recorder.journal.recordChildRemoved(track, clip);
+        track.appendChild(clip, nullptr);
+        recorder.journal.recordChildAdded(track, clip);
+
+        auto updates = recorder.flush();
+        if (updates.size() != 4) {
+            return TestResult{false, "Expected 4 updates, got " + juce::String((int)updates.size())};
+        }
+        if (updates[0].type != Update::Type::addedChild || updates[0].child.hasProperty("name")) {
+            return TestResult{false, "Added child should be copied as it was when added"};
+        }
+        if (updates[2].type != Update::Type::removedChild || updates[2].uuid != "c1" || updates[2].path != juce::StringArray("t1", "c1")) {
+            return TestResult{false, "Removed child should be identified by its uuid and path"};
+        }
+        if (updates[3].type != Update::Type::addedChild || updates[3].child["name"].toString() != "changed") {
+            return TestResult{false, "Child added again should be recorded with its current properties"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateUpdateJournal - Replacing children records a single update at the outermost end", []() {
+        RecordingJournal recorder;
+        auto clip = createTree("CLIP", "c1");
+        auto otherClip = createTree("CLIP", "c2");
+        auto oldEvent = createTree("SEQUENCE_EVENT", "e1");
+        clip.appendChild(oldEvent, nullptr);
+
+        recorder.journal.beginReplacingChildren(clip);
+        clip.removeChild(oldEvent, nullptr);
+        recorder.journal.recordChildRemoved(clip, oldEvent);
+        recorder.journal.beginReplacingChildren(clip);  // Nested edit
+        auto newEvent = createTree("SEQUENCE_EVENT", "e2");
+        clip.appendChild(newEvent, nullptr);
+        recorder.journal.recordChildAdded(clip, newEvent);
+        setProperty(recorder, newEvent, "midiNote", 60);
+        clip.appendChild(createTree("OTHER", "o1"), nullptr);
+        recorder.journal.endReplacingChildren(clip, "SEQUENCE_EVENT");
+        if (recorder.journal.hasPendingUpdates()) {
+            return TestResult{false, "Nothing should be recorded before the outermost edit ends"};
+        }
+        setProperty(recorder, clip, "clipLengthInBeats", 8.0);  // Properties of the parent itself are still recorded
+        setProperty(recorder, otherClip, "clipLengthInBeats", 4.0);
+        recorder.journal.endReplacingChildren(clip, "SEQUENCE_EVENT");
+        setProperty(recorder, newEvent, "midiNote", 61);  // Recorded again after the edit
+
+        auto updates = recorder.flush();
+        if (updates.size() != 4) {
+            return TestResult{false, "Expected 4 updates, got " + juce::String((int)updates.size())};
+        }
+        if (updates[0].uuid != "c1" || updates[1].uuid != "c2") {
+            return TestResult{false, "Property changes of the parent and of other trees should be recorded"};
+        }
+        const auto& replaced = updates[2];
+        if (replaced.type != Update::Type::replacedChildren || replaced.uuid != "c1" || replaced.property != juce::Identifier("SEQUENCE_EVENT")) {
+            return TestResult{false, "Expected a replacedChildren update for the clip"};
+        }
+        if (replaced.child.getNumChildren() != 1 || replaced.child.getChild(0)[ShepherdIDs::uuid].toString() != "e2" || (int)replaced.child.getChild(0)["midiNote"] != 60) {
+            return TestResult{false, "replacedChildren should have copies of the resulting children of the given type"};
+        }
+        if (updates[3].uuid != "e2" || (int)updates[3].value != 61) {
+            return TestResult{false, "Changes after the edit should be recorded"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateUpdateHistory - Range of batches which can be replayed", []() {
+        StateUpdateHistory history(4, 100);
+        if (!history.canReplayFrom(0, 0) || history.canReplayFrom(1, 0)) {
+            return TestResult{false, "Only the next ID can be replayed (with nothing to replay) before any batch is sent"};
+        }
+        for (int id = 0; id < 6; id++) {
+            history.add(id, {Update()});
+        }
+        // Batches 2 to 5 are kept, the next batch will be 6
+        if (history.getBatches().size() != 4 || history.getBatches().front().id != 2) {
+            return TestResult{false, "Oldest batches should be forgotten when more than maxBatches are kept"};
+        }
+        if (!history.canReplayFrom(2, 6) || !history.canReplayFrom(5, 6) || !history.canReplayFrom(6, 6)) {
+            return TestResult{false, "Batches still kept should be replayable"};
+        }
+        if (history.canReplayFrom(1, 6) || history.canReplayFrom(-1, 6)) {
+            return TestResult{false, "Batches which are no longer kept can't be replayed"};
+        }
+        if (history.canReplayFrom(7, 6)) {
+            return TestResult{false, "Batches which have not been sent yet can't be replayed"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("StateUpdateHistory - Max number of updates", []() {
+        StateUpdateHistory history(100, 3);
+        history.add(0, {Update(), Update()});
+        history.add(1, {Update()});
+        history.add(2, {Update()});
+        if (history.getBatches().size() != 2 || history.getBatches().front().id != 1 || history.canReplayFrom(0, 3)) {
+            return TestResult{false, "Oldest batches should be forgotten when more than maxUpdates are kept"};
+        }
+        history.add(3, {Update(), Update(), Update(), Update()});
+        if (history.getBatches().size() != 1 || !history.canReplayFrom(3, 4) || history.canReplayFrom(2, 4)) {
+            return TestResult{false, "The last batch should be kept even if it has more than maxUpdates"};
+        }
+        return TestResult{true, ""};
+    });
+}
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <cmath>
+#include "MessagePack.h"
+#include "test_runner.h"
+
+void runMessagePackTests() {
+    TestRunner::run("MessagePack - Integers use smallest encoding and round trip", []() {
+        const std::vector<std::pair<int64_t, size_t>> cases = {
+            {0, 1}, {127, 1}, {128, 2}, {255, 2}, {256, 3}, {65535, 3}, {65536, 5},
+            {4294967295LL, 5}, {4294967296LL, 9}, {-1, 1}, {-32, 1}, {-33, 2}, {-128, 2},
+            {-129, 3}, {-32768, 3}, {-32769, 5}, {INT32_MIN, 5}, {(int64_t)INT32_MIN - 1, 9}
+        };
+        for (const auto& [number, expectedSize] : cases) {
+            MessagePack::Writer writer;
+            writer.writeInt(number);
+            if (writer.getData().size() != expectedSize) {
+                return TestResult{false, "Unexpected encoded size for " + std::to_string(number)};
+            }
+            MessagePack::Reader reader(writer.getData().data(), writer.getData().size());
+            MessagePack::Value value;
+            if (!reader.read(value) || value.type != MessagePack::Value::Type::integer || value.intValue != number || !reader.atEnd()) {
+                return TestResult{false, "Round trip failed for " + std::to_string(number)};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MessagePack - Known encodings", []() {
+        MessagePack::Writer writer;
+        writer.writeArrayHeader(3);
+        writer.writeString("/a");
+        writer.writeInt(-1);
+        writer.writeBool(true);
+        const std::vector<uint8_t> expected = {0x93, 0xa2, '/', 'a', 0xff, 0xc3};
+        if (writer.getData() != expected) {
+            return TestResult{false, "Encoding does not match the MessagePack specification"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MessagePack - Message with mixed types round trips", []() {
+        const std::string longString(300, 'x');
+        const std::vector<uint8_t> blob(70000, 0xab);
+        MessagePack::Writer writer;
+        writer.writeArrayHeader(7);
+        writer.writeString("/state_update");
+        writer.writeString(longString);
+        writer.writeFloat(1.5f);
+        writer.writeDouble(-0.125);
+        writer.writeNil();
+        writer.writeBinary(blob.data(), blob.size());
+        writer.writeInt(42);
+
+        const auto& data = writer.getData();
+        MessagePack::Reader reader(data.data(), data.size());
+        MessagePack::Value value;
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::array || value.size != 7) {
+            return TestResult{false, "Wrong array header"};
+        }
+        if (!reader.read(value) || value.getString() != "/state_update") {
+            return TestResult{false, "Wrong address"};
+        }
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::string || value.getString() != longString) {
+            return TestResult{false, "Wrong str8 value"};
+        }
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::floatingPoint || value.doubleValue != 1.5) {
+            return TestResult{false, "Wrong float value"};
+        }
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::floatingPoint || value.doubleValue != -0.125) {
+            return TestResult{false, "Wrong double value"};
+        }
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::nil) {
+            return TestResult{false, "Wrong nil value"};
+        }
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::binary || value.size != blob.size()
+            || std::vector<uint8_t>(value.bytes, value.bytes + value.size) != blob) {
+            return TestResult{false, "Wrong bin32 value"};
+        }
+        if (!reader.read(value) || value.intValue != 42 || !reader.atEnd()) {
+            return TestResult{false, "Wrong last value"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MessagePack - Long arrays", []() {
+        MessagePack::Writer writer;
+        writer.writeArrayHeader(20);
+        for (int i = 0; i < 20; i++) {
+            writer.writeInt(i);
+        }
+        MessagePack::Reader reader(writer.getData().data(), writer.getData().size());
+        MessagePack::Value value;
+        if (!reader.read(value) || value.type != MessagePack::Value::Type::array || value.size != 20) {
+            return TestResult{false, "Wrong array16 header"};
+        }
+        for (int i = 0; i < 20; i++) {
+            if (!reader.read(value) || value.intValue != i) {
+                return TestResult{false, "Wrong array element"};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MessagePack - Truncated and unsupported data is rejected", []() {
+        MessagePack::Writer writer;
+        writer.writeString("/clip/play");
+        const auto& data = writer.getData();
+        for (size_t size = 0; size < data.size(); size++) {
+            MessagePack::Reader reader(data.data(), size);
+            MessagePack::Value value;
+            if (reader.read(value)) {
+                return TestResult{false, "Truncated string accepted with size " + std::to_string(size)};
+            }
+        }
+        const uint8_t map[] = {0x80};  // fixmap, not supported
+        MessagePack::Reader mapReader(map, sizeof(map));
+        MessagePack::Value value;
+        if (mapReader.read(value)) {
+            return TestResult{false, "Map accepted"};
+        }
+        const uint8_t hugeBinary[] = {0xc6, 0xff, 0xff, 0xff, 0xff, 0x00};
+        MessagePack::Reader binaryReader(hugeBinary, sizeof(hugeBinary));
+        if (binaryReader.read(value)) {
+            return TestResult{false, "Binary longer than the data accepted"};
+        }
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd MessagePack Tests" << std::endl;
+    std::cout << "==========================" << std::endl;
+
+    runMessagePackTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
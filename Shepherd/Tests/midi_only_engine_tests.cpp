@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "MidiOnlyEngine.h"
+#include "test_runner.h"
+
+void runMidiOnlyEngineTests() {
+    TestRunner::run("PeriodJitterStats - Aggregates and resets", []() {
+        PeriodJitterStats stats;
+        stats.addPeriod(1000000, 1000000, 10000);
+        stats.addPeriod(1020000, 1000000, 30000);
+        stats.addPeriod(990000, 1000000, 2500000);  // Woke up more than a period late
+        auto report = stats.getAndReset();
+        if (report.numPeriods != 3 || report.numOverruns != 1) {
+            return TestResult{false, "Wrong number of periods or overruns"};
+        }
+        if (std::abs(report.maxAbsJitterUs - 20.0) > 1e-9 || std::abs(report.meanAbsJitterUs - 10.0) > 1e-9) {
+            return TestResult{false, "Wrong jitter values"};
+        }
+        if (std::abs(report.maxWakeUpLatencyUs - 2500.0) > 1e-9) {
+            return TestResult{false, "Wrong max wake up latency"};
+        }
+        if (stats.getAndReset().numPeriods != 0) {
+            return TestResult{false, "Stats not reset"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MidiOnlyEngine - Slice length matches period", []() {
+        int preparedSamples = 0;
+        double preparedSampleRate = 0.0;
+        MidiOnlyEngine engine([](int) {}, [&](int n, double sr) { preparedSamples = n; preparedSampleRate = sr; });
+        engine.start(1.0, 44100.0, 0);
+        engine.stop();
+        // 1 ms at 44100 Hz is 44.1 samples, rounded to 44 and the sample rate adjusted to keep 1 ms slices
+        if (preparedSamples != 44 || std::abs(preparedSampleRate - 44000.0) > 1e-6) {
+            return TestResult{false, "Unexpected slice size or sample rate: " + std::to_string(preparedSamples) + " " + std::to_string(preparedSampleRate)};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MidiOnlyEngine - Drives slices at the configured period", []() {
+        std::atomic<int> numSlices {0};
+        std::atomic<int> numSamples {0};
+        MidiOnlyEngine engine([&](int n) { numSlices++; numSamples += n; }, [](int, double) {});
+        if (!engine.start(1.0, 48000.0, 80)) {
+            return TestResult{false, "Engine did not start"};
+        }
+        auto startTime = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        engine.stop();
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        auto report = engine.jitterStats.getAndReset();
+        std::cout << "(" << numSlices.load() << " slices, " << (engine.isRealtime() ? "SCHED_FIFO" : "normal priority")
+                  << ", mean jitter " << report.meanAbsJitterUs << " us, max jitter " << report.maxAbsJitterUs << " us) ";
+        // Absolute wake up times are used, so the number of slices should match elapsed time even if some wake ups are late
+        if (std::abs(numSlices.load() - elapsedMs) > 0.1 * elapsedMs) {
+            return TestResult{false, "Number of slices does not match elapsed time: " + std::to_string(numSlices.load())};
+        }
+        if (numSamples.load() != numSlices.load() * 48) {
+            return TestResult{false, "Wrong number of samples per slice"};
+        }
+        if (report.numPeriods != numSlices.load()) {
+            return TestResult{false, "Jitter stats not updated for every period"};
+        }
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd MIDI-only Engine Tests" << std::endl;
+    std::cout << "===============================" << std::endl;
+
+    runMidiOnlyEngineTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include "MidiOutputTimeBase.h"
+#include "test_runner.h"
+
+// Idealised model of an output port: a message goes out at the requested time, or at the time it was sent if the
+// requested time is already in the past (as documented for JUCE's MidiOutput::sendBlockOfMessages and
+// sendBlockOfMessagesNow). All times are in milliseconds. NOTE: this only models the port, so the simulations below
+// check the times computed with MidiOutputTimeBase, not the jitter of real MIDI output (see juce_test_midi_loopback.cpp)
+class ModelOutputPort {
+public:
+    void send(double timeNowMs, double requestedTimeMs) {
+        outputTimesMs.push_back(std::max(timeNowMs, requestedTimeMs) + transportDelayMs);
+    }
+
+    // Max absolute deviation of the intervals between output messages with respect to the expected interval
+    double maxIntervalDeviationMs(double expectedIntervalMs) const {
+        double maxDeviation = 0.0;
+        for (size_t i = 1; i < outputTimesMs.size(); i++) {
+            double interval = outputTimesMs[i] - outputTimesMs[i - 1];
+            maxDeviation = std::max(maxDeviation, std::abs(interval - expectedIntervalMs));
+        }
+        return maxDeviation;
+    }
+
+    std::vector<double> outputTimesMs;
+    double transportDelayMs = 0.32;  // Fixed delay of a MIDI message at 31250 bauds
+};
+
+// Simulates an audio device calling the sequencer with blocks of samples. Callbacks arrive with random jitter
+// and the audio clock can run slightly faster/slower than the system clock. MIDI clock messages (24 ppq) are
+// rendered at their sample positions in the block and sent to the model port either immediately or scheduled
+struct AudioCallbackSimulation {
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+    double bpm = 120.0;
+    double callbackJitterMs = 3.0;
+    double audioClockRatio = 1.0;  // > 1.0 means audio clock runs faster than the system clock
+    double latencyMs = 15.0;
+    int numBlocks = 2000;
+    int xrunAtBlock = -1;  // Simulate a long gap between two callbacks
+
+    double minSchedulingMarginMs = 1000.0;  // Min difference between the scheduled time and the time the message is sent
+
+    void run(ModelOutputPort& port, bool scheduled) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> jitter(0.0, callbackJitterMs);
+        MidiOutputTimeBase timeBase;
+        timeBase.prepare(sampleRate);
+
+        double samplesPerClock = sampleRate * 60.0 / bpm / 24.0;
+        double nextClockSample = 0.0;
+        double sliceStartSample = 0.0;
+        double gapMs = 0.0;
+        for (int block = 0; block < numBlocks; block++) {
+            if (block == xrunAtBlock) {
+                gapMs += 200.0;
+            }
+            double idealCallbackTimeMs = 1000.0 + gapMs + sliceStartSample * 1000.0 / (sampleRate * audioClockRatio);
+            double callbackTimeMs = idealCallbackTimeMs + jitter(rng);
+            timeBase.processSlice(callbackTimeMs, blockSize);
+
+            while (nextClockSample < sliceStartSample + blockSize) {
+                int samplePosition = (int)std::round(nextClockSample - sliceStartSample);
+                if (scheduled) {
+                    double requestedTimeMs = timeBase.getTimeForSamplePosition(samplePosition) + latencyMs;
+                    minSchedulingMarginMs = std::min(minSchedulingMarginMs, requestedTimeMs - callbackTimeMs);
+                    port.send(callbackTimeMs, requestedTimeMs);
+                } else {
+                    port.send(callbackTimeMs, callbackTimeMs);
+                }
+                nextClockSample += samplesPerClock;
+            }
+            sliceStartSample += blockSize;
+        }
+    }
+
+    double expectedClockIntervalMs() const {
+        return 60.0 * 1000.0 / bpm / 24.0 / audioClockRatio;
+    }
+};
+
+void runMidiOutputTimeBaseTests() {
+    TestRunner::run("MidiOutputTimeBase - Sample positions to absolute times", []() {
+        MidiOutputTimeBase timeBase;
+        timeBase.prepare(48000.0);
+        double start = timeBase.processSlice(1000.0, 480);
+        if (std::abs(start - 1000.0) > 1e-9) {
+            return TestResult{false, "First slice should be anchored at the callback time"};
+        }
+        if (std::abs(timeBase.getTimeForSamplePosition(240) - 1005.0) > 1e-9) {
+            return TestResult{false, "Sample position not converted to the correct time"};
+        }
+        // Next callback arrives late, but slice start time should follow the sample count
+        double next = timeBase.processSlice(1012.0, 480);
+        if (std::abs(next - 1010.0) > 0.1) {
+            return TestResult{false, "Slice start time should be computed from the number of rendered samples"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MidiOutputTimeBase - Re-anchors after xrun", []() {
+        MidiOutputTimeBase timeBase;
+        timeBase.prepare(48000.0);
+        timeBase.processSlice(1000.0, 480);
+        timeBase.processSlice(1010.0, 480);
+        double afterGap = timeBase.processSlice(1500.0, 480);
+        if (std::abs(afterGap - 1500.0) > 1e-9) {
+            return TestResult{false, "Time base should re-anchor when callback time diverges"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("Simulated MIDI clock - Immediate output follows callback times", []() {
+        AudioCallbackSimulation simulation;
+        ModelOutputPort port;
+        simulation.run(port, false);
+        double deviationMs = port.maxIntervalDeviationMs(simulation.expectedClockIntervalMs());
+        std::cout << "(max interval deviation " << deviationMs << " ms) ";
+        // Without scheduling, messages are spread by the block size (~10.7 ms)
+        if (deviationMs < 5.0) {
+            return TestResult{false, "Expected immediate output intervals to deviate in the order of the block size"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("Simulated MIDI clock - Scheduled times evenly spaced", []() {
+        AudioCallbackSimulation simulation;
+        ModelOutputPort port;
+        simulation.run(port, true);
+        double deviationMs = port.maxIntervalDeviationMs(simulation.expectedClockIntervalMs());
+        std::cout << "(max interval deviation " << deviationMs << " ms) ";
+        if (deviationMs > 0.1) {
+            return TestResult{false, "Scheduled times not evenly spaced: " + std::to_string(deviationMs) + " ms"};
+        }
+        if (simulation.minSchedulingMarginMs <= 0.0) {
+            return TestResult{false, "Some messages were scheduled in the past"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("Simulated MIDI clock - Scheduled times follow clock drift", []() {
+        AudioCallbackSimulation simulation;
+        simulation.audioClockRatio = 1.0005;  // 500 ppm
+        simulation.numBlocks = 20000;
+        ModelOutputPort port;
+        simulation.run(port, true);
+        double deviationMs = port.maxIntervalDeviationMs(simulation.expectedClockIntervalMs());
+        std::cout << "(max interval deviation " << deviationMs << " ms) ";
+        if (deviationMs > 0.1) {
+            return TestResult{false, "Scheduled times not evenly spaced with clock drift: " + std::to_string(deviationMs) + " ms"};
+        }
+        if (simulation.minSchedulingMarginMs <= 0.0) {
+            return TestResult{false, "Time base did not follow clock drift and messages were scheduled in the past"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("Simulated MIDI clock - Scheduled times recover from xrun", []() {
+        AudioCallbackSimulation simulation;
+        simulation.xrunAtBlock = 1000;
+        ModelOutputPort port;
+        simulation.run(port, true);
+        if (simulation.minSchedulingMarginMs <= 0.0) {
+            return TestResult{false, "Messages were scheduled in the past after xrun"};
+        }
+        // Check interval deviation after the xrun
+        ModelOutputPort afterXrun;
+        size_t firstAfterXrun = port.outputTimesMs.size() / 2 + 5;
+        afterXrun.outputTimesMs.assign(port.outputTimesMs.begin() + firstAfterXrun, port.outputTimesMs.end());
+        double deviationMs = afterXrun.maxIntervalDeviationMs(simulation.expectedClockIntervalMs());
+        if (deviationMs > 0.1) {
+            return TestResult{false, "Scheduled times not evenly spaced after xrun: " + std::to_string(deviationMs) + " ms"};
+        }
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd MIDI Output Time Base Tests" << std::endl;
+    std::cout << "====================================" << std::endl;
+
+    runMidiOutputTimeBaseTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "MpscFifo.h"
+#include "test_runner.h"
+
+struct TestCommand {
+    int producer = -1;
+    int sequence = -1;
+    double payload = 0.0;
+};
+
+void runMpscFifoTests() {
+    TestRunner::run("MpscFifo - Push and pull in order", []() {
+        MpscFifo<TestCommand, 8> fifo;
+        for (int i = 0; i < 8; i++) {
+            if (!fifo.push(TestCommand{0, i, i * 0.5})) {
+                return TestResult{false, "Push failed before FIFO was full"};
+            }
+        }
+        if (fifo.push(TestCommand{0, 8, 0.0})) {
+            return TestResult{false, "Push succeeded with a full FIFO"};
+        }
+        TestCommand command;
+        for (int i = 0; i < 8; i++) {
+            if (!fifo.pull(command) || command.sequence != i || command.payload != i * 0.5) {
+                return TestResult{false, "Wrong element pulled at position " + std::to_string(i)};
+            }
+        }
+        if (fifo.pull(command)) {
+            return TestResult{false, "Pull succeeded with an empty FIFO"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MpscFifo - Wraps around", []() {
+        MpscFifo<TestCommand, 4> fifo;
+        TestCommand command;
+        for (int i = 0; i < 1000; i++) {
+            if (!fifo.push(TestCommand{0, i, 0.0}) || !fifo.push(TestCommand{0, i + 1, 0.0})) {
+                return TestResult{false, "Push failed"};
+            }
+            if (!fifo.pull(command) || command.sequence != i || !fifo.pull(command) || command.sequence != i + 1) {
+                return TestResult{false, "Wrong element after wrapping around"};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("MpscFifo - Multiple producers, single consumer", []() {
+        const int numProducers = 4;
+        const int numCommandsPerProducer = 100000;
+        MpscFifo<TestCommand, 64> fifo;
+        std::vector<std::thread> producers;
+        for (int p = 0; p < numProducers; p++) {
+            producers.emplace_back([&fifo, p]() {
+                for (int i = 0; i < numCommandsPerProducer; i++) {
+                    while (!fifo.push(TestCommand{p, i, 0.0})) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        std::vector<int> nextExpected(numProducers, 0);
+        int numPulled = 0;
+        bool orderOk = true;
+        TestCommand command;
+        while (numPulled < numProducers * numCommandsPerProducer) {
+            if (fifo.pull(command)) {
+                // Commands from the same producer must be received in order
+                if (command.sequence != nextExpected[(size_t)command.producer]) {
+                    orderOk = false;
+                }
+                nextExpected[(size_t)command.producer] = command.sequence + 1;
+                numPulled++;
+            }
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        if (!orderOk) {
+            return TestResult{false, "Commands of a producer received out of order"};
+        }
+        if (fifo.pull(command)) {
+            return TestResult{false, "Unexpected extra command"};
+        }
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd MPSC FIFO Tests" << std::endl;
+    std::cout << "========================" << std::endl;
+
+    runMpscFifoTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
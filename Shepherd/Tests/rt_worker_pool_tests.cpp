@@ -0,0 +1,112 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "RTWorkerPool.h"
+#include "test_runner.h"
+
+// Synthetic per-track work used in the benchmark (roughly the cost of rendering a track with a few busy clips)
+static float renderSyntheticTrack(int trackIndex, int amountOfWork) {
+    float acc = (float)trackIndex;
+    for (int i = 0; i < amountOfWork; i++) {
+        acc = std::sin(acc + (float)i * 0.001f);
+    }
+    return acc;
+}
+
+void runRTWorkerPoolTests() {
+    TestRunner::run("RTWorkerPool - Every task runs exactly once", []() {
+        RTWorkerPool pool;
+        pool.start(3, 0);
+        std::vector<std::atomic<int>> counts(16);
+        for (auto& c : counts) c = 0;
+        auto task = [&](int i) { counts[(size_t)i]++; };
+        for (int batch = 0; batch < 1000; batch++) {
+            pool.parallelFor((int)counts.size(), task);
+        }
+        pool.stop();
+        for (size_t i = 0; i < counts.size(); i++) {
+            if (counts[i].load() != 1000) {
+                return TestResult{false, "Task " + std::to_string(i) + " ran " + std::to_string(counts[i].load()) + " times"};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("RTWorkerPool - Batches of different sizes", []() {
+        RTWorkerPool pool(100);  // Few spin iterations so that workers also go through the futex wait path
+        pool.start(2, 0);
+        std::atomic<int> total {0};
+        int expected = 0;
+        auto task = [&](int i) { total += i + 1; };
+        for (int batch = 0; batch < 500; batch++) {
+            int numTasks = batch % 9;
+            pool.parallelFor(numTasks, task);
+            expected += numTasks * (numTasks + 1) / 2;
+            if (batch % 50 == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        pool.stop();
+        if (total.load() != expected) {
+            return TestResult{false, "Wrong sum: " + std::to_string(total.load()) + " != " + std::to_string(expected)};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("RTWorkerPool - Results independent of number of workers", []() {
+        const int numTracks = 12;
+        std::vector<float> reference(numTracks);
+        for (int t = 0; t < numTracks; t++) reference[(size_t)t] = renderSyntheticTrack(t, 1000);
+        for (int numWorkers = 0; numWorkers <= 3; numWorkers++) {
+            RTWorkerPool pool;
+            pool.start(numWorkers, 0);
+            std::vector<float> results(numTracks, 0.0f);
+            auto task = [&](int i) { results[(size_t)i] = renderSyntheticTrack(i, 1000); };
+            pool.parallelFor(numTracks, task);
+            pool.stop();
+            if (results != reference) {
+                return TestResult{false, "Results differ with " + std::to_string(numWorkers) + " workers"};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("RTWorkerPool - Benchmark (slices of 8/16 tracks)", []() {
+        // Not a pass/fail test, it prints the average time per slice for different numbers of workers
+        // (speedups are only expected up to the number of cores minus one workers)
+        const int numSlices = 2000;
+        std::cout << "(" << std::thread::hardware_concurrency() << " cores)" << std::endl;
+        for (int numTracks : {8, 16}) {
+            for (int numWorkers = 0; numWorkers <= 3; numWorkers++) {
+                RTWorkerPool pool;
+                pool.start(numWorkers, 0);
+                std::vector<float> results((size_t)numTracks);
+                auto task = [&](int i) { results[(size_t)i] = renderSyntheticTrack(i, 2000); };
+                auto startTime = std::chrono::steady_clock::now();
+                for (int s = 0; s < numSlices; s++) {
+                    pool.parallelFor(numTracks, task);
+                }
+                double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+                pool.stop();
+                std::cout << "    " << numTracks << " tracks, " << numWorkers << " workers: " << elapsedUs / numSlices << " us per slice" << std::endl;
+            }
+        }
+        std::cout << "    ";
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd RT Worker Pool Tests" << std::endl;
+    std::cout << "=============================" << std::endl;
+
+    runRTWorkerPoolTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
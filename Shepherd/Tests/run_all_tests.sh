@@ -55,6 +55,14 @@ make -f minimal_juce_makefile test
 JUCE_RESULT=$?
 echo
 
+# Run the tests of the standard library only headers (MIDI output time base, MIDI-only engine, RT worker pool,
+# MPSC FIFO, controller actions, MessagePack, connection send queue, sequence JSON parser and clip overview)
+echo "8. Standard Library Only Tests"
+echo "------------------------------"
+make test_std_only
+STD_ONLY_RESULT=$?
+echo
+
 # Summary
 echo "Test Summary"
 echo "============"
@@ -100,8 +108,14 @@ else
     echo "❌ Minimal JUCE-like Tests: FAILED"
 fi
 
+if [ $STD_ONLY_RESULT -eq 0 ]; then
+    echo "✅ Standard Library Only Tests: PASSED"
+else
+    echo "❌ Standard Library Only Tests: FAILED"
+fi
+
 # Overall result
-TOTAL_FAILURES=$((SIMPLE_RESULT + MOCK_RESULT + INTEGRATION_RESULT + COMPONENT_RESULT + TRANSPORT_RESULT + CONFIG_RESULT + JUCE_RESULT))
+TOTAL_FAILURES=$((SIMPLE_RESULT + MOCK_RESULT + INTEGRATION_RESULT + COMPONENT_RESULT + TRANSPORT_RESULT + CONFIG_RESULT + JUCE_RESULT + STD_ONLY_RESULT))
 if [ $TOTAL_FAILURES -eq 0 ]; then
     echo
     echo "🎉 All tests passed!"
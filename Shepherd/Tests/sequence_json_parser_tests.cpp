@@ -0,0 +1,272 @@
+#include <iostream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include "SequenceJsonParser.h"
+#include "test_runner.h"
+
+// Minimal DOM JSON parser used as a stand-in for juce::JSON::parse in the benchmark: the whole payload is parsed into
+// a tree of dynamically allocated values (objects as maps) which is then walked with string-keyed lookups, as the
+// Sequencer did before using SequenceJsonParser
+struct DomValue {
+    enum class Type { null, number, string, array, object } type = Type::null;
+    double number = 0.0;
+    std::string string;
+    std::vector<DomValue> array;
+    std::map<std::string, DomValue> object;
+
+    const DomValue& operator[](const std::string& key) const {
+        static const DomValue nullValue;
+        auto it = object.find(key);
+        return it != object.end() ? it->second : nullValue;
+    }
+    double toNumber() const { return type == Type::number ? number : (type == Type::string ? std::strtod(string.c_str(), nullptr) : 0.0); }
+};
+
+class DomParser {
+public:
+    explicit DomParser(const std::string& _json) : json(_json) {}
+
+    bool parse(DomValue& value) {
+        skipWhitespace();
+        if (pos >= json.size()) { return false; }
+        char c = json[pos];
+        if (c == '{') {
+            pos++;
+            value.type = DomValue::Type::object;
+            skipWhitespace();
+            if (json[pos] == '}') { pos++; return true; }
+            while (true) {
+                DomValue key;
+                skipWhitespace();
+                if (!parse(key) || key.type != DomValue::Type::string) { return false; }
+                skipWhitespace();
+                if (json[pos++] != ':') { return false; }
+                if (!parse(value.object[key.string])) { return false; }
+                skipWhitespace();
+                if (json[pos] == ',') { pos++; continue; }
+                if (json[pos] == '}') { pos++; return true; }
+                return false;
+            }
+        } else if (c == '[') {
+            pos++;
+            value.type = DomValue::Type::array;
+            skipWhitespace();
+            if (json[pos] == ']') { pos++; return true; }
+            while (true) {
+                value.array.emplace_back();
+                if (!parse(value.array.back())) { return false; }
+                skipWhitespace();
+                if (json[pos] == ',') { pos++; continue; }
+                if (json[pos] == ']') { pos++; return true; }
+                return false;
+            }
+        } else if (c == '"') {
+            pos++;
+            value.type = DomValue::Type::string;
+            while (pos < json.size() && json[pos] != '"') { value.string += json[pos++]; }
+            pos++;
+            return true;
+        }
+        value.type = DomValue::Type::number;
+        char* end;
+        value.number = std::strtod(json.c_str() + pos, &end);
+        pos = (size_t)(end - json.c_str());
+        return true;
+    }
+
+private:
+    void skipWhitespace() { while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\n')) { pos++; } }
+    const std::string& json;
+    size_t pos = 0;
+};
+
+std::string createSetSequencePayload(int numEvents) {
+    std::string json = "{\"clipLength\": 64, \"sequenceEvents\": [";
+    char buffer[256];
+    for (int i = 0; i < numEvents; i++) {
+        if (i % 10 == 9) {
+            std::snprintf(buffer, sizeof(buffer), "{\"type\": 0, \"eventMidiBytes\": \"176,%d,%d\", \"timestamp\": %.3f}", i % 128, (i * 7) % 128, i * 0.0064);
+        } else {
+            std::snprintf(buffer, sizeof(buffer), "{\"type\": 1, \"midiNote\": %d, \"midiVelocity\": %.3f, \"timestamp\": %.3f, \"duration\": %.3f}", 36 + i % 48, 0.5 + (i % 50) / 100.0, i * 0.0064, 0.25);
+        }
+        if (i > 0) { json += ", "; }
+        json += buffer;
+    }
+    json += "]}";
+    return json;
+}
+
+void runSequenceJsonParserTests() {
+    TestRunner::run("SequenceJsonParser - setSequence payload", []() {
+        SequenceJsonParser::SetSequence output;
+        std::string json = R"({
+            "clipLength": 6,
+            "sequenceEvents": [
+                {"type": 1, "midiNote": 79, "midiVelocity": 1.0, "timestamp": 0.29, "duration": 0.65},
+                {"type": 0, "eventMidiBytes": "73,21,56", "timestamp": 2.99}
+            ]
+        })";
+        if (!SequenceJsonParser::parseSetSequence(json, output)) {
+            return TestResult{false, "Valid payload rejected"};
+        }
+        if (output.clipLength != 6.0 || output.sequenceEvents.size() != 2) {
+            return TestResult{false, "Wrong clip length or number of events"};
+        }
+        const auto& note = output.sequenceEvents[0];
+        if (note.type != 1 || note.midiNote != 79 || note.midiVelocity != 1.0f || note.timestamp != 0.29 || note.duration != 0.65) {
+            return TestResult{false, "Wrong note event"};
+        }
+        const auto& midi = output.sequenceEvents[1];
+        if (midi.type != 0 || midi.eventMidiBytes != "73,21,56" || midi.timestamp != 2.99 || midi.has(SequenceJsonParser::Event::durationField)) {
+            return TestResult{false, "Wrong MIDI event"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("SequenceJsonParser - editSequence payload only sets present fields", []() {
+        using Event = SequenceJsonParser::Event;
+        SequenceJsonParser::EditSequence output;
+        std::string json = R"({"action": "editEvent", "eventHandle": 123, "eventData": {"midiNote": 60, "chance": 0.5}})";
+        if (!SequenceJsonParser::parseEditSequence(json, output)) {
+            return TestResult{false, "Valid payload rejected"};
+        }
+        if (output.action != "editEvent" || !output.hasEventHandle || output.eventHandle != 123 || !output.eventUUID.empty()) {
+            return TestResult{false, "Wrong action or event reference"};
+        }
+        const auto& eventData = output.eventData;
+        if (!eventData.has(Event::midiNoteField) || !eventData.has(Event::chanceField) || eventData.midiNote != 60 || eventData.chance != 0.5f) {
+            return TestResult{false, "Present fields not set"};
+        }
+        if (eventData.has(Event::timestampField) || eventData.has(Event::durationField) || eventData.has(Event::typeField)) {
+            return TestResult{false, "Missing fields reported as present"};
+        }
+
+        json = R"({"action": "removeEvent", "eventUUID": "356cbbdjgf"})";
+        if (!SequenceJsonParser::parseEditSequence(json, output) || output.eventUUID != "356cbbdjgf" || output.hasEventHandle) {
+            return TestResult{false, "Wrong event UUID"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("SequenceJsonParser - Values converted like juce::var", []() {
+        SequenceJsonParser::SetSequence output;
+        std::string json = R"({"clipLength": "8.5", "sequenceEvents": [
+            {"type": 1, "midiNote": 60.7, "midiVelocity": true, "timestamp": null, "duration": -1e-1},
+            {"type": 0, "eventMidiBytes": 144, "timestamp": 1}
+        ]})";
+        if (!SequenceJsonParser::parseSetSequence(json, output) || output.sequenceEvents.size() != 2) {
+            return TestResult{false, "Valid payload rejected"};
+        }
+        const auto& note = output.sequenceEvents[0];
+        if (output.clipLength != 8.5 || note.midiNote != 60 || note.midiVelocity != 1.0f || note.timestamp != 0.0 || std::abs(note.duration + 0.1) > 1e-12) {
+            return TestResult{false, "Wrong conversion of numbers"};
+        }
+        if (output.sequenceEvents[1].eventMidiBytes != "144") {
+            return TestResult{false, "Number not converted to string"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("SequenceJsonParser - Unknown keys skipped and escapes decoded", []() {
+        SequenceJsonParser::EditSequence output;
+        std::string json = R"({"extra": {"nested": [1, {"a": "b\"]}"}, null, true]}, "action": "add\u0045vent",
+            "eventUUID": "a\\b\/c\u00e9\ud83c\udfb9", "eventData": {"type": 1, "unknown": [[]], "timestamp": 4}})";
+        if (!SequenceJsonParser::parseEditSequence(json, output)) {
+            return TestResult{false, "Valid payload rejected"};
+        }
+        if (output.action != "addEvent" || output.eventUUID != "a\\b/c\xc3\xa9\xf0\x9f\x8e\xb9") {
+            return TestResult{false, "Wrong decoding of escapes: " + output.eventUUID};
+        }
+        if (output.eventData.type != 1 || output.eventData.timestamp != 4.0) {
+            return TestResult{false, "Fields after unknown keys not parsed"};
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("SequenceJsonParser - Malformed payloads rejected", []() {
+        const std::vector<std::string> payloads = {
+            "", "{", "[]", "{\"clipLength\": }", "{\"clipLength\": 1,}", "{\"sequenceEvents\": [{\"type\": 1}",
+            "{\"sequenceEvents\": [{\"type\" 1}]}", "{\"clipLength\": \"unterminated}", "{\"clipLength\": 1} trailing",
+            "{\"a\": \"\\x\"}", "{\"a\": \"\\u12\"}", "{\"a\": \"\\ud800\\u0041\"}"
+        };
+        for (const auto& payload : payloads) {
+            SequenceJsonParser::SetSequence output;
+            if (SequenceJsonParser::parseSetSequence(payload, output)) {
+                return TestResult{false, "Malformed payload accepted: " + payload};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("SequenceJsonParser - Large payload matches DOM parsing", []() {
+        std::string json = createSetSequencePayload(10000);
+        SequenceJsonParser::SetSequence output;
+        DomValue dom;
+        if (!SequenceJsonParser::parseSetSequence(json, output) || !DomParser(json).parse(dom)) {
+            return TestResult{false, "Payload rejected"};
+        }
+        const auto& domEvents = dom["sequenceEvents"].array;
+        if (output.sequenceEvents.size() != 10000 || domEvents.size() != 10000) {
+            return TestResult{false, "Wrong number of events"};
+        }
+        for (size_t i = 0; i < domEvents.size(); i++) {
+            const auto& event = output.sequenceEvents[i];
+            if (event.type != (int)domEvents[i]["type"].toNumber() || event.timestamp != domEvents[i]["timestamp"].toNumber()
+                || event.midiNote != (int)domEvents[i]["midiNote"].toNumber() || event.eventMidiBytes != domEvents[i]["eventMidiBytes"].string) {
+                return TestResult{false, "Event " + std::to_string(i) + " differs"};
+            }
+        }
+        return TestResult{true, ""};
+    });
+
+    TestRunner::run("SequenceJsonParser - Benchmark (10k events payload)", []() {
+        // Not a pass/fail test, it prints the time to decode a 10k events setSequence payload with the streaming
+        // parser and with a DOM parser followed by string-keyed lookups
+        std::string json = createSetSequencePayload(10000);
+        const int numIterations = 50;
+        double checksum = 0.0;
+
+        auto startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numIterations; i++) {
+            SequenceJsonParser::SetSequence output;
+            SequenceJsonParser::parseSetSequence(json, output);
+            for (const auto& event : output.sequenceEvents) {
+                checksum += event.timestamp + event.midiNote + event.midiVelocity + event.duration + (double)event.eventMidiBytes.size();
+            }
+        }
+        double streamingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() / numIterations;
+
+        startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < numIterations; i++) {
+            DomValue dom;
+            DomParser(json).parse(dom);
+            for (const auto& eventData : dom["sequenceEvents"].array) {
+                checksum += eventData["timestamp"].toNumber() + (int)eventData["midiNote"].toNumber() + (float)eventData["midiVelocity"].toNumber()
+                    + eventData["duration"].toNumber() + (double)eventData["eventMidiBytes"].string.size();
+            }
+        }
+        double domMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() / numIterations;
+
+        std::cout << "(" << json.size() / 1024 << " KB, checksum " << checksum << ")" << std::endl;
+        std::cout << "    streaming parser: " << streamingMs << " ms per payload" << std::endl;
+        std::cout << "    DOM + lookups: " << domMs << " ms per payload" << std::endl;
+        std::cout << "    ";
+        return TestResult{true, ""};
+    });
+}
+
+int main() {
+    std::cout << "Shepherd Sequence JSON Parser Tests" << std::endl;
+    std::cout << "===================================" << std::endl;
+
+    runSequenceJsonParserTests();
+
+    TestRunner::printSummary();
+    return TestRunner::getFailCount() > 0 ? 1 : 0;
+}
@@ -13,6 +13,21 @@ MidiInputDeviceData* mockMidiInputDeviceData(juce::String deviceName) {
     return nullptr; // For basic tests, we don't need actual MIDI devices
 }
 
+// Runs the message loop so that the timer of the devices (which re-creates the config snapshots) is called
+static void runDeviceTimers(int milliseconds = 120) {
+    juce::MessageManager::getInstance()->runDispatchLoopUntil(milliseconds);
+}
+
+static juce::ValueTree createInputDeviceState(const juce::String& uuid) {
+    juce::ValueTree state(ShepherdIDs::HARDWARE_DEVICE);
+    state.setProperty(ShepherdIDs::uuid, uuid, nullptr);
+    state.setProperty(ShepherdIDs::type, (int)HardwareDeviceType::input, nullptr);
+    state.setProperty(ShepherdIDs::name, "Snapshot Input Device", nullptr);
+    state.setProperty(ShepherdIDs::midiInputDeviceName, "Mock MIDI In", nullptr);
+    state.setProperty(ShepherdIDs::allowedMidiInputChannel, 3, nullptr);
+    return state;
+}
+
 void runHardwareDeviceTests() {
     TestRunner::run("HardwareDevice - Output Device Creation", []() {
         juce::ValueTree state(ShepherdIDs::HARDWARE_DEVICE);
@@ -115,4 +130,110 @@ void runHardwareDeviceTests() {
         
         return TestResult{true, ""};
     });
+    
+    TestRunner::run("HardwareDevice - RT Config Snapshot", []() {
+        juce::ValueTree state(ShepherdIDs::HARDWARE_DEVICE);
+        state.setProperty(ShepherdIDs::uuid, "snapshot-device-1", nullptr);
+        state.setProperty(ShepherdIDs::type, (int)HardwareDeviceType::input, nullptr);
+        state.setProperty(ShepherdIDs::name, "Snapshot Input Device", nullptr);
+        state.setProperty(ShepherdIDs::midiInputDeviceName, "Mock MIDI In", nullptr);
+        state.setProperty(ShepherdIDs::allowedMidiInputChannel, 3, nullptr);
+        state.setProperty(ShepherdIDs::allowPitchBendMessages, false, nullptr);
+        
+        HardwareDevice device(state, mockMidiOutputDeviceData, mockMidiInputDeviceData);
+        const auto& config = device.getRTConfig();
+        
+        if (!config.isTypeInput()) {
+            return TestResult{false, "Config snapshot should be input type"};
+        }
+        if (config.midiInputDeviceName != "Mock MIDI In") {
+            return TestResult{false, "Config snapshot MIDI input device name not set correctly"};
+        }
+        if (config.allowedMidiInputChannel != 3 || config.allowPitchBendMessages) {
+            return TestResult{false, "Config snapshot input filters not set correctly"};
+        }
+        if (config.notesMapping[60] != 60 || config.controlChangeMapping[10] != 10) {
+            return TestResult{false, "Config snapshot mappings should default to identity"};
+        }
+        
+        // Changes in the state are only visible to the RT thread once a new snapshot has been pulled
+        state.setProperty(ShepherdIDs::allowedMidiInputChannel, 5, nullptr);
+        device.prepareSlice();
+        if (device.getRTConfig().allowedMidiInputChannel != 3) {
+            return TestResult{false, "Config snapshot should not change before being re-created"};
+        }
+        return TestResult{true, ""};
+    });
+    
+    TestRunner::run("HardwareDevice - Config Snapshot Is Re-created By The Timer", []() {
+        auto state = createInputDeviceState("snapshot-device-2");
+        HardwareDevice device(state, mockMidiOutputDeviceData, mockMidiInputDeviceData);
+        
+        // A property change flags the snapshot for re-creation, the timer pushes the new snapshot to the fifo and
+        // prepareSlice pulls it
+        state.setProperty(ShepherdIDs::allowedMidiInputChannel, 5, nullptr);
+        runDeviceTimers();
+        if (device.getRTConfig().allowedMidiInputChannel != 3) {
+            return TestResult{false, "Config snapshot should only change when prepareSlice is called"};
+        }
+        device.prepareSlice();
+        if (device.getRTConfig().allowedMidiInputChannel != 5) {
+            return TestResult{false, "Config snapshot should have been re-created after the property change"};
+        }
+        
+        // Several changes between timer callbacks result in a single snapshot with the latest values
+        state.setProperty(ShepherdIDs::allowedMidiInputChannel, 6, nullptr);
+        state.setProperty(ShepherdIDs::allowNoteMessages, false, nullptr);
+        runDeviceTimers();
+        device.prepareSlice();
+        if (device.getRTConfig().allowedMidiInputChannel != 6 || device.getRTConfig().allowNoteMessages) {
+            return TestResult{false, "Config snapshot should have the latest values"};
+        }
+        return TestResult{true, ""};
+    });
+    
+    TestRunner::run("HardwareDevice - CC Values Do Not Re-create The Config Snapshot", []() {
+        juce::ValueTree state(ShepherdIDs::HARDWARE_DEVICE);
+        state.setProperty(ShepherdIDs::uuid, "snapshot-device-3", nullptr);
+        state.setProperty(ShepherdIDs::type, (int)HardwareDeviceType::output, nullptr);
+        state.setProperty(ShepherdIDs::name, "Snapshot Output Device", nullptr);
+        HardwareDevice device(state, mockMidiOutputDeviceData, mockMidiInputDeviceData);
+        const auto* initialConfig = &device.getRTConfig();
+        
+        // CC values are published to the state by the timer, but they are not part of the config snapshot
+        device.setMidiCCParameterValue(7, 100);
+        runDeviceTimers();
+        auto publishedValues = ShepherdHelpers::deserialize128IntArray(state.getProperty(ShepherdIDs::midiCCParameterValuesList).toString());
+        if (publishedValues[7] != 100) {
+            return TestResult{false, "CC value should have been published to the state"};
+        }
+        runDeviceTimers();
+        device.prepareSlice();
+        if (&device.getRTConfig() != initialConfig) {
+            return TestResult{false, "Publishing CC values should not re-create the config snapshot"};
+        }
+        return TestResult{true, ""};
+    });
+    
+    TestRunner::run("HardwareDevice - Config Snapshot Is Retried When The Fifo Is Full", []() {
+        auto state = createInputDeviceState("snapshot-device-4");
+        HardwareDevice device(state, mockMidiOutputDeviceData, mockMidiInputDeviceData);
+        
+        // The RT thread does not pull snapshots for a while (e.g. audio device stopped), so the fifo gets full
+        for (int channel = 1; channel <= 30; channel++) {
+            state.setProperty(ShepherdIDs::allowedMidiInputChannel, channel % 16 + 1, nullptr);
+            runDeviceTimers(60);
+        }
+        state.setProperty(ShepherdIDs::allowedMidiInputChannel, 9, nullptr);
+        runDeviceTimers();
+        
+        // Once the RT thread pulls again, the latest config must reach it
+        device.prepareSlice();
+        runDeviceTimers();
+        device.prepareSlice();
+        if (device.getRTConfig().allowedMidiInputChannel != 9) {
+            return TestResult{false, "Latest config should reach the RT thread after the fifo was full, got channel " + juce::String(device.getRTConfig().allowedMidiInputChannel)};
+        }
+        return TestResult{true, ""};
+    });
 }
\ No newline at end of file
@@ -47,6 +47,10 @@ void runMusicalContextTests();
 void runHardwareDeviceTests();
 
 int main() {
+    // Creates the MessageManager, so the thread running the tests is the message thread (the message loop is run by
+    // the tests which need timer callbacks, e.g. the ones re-creating the config snapshots of hardware devices)
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    
     std::cout << "Shepherd Backend Tests" << std::endl;
     std::cout << "======================" << std::endl;
     
@@ -0,0 +1,44 @@
+// Minimal test framework shared by the standard library only tests (the ones built with the std_only_tests rule of
+// the Makefile). Each test returns a TestResult, and main exits with a non-zero status if any of them failed.
+
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <string>
+
+struct TestResult {
+    bool passed = true;
+    std::string message;
+};
+
+class TestRunner {
+public:
+    static void run(const std::string& testName, std::function<TestResult()> test) {
+        std::cout << "Running " << testName << "... ";
+        auto result = test();
+        if (result.passed) {
+            std::cout << "PASS" << std::endl;
+            passCount++;
+        } else {
+            std::cout << "FAIL: " << result.message << std::endl;
+            failCount++;
+        }
+        totalCount++;
+    }
+
+    static void printSummary() {
+        std::cout << "\nTest Summary: " << passCount << "/" << totalCount << " passed";
+        if (failCount > 0) {
+            std::cout << " (" << failCount << " failed)";
+        }
+        std::cout << std::endl;
+    }
+
+    static int getFailCount() { return failCount; }
+
+private:
+    static inline int totalCount = 0;
+    static inline int passCount = 0;
+    static inline int failCount = 0;
+};
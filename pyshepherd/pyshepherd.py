@@ -1,7 +1,9 @@
 from __future__ import annotations
 
 import json
+import math
 import mido
+import time
 
 from bs4 import BeautifulSoup
 from typing import Optional, List
@@ -34,6 +36,7 @@ parameters_data = {
     'eventmidibytes': (str, "_midi_bytes"),
     'fixedlengthrecordingbars': (int, "fixed_length_recording_bars"),
     'fixedvelocity': (bool, "fixed_velocity"),
+    'handle': (int, "handle"),  # Session-scoped integer handle, can be used instead of uuid in messages to backend
     'outputhardwaredevicename': (str, "output_hardware_device_name"),
     'inputmonitoring': (bool, "input_monitoring"),
     'meter': (int, "meter"),
@@ -48,13 +51,16 @@ parameters_data = {
     'name': (str, "name"),
     'notesmapping': (str, "notes_mapping"),
     'notesmonitoringdevicename': (str, "notes_monitoring_device_name"),
-    'playheadpositioninbeats': (float, "playhead_position_in_beats"),
+    'playheadbpm': (float, "playhead_anchor_bpm"),  # 0.0 if playhead is stopped
+    'playheadpositioninbeats': (float, "playhead_anchor_position_in_beats"),  # Use playhead_position_in_beats to get current position
+    'playheadpositiontimems': (int, "playhead_anchor_time_ms"),
     'playing': (bool, "playing"),
     'recordautomationenabled': (bool, "record_automation_enabled"),
     'recording': (bool, "recording"),
     'renderedendtimestamp': (float, "rendered_end_timestamp"),
     'renderedstarttimestamp': (float, "rendered_start_timestamp"),
     'renderwithinternalsynth': (bool, "render_with_internal_synth"),
+    'sequenceoverview': (str, "sequence_overview"),  # Use Clip.overview to get the parsed ClipOverview
     'shortname': (str, "short_name"),
     'timestamp': (float, "timestamp"),
     'type': (int, "type"),  # SequenceEventType {midi=0, note=1} or HardwareDeviceType {input=0, output=1}
@@ -100,6 +106,7 @@ class BaseShepherdClass(object):
 
     _parent = None
     uuid: str
+    handle: int = -1
 
     def __init__(self, soup, shepherd_backend_interface, parent=None):
         # Set parent
@@ -115,6 +122,12 @@ class BaseShepherdClass(object):
     def _send_msg_to_app(self, address, values):
         self.shepherd_backend_interface.send_msg_to_app(address, values)
 
+    @property
+    def _ref(self):
+        # Reference to the object used in messages to the backend: the handle if the backend assigned one, otherwise
+        # the uuid
+        return self.handle if self.handle > -1 else self.uuid
+
     def render_object_attributes(self, num_spaces_offset=0):
         text = ''
         for attr_name in dir(self):
@@ -216,7 +229,29 @@ class State(BaseShepherdClass):
         self._send_msg_to_app('/settings/debugSynthOnOff', [])
 
 
-class Session(BaseShepherdClass):
+class PlayheadAnchorMixin(object):
+    # The backend does not stream playhead positions but publishes anchors (the position at a given time and the bpm
+    # at which it advances) from which the current position is extrapolated. Times are milliseconds since epoch, which
+    # assumes the backend runs on the same machine (or re-anchor with ShepherdBackendInterface.request_playheads)
+
+    playhead_anchor_position_in_beats: float = 0.0
+    playhead_anchor_time_ms: int = 0
+    playhead_anchor_bpm: float = 0.0
+
+    def _set_playhead_anchor(self, position_in_beats, time_ms):
+        self.playhead_anchor_position_in_beats = position_in_beats
+        self.playhead_anchor_time_ms = time_ms
+
+    def _extrapolate_playhead_position(self, loop_length_in_beats=0.0) -> float:
+        position = self.playhead_anchor_position_in_beats
+        if self.playhead_anchor_bpm > 0.0 and self.playhead_anchor_time_ms > 0:
+            position += (time.time() * 1000 - self.playhead_anchor_time_ms) * self.playhead_anchor_bpm / 60000.0
+            if loop_length_in_beats > 0.0:
+                position = math.fmod(position, loop_length_in_beats)
+        return position
+
+
+class Session(PlayheadAnchorMixin, BaseShepherdClass):
     tracks: List[Track] = []
 
     bar_count: int
@@ -236,6 +271,10 @@ class Session(BaseShepherdClass):
     def state(self) -> State:
         return self._parent
 
+    @property
+    def playhead_position_in_beats(self) -> float:
+        return self._extrapolate_playhead_position()
+
     def __init__(self, *args, **kwargs):
         self.tracks = []
         super().__init__(*args, **kwargs)
@@ -341,25 +380,57 @@ class Track(BaseShepherdClass):
         return self.session.state.get_output_hardware_device_by_name(self.output_hardware_device_name)
 
     def set_input_monitoring(self, enabled):
-        self._send_msg_to_app('/track/setInputMonitoring', [self.uuid, 1 if enabled else 0])
+        self._send_msg_to_app('/track/setInputMonitoring', [self._ref, 1 if enabled else 0])
 
     def set_active_ui_notes_monitoring(self):
-        self._send_msg_to_app('/track/setActiveUiNotesMonitoringTrack', [self.uuid])
+        self._send_msg_to_app('/track/setActiveUiNotesMonitoringTrack', [self._ref])
 
     def set_output_hardware_device(self, device_name):
-        self._send_msg_to_app('/track/setOutputHardwareDevice', [self.uuid, device_name])
-
-
-class Clip(BaseShepherdClass):
+        self._send_msg_to_app('/track/setOutputHardwareDevice', [self._ref, device_name])
+
+
+class ClipOverview(object):
+    # Summary of the contents of a clip computed by the backend every time the clip sequence changes (see
+    # Shepherd/Source/common/ClipOverview.h), so that clips can be drawn without going through all their sequence events.
+    # Columns split the clip length in equal parts and rows split the pitch range of the notes of the clip (row 0 has
+    # the lowest note)
+
+    num_columns = 64
+    num_rows = 16
+
+    def __init__(self, serialized_overview):
+        parts = serialized_overview.split(',')
+        self.num_notes = int(parts[0])
+        self.num_midi_events = int(parts[1])
+        self.min_midi_note = int(parts[2])  # -1 if there are no notes
+        self.max_midi_note = int(parts[3])
+        self.rows = [int(parts[4][i * 16:(i + 1) * 16], 16) for i in range(self.num_rows)]
+
+    def is_occupied(self, column, row):
+        return (self.rows[row] >> column) & 1 == 1
+
+    def occupied_column_runs(self, row):
+        # Yields (first_column, last_column) of the consecutive occupied columns of a row, useful for drawing
+        run_start = None
+        for column in range(self.num_columns + 1):
+            occupied = column < self.num_columns and self.is_occupied(column, row)
+            if occupied and run_start is None:
+                run_start = column
+            elif not occupied and run_start is not None:
+                yield run_start, column - 1
+                run_start = None
+
+
+class Clip(PlayheadAnchorMixin, BaseShepherdClass):
     sequence_events: List[SequenceEvent] = []
 
     bpm_multiplier: float
     clip_length_in_beats: float
     current_quantization_step: float
     name: str
-    playhead_position_in_beats: float
     playing: bool
     recording: bool
+    sequence_overview: str = ''
     will_play_at: float
     will_start_recording_at: float
     will_stop_at: float
@@ -370,10 +441,24 @@ class Clip(BaseShepherdClass):
     def track(self) -> Track():
         return self._parent
 
+    @property
+    def playhead_position_in_beats(self) -> float:
+        return self._extrapolate_playhead_position(self.clip_length_in_beats)
+
     def __init__(self, *args, **kwargs):
         self.sequence_events = []
+        self._parsed_overview = (None, None)
         super().__init__(*args, **kwargs)
 
+    @property
+    def overview(self) -> Optional[ClipOverview]:
+        # Parsed lazily and only again when the backend sends a new overview. None until the backend computes one
+        if not self.sequence_overview:
+            return None
+        if self._parsed_overview[0] != self.sequence_overview:
+            self._parsed_overview = (self.sequence_overview, ClipOverview(self.sequence_overview))
+        return self._parsed_overview[1]
+
     def _add_sequence_event(self, sequence_event: SequenceEvent, position=None):
         # Note this method adds a SequenceEvent object in the local Clip object but does not create a sequence event
         # in the backend
@@ -428,34 +513,34 @@ class Clip(BaseShepherdClass):
         return 'E' in self.get_status()
 
     def play_stop(self):
-        self._send_msg_to_app('/clip/playStop', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/playStop', [self.track._ref, self._ref])
 
     def play(self):
-        self._send_msg_to_app('/clip/play', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/play', [self.track._ref, self._ref])
 
     def stop(self):
-        self._send_msg_to_app('/clip/stop', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/stop', [self.track._ref, self._ref])
     
     def record_on_off(self):
-        self._send_msg_to_app('/clip/recordOnOff', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/recordOnOff', [self.track._ref, self._ref])
 
     def clear(self):
-        self._send_msg_to_app('/clip/clear', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/clear', [self.track._ref, self._ref])
 
     def double(self):
-        self._send_msg_to_app('/clip/double', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/double', [self.track._ref, self._ref])
 
     def quantize(self, quantization_step):
-        self._send_msg_to_app('/clip/quantize', [self.track.uuid, self.uuid, quantization_step])
+        self._send_msg_to_app('/clip/quantize', [self.track._ref, self._ref, quantization_step])
 
     def undo(self):
-        self._send_msg_to_app('/clip/undo', [self.track.uuid, self.uuid])
+        self._send_msg_to_app('/clip/undo', [self.track._ref, self._ref])
 
     def set_length(self, new_length):
-        self._send_msg_to_app('/clip/setLength', [self.track.uuid, self.uuid, new_length])
+        self._send_msg_to_app('/clip/setLength', [self.track._ref, self._ref, new_length])
 
     def set_bpm_multiplier(self, new_bpm_multiplier):
-        self._send_msg_to_app('/clip/setBpmMultiplier', [self.track.uuid, self.uuid, new_bpm_multiplier])
+        self._send_msg_to_app('/clip/setBpmMultiplier', [self.track._ref, self._ref, new_bpm_multiplier])
 
     def set_sequence(self, new_sequence):
         """new_sequence must be passed as a dictionary with this form:
@@ -469,7 +554,7 @@ class Clip(BaseShepherdClass):
             ]
         }
         """
-        self._send_msg_to_app("/clip/setSequence", [self.track.uuid, self.uuid, json.dumps(new_sequence)])
+        self._send_msg_to_app("/clip/setSequence", [self.track._ref, self._ref, json.dumps(new_sequence)])
 
     def edit_sequence(self, edit_sequence_data):
         """edit_sequence_data should be a dictionary with this form:
@@ -484,7 +569,18 @@ class Clip(BaseShepherdClass):
         }
         Note that there are more specialized methods that will call "edit_sequence" and will have easier interface
         """
-        self._send_msg_to_app("/clip/editSequence", [self.track.uuid, self.uuid, json.dumps(edit_sequence_data)])
+        self._send_msg_to_app("/clip/editSequence", [self.track._ref, self._ref, json.dumps(edit_sequence_data)])
+
+    def query_events(self, start_beat, end_beat, min_midi_note=0, max_midi_note=127, event_type=None, max_events=None):
+        """Ask the backend for the compiled events of the clip which sound in the [start_beat, end_beat) window
+        (optionally filtered by note range and/or event type). The result is received asynchronously in
+        ShepherdBackendControllerApp.on_clip_events_received, so clip contents can be paged without scanning all the
+        sequence events of the clip. Each event is a dictionary with the same property names as SEQUENCE_EVENT elements
+        """
+        self.shepherd_backend_interface.query_clip_events(self.track._ref, self._ref, start_beat, end_beat,
+                                                          min_midi_note, max_midi_note,
+                                                          event_type if event_type is not None else -1,
+                                                          max_events if max_events is not None else -1)
 
     def remove_sequence_event(self, event_uuid):
         self.edit_sequence({
@@ -613,6 +709,11 @@ class HardwareDevice(BaseShepherdClass):
     _midi_cc_parameter_values_list_used_for_splitting = None
     _midi_cc_parameter_values_list_splitted = []
 
+    @property
+    def _ref(self):
+        # Devices are referenced by name in messages to the backend if they have no handle
+        return self.handle if self.handle > -1 else self.name
+
     def is_type_output(self):
         return self.type == 1
 
@@ -620,13 +721,13 @@ class HardwareDevice(BaseShepherdClass):
         return self.type == 0
 
     def send_midi(self, msg: mido.Message):
-        self._send_msg_to_app('/device/sendMidi', [self.name] + msg.bytes())
+        self._send_msg_to_app('/device/sendMidi', [self._ref] + msg.bytes())
 
     def all_notes_off(self):
-        self._send_msg_to_app('/device/sendAllNotesOff', [self.name])
+        self._send_msg_to_app('/device/sendAllNotesOff', [self._ref])
 
     def load_preset(self, bank, preset):
-        self._send_msg_to_app('/device/loadDevicePreset', [self.name, bank, preset])
+        self._send_msg_to_app('/device/loadDevicePreset', [self._ref, bank, preset])
 
     def get_current_midi_cc_parameter_value(self, midi_cc_num) -> int:
         if self.midi_cc_parameter_values_list != self._midi_cc_parameter_values_list_used_for_splitting:
@@ -635,13 +736,13 @@ class HardwareDevice(BaseShepherdClass):
         return int(self._midi_cc_parameter_values_list_splitted[midi_cc_num])
 
     def set_notes_mapping(self, mapping):
-        self._send_msg_to_app('/device/setNotesMapping', [self.name, ",".join([str(item) for item in mapping])])
+        self._send_msg_to_app('/device/setNotesMapping', [self._ref, ",".join([str(item) for item in mapping])])
 
     def set_control_change_mapping(self, mapping):
-        self._send_msg_to_app('/device/setCCMapping', [self.name, ",".join([str(item) for item in mapping])])
+        self._send_msg_to_app('/device/setCCMapping', [self._ref, ",".join([str(item) for item in mapping])])
     
     def set_midi_channel(self, channel):
-        self._send_msg_to_app('/device/setMidiChannel', [self.name, channel])
+        self._send_msg_to_app('/device/setMidiChannel', [self._ref, channel])
 
 
 class ShepherdBackendInterface(StateSynchronizer):
@@ -804,6 +905,35 @@ class ShepherdBackendInterface(StateSynchronizer):
                               .format(update_data, e))
                     self.should_request_full_state = True
 
+            elif update_type == "replacedChildren":
+                # Bulk edit: all children of the given type are replaced by the children of the attached tree
+                parent_tree_uuid = update_data[0]
+                children_type = update_data[2].lower()
+                try:
+                    parent_tree_element = self.get_element_with_uuid(parent_tree_uuid)
+                    if children_type == 'SEQUENCE_EVENT'.lower() and isinstance(parent_tree_element, Clip):
+                        for sequence_event in parent_tree_element.sequence_events:
+                            self.elements_uuids_map.pop(sequence_event.uuid, None)
+                        parent_tree_element.sequence_events = []
+                        children_soup = BeautifulSoup(update_data[3], "lxml").find("body").find(recursive=False)
+                        for sequence_event_soup in children_soup.findAll("sequence_event", recursive=False):
+                            sequence_event = SequenceEvent(sequence_event_soup, self, parent=parent_tree_element)
+                            parent_tree_element._add_sequence_event(sequence_event)
+                            self._add_element_to_uuid_map(sequence_event)
+                    else:
+                        if self.verbose_level >= 1:
+                            print('WARNING: trying to replace children of a type that can\'t be handled: {}'
+                                  .format(children_type))
+                    app_notification_data = {
+                        'updateType': update_type,
+                        'parentElement': parent_tree_element,
+                    }
+                except KeyError as e:
+                    if self.verbose_level >= 1:
+                        print('WARNING: trying to replace children of parent that does not exist: {} ({})'
+                              .format(update_data, e))
+                    self.should_request_full_state = True
+
             # Notify app that state was updated
             if self.app is not None:
                 self.app.on_state_update_received(app_notification_data)
@@ -828,6 +958,33 @@ class ShepherdBackendInterface(StateSynchronizer):
         if old_session_uuid != self.state.session.uuid:
             self.app.on_new_session_loaded()
 
+    def on_playheads_received(self, backend_time_ms, session_playhead_position, clip_playhead_positions):
+        if self.state is None:
+            return
+        # Re-anchor at local reception time so that differences between backend and local clocks are not relevant
+        now_ms = int(time.time() * 1000)
+        self.state.session._set_playhead_anchor(session_playhead_position, now_ms)
+        for clip_uuid, position in clip_playhead_positions.items():
+            clip = self.elements_uuids_map.get(clip_uuid, None)
+            if clip is not None:
+                clip._set_playhead_anchor(position, now_ms)
+
+    def on_clip_events_received(self, clip_uuid, start_beat, end_beat, truncated, events):
+        clip = self.elements_uuids_map.get(clip_uuid, None)
+        if clip is None or self.app is None:
+            return
+        clip_events = []
+        for event in events:
+            # See Sequencer::sendClipEventsQueryResult for the list of fields
+            clip_event = dict(zip(['uuid', 'handle', 'type', 'renderedStartTimestamp', 'renderedEndTimestamp',
+                                   'timestamp', 'uTime'], event[:7]))
+            if clip_event['type'] == 1:
+                clip_event.update(zip(['midiNote', 'midiVelocity', 'duration', 'chance'], event[7:]))
+            else:
+                clip_event['eventMidiBytes'] = event[7]
+            clip_events.append(clip_event)
+        self.app.on_clip_events_received(clip, start_beat, end_beat, truncated, clip_events)
+
     def build_objects_from_full_state(self, full_state_soup):
         self.elements_uuids_map = {}
 
@@ -869,11 +1026,12 @@ class ShepherdBackendControllerApp(object):
 
     shepherd_interface: ShepherdBackendInterface
 
-    def __init__(self, ws_port=8126, verbose_level=1, debugger_port=None):
+    def __init__(self, ws_port=8126, verbose_level=1, debugger_port=None, use_binary_protocol=False):
         self.shepherd_interface = ShepherdBackendInterface(app=self,
                                                            ws_port=ws_port,
                                                            verbose_level=verbose_level,
-                                                           debugger_port=debugger_port)
+                                                           debugger_port=debugger_port,
+                                                           use_binary_protocol=use_binary_protocol)
 
     @property
     def state(self) -> Optional[State]:
@@ -903,6 +1061,9 @@ class ShepherdBackendControllerApp(object):
     def on_state_update_received(self, update_data):
         pass
 
+    def on_clip_events_received(self, clip, start_beat, end_beat, truncated, events):
+        pass
+
     def on_state_first_synced(self):
         pass
 
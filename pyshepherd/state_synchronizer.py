@@ -1,9 +1,15 @@
 import asyncio
+import base64
+import json
 import ssl
+import struct
 import threading
 import time
 import traceback
 import websocket
+import zlib
+
+from xml.etree import ElementTree
 
 from bs4 import BeautifulSoup
 
@@ -12,6 +18,125 @@ state_request_hz = 10  # Only used to check if request for full state should be
 ss_instance = None
 
 
+def _read_compressed_int(data, pos):
+    # Format of juce::OutputStream::writeCompressedInt: number of bytes (with sign in the high bit) followed by the
+    # little endian bytes of the absolute value
+    size_byte = data[pos]
+    num_bytes = size_byte & 0x7f
+    value = int.from_bytes(data[pos + 1:pos + 1 + num_bytes], 'little')
+    return (-value if size_byte & 0x80 else value), pos + 1 + num_bytes
+
+
+def _read_string(data, pos):
+    end = data.index(b'\x00', pos)
+    return data[pos:end].decode('utf-8'), end + 1
+
+
+def _read_var(data, pos):
+    # Format of juce::var::writeToStream, values are returned as they would be written in the XML version of the state
+    size, pos = _read_compressed_int(data, pos)
+    if size == 0:
+        return '', pos
+    marker, body, end = data[pos], data[pos + 1:pos + size], pos + size
+    if marker == 1:
+        return str(struct.unpack('<i', body)[0]), end
+    elif marker == 2 or marker == 3:
+        return '1' if marker == 2 else '0', end
+    elif marker == 4:
+        return str(struct.unpack('<d', body)[0]), end
+    elif marker == 5:
+        return body[:-1].decode('utf-8'), end
+    elif marker == 6:
+        return str(struct.unpack('<q', body)[0]), end
+    elif marker == 8:
+        return base64.b64encode(body).decode('ascii'), end
+    return '', end  # Arrays and undefined values are not used in the state
+
+
+def _read_value_tree(data, pos):
+    # Format of juce::ValueTree::writeToStream: type, properties and children
+    tree_type, pos = _read_string(data, pos)
+    element = ElementTree.Element(tree_type)
+    num_properties, pos = _read_compressed_int(data, pos)
+    for _ in range(num_properties):
+        name, pos = _read_string(data, pos)
+        value, pos = _read_var(data, pos)
+        element.set(name, value)
+    num_children, pos = _read_compressed_int(data, pos)
+    for _ in range(num_children):
+        child, pos = _read_value_tree(data, pos)
+        element.append(child)
+    return element, pos
+
+
+def value_tree_binary_to_xml(data, compressed=False):
+    if compressed:
+        data = zlib.decompress(data)
+    element, _ = _read_value_tree(data, 0)
+    return ElementTree.tostring(element, encoding='unicode')
+
+
+def _read_message_pack(data, pos):
+    # Decodes the MessagePack types written by the backend in the binary protocol (see MessagePack.h): nil, booleans,
+    # integers, floats, strings, binary data and arrays
+    marker = data[pos]
+    pos += 1
+    if marker <= 0x7f:
+        return marker, pos
+    elif marker >= 0xe0:
+        return marker - 0x100, pos
+    elif marker & 0xe0 == 0xa0:
+        size = marker & 0x1f
+        return data[pos:pos + size].decode('utf-8'), pos + size
+    elif marker & 0xf0 == 0x90:
+        return _read_message_pack_array(data, pos, marker & 0x0f)
+    elif marker == 0xc0:
+        return None, pos
+    elif marker == 0xc2 or marker == 0xc3:
+        return marker == 0xc3, pos
+    elif 0xc4 <= marker <= 0xc6:
+        size_bytes = 1 << (marker - 0xc4)
+        size = int.from_bytes(data[pos:pos + size_bytes], 'big')
+        pos += size_bytes
+        return bytes(data[pos:pos + size]), pos + size
+    elif marker == 0xca:
+        return struct.unpack('>f', data[pos:pos + 4])[0], pos + 4
+    elif marker == 0xcb:
+        return struct.unpack('>d', data[pos:pos + 8])[0], pos + 8
+    elif 0xcc <= marker <= 0xcf:
+        size = 1 << (marker - 0xcc)
+        return int.from_bytes(data[pos:pos + size], 'big'), pos + size
+    elif 0xd0 <= marker <= 0xd3:
+        size = 1 << (marker - 0xd0)
+        return int.from_bytes(data[pos:pos + size], 'big', signed=True), pos + size
+    elif 0xd9 <= marker <= 0xdb:
+        size_bytes = 1 << (marker - 0xd9)
+        size = int.from_bytes(data[pos:pos + size_bytes], 'big')
+        pos += size_bytes
+        return data[pos:pos + size].decode('utf-8'), pos + size
+    elif marker == 0xdc or marker == 0xdd:
+        size_bytes = 2 if marker == 0xdc else 4
+        return _read_message_pack_array(data, pos + size_bytes, int.from_bytes(data[pos:pos + size_bytes], 'big'))
+    raise ValueError('Unsupported MessagePack type 0x{:02x}'.format(marker))
+
+
+def _read_message_pack_array(data, pos, num_elements):
+    values = []
+    for _ in range(num_elements):
+        value, pos = _read_message_pack(data, pos)
+        values.append(value)
+    return values, pos
+
+
+def _state_updates_binary_to_xml(updates):
+    # Children of addedChild and replacedChildren updates are sent as binary trees, convert them to XML so that
+    # on_state_update receives the same data as with the text protocol
+    for update in updates:
+        if update[0] == 'addedChild' or update[0] == 'replacedChildren':
+            update[-1] = value_tree_binary_to_xml(update[-1])
+    return updates
+
+
 def state_update_handler(*values):
     update_type = values[0]
     update_id = values[1]
@@ -20,6 +145,26 @@ def state_update_handler(*values):
         ss_instance.apply_update(update_id, update_type, update_data)
     
 
+def state_update_batch_handler(update_id, previous_update_id, updates):
+    if ss_instance is not None:
+        ss_instance.apply_update_batch(update_id, updates, previous_update_id)
+
+
+def state_update_replay_handler(batches):
+    if ss_instance is not None:
+        ss_instance.apply_update_replay(batches)
+
+
+def state_snapshot_chunk_handler(update_id, chunk_index, num_chunks, encoding, chunk_data):
+    if ss_instance is not None:
+        ss_instance.add_snapshot_chunk(update_id, chunk_index, num_chunks, encoding, chunk_data)
+
+
+def clip_events_handler(clip_uuid, start_beat, end_beat, truncated, events):
+    if ss_instance is not None:
+        ss_instance.set_clip_events(clip_uuid, start_beat, end_beat, truncated, events)
+
+
 def full_state_handler(*values):
     update_id = values[0]
     new_state_raw = values[1]
@@ -27,12 +172,21 @@ def full_state_handler(*values):
         ss_instance.set_full_state(update_id, new_state_raw)
 
 
+def playheads_handler(*values):
+    if ss_instance is not None:
+        ss_instance.set_playheads(*values)
+
+
 def ws_on_message(ws, message):
     if ss_instance is not None:
         ss_instance.ws_connection_ok = True
 
-    # Ensure message is a string (decode if bytes)
+    # Ensure message is a string (decode if bytes). Text frames are also received as bytes because UTF-8 validation is
+    # skipped, but these always start with the address while binary protocol messages start with a MessagePack array
     if isinstance(message, bytes):
+        if not message.startswith(b'/'):
+            ws_on_binary_message(message)
+            return
         message = message.decode('utf-8')
 
     address = message[:message.find(':')]
@@ -54,6 +208,17 @@ def ws_on_message(ws, message):
         args = [update_type, update_id] + update_data
         state_update_handler(*args)
 
+    elif address == '/state_update_batch':
+        # Batch ID and ID of the previous batch sent to this connection (batches with no updates for the connection
+        # are not sent) followed by a JSON list of updates, each update being a list with the update type followed by
+        # the same update data as in /state_update messages
+        data_parts = data.split(';', 2)
+        state_update_batch_handler(int(data_parts[0]), int(data_parts[1]), json.loads(data_parts[2]))
+
+    elif address == '/state_update_replay':
+        # JSON list of [batch ID, updates] pairs with the batches missed since the ID passed in /get_state "since:<id>"
+        state_update_replay_handler(json.loads(data))
+
     elif address == '/full_state':
         # Split data at first ocurrence of ; instead of all ocurrences of ; as character ; might be in XML state portion
         split_at = data.find(';')
@@ -63,11 +228,70 @@ def ws_on_message(ws, message):
         args = [update_id, full_state_raw]
         full_state_handler(*args)
 
+    elif address == '/state_snapshot_chunk':
+        # Chunk of a full state snapshot serialized in the binary ValueTree format (see StateSnapshotSender.h)
+        data_parts = data.split(';')
+        state_snapshot_chunk_handler(int(data_parts[0]), int(data_parts[1]), int(data_parts[2]), data_parts[3],
+                                     base64.b64decode(data_parts[4]))
+
+    elif address == '/playheads':
+        # Backend time followed by the global playhead position and uuid/position pairs for the clips that are playing
+        data_parts = data.split(';')
+        backend_time_ms = int(data_parts[0])
+        session_playhead_position = float(data_parts[1])
+        clip_playhead_positions = {data_parts[i]: float(data_parts[i + 1]) for i in range(2, len(data_parts) - 1, 2)}
+        playheads_handler(backend_time_ms, session_playhead_position, clip_playhead_positions)
+
+    elif address == '/clip/events':
+        # Reply to /clip/queryEvents: clip UUID, queried window, truncated flag and JSON list of the matched events
+        data_parts = data.split(';', 4)
+        clip_events_handler(data_parts[0], float(data_parts[1]), float(data_parts[2]), data_parts[3] == '1',
+                            json.loads(data_parts[4]))
+
+    elif address == '/resync':
+        # Backend dropped messages because this client was not consuming them fast enough, state must be re-synced
+        if ss_instance is not None:
+            ss_instance.resync()
+
     elif address == '/alive':
         # When using WS communication we don't need the /alive message to know the connection is alive as WS manages that
         pass
 
 
+def ws_on_binary_message(message):
+    # Binary protocol (see StateSynchronizer.use_binary_protocol): each message is a MessagePack array with the address
+    # followed by the same parameters as in the text protocol, but typed and with trees in binary ValueTree format
+    values, _ = _read_message_pack(message, 0)
+    address, data = values[0], values[1:]
+
+    if address == '/app_started':
+        ss_instance.app_has_started()
+
+    elif address == '/state_update_batch':
+        state_update_batch_handler(data[0], data[1], _state_updates_binary_to_xml(data[2]))
+
+    elif address == '/state_update_replay':
+        state_update_replay_handler([[update_id, _state_updates_binary_to_xml(updates)] for update_id, updates in data[0]])
+
+    elif address == '/full_state':
+        full_state_handler(data[0], value_tree_binary_to_xml(data[1]))
+
+    elif address == '/state_snapshot_chunk':
+        # Chunk data is sent as raw binary data (no base64 encoding)
+        state_snapshot_chunk_handler(data[0], data[1], data[2], data[3], data[4])
+
+    elif address == '/playheads':
+        clip_playhead_positions = {data[i]: data[i + 1] for i in range(2, len(data) - 1, 2)}
+        playheads_handler(int(data[0]), data[1], clip_playhead_positions)
+
+    elif address == '/clip/events':
+        clip_events_handler(data[0], data[1], data[2], data[3], data[4])
+
+    elif address == '/resync':
+        if ss_instance is not None:
+            ss_instance.resync()
+
+
 def ws_on_error(ws, error):
     if ss_instance is not None:
         if ss_instance.verbose_level >= 1:
@@ -153,19 +377,31 @@ class StateSynchronizer(object):
     full_state_requested = False
     last_time_full_state_requested = 0
     full_state_request_timeout = 5  # Seconds
+    last_time_replay_requested = None  # Set while waiting for the updates missed to be replayed
+    replay_request_timeout = 2  # Seconds
+
+    use_binary_protocol = False  # Ask the backend to send messages in the binary (MessagePack) protocol
+    use_state_snapshots = True  # Request the full state as a compressed snapshot sent in chunks
+    snapshot_update_id = None  # Set while receiving a snapshot
+    snapshot_chunks = None
+    updates_received_during_snapshot = None
 
     state_soup = None
     app = None
+    subscriptions = None
 
     verbose_level = None
 
     def __init__(self,
                  ws_port=8126,
-                 verbose_level=1):
+                 verbose_level=1,
+                 use_binary_protocol=False):
 
         global ss_instance
         ss_instance = self
         self.verbose_level = verbose_level
+        self.use_binary_protocol = use_binary_protocol
+        self.subscriptions = {}
 
         if ws_port is None:
             raise Exception('Web sockets port not properly configured')
@@ -188,8 +424,33 @@ class StateSynchronizer(object):
 
     def app_has_started(self):
         self.last_update_id = -1
+        self.last_time_replay_requested = None
+        self.snapshot_update_id = None
         self.full_state_requested = False
         self.should_request_full_state = True
+        # Protocol and subscriptions belong to the connection, send them again in case this is a new one
+        if self.use_binary_protocol:
+            self.send_msg_to_app('/setProtocol', ['binary'])
+        for (kind, value), max_rate_hz in self.subscriptions.items():
+            self._send_subscription(kind, value, max_rate_hz)
+
+    def subscribe(self, kind, value, max_rate_hz=None):
+        # Only receive state updates which match the subscription rules (kind is one of "type", "subtree" or
+        # "property"). Updates matching rules with max_rate_hz are received at most max_rate_hz times per second
+        self.subscriptions[(kind, value)] = max_rate_hz
+        self._send_subscription(kind, value, max_rate_hz)
+
+    def unsubscribe(self, kind=None, value=None):
+        # Remove a subscription rule, or all of them if no kind and value are given (so all updates are received)
+        if kind is None:
+            self.subscriptions = {}
+            self.send_msg_to_app('/unsubscribe', [])
+        else:
+            self.subscriptions.pop((kind, value), None)
+            self.send_msg_to_app('/unsubscribe', [kind, value])
+
+    def _send_subscription(self, kind, value, max_rate_hz):
+        self.send_msg_to_app('/subscribe', [kind, value] + ([max_rate_hz] if max_rate_hz is not None else []))
 
     def app_connection_lost(self):
         # Maybe subclasses want to do something with that...
@@ -208,7 +469,46 @@ class StateSynchronizer(object):
                 print('* Requesting full state')
             self.full_state_requested = True
             self.last_time_full_state_requested = time.time()
-            self.send_msg_to_app('/get_state', ["full"])
+            if self.use_state_snapshots:
+                self.send_msg_to_app('/get_state', ["snapshot", "gzip"])
+            else:
+                self.send_msg_to_app('/get_state', ["full"])
+
+    def request_update_replay(self):
+        # Ask the app to replay the batches of updates missed since the last one applied. If these are too old for the
+        # app to still have them, it will send the full state instead
+        if self.verbose_level >= 2:
+            print('* Requesting replay of state updates since {}'.format(self.last_update_id + 1))
+        self.last_time_replay_requested = time.time()
+        self.send_msg_to_app('/get_state', ["since:{}".format(self.last_update_id + 1)])
+
+    def resync(self):
+        if self.snapshot_update_id is not None:
+            # Snapshot being received is incomplete, updates received meanwhile can't be applied without it
+            self.snapshot_update_id = None
+            self.full_state_requested = False
+            self.should_request_full_state = True
+        elif self.last_update_id == -1:
+            self.should_request_full_state = True
+        else:
+            self.request_update_replay()
+
+    def request_playheads(self):
+        # Cheap alternative to requesting the full state to resync extrapolated playhead positions
+        self.send_msg_to_app('/get_state', ["playheads"])
+
+    def set_playheads(self, backend_time_ms, session_playhead_position, clip_playhead_positions):
+        self.on_playheads_received(backend_time_ms, session_playhead_position, clip_playhead_positions)
+
+    def query_clip_events(self, track_ref, clip_ref, start_beat, end_beat, min_midi_note=0, max_midi_note=127,
+                          event_type=-1, max_events=-1):
+        # Ask the backend for the compiled events of a clip in a beat window, the reply is passed to
+        # on_clip_events_received. event_type -1 and max_events -1 mean all types and no limit
+        self.send_msg_to_app('/clip/queryEvents', [track_ref, clip_ref, start_beat, end_beat, min_midi_note,
+                                                   max_midi_note, event_type, max_events])
+
+    def set_clip_events(self, clip_uuid, start_beat, end_beat, truncated, events):
+        self.on_clip_events_received(clip_uuid, start_beat, end_beat, truncated, events)
 
     def set_full_state(self, update_id, full_state_raw):
         if self.verbose_level >= 2:
@@ -216,20 +516,91 @@ class StateSynchronizer(object):
         full_state_soup = BeautifulSoup(full_state_raw, "lxml")
         self.full_state_requested = False
         self.should_request_full_state = False
+        self.last_time_replay_requested = None
+        self.last_update_id = update_id - 1  # Full state has the ID of the next batch of updates
         self.on_full_state_received(full_state_soup)
 
+    def add_snapshot_chunk(self, update_id, chunk_index, num_chunks, encoding, chunk_data):
+        if chunk_index == 0:
+            self.snapshot_update_id = update_id
+            self.snapshot_chunks = []
+            self.updates_received_during_snapshot = []
+        elif self.snapshot_update_id is None:
+            return
+        elif update_id != self.snapshot_update_id or chunk_index != len(self.snapshot_chunks):
+            # Some chunks were lost (e.g. dropped by the backend), request a new snapshot
+            self.resync()
+            return
+        self.snapshot_chunks.append(chunk_data)
+        if len(self.snapshot_chunks) < num_chunks:
+            return
+
+        full_state_raw = value_tree_binary_to_xml(b''.join(self.snapshot_chunks), compressed=encoding.endswith('+gzip'))
+        buffered_updates = self.updates_received_during_snapshot
+        self.snapshot_update_id = None
+        self.snapshot_chunks = None
+        self.updates_received_during_snapshot = None
+        self.set_full_state(update_id, full_state_raw)
+        # Updates sent while the snapshot was being received are newer than the snapshot, apply them now
+        for buffered_update_id, updates, previous_update_id in buffered_updates:
+            self.apply_update_batch(buffered_update_id, updates, previous_update_id)
+
     def apply_update(self, update_id, update_type, update_data):
+        if self.snapshot_update_id is not None:
+            self.updates_received_during_snapshot.append((update_id, [[update_type] + list(update_data)], update_id - 1))
+            return
         if self.verbose_level >= 2:
             print("Applying state update {} - {}".format(update_id, update_type))
-        self.on_state_update(update_type, update_data)
+        if self.check_update_id(update_id):
+            self.on_state_update(update_type, update_data)
+
+    def apply_update_batch(self, update_id, updates, previous_update_id=None):
+        if self.snapshot_update_id is not None:
+            self.updates_received_during_snapshot.append((update_id, updates, previous_update_id))
+            return
+        if self.verbose_level >= 2:
+            print("Applying state update batch {} ({} updates)".format(update_id, len(updates)))
+        if self.check_update_id(update_id, previous_update_id):
+            self._apply_batch_updates(updates)
 
-        # Check if update ID is correct and trigger request of full state if there are possible sync errors
-        if self.last_update_id != -1 and self.last_update_id + 1 != update_id:
+    def apply_update_replay(self, batches):
+        if self.verbose_level >= 2:
+            print("Applying replay of {} state update batches".format(len(batches)))
+        self.last_time_replay_requested = None
+        for update_id, updates in batches:
+            if update_id > self.last_update_id:
+                self._apply_batch_updates(updates)
+                self.last_update_id = update_id
+
+    def _apply_batch_updates(self, updates):
+        for update in updates:
+            update_type = update[0]
+            update_data = [str(value) for value in update[1:]]
+            self.on_state_update(update_type, update_data)
+
+    def check_update_id(self, update_id, previous_update_id=None):
+        # Check if update ID is correct and returns whether the update should be applied. previous_update_id is the ID
+        # of the previous batch sent to this connection (batches between both had no updates for it). If some updates
+        # were missed, request these to be replayed (updates received meanwhile are ignored as these will be part of
+        # the replay)
+        if previous_update_id is None:
+            previous_update_id = update_id - 1
+        if self.last_time_replay_requested is not None:
+            if (time.time() - self.last_time_replay_requested) > self.replay_request_timeout:
+                # Replay did not arrive, fall back to requesting the full state
+                self.last_time_replay_requested = None
+                self.should_request_full_state = True
+            return False
+        if self.last_update_id != -1 and not (previous_update_id <= self.last_update_id < update_id):
+            if update_id <= self.last_update_id:
+                return False  # Already applied
             if self.verbose_level >= 2:
                 print('WARNING: last_update_id does not match with received update ({} vs {})'
                       .format(self.last_update_id + 1, update_id))
-            self.should_request_full_state = True
+            self.request_update_replay()
+            return False
         self.last_update_id = update_id
+        return True
     
     def on_state_update(self, update_type, update_data):
         pass
@@ -237,3 +608,9 @@ class StateSynchronizer(object):
     def on_full_state_received(self, full_state_soup):
         pass
 
+    def on_playheads_received(self, backend_time_ms, session_playhead_position, clip_playhead_positions):
+        pass
+
+    def on_clip_events_received(self, clip_uuid, start_beat, end_beat, truncated, events):
+        pass
+